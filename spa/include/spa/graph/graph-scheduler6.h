@@ -26,6 +26,12 @@ extern "C" {
 
 #include <spa/graph/graph.h>
 
+/* static probes around the process calls, define before including this
+ * file to enable them */
+#ifndef spa_graph_probe
+#define spa_graph_probe(...)
+#endif
+
 struct spa_graph_data {
 	struct spa_graph *graph;
 };
@@ -36,6 +42,73 @@ static inline void spa_graph_data_init(struct spa_graph_data *data,
 	data->graph = graph;
 }
 
+/** Account for the buffer or buffer request on \a pport and process its node
+ * when all of its ports are ready. Must be called from the thread of the graph
+ * of the node. */
+static inline void spa_graph_impl_process_peer(struct spa_graph_port *pport)
+{
+	struct spa_graph_node *pnode = pport->node;
+	enum spa_direction direction = pport->direction;
+	uint32_t prequired, pready;
+
+	if (pport->io->status == (direction == SPA_DIRECTION_INPUT ?
+				  SPA_STATUS_HAVE_BUFFER : SPA_STATUS_NEED_BUFFER))
+		pnode->ready[direction]++;
+
+	pready = pnode->ready[direction];
+	prequired = pnode->required[direction];
+
+	spa_debug("peer %p io %d %d %d %d", pnode, pport->io->status,
+			pport->io->buffer_id, pready, prequired);
+
+	if (prequired > 0 && pready >= prequired) {
+		if (direction == SPA_DIRECTION_INPUT) {
+			spa_graph_probe(process__input__start, pnode);
+			pnode->state = spa_node_process_input(pnode->implementation);
+			spa_graph_probe(process__input__end, pnode, pnode->state);
+		} else {
+			spa_graph_probe(process__output__start, pnode);
+			pnode->state = spa_node_process_output(pnode->implementation);
+			spa_graph_probe(process__output__end, pnode, pnode->state);
+		}
+
+		spa_debug("peer %p processed %d", pnode, pnode->state);
+		if (pnode->state == SPA_STATUS_HAVE_BUFFER)
+			spa_graph_have_output(pnode->graph, pnode);
+		else if (pnode->state == SPA_STATUS_NEED_BUFFER)
+			spa_graph_need_input(pnode->graph, pnode);
+	}
+}
+
+/* the flags of a peer in another graph are changed by the thread of that graph */
+static inline bool spa_graph_port_is_disabled(struct spa_graph_port *port)
+{
+	return __atomic_load_n(&port->flags, __ATOMIC_RELAXED) & SPA_GRAPH_PORT_FLAG_DISABLED;
+}
+
+/* a peer in another graph is processed by the thread of that graph. When it
+ * can't be woken up, the peer skips this cycle. Graphs without a wakeup
+ * method share the thread of the caller. */
+static inline void spa_graph_impl_schedule_peer(struct spa_graph_node *node,
+						struct spa_graph_port *pport)
+{
+	struct spa_graph *pgraph = pport->node->graph;
+	int res;
+
+	if (pgraph == node->graph) {
+		spa_graph_impl_process_peer(pport);
+		return;
+	}
+	/* publish the io area before the other thread reads it */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	if ((res = spa_graph_wakeup(pgraph, pport)) == -ENOTSUP) {
+		spa_graph_impl_process_peer(pport);
+	} else if (res < 0) {
+		node->graph->xruns++;
+		spa_debug("node %p peer %p xrun %d", node, pport->node, res);
+	}
+}
+
 static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *node)
 {
 	struct spa_graph_port *p;
@@ -50,33 +123,12 @@ static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *n
 	node->ready[SPA_DIRECTION_INPUT] = 0;
 	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
 		struct spa_graph_port *pport;
-		struct spa_graph_node *pnode;
-		uint32_t prequired, pready;
 
-		if ((pport = p->peer) == NULL || (pport->flags & SPA_GRAPH_PORT_FLAG_DISABLED)) {
+		if ((pport = p->peer) == NULL || spa_graph_port_is_disabled(pport)) {
 			spa_debug("node %p port %p has no peer", node, p);
 			continue;
 		}
-		pnode = pport->node;
-
-		if (pport->io->status == SPA_STATUS_NEED_BUFFER)
-			pnode->ready[SPA_DIRECTION_OUTPUT]++;
-
-		pready = pnode->ready[SPA_DIRECTION_OUTPUT];
-		prequired = pnode->required[SPA_DIRECTION_OUTPUT];
-
-		spa_debug("node %p peer %p io %d %d %d %d", node, pnode, pport->io->status,
-				pport->io->buffer_id, pready, prequired);
-
-		if (prequired > 0 && pready >= prequired) {
-			pnode->state = spa_node_process_output(pnode->implementation);
-
-			spa_debug("peer %p processed out %d", pnode, pnode->state);
-			if (pnode->state == SPA_STATUS_HAVE_BUFFER)
-				spa_graph_have_output(pnode->graph, pnode);
-			else if (pnode->state == SPA_STATUS_NEED_BUFFER)
-				spa_graph_need_input(pnode->graph, pnode);
-		}
+		spa_graph_impl_schedule_peer(node, pport);
 	}
 	spa_debug("node %p end pull", node);
 	return 0;
@@ -98,33 +150,12 @@ static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *
 	node->ready[SPA_DIRECTION_OUTPUT] = 0;
 	spa_list_for_each(p, &node->ports[SPA_DIRECTION_OUTPUT], link) {
 		struct spa_graph_port *pport;
-		struct spa_graph_node *pnode;
-		uint32_t prequired, pready;
 
-		if ((pport = p->peer) == NULL || (pport->flags & SPA_GRAPH_PORT_FLAG_DISABLED)) {
+		if ((pport = p->peer) == NULL || spa_graph_port_is_disabled(pport)) {
 			spa_debug("node %p port %p has no peer", node, p);
 			continue;
 		}
-		pnode = pport->node;
-
-		if (pport->io->status == SPA_STATUS_HAVE_BUFFER)
-			pnode->ready[SPA_DIRECTION_INPUT]++;
-
-		pready = pnode->ready[SPA_DIRECTION_INPUT];
-		prequired = pnode->required[SPA_DIRECTION_INPUT];
-
-		spa_debug("node %p peer %p io %d %d %d %d", node, pnode, pport->io->status,
-				pport->io->buffer_id, pready, prequired);
-
-		if (prequired > 0 && pready >= prequired) {
-			pnode->state = spa_node_process_input(pnode->implementation);
-
-			spa_debug("peer %p processed in %d", pnode, pnode->state);
-			if (pnode->state == SPA_STATUS_HAVE_BUFFER)
-				spa_graph_have_output(pnode->graph, pnode);
-			else if (pnode->state == SPA_STATUS_NEED_BUFFER)
-				spa_graph_need_input(pnode->graph, pnode);
-		}
+		spa_graph_impl_schedule_peer(node, pport);
 	}
 	spa_debug("node %p end push", node);
 	return 0;
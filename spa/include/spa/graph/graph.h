@@ -24,6 +24,8 @@
 extern "C" {
 #endif
 
+#include <errno.h>
+
 #include <spa/utils/defs.h>
 #include <spa/utils/list.h>
 #include <spa/node/node.h>
@@ -38,21 +40,34 @@ struct spa_graph_node;
 struct spa_graph_port;
 
 struct spa_graph_callbacks {
-#define SPA_VERSION_GRAPH_CALLBACKS	0
+#define SPA_VERSION_GRAPH_CALLBACKS	1
 	uint32_t version;
 
 	int (*need_input) (void *data, struct spa_graph_node *node);
 	int (*have_output) (void *data, struct spa_graph_node *node);
+
+	/** Schedule the node of \a port, that is in this graph, from the thread
+	 * of the graph of its peer. \a port got a buffer when it is an input
+	 * port or a buffer request when it is an output port. The caller
+	 * releases the io area of \a port before the call, the implementation
+	 * must acquire it before the node is processed.
+	 * \since version 1
+	 * \return 0 when the node will be scheduled, <0 on error */
+	int (*wakeup) (void *data, struct spa_graph_port *port);
 };
 
 struct spa_graph {
 	struct spa_list nodes;
 	const struct spa_graph_callbacks *callbacks;
 	void *callbacks_data;
+	uint32_t xruns;			/**< peers in other graphs that could not be
+					  *  woken up, their cycle was skipped */
 };
 
 #define spa_graph_need_input(g,n)	((g)->callbacks->need_input((g)->callbacks_data, (n)))
 #define spa_graph_have_output(g,n)	((g)->callbacks->have_output((g)->callbacks_data, (n)))
+#define spa_graph_wakeup(g,p)		((g)->callbacks->version >= 1 && (g)->callbacks->wakeup ?	\
+						(g)->callbacks->wakeup((g)->callbacks_data, (p)) : -ENOTSUP)
 #define spa_graph_reuse_buffer(g,n,p,i)	((g)->callbacks->reuse_buffer((g)->callbacks_data, (n),(p),(i)))
 
 struct spa_graph_node {
@@ -84,6 +99,7 @@ struct spa_graph_port {
 static inline void spa_graph_init(struct spa_graph *graph)
 {
 	spa_list_init(&graph->nodes);
+	graph->xruns = 0;
 }
 
 static inline void
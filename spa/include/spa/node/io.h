@@ -25,6 +25,7 @@ extern "C" {
 #endif
 
 #include <spa/support/type-map.h>
+#include <spa/utils/ringbuffer.h>
 
 /** Base for IO structures to interface with node ports */
 #define SPA_TYPE__IO			SPA_TYPE_POINTER_BASE "IO"
@@ -59,6 +60,24 @@ struct spa_io_buffers {
 
 #define SPA_IO_BUFFERS_INIT  (struct spa_io_buffers) { SPA_STATUS_OK, SPA_ID_INVALID, }
 
+/** An io area to exchange raw bytes with a port */
+#define SPA_TYPE_IO__Ringbuffer		SPA_TYPE_IO_BASE "Ringbuffer"
+
+/** Ringbuffer IO area
+ *
+ * A byte ringbuffer shared between the host and a port. The ringbuffer
+ * memory of \a size bytes follows the structure. \a size is a power
+ * of 2.
+ */
+struct spa_io_ringbuffer {
+	struct spa_ringbuffer ring;	/**< read and write index */
+	uint32_t size;			/**< size of the ringbuffer memory */
+	uint32_t padding;
+	/* ringbuffer memory follows */
+};
+
+#define SPA_IO_RINGBUFFER_DATA(io)	SPA_MEMBER((io), sizeof(struct spa_io_ringbuffer), void)
+
 /** Information about requested range */
 #define SPA_TYPE_IO_CONTROL__Range	SPA_TYPE_IO_CONTROL_BASE "Range"
 
@@ -73,6 +92,7 @@ struct spa_type_io {
 	uint32_t Buffers;
 	uint32_t ControlRange;
 	uint32_t Prop;
+	uint32_t Ringbuffer;
 };
 
 static inline void spa_type_io_map(struct spa_type_map *map, struct spa_type_io *type)
@@ -81,6 +101,7 @@ static inline void spa_type_io_map(struct spa_type_map *map, struct spa_type_io
 		type->Buffers = spa_type_map_get_id(map, SPA_TYPE_IO__Buffers);
 		type->ControlRange = spa_type_map_get_id(map, SPA_TYPE_IO_CONTROL__Range);
 		type->Prop = spa_type_map_get_id(map, SPA_TYPE_IO__Prop);
+		type->Ringbuffer = spa_type_map_get_id(map, SPA_TYPE_IO__Ringbuffer);
 	}
 }
 
@@ -57,6 +57,8 @@ struct spa_port_info {
 #define SPA_PORT_INFO_FLAG_TERMINAL		(1<<8)	/**< data was not created from this port
 							 *   or will not be made available on another
 							 *   port */
+#define SPA_PORT_INFO_FLAG_LOCAL_BUFFERS	(1<<9)	/**< buffers allocated by the port can only
+							 *   be used in the same process */
 	uint32_t flags;				/**< port flags */
 	uint32_t rate;				/**< rate of sequence numbers on port */
 	const struct spa_dict *props;		/**< extra port properties */
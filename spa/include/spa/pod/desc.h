@@ -0,0 +1,266 @@
+/* Spa
+ * Copyright (C) 2017 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_POD_DESC_H__
+#define __SPA_POD_DESC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <string.h>
+
+#include <spa/pod/iter.h>
+#include <spa/pod/builder.h>
+
+/** Describes a property of an object and where its value is stored in
+ * a structure.
+ *
+ * An array of descriptions replaces the format string of
+ * spa_pod_object_parse() and spa_pod_builder_add(). The description is
+ * made once and the object is then parsed or built in a single pass over
+ * its properties, without varargs or interpreting a format.
+ *
+ * The keys are ids from the type map, which are only known at runtime. The
+ * array is filled after the ids are mapped and can't be static const. */
+struct spa_pod_prop_desc {
+	uint32_t key;		/**< key of the property */
+	uint32_t type;		/**< SPA_POD_TYPE_* of the value */
+	uint32_t offset;	/**< offset of the value in the structure */
+#define SPA_POD_PROP_DESC_FLAG_REQUIRED	(1 << 0)	/**< parsing fails when the property
+							  *  is missing */
+	uint32_t flags;
+};
+
+/* evaluates to the offset of field, fails to compile when the size of
+ * field is not the size of ctype. A negative array size is an error in both
+ * C and C++, unlike a struct defined inside sizeof. */
+#define SPA_POD_DESC_OFFSET(st,field,ctype)					\
+	(offsetof(st, field) +							\
+	 0 * sizeof(char[sizeof(((st *) 0)->field) == sizeof(ctype) ? 1 : -1]))
+
+#define SPA_POD_PROP_DESC(key,type,ctype,st,field,flags)	\
+	{ key, type, SPA_POD_DESC_OFFSET(st, field, ctype), flags }
+
+#define SPA_POD_PROP_DESC_BOOL(key,st,field,flags)	SPA_POD_PROP_DESC(key, SPA_POD_TYPE_BOOL, bool, st, field, flags)
+#define SPA_POD_PROP_DESC_ID(key,st,field,flags)	SPA_POD_PROP_DESC(key, SPA_POD_TYPE_ID, uint32_t, st, field, flags)
+#define SPA_POD_PROP_DESC_INT(key,st,field,flags)	SPA_POD_PROP_DESC(key, SPA_POD_TYPE_INT, int32_t, st, field, flags)
+#define SPA_POD_PROP_DESC_LONG(key,st,field,flags)	SPA_POD_PROP_DESC(key, SPA_POD_TYPE_LONG, int64_t, st, field, flags)
+#define SPA_POD_PROP_DESC_FLOAT(key,st,field,flags)	SPA_POD_PROP_DESC(key, SPA_POD_TYPE_FLOAT, float, st, field, flags)
+#define SPA_POD_PROP_DESC_DOUBLE(key,st,field,flags)	SPA_POD_PROP_DESC(key, SPA_POD_TYPE_DOUBLE, double, st, field, flags)
+#define SPA_POD_PROP_DESC_STRING(key,st,field,flags)	SPA_POD_PROP_DESC(key, SPA_POD_TYPE_STRING, const char *, st, field, flags)
+#define SPA_POD_PROP_DESC_RECTANGLE(key,st,field,flags)	SPA_POD_PROP_DESC(key, SPA_POD_TYPE_RECTANGLE, struct spa_rectangle, st, field, flags)
+#define SPA_POD_PROP_DESC_FRACTION(key,st,field,flags)	SPA_POD_PROP_DESC(key, SPA_POD_TYPE_FRACTION, struct spa_fraction, st, field, flags)
+#define SPA_POD_PROP_DESC_POD(key,st,field,flags)	SPA_POD_PROP_DESC(key, SPA_POD_TYPE_NONE, struct spa_pod *, st, field, flags)
+
+static inline uint32_t spa_pod_desc_value_size(uint32_t type)
+{
+	switch (type) {
+	case SPA_POD_TYPE_BOOL:
+	case SPA_POD_TYPE_ID:
+	case SPA_POD_TYPE_INT:
+	case SPA_POD_TYPE_FLOAT:
+		return 4;
+	case SPA_POD_TYPE_LONG:
+	case SPA_POD_TYPE_DOUBLE:
+	case SPA_POD_TYPE_RECTANGLE:
+	case SPA_POD_TYPE_FRACTION:
+		return 8;
+	case SPA_POD_TYPE_STRING:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/** Parse the properties of object \a pod into \a data.
+ *
+ * Properties that are unset, have a different type or are not in \a desc
+ * are skipped. A description with SPA_POD_TYPE_NONE stores a pointer to
+ * the value of any type. At most 64 properties can be described.
+ *
+ * \return the number of parsed properties, -ESRCH when a required property
+ * is missing or -EINVAL when \a pod is not an object */
+static inline int spa_pod_object_parse_desc(const struct spa_pod *pod,
+					    const struct spa_pod_prop_desc *desc,
+					    uint32_t n_desc, void *data)
+{
+	const struct spa_pod_object *obj = (const struct spa_pod_object *) pod;
+	struct spa_pod *p;
+	uint64_t found = 0;
+	uint32_t i;
+	int n_found = 0;
+
+	if (SPA_POD_TYPE(pod) != SPA_POD_TYPE_OBJECT || n_desc > 64)
+		return -EINVAL;
+
+	SPA_POD_OBJECT_FOREACH(obj, p) {
+		struct spa_pod_prop *prop = (struct spa_pod_prop *) p;
+		struct spa_pod *value = &prop->body.value;
+		void *dest;
+
+		if (p->type != SPA_POD_TYPE_PROP ||
+		    p->size < sizeof(struct spa_pod_prop_body) ||
+		    p->size - sizeof(struct spa_pod_prop_body) < value->size ||
+		    (prop->body.flags & SPA_POD_PROP_FLAG_UNSET))
+			continue;
+
+		for (i = 0; i < n_desc; i++)
+			if (desc[i].key == prop->body.key)
+				break;
+		if (i == n_desc || (found & (1ULL << i)))
+			continue;
+
+		dest = SPA_MEMBER(data, desc[i].offset, void);
+
+		if (desc[i].type == SPA_POD_TYPE_NONE) {
+			*(struct spa_pod **) dest = value;
+			goto found;
+		}
+		if (value->type != desc[i].type ||
+		    value->size < spa_pod_desc_value_size(value->type))
+			continue;
+
+		switch (value->type) {
+		case SPA_POD_TYPE_BOOL:
+			*(bool *) dest = SPA_POD_VALUE(struct spa_pod_bool, value);
+			break;
+		case SPA_POD_TYPE_ID:
+		case SPA_POD_TYPE_INT:
+		case SPA_POD_TYPE_FLOAT:
+			*(uint32_t *) dest = SPA_POD_VALUE(struct spa_pod_int, value);
+			break;
+		case SPA_POD_TYPE_LONG:
+		case SPA_POD_TYPE_DOUBLE:
+			*(uint64_t *) dest = SPA_POD_VALUE(struct spa_pod_long, value);
+			break;
+		case SPA_POD_TYPE_STRING:
+		{
+			const char *str = (const char *) SPA_POD_CONTENTS(struct spa_pod_string, value);
+			if (str[value->size - 1] != '\0')
+				continue;
+			*(const char **) dest = str;
+			break;
+		}
+		case SPA_POD_TYPE_RECTANGLE:
+			*(struct spa_rectangle *) dest = SPA_POD_VALUE(struct spa_pod_rectangle, value);
+			break;
+		case SPA_POD_TYPE_FRACTION:
+			*(struct spa_fraction *) dest = SPA_POD_VALUE(struct spa_pod_fraction, value);
+			break;
+		default:
+			continue;
+		}
+	      found:
+		found |= 1ULL << i;
+		n_found++;
+	}
+	for (i = 0; i < n_desc; i++) {
+		if ((desc[i].flags & SPA_POD_PROP_DESC_FLAG_REQUIRED) &&
+		    (found & (1ULL << i)) == 0)
+			return -ESRCH;
+	}
+	return n_found;
+}
+
+/** Build an object with the properties in \a desc and the values
+ * from \a data
+ *
+ * \return the object or NULL when the builder has no memory */
+static inline void *spa_pod_builder_object_desc(struct spa_pod_builder *builder,
+						uint32_t id, uint32_t type,
+						const struct spa_pod_prop_desc *desc,
+						uint32_t n_desc, const void *data)
+{
+	uint32_t i;
+
+	spa_pod_builder_push_object(builder, id, type);
+	for (i = 0; i < n_desc; i++) {
+		const void *src = SPA_MEMBER(data, desc[i].offset, const void);
+		/* values are copied out of the structure with the size of their
+		 * type, the compiler can't see which member is read */
+		union {
+			bool b;
+			int32_t i;
+			int64_t l;
+			float f;
+			double d;
+			const char *s;
+			struct spa_rectangle r;
+			struct spa_fraction fr;
+			const struct spa_pod *p;
+		} v;
+
+		spa_pod_builder_push_prop(builder, desc[i].key, 0);
+		switch (desc[i].type) {
+		case SPA_POD_TYPE_BOOL:
+			memcpy(&v.b, src, sizeof(v.b));
+			spa_pod_builder_bool(builder, v.b);
+			break;
+		case SPA_POD_TYPE_ID:
+			memcpy(&v.i, src, sizeof(v.i));
+			spa_pod_builder_id(builder, v.i);
+			break;
+		case SPA_POD_TYPE_INT:
+			memcpy(&v.i, src, sizeof(v.i));
+			spa_pod_builder_int(builder, v.i);
+			break;
+		case SPA_POD_TYPE_LONG:
+			memcpy(&v.l, src, sizeof(v.l));
+			spa_pod_builder_long(builder, v.l);
+			break;
+		case SPA_POD_TYPE_FLOAT:
+			memcpy(&v.f, src, sizeof(v.f));
+			spa_pod_builder_float(builder, v.f);
+			break;
+		case SPA_POD_TYPE_DOUBLE:
+			memcpy(&v.d, src, sizeof(v.d));
+			spa_pod_builder_double(builder, v.d);
+			break;
+		case SPA_POD_TYPE_STRING:
+			memcpy(&v.s, src, sizeof(v.s));
+			spa_pod_builder_string(builder, v.s);
+			break;
+		case SPA_POD_TYPE_RECTANGLE:
+			memcpy(&v.r, src, sizeof(v.r));
+			spa_pod_builder_rectangle(builder, v.r.width, v.r.height);
+			break;
+		case SPA_POD_TYPE_FRACTION:
+			memcpy(&v.fr, src, sizeof(v.fr));
+			spa_pod_builder_fraction(builder, v.fr.num, v.fr.denom);
+			break;
+		default:
+			memcpy(&v.p, src, sizeof(v.p));
+			if (v.p)
+				spa_pod_builder_primitive(builder, v.p);
+			else
+				spa_pod_builder_none(builder);
+			break;
+		}
+		spa_pod_builder_pop(builder);
+	}
+	return spa_pod_builder_pop(builder);
+}
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* __SPA_POD_DESC_H__ */
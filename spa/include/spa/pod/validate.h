@@ -0,0 +1,305 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_POD_VALIDATE_H__
+#define __SPA_POD_VALIDATE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <errno.h>
+
+#include <spa/pod/pod.h>
+
+/** \page page_pod_validate Pod validation
+ *
+ * spa_pod_validate() checks a complete pod tree from an untrusted source in
+ * one pass: every pod must be 8 byte aligned, fit inside its container, have
+ * a body large enough for its type, strings must be 0 terminated and the
+ * nesting depth is limited to SPA_POD_MAX_DEPTH.
+ *
+ * Once a pod is validated, the spa_pod_cursor accessors can be used to read
+ * it without any further bounds checks. They only check the types.
+ */
+
+static inline int spa_pod_validate_value(uint32_t type, const void *body, uint32_t size)
+{
+	switch (type) {
+	case SPA_POD_TYPE_NONE:
+	case SPA_POD_TYPE_BYTES:
+	case SPA_POD_TYPE_BITMAP:
+	case SPA_POD_TYPE_POD:
+		return 0;
+	case SPA_POD_TYPE_BOOL:
+	case SPA_POD_TYPE_ID:
+	case SPA_POD_TYPE_INT:
+	case SPA_POD_TYPE_FLOAT:
+	case SPA_POD_TYPE_FD:
+		return size < sizeof(int32_t) ? -EINVAL : 0;
+	case SPA_POD_TYPE_LONG:
+	case SPA_POD_TYPE_DOUBLE:
+		return size < sizeof(int64_t) ? -EINVAL : 0;
+	case SPA_POD_TYPE_RECTANGLE:
+		return size < sizeof(struct spa_rectangle) ? -EINVAL : 0;
+	case SPA_POD_TYPE_FRACTION:
+		return size < sizeof(struct spa_fraction) ? -EINVAL : 0;
+	case SPA_POD_TYPE_POINTER:
+		return size < sizeof(struct spa_pod_pointer_body) ? -EINVAL : 0;
+	case SPA_POD_TYPE_STRING:
+		if (size < 1 || ((const char *) body)[size - 1] != '\0')
+			return -EINVAL;
+		return 0;
+	default:
+		return type >= SPA_POD_TYPE_CUSTOM_START ? 0 : -EINVAL;
+	}
+}
+
+static inline int spa_pod_validate_depth(const struct spa_pod *pod, uint32_t size, int depth);
+
+/* check a series of pods in \a size bytes of \a data */
+static inline int spa_pod_validate_series(const void *data, uint32_t size, int depth)
+{
+	uint32_t offset = 0;
+	int res;
+
+	while (offset < size) {
+		const struct spa_pod *pod = SPA_MEMBER(data, offset, const struct spa_pod);
+
+		if ((res = spa_pod_validate_depth(pod, size - offset, depth)) < 0)
+			return res;
+
+		offset += SPA_ROUND_UP_N(SPA_POD_SIZE(pod), 8);
+	}
+	return 0;
+}
+
+static inline int spa_pod_validate_depth(const struct spa_pod *pod, uint32_t size, int depth)
+{
+	const void *body;
+	uint32_t body_size;
+
+	if (depth >= SPA_POD_MAX_DEPTH)
+		return -EINVAL;
+	if (((uintptr_t) pod & 7) != 0)
+		return -EINVAL;
+	if (size < sizeof(struct spa_pod) || pod->size > size - sizeof(struct spa_pod))
+		return -EINVAL;
+
+	body = SPA_POD_BODY_CONST(pod);
+	body_size = pod->size;
+
+	switch (pod->type) {
+	case SPA_POD_TYPE_STRUCT:
+		return spa_pod_validate_series(body, body_size, depth + 1);
+
+	case SPA_POD_TYPE_OBJECT:
+		if (body_size < sizeof(struct spa_pod_object_body))
+			return -EINVAL;
+		return spa_pod_validate_series(SPA_MEMBER(body, sizeof(struct spa_pod_object_body), void),
+					       body_size - sizeof(struct spa_pod_object_body),
+					       depth + 1);
+
+	case SPA_POD_TYPE_ARRAY:
+	{
+		const struct spa_pod_array_body *b = (const struct spa_pod_array_body *) body;
+		uint32_t i, n_values;
+
+		if (body_size < sizeof(struct spa_pod_array_body))
+			return -EINVAL;
+		body_size -= sizeof(struct spa_pod_array_body);
+		if (body_size == 0)
+			return 0;
+		if (b->child.size == 0 || body_size % b->child.size != 0)
+			return -EINVAL;
+		/* only values can be in an array, they have no header to check */
+		switch (b->child.type) {
+		case SPA_POD_TYPE_STRUCT:
+		case SPA_POD_TYPE_OBJECT:
+		case SPA_POD_TYPE_ARRAY:
+		case SPA_POD_TYPE_SEQUENCE:
+		case SPA_POD_TYPE_PROP:
+			return -EINVAL;
+		}
+		n_values = body_size / b->child.size;
+		for (i = 0; i < n_values; i++) {
+			if (spa_pod_validate_value(b->child.type,
+					SPA_MEMBER(b, sizeof(*b) + i * b->child.size, void),
+					b->child.size) < 0)
+				return -EINVAL;
+		}
+		return 0;
+	}
+	case SPA_POD_TYPE_PROP:
+	{
+		const struct spa_pod_prop_body *b = (const struct spa_pod_prop_body *) body;
+		uint32_t i, n_values;
+
+		if (body_size < sizeof(struct spa_pod_prop_body))
+			return -EINVAL;
+		body_size -= sizeof(struct spa_pod_prop_body);
+		if (b->value.size == 0) {
+			if (body_size != 0 || b->value.type != SPA_POD_TYPE_NONE)
+				return -EINVAL;
+			return 0;
+		}
+		if (body_size < b->value.size || body_size % b->value.size != 0)
+			return -EINVAL;
+		switch (b->value.type) {
+		case SPA_POD_TYPE_STRUCT:
+		case SPA_POD_TYPE_OBJECT:
+		case SPA_POD_TYPE_ARRAY:
+		case SPA_POD_TYPE_SEQUENCE:
+		case SPA_POD_TYPE_PROP:
+			return -EINVAL;
+		}
+		n_values = body_size / b->value.size;
+		for (i = 0; i < n_values; i++) {
+			if (spa_pod_validate_value(b->value.type,
+					SPA_MEMBER(b, sizeof(*b) + i * b->value.size, void),
+					b->value.size) < 0)
+				return -EINVAL;
+		}
+		return 0;
+	}
+	case SPA_POD_TYPE_SEQUENCE:
+	{
+		uint32_t offset = sizeof(struct spa_pod_sequence_body);
+
+		if (body_size < offset)
+			return -EINVAL;
+		while (offset < body_size) {
+			const struct spa_pod_event *ev = SPA_MEMBER(body, offset, const struct spa_pod_event);
+			int res;
+
+			if (body_size - offset < sizeof(struct spa_pod_event))
+				return -EINVAL;
+			if ((res = spa_pod_validate_depth(&ev->value,
+							  body_size - offset - sizeof(uint64_t),
+							  depth + 1)) < 0)
+				return res;
+			offset += SPA_ROUND_UP_N(sizeof(uint64_t) + SPA_POD_SIZE(&ev->value), 8);
+		}
+		return 0;
+	}
+	default:
+		return spa_pod_validate_value(pod->type, body, body_size);
+	}
+}
+
+/** Check that \a pod and all of its children fit in \a size bytes and are
+ * well formed.
+ * \return 0 when the pod can be trusted, -EINVAL otherwise */
+static inline int spa_pod_validate(const struct spa_pod *pod, uint32_t size)
+{
+	return spa_pod_validate_depth(pod, size, 0);
+}
+
+/** A cursor over the children of a validated struct or object */
+struct spa_pod_cursor {
+	const struct spa_pod *pod;
+	const struct spa_pod *end;
+};
+
+/** Iterate the children of the validated struct or object \a pod */
+static inline int spa_pod_cursor_init(struct spa_pod_cursor *c, const struct spa_pod *pod)
+{
+	uint32_t offset;
+
+	if (pod == NULL)
+		return -EINVAL;
+	if (pod->type == SPA_POD_TYPE_STRUCT)
+		offset = sizeof(struct spa_pod_struct);
+	else if (pod->type == SPA_POD_TYPE_OBJECT)
+		offset = sizeof(struct spa_pod_object);
+	else
+		return -EINVAL;
+
+	c->pod = SPA_MEMBER(pod, offset, const struct spa_pod);
+	c->end = SPA_MEMBER(pod, SPA_POD_SIZE(pod), const struct spa_pod);
+	return 0;
+}
+
+/** Get the next child of type \a type, or any type with SPA_POD_TYPE_INVALID
+ * \return the child or NULL when there are no more children or the type is wrong */
+static inline const struct spa_pod *
+spa_pod_cursor_next(struct spa_pod_cursor *c, uint32_t type)
+{
+	const struct spa_pod *pod = c->pod;
+
+	if (pod >= c->end)
+		return NULL;
+	if (type != SPA_POD_TYPE_INVALID && pod->type != type)
+		return NULL;
+
+	c->pod = SPA_MEMBER(pod, SPA_ROUND_UP_N(SPA_POD_SIZE(pod), 8), const struct spa_pod);
+	return pod;
+}
+
+static inline int spa_pod_cursor_get_int(struct spa_pod_cursor *c, int32_t *value)
+{
+	const struct spa_pod *pod;
+
+	if ((pod = spa_pod_cursor_next(c, SPA_POD_TYPE_INT)) == NULL)
+		return -EINVAL;
+	*value = SPA_POD_VALUE(struct spa_pod_int, pod);
+	return 0;
+}
+
+static inline int spa_pod_cursor_get_id(struct spa_pod_cursor *c, uint32_t *value)
+{
+	const struct spa_pod *pod;
+
+	if ((pod = spa_pod_cursor_next(c, SPA_POD_TYPE_ID)) == NULL)
+		return -EINVAL;
+	*value = SPA_POD_VALUE(struct spa_pod_id, pod);
+	return 0;
+}
+
+static inline int spa_pod_cursor_get_long(struct spa_pod_cursor *c, int64_t *value)
+{
+	const struct spa_pod *pod;
+
+	if ((pod = spa_pod_cursor_next(c, SPA_POD_TYPE_LONG)) == NULL)
+		return -EINVAL;
+	*value = SPA_POD_VALUE(struct spa_pod_long, pod);
+	return 0;
+}
+
+/** Get a string, a NONE pod gives a NULL string */
+static inline int spa_pod_cursor_get_string(struct spa_pod_cursor *c, const char **value)
+{
+	const struct spa_pod *pod;
+
+	if ((pod = spa_pod_cursor_next(c, SPA_POD_TYPE_INVALID)) == NULL)
+		return -EINVAL;
+	if (pod->type == SPA_POD_TYPE_NONE)
+		*value = NULL;
+	else if (pod->type == SPA_POD_TYPE_STRING)
+		*value = (const char *) SPA_POD_CONTENTS_CONST(struct spa_pod_string, pod);
+	else
+		return -EINVAL;
+	return 0;
+}
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* __SPA_POD_VALIDATE_H__ */
@@ -32,6 +32,8 @@ struct spa_loop_control;
 #define SPA_TYPE__LoopControl	SPA_TYPE_INTERFACE_BASE "LoopControl"
 struct spa_loop_utils;
 #define SPA_TYPE__LoopUtils	SPA_TYPE_INTERFACE_BASE "LoopUtils"
+struct spa_loop_stats;
+#define SPA_TYPE__LoopStats	SPA_TYPE_INTERFACE_BASE "LoopStats"
 
 #define SPA_TYPE_LOOP__MainLoop		SPA_TYPE_LOOP_BASE "MainLoop"
 #define SPA_TYPE_LOOP__DataLoop		SPA_TYPE_LOOP_BASE "DataLoop"
@@ -205,6 +207,70 @@ struct spa_loop_utils {
 #define spa_loop_utils_add_signal(l,...)	(l)->add_signal(l,__VA_ARGS__)
 #define spa_loop_utils_destroy_source(l,...)	(l)->destroy_source(__VA_ARGS__)
 
+/** number of bins in the histograms, bin i counts the values between
+ * 2^i and 2^(i+1) microseconds, the first bin also counts the values below
+ * 1 microsecond and the last one all values above it. */
+#define SPA_LOOP_STATS_N_BINS	16
+
+/** Statistics of a loop */
+struct spa_loop_stats_info {
+	uint64_t n_iterations;		/**< number of wakeups */
+	uint64_t n_dispatches;		/**< number of dispatched sources */
+	uint64_t busy;			/**< total dispatch time in nsec */
+	uint64_t latency[SPA_LOOP_STATS_N_BINS];	/**< histogram of the time
+							  *  between the wakeup, or
+							  *  timer expiration, and the
+							  *  dispatch of a source */
+	uint64_t dispatch[SPA_LOOP_STATS_N_BINS];	/**< histogram of the dispatch
+							  *  time of the sources */
+};
+
+/** Statistics of a source */
+struct spa_loop_source_stats {
+	const struct spa_source *source;	/**< the source */
+	const void *func;		/**< the callback of the source, resolve the
+					  *  name with dladdr() outside of the loop */
+	uint64_t count;			/**< number of dispatches */
+	uint64_t total;			/**< total dispatch time in nsec */
+	uint64_t max;			/**< max dispatch time in nsec */
+};
+
+/**
+ * Dispatch statistics of a loop
+ *
+ * The accounting is disabled by default, when enabled the time of each
+ * dispatch is measured. Except for enable, the methods should only be
+ * called from the context of the loop.
+ */
+struct spa_loop_stats {
+	/* the version of this structure. This can be used to expand this
+	 * structure in the future */
+#define SPA_VERSION_LOOP_STATS	0
+	uint32_t version;
+
+	/** enable or disable the accounting */
+	int (*enable) (struct spa_loop_stats *stats, bool enable);
+
+	/** get the statistics of the loop */
+	int (*get_info) (struct spa_loop_stats *stats, struct spa_loop_stats_info *info);
+
+	/** get the statistics of the sources
+	 * \param index the index of the source, start with 0
+	 * \param source the statistics of the source
+	 * \return 1 when a source was returned, 0 when there are no more
+	 *	   sources */
+	int (*enum_sources) (struct spa_loop_stats *stats, uint32_t *index,
+			     struct spa_loop_source_stats *source);
+
+	/** clear all counters */
+	void (*reset) (struct spa_loop_stats *stats);
+};
+
+#define spa_loop_stats_enable(l,...)		(l)->enable((l),__VA_ARGS__)
+#define spa_loop_stats_get_info(l,...)		(l)->get_info((l),__VA_ARGS__)
+#define spa_loop_stats_enum_sources(l,...)	(l)->enum_sources((l),__VA_ARGS__)
+#define spa_loop_stats_reset(l)			(l)->reset(l)
+
 #ifdef __cplusplus
 }  /* extern "C" */
 #endif
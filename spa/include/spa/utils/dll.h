@@ -0,0 +1,102 @@
+/* Simple Plugin API
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_DLL_H__
+#define __SPA_DLL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <math.h>
+
+#include <spa/utils/defs.h>
+
+#define SPA_DLL_BW_MAX		0.128
+#define SPA_DLL_BW_MIN		0.016
+
+/**
+ * A second order delay-locked loop.
+ *
+ * The loop tracks a position that advances at a (nearly) constant rate,
+ * such as the ticks of a clock, against a reference time. Noisy position
+ * updates are smoothed and the real rate of the position is estimated so
+ * that the position can be interpolated between updates.
+ */
+struct spa_dll {
+	double b;		/*< first loop filter coefficient */
+	double c;		/*< second loop filter coefficient */
+	double time;		/*< reference time of the last update */
+	double pos;		/*< filtered position at \a time */
+	double rate;		/*< estimated position increment per time unit */
+	bool valid;		/*< true when the loop has a reference */
+};
+
+/**
+ * Initialize the loop
+ *
+ * \param dll the loop
+ * \param bw the bandwidth of the loop in Hz, usually between
+ *        SPA_DLL_BW_MIN and SPA_DLL_BW_MAX
+ * \param period the expected time between updates in seconds
+ */
+static inline void spa_dll_init(struct spa_dll *dll, double bw, double period)
+{
+	double w = 2 * M_PI * bw * period;
+	dll->b = M_SQRT2 * w;
+	dll->c = w * w;
+	dll->valid = false;
+}
+
+/** Restart the loop at \a pos on \a time with nominal \a rate */
+static inline void spa_dll_reset(struct spa_dll *dll, double time, double pos, double rate)
+{
+	dll->time = time;
+	dll->pos = pos;
+	dll->rate = rate;
+	dll->valid = true;
+}
+
+/** Get the interpolated position of the loop at \a time */
+static inline double spa_dll_get_pos(struct spa_dll *dll, double time)
+{
+	return dll->pos + dll->rate * (time - dll->time);
+}
+
+/** Feed a new measured \a pos at \a time into the loop */
+static inline void spa_dll_update(struct spa_dll *dll, double time, double pos)
+{
+	double dt = time - dll->time, pred, err;
+
+	if (dt <= 0.0)
+		return;
+
+	pred = spa_dll_get_pos(dll, time);
+	err = pos - pred;
+
+	dll->time = time;
+	dll->pos = pred + dll->b * err;
+	dll->rate += dll->c * err / dt;
+}
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* __SPA_DLL_H__ */
@@ -355,7 +355,7 @@ impl_node_port_enum_params(struct spa_node *node,
 						     INT32_MAX),
 			":", t->param_buffers.stride,  "i", 0,
 			":", t->param_buffers.buffers, "ir", 1,
-				SPA_POD_PROP_MIN_MAX(1, MAX_BUFFERS),
+				SPA_POD_PROP_MIN_MAX(1, this->zero_copy ? 1 : MAX_BUFFERS),
 			":", t->param_buffers.align,   "i", 16);
 	}
 	else if (id == t->param.idMeta) {
@@ -390,6 +390,7 @@ static int clear_buffers(struct state *this)
 		spa_list_init(&this->ready);
 		this->n_buffers = 0;
 	}
+	spa_alsa_free_buffers(this);
 	return 0;
 }
 
@@ -483,6 +484,7 @@ impl_node_port_use_buffers(struct spa_node *node,
 		clear_buffers(this);
 		return 0;
 	}
+	spa_alsa_free_buffers(this);
 
 	for (i = 0; i < n_buffers; i++) {
 		struct buffer *b = &this->buffers[i];
@@ -516,6 +518,8 @@ impl_node_port_alloc_buffers(struct spa_node *node,
 			     uint32_t *n_buffers)
 {
 	struct state *this;
+	uint32_t i;
+	int res;
 
 	spa_return_val_if_fail(node != NULL, -EINVAL);
 	spa_return_val_if_fail(buffers != NULL, -EINVAL);
@@ -527,7 +531,22 @@ impl_node_port_alloc_buffers(struct spa_node *node,
 	if (!this->have_format)
 		return -EIO;
 
-	return -ENOTSUP;
+	if (this->n_buffers > 0) {
+		spa_alsa_pause(this, false);
+		clear_buffers(this);
+	}
+
+	*n_buffers = SPA_MIN(*n_buffers, 1);
+	if ((res = spa_alsa_alloc_buffers(this, buffers, *n_buffers)) < 0)
+		return res;
+
+	/* the buffers start with the peer, it renders into them */
+	for (i = 0; i < *n_buffers; i++)
+		this->buffers[i].outstanding = true;
+
+	spa_log_info(this->log, NAME " %p: allocated %u zero-copy buffers", this, *n_buffers);
+
+	return 0;
 }
 
 static int
@@ -656,6 +675,9 @@ static int impl_get_interface(struct spa_handle *handle, uint32_t interface_id,
 
 static int impl_clear(struct spa_handle *handle)
 {
+	struct state *this = (struct state *) handle;
+
+	spa_alsa_free_buffers(this);
 	return 0;
 }
 
@@ -713,7 +735,15 @@ impl_init(const struct spa_handle_factory *factory,
 		if (!strcmp(info->items[i].key, "alsa.card")) {
 			snprintf(this->props.device, 63, "%s", info->items[i].value);
 		}
+		else if (!strcmp(info->items[i].key, "alsa.zero-copy")) {
+			this->zero_copy = !strcmp(info->items[i].value, "true") ||
+					  atoi(info->items[i].value) == 1;
+		}
 	}
+	/* the buffers point into the mmap area, only for peers in this process */
+	if (this->zero_copy)
+		this->info.flags |= SPA_PORT_INFO_FLAG_CAN_ALLOC_BUFFERS |
+				    SPA_PORT_INFO_FLAG_LOCAL_BUFFERS;
 
 	return 0;
 }
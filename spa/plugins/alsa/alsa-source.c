@@ -367,8 +367,8 @@ impl_node_port_enum_params(struct spa_node *node,
 			id, t->param_buffers.Buffers,
 			":", t->param_buffers.size,    "i", this->props.min_latency * this->frame_size,
 			":", t->param_buffers.stride,  "i", 0,
-			":", t->param_buffers.buffers, "ir", 2,
-				SPA_POD_PROP_MIN_MAX(1, MAX_BUFFERS),
+			":", t->param_buffers.buffers, "ir", this->zero_copy ? 1 : 2,
+				SPA_POD_PROP_MIN_MAX(1, this->zero_copy ? 1 : MAX_BUFFERS),
 			":", t->param_buffers.align,   "i", 16);
 	}
 	else if (id == t->param.idMeta) {
@@ -404,6 +404,7 @@ static int clear_buffers(struct state *this)
 		spa_list_init(&this->ready);
 		this->n_buffers = 0;
 	}
+	spa_alsa_free_buffers(this);
 	return 0;
 }
 
@@ -493,6 +494,8 @@ impl_node_port_use_buffers(struct spa_node *node,
 		if ((res = clear_buffers(this)) < 0)
 			return res;
 	}
+	spa_alsa_free_buffers(this);
+
 	for (i = 0; i < n_buffers; i++) {
 		struct buffer *b = &this->buffers[i];
 		struct spa_data *d = buffers[i]->datas;
@@ -526,6 +529,8 @@ impl_node_port_alloc_buffers(struct spa_node *node,
 			     uint32_t *n_buffers)
 {
 	struct state *this;
+	uint32_t i;
+	int res;
 
 	spa_return_val_if_fail(node != NULL, -EINVAL);
 	spa_return_val_if_fail(buffers != NULL, -EINVAL);
@@ -534,10 +539,28 @@ impl_node_port_alloc_buffers(struct spa_node *node,
 
 	spa_return_val_if_fail(CHECK_PORT(this, direction, port_id), -EINVAL);
 
-	if (this->n_buffers == 0)
+	if (!this->have_format)
 		return -EIO;
 
-	return -ENOTSUP;
+	if (this->n_buffers > 0) {
+		spa_alsa_pause(this, false);
+		if ((res = clear_buffers(this)) < 0)
+			return res;
+	}
+
+	/* only one mmap area can be outstanding */
+	*n_buffers = SPA_MIN(*n_buffers, 1);
+	if ((res = spa_alsa_alloc_buffers(this, buffers, *n_buffers)) < 0)
+		return res;
+
+	for (i = 0; i < *n_buffers; i++) {
+		this->buffers[i].outstanding = false;
+		spa_list_append(&this->free, &this->buffers[i].link);
+	}
+
+	spa_log_info(this->log, NAME " %p: allocated %u zero-copy buffers", this, *n_buffers);
+
+	return 0;
 }
 
 static int
@@ -717,6 +740,9 @@ static int impl_get_interface(struct spa_handle *handle, uint32_t interface_id,
 
 static int impl_clear(struct spa_handle *handle)
 {
+	struct state *this = (struct state *) handle;
+
+	spa_alsa_free_buffers(this);
 	return 0;
 }
 
@@ -779,7 +805,15 @@ impl_init(const struct spa_handle_factory *factory,
 		if (!strcmp(info->items[i].key, "alsa.card")) {
 			snprintf(this->props.device, 63, "%s", info->items[i].value);
 		}
+		else if (!strcmp(info->items[i].key, "alsa.zero-copy")) {
+			this->zero_copy = !strcmp(info->items[i].value, "true") ||
+					  atoi(info->items[i].value) == 1;
+		}
 	}
+	/* the buffers point into the mmap area, only for peers in this process */
+	if (this->zero_copy)
+		this->info.flags |= SPA_PORT_INFO_FLAG_CAN_ALLOC_BUFFERS |
+				    SPA_PORT_INFO_FLAG_LOCAL_BUFFERS;
 	return 0;
 }
 
@@ -319,6 +319,84 @@ static int set_swparams(struct state *state)
 	return 0;
 }
 
+/** Prepare the buffers for zero-copy. The memory is set to the mmap area
+ * of the device before the buffer is given to the peer. */
+int spa_alsa_alloc_buffers(struct state *state,
+			   struct spa_buffer **buffers, uint32_t n_buffers)
+{
+	size_t maxsize = state->props.max_latency * state->frame_size;
+	uint32_t i;
+
+	if (!state->zero_copy)
+		return -ENOTSUP;
+
+	if (state->mmap_fallback_size < maxsize) {
+		free(state->mmap_fallback);
+		if ((state->mmap_fallback = calloc(1, maxsize)) == NULL) {
+			state->mmap_fallback_size = 0;
+			return -errno;
+		}
+		state->mmap_fallback_size = maxsize;
+	}
+
+	for (i = 0; i < n_buffers; i++) {
+		struct buffer *b = &state->buffers[i];
+		struct spa_data *d = buffers[i]->datas;
+
+		if (buffers[i]->n_datas < 1) {
+			spa_log_error(state->log, "alsa %p: invalid buffer data", state);
+			return -EINVAL;
+		}
+		b->outbuf = buffers[i];
+		b->h = spa_buffer_find_meta(b->outbuf, state->type.meta.Header);
+
+		d[0].type = state->type.data.MemPtr;
+		d[0].flags = 0;
+		d[0].fd = -1;
+		d[0].mapoffset = 0;
+		d[0].maxsize = maxsize;
+		d[0].data = state->mmap_fallback;
+		d[0].chunk->offset = 0;
+		d[0].chunk->size = 0;
+		d[0].chunk->stride = state->frame_size;
+	}
+	state->n_buffers = n_buffers;
+	state->mmap_buffer = NULL;
+
+	return 0;
+}
+
+void spa_alsa_free_buffers(struct state *state)
+{
+	free(state->mmap_fallback);
+	state->mmap_fallback = NULL;
+	state->mmap_fallback_size = 0;
+	state->mmap_buffer = NULL;
+}
+
+/* the buffers were made by spa_alsa_alloc_buffers() */
+static inline bool have_mmap_buffers(struct state *state)
+{
+	return state->mmap_fallback != NULL;
+}
+
+/* point the buffer memory at \a frames of the mmap area or at the fallback
+ * memory when there are no frames */
+static inline void set_mmap_area(struct state *state, struct buffer *b,
+				 uint8_t *area, snd_pcm_uframes_t frames)
+{
+	struct spa_data *d = b->outbuf->datas;
+
+	frames = SPA_MIN(frames, state->mmap_fallback_size / state->frame_size);
+	if (frames > 0) {
+		d[0].data = area;
+		d[0].maxsize = frames * state->frame_size;
+	} else {
+		d[0].data = state->mmap_fallback;
+		d[0].maxsize = state->mmap_fallback_size;
+	}
+}
+
 static inline void calc_timeout(size_t target, size_t current,
 				size_t rate, snd_htimestamp_t *now,
 				struct timespec *ts)
@@ -361,6 +439,17 @@ pull_frames(struct state *state,
 {
 	snd_pcm_uframes_t total_frames = 0, to_write = SPA_MIN(frames, state->props.max_latency);
 	bool underrun = false;
+	uint32_t i;
+
+	/* let the peer render straight into the device */
+	if (have_mmap_buffers(state) && spa_list_is_empty(&state->ready)) {
+		for (i = 0; i < state->n_buffers; i++) {
+			if (state->buffers[i].outstanding)
+				set_mmap_area(state, &state->buffers[i],
+					      SPA_MEMBER(my_areas[0].addr, offset * state->frame_size, uint8_t),
+					      to_write);
+		}
+	}
 
 	try_pull(state, frames, 0, do_pull);
 
@@ -388,15 +477,20 @@ pull_frames(struct state *state,
 		l0 = SPA_MIN(n_bytes, d[0].maxsize - offs);
 		l1 = n_bytes - l0;
 
-		memcpy(dst, src + offs, l0);
-		if (l1 > 0)
-			memcpy(dst + l0, src, l1);
+		/* rendered in place with zero-copy */
+		if (src + offs != dst) {
+			memcpy(dst, src + offs, l0);
+			if (l1 > 0)
+				memcpy(dst + l0, src, l1);
+		}
 
 		state->ready_offset += n_bytes;
 
 		if (state->ready_offset >= d[0].chunk->size) {
 			spa_list_remove(&b->link);
 			b->outstanding = true;
+			if (have_mmap_buffers(state))
+				set_mmap_area(state, b, dst + n_bytes, to_write - n_frames);
 			spa_log_trace(state->log, "alsa-util %p: reuse buffer %u", state, b->outbuf->id);
 			state->callbacks->reuse_buffer(state->callbacks_data, 0, b->outbuf->id);
 			state->ready_offset = 0;
@@ -419,6 +513,14 @@ pull_frames(struct state *state,
 		underrun = true;
 	}
 
+	/* the area is committed after this, don't let the peer render into it */
+	if (have_mmap_buffers(state)) {
+		for (i = 0; i < state->n_buffers; i++) {
+			if (state->buffers[i].outstanding)
+				set_mmap_area(state, &state->buffers[i], NULL, 0);
+		}
+	}
+
 	if (state->underrun > 0) {
 		if (state->underrun >= state->rate || !underrun) {
 			spa_log_warn(state->log, "underrun, for %zd frames", state->underrun);
@@ -468,9 +570,9 @@ push_frames(struct state *state,
 		l0 = SPA_MIN(n_bytes, d[0].maxsize - offs);
 		l1 = n_bytes - l0;
 
-		memcpy(src, d[0].data + offs, l0);
+		memcpy(d[0].data + offs, src, l0);
 		if (l1 > 0)
-			memcpy(src + l0, d[0].data, l1);
+			memcpy(d[0].data, src + l0, l1);
 
 		d[0].chunk->offset = index;
 		d[0].chunk->size = n_bytes;
@@ -484,6 +586,73 @@ push_frames(struct state *state,
 	return total_frames;
 }
 
+/* give the mmap area to the peer, it is committed when the buffer is
+ * recycled */
+static snd_pcm_uframes_t
+push_frames_mmap(struct state *state,
+		 const snd_pcm_channel_area_t *my_areas,
+		 snd_pcm_uframes_t offset,
+		 snd_pcm_uframes_t frames)
+{
+	struct spa_io_buffers *io = state->io;
+	struct buffer *b;
+	struct spa_data *d;
+
+	if (spa_list_is_empty(&state->free)) {
+		spa_log_trace(state->log, "no more buffers");
+		return 0;
+	}
+	b = spa_list_first(&state->free, struct buffer, link);
+	spa_list_remove(&b->link);
+
+	if (b->h) {
+		b->h->seq = state->sample_count;
+		b->h->pts = state->last_monotonic;
+		b->h->dts_offset = 0;
+	}
+
+	set_mmap_area(state, b, SPA_MEMBER(my_areas[0].addr, offset * state->frame_size, uint8_t),
+		      frames);
+
+	d = b->outbuf->datas;
+	d[0].chunk->offset = 0;
+	d[0].chunk->size = d[0].maxsize;
+	d[0].chunk->stride = state->frame_size;
+
+	state->mmap_buffer = b;
+	state->mmap_offset = offset;
+	state->mmap_frames = d[0].maxsize / state->frame_size;
+
+	b->outstanding = true;
+	io->buffer_id = b->outbuf->id;
+	io->status = SPA_STATUS_HAVE_BUFFER;
+	state->callbacks->have_output(state->callbacks_data);
+
+	return state->mmap_frames;
+}
+
+/* commit the mmap area of the capture buffer when the peer recycled it */
+static int commit_mmap_buffer(struct state *state)
+{
+	struct buffer *b = state->mmap_buffer;
+	snd_pcm_sframes_t res;
+
+	if (b == NULL)
+		return 0;
+	if (b->outstanding)
+		return -EBUSY;
+
+	set_mmap_area(state, b, NULL, 0);
+	state->mmap_buffer = NULL;
+
+	spa_log_trace(state->log, "commit %ld %ld", state->mmap_offset, state->mmap_frames);
+	if ((res = snd_pcm_mmap_commit(state->hndl, state->mmap_offset, state->mmap_frames)) < 0) {
+		spa_log_error(state->log, "snd_pcm_mmap_commit error: %s", snd_strerror(res));
+		return res;
+	}
+	return 0;
+}
+
 static int alsa_try_resume(struct state *state)
 {
 	int res;
@@ -620,12 +789,29 @@ static void alsa_on_capture_timeout_event(struct spa_source *source)
 	spa_log_trace(state->log, "timeout %ld %d %ld %ld %ld", avail, state->threshold,
 		      state->sample_count, htstamp.tv_sec, htstamp.tv_nsec);
 
+	if (have_mmap_buffers(state) && commit_mmap_buffer(state) == -EBUSY) {
+		/* the peer still has the mmap area, check again in a period */
+		spa_log_trace(state->log, "mmap buffer busy");
+		calc_timeout(state->threshold, 0, state->rate, &htstamp, &ts.it_value);
+		goto done;
+	}
+
 	if (avail < state->threshold) {
 		if (snd_pcm_state(hndl) == SND_PCM_STATE_SUSPENDED) {
 			spa_log_error(state->log, "suspended: try resume");
 			if ((res = alsa_try_resume(state)) < 0)
 				return;
 		}
+	} else if (have_mmap_buffers(state)) {
+		snd_pcm_uframes_t frames, offset;
+
+		frames = SPA_MIN(avail, state->props.max_latency);
+		if ((res = snd_pcm_mmap_begin(hndl, &my_areas, &offset, &frames)) < 0) {
+			spa_log_error(state->log, "snd_pcm_mmap_begin error: %s", snd_strerror(res));
+			return;
+		}
+		total_read = push_frames_mmap(state, my_areas, offset, frames);
+		state->sample_count += total_read;
 	} else {
 		snd_pcm_uframes_t to_read = avail;
 
@@ -653,6 +839,7 @@ static void alsa_on_capture_timeout_event(struct spa_source *source)
 	}
 	calc_timeout(state->threshold, avail - total_read, state->rate, &htstamp, &ts.it_value);
 
+      done:
 	ts.it_interval.tv_sec = 0;
 	ts.it_interval.tv_nsec = 0;
 	timerfd_settime(state->timerfd, TFD_TIMER_ABSTIME, &ts, NULL);
@@ -745,6 +932,12 @@ int spa_alsa_pause(struct state *state, bool xrun_recover)
 	if ((err = snd_pcm_drop(state->hndl)) < 0)
 		spa_log_error(state->log, "snd_pcm_drop %s", snd_strerror(err));
 
+	/* the uncommitted mmap area is gone after the drop */
+	if (state->mmap_buffer) {
+		set_mmap_area(state, state->mmap_buffer, NULL, 0);
+		state->mmap_buffer = NULL;
+	}
+
 	state->started = false;
 
 	return 0;
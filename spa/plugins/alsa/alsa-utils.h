@@ -155,6 +155,17 @@ struct state {
 
 	size_t ready_offset;
 
+	/* with zero-copy, the buffers are allocated by the node and point
+	 * into the mmap area of the device. This only works for peers in
+	 * the same process and with the sink, when the peer renders from
+	 * the same thread. */
+	bool zero_copy;
+	void *mmap_fallback;		/**< memory for buffers that are not in the mmap area */
+	size_t mmap_fallback_size;
+	struct buffer *mmap_buffer;	/**< capture buffer in the mmap area */
+	snd_pcm_uframes_t mmap_offset;	/**< uncommitted mmap area of mmap_buffer */
+	snd_pcm_uframes_t mmap_frames;
+
 	bool started;
 	struct spa_source source;
 	int timerfd;
@@ -179,6 +190,10 @@ spa_alsa_enum_format(struct state *state,
 
 int spa_alsa_set_format(struct state *state, struct spa_audio_info *info, uint32_t flags);
 
+int spa_alsa_alloc_buffers(struct state *state,
+			   struct spa_buffer **buffers, uint32_t n_buffers);
+void spa_alsa_free_buffers(struct state *state);
+
 int spa_alsa_start(struct state *state, bool xrun_recover);
 int spa_alsa_pause(struct state *state, bool xrun_recover);
 int spa_alsa_close(struct state *state);
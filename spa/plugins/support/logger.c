@@ -18,11 +18,15 @@
  */
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 #include <spa/support/type-map.h>
 #include <spa/support/log.h>
@@ -36,6 +40,14 @@
 
 #define TRACE_BUFFER (16*1024)
 
+/* binary mode, see log_binary() */
+#define RING_SIZE	(16*1024)
+#define MAX_RINGS	16
+#define MAX_RECORD	1024
+#define MAX_STRING	256
+#define MAX_SPEC	32
+#define FLUSH_INTERVAL	(50 * SPA_NSEC_PER_MSEC)
+
 struct type {
 	uint32_t log;
 };
@@ -57,8 +69,434 @@ struct impl {
 
 	bool have_source;
 	struct spa_source source;
+
+	bool binary;
+	struct log_ring *rings;
+	pthread_key_t ring_key;
+	uint64_t dropped;
+	uint64_t dropped_reported;
+	struct spa_source flush;
+};
+
+/** A record in binary mode. The file, the function and the format are
+ * copied after it, they could be unloaded before the record is flushed,
+ * and then the packed arguments of the format follow. */
+struct record {
+	uint32_t size;
+	uint32_t level;
+	int line;
+#define RECORD_FLAG_FORMATTED	(1 << 0)	/**< the writer formatted the message,
+						  *  it is stored instead of the format */
+	uint32_t flags;
 };
 
+/** A ring with records, written by one thread and read in the main loop.
+ * The ring is released when the thread exits and can then be used by a
+ * new thread, the records that are left are still flushed. */
+struct log_ring {
+	int used;
+	struct spa_ringbuffer rb;
+	uint8_t data[RING_SIZE];
+};
+
+enum arg_type {
+	ARG_NONE,
+	ARG_INT,
+	ARG_LONG,
+	ARG_LLONG,
+	ARG_SIZE,
+	ARG_INTMAX,
+	ARG_PTRDIFF,
+	ARG_PTR,
+	ARG_DOUBLE,
+	ARG_LDOUBLE,
+	ARG_STRING,
+	ARG_ERRNO,
+};
+
+/* parse the conversion after a '%' in \a p, returns a pointer after the
+ * conversion or NULL when it can't be packed */
+static const char *parse_conversion(const char *p, uint32_t *n_star, enum arg_type *type)
+{
+	enum arg_type itype = ARG_INT, ftype = ARG_DOUBLE;
+
+	*n_star = 0;
+	while (*p && strchr("#0- +'", *p))
+		p++;
+	if (*p == '*') {
+		(*n_star)++;
+		p++;
+	}
+	while (*p >= '0' && *p <= '9')
+		p++;
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			(*n_star)++;
+			p++;
+		}
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+	for (;; p++) {
+		switch (*p) {
+		case 'h':
+			continue;
+		case 'l':
+			itype = itype == ARG_INT ? ARG_LONG : ARG_LLONG;
+			continue;
+		case 'q':
+		case 'L':
+			itype = ARG_LLONG;
+			ftype = ARG_LDOUBLE;
+			continue;
+		case 'z':
+			itype = ARG_SIZE;
+			continue;
+		case 'j':
+			itype = ARG_INTMAX;
+			continue;
+		case 't':
+			itype = ARG_PTRDIFF;
+			continue;
+		}
+		break;
+	}
+	switch (*p) {
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+		*type = itype;
+		break;
+	case 'c':
+		if (itype != ARG_INT)
+			return NULL;
+		*type = ARG_INT;
+		break;
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+		*type = ftype;
+		break;
+	case 's':
+		if (itype != ARG_INT)
+			return NULL;
+		*type = ARG_STRING;
+		break;
+	case 'p':
+		*type = ARG_PTR;
+		break;
+	case '%':
+		if (*n_star > 0)
+			return NULL;
+		*type = ARG_NONE;
+		break;
+	case 'm':
+		if (*n_star > 0)
+			return NULL;
+		*type = ARG_ERRNO;
+		break;
+	default:
+		return NULL;
+	}
+	return p + 1;
+}
+
+#define PACK_ARG(type,value)				\
+do {							\
+	type _v = (value);				\
+	if (offset + sizeof(type) > avail)		\
+		return -ENOSPC;				\
+	memcpy(data + offset, &_v, sizeof(type));	\
+	offset += sizeof(type);				\
+} while (0)
+
+/* store at most \a max bytes of \a str with a terminating 0 */
+static int pack_string(uint8_t *data, size_t avail, const char *str, size_t max)
+{
+	size_t len = strnlen(str, max);
+
+	if (len + 1 > avail)
+		return -ENOSPC;
+	memcpy(data, str, len);
+	data[len] = '\0';
+	return len + 1;
+}
+
+#define PACK_STRING(str,max)					\
+do {								\
+	int _res = pack_string(data + offset, avail - offset,	\
+			       str, max);			\
+	if (_res < 0)						\
+		return _res;					\
+	offset += _res;						\
+} while (0)
+
+/* store \a fmt and its arguments in \a data, no formatting is done. %m
+ * is stored as the string of \a err, the errno of the caller. */
+static int pack_args(const char *fmt, va_list args, uint8_t *data, size_t avail, int err)
+{
+	const char *p = fmt;
+	size_t offset = 0;
+	uint32_t i, n_star;
+	enum arg_type type;
+
+	PACK_STRING(fmt, avail);
+
+	while ((p = strchr(p, '%')) != NULL) {
+		if ((p = parse_conversion(p + 1, &n_star, &type)) == NULL)
+			return -ENOTSUP;
+
+		for (i = 0; i < n_star; i++)
+			PACK_ARG(int, va_arg(args, int));
+
+		switch (type) {
+		case ARG_NONE:
+			break;
+		case ARG_INT:
+			PACK_ARG(int, va_arg(args, int));
+			break;
+		case ARG_LONG:
+			PACK_ARG(long, va_arg(args, long));
+			break;
+		case ARG_LLONG:
+			PACK_ARG(long long, va_arg(args, long long));
+			break;
+		case ARG_SIZE:
+			PACK_ARG(size_t, va_arg(args, size_t));
+			break;
+		case ARG_INTMAX:
+			PACK_ARG(intmax_t, va_arg(args, intmax_t));
+			break;
+		case ARG_PTRDIFF:
+			PACK_ARG(ptrdiff_t, va_arg(args, ptrdiff_t));
+			break;
+		case ARG_PTR:
+			PACK_ARG(void *, va_arg(args, void *));
+			break;
+		case ARG_DOUBLE:
+			PACK_ARG(double, va_arg(args, double));
+			break;
+		case ARG_LDOUBLE:
+			PACK_ARG(long double, va_arg(args, long double));
+			break;
+		case ARG_STRING:
+		{
+			const char *str = va_arg(args, const char *);
+			PACK_STRING(str ? str : "(null)", MAX_STRING - 1);
+			break;
+		}
+		case ARG_ERRNO:
+			PACK_STRING(strerror(err), MAX_STRING - 1);
+			break;
+		}
+	}
+	return offset;
+}
+
+/* The binary mode for trace messages. The arguments are packed into a ring
+ * of the calling thread without formatting, locking or system calls and the
+ * main loop formats them later. Records that don't fit are dropped and
+ * counted. */
+static struct log_ring *get_ring(struct impl *impl)
+{
+	struct log_ring *r = pthread_getspecific(impl->ring_key);
+	uint32_t i;
+	int used;
+
+	if (SPA_LIKELY(r != NULL))
+		return r;
+
+	for (i = 0; i < MAX_RINGS; i++) {
+		r = &impl->rings[i];
+		used = 0;
+		if (!__atomic_compare_exchange_n(&r->used, &used, 1, false,
+						 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			continue;
+
+		/* release_ring() is called when the thread exits */
+		pthread_setspecific(impl->ring_key, r);
+		return r;
+	}
+	return NULL;
+}
+
+static void release_ring(void *data)
+{
+	struct log_ring *r = data;
+
+	__atomic_store_n(&r->used, 0, __ATOMIC_RELEASE);
+}
+
+static void
+log_binary(struct impl *impl,
+	   enum spa_log_level level,
+	   const char *file,
+	   int line,
+	   const char *func,
+	   const char *fmt,
+	   va_list args)
+{
+	uint8_t buffer[MAX_RECORD];
+	struct record *rec = (struct record *) buffer;
+	uint8_t *payload = buffer + sizeof(struct record);
+	size_t avail = sizeof(buffer) - sizeof(struct record);
+	struct log_ring *r;
+	uint32_t index;
+	int32_t filled;
+	int err = errno, len, res;
+	va_list copy;
+
+	if ((r = get_ring(impl)) == NULL)
+		goto dropped;
+
+	rec->level = level;
+	rec->line = line;
+	rec->flags = 0;
+
+	/* MAX_RECORD has room for both */
+	len = pack_string(payload, avail, strrchr(file, '/') + 1, MAX_STRING - 1);
+	len += pack_string(payload + len, avail - len, func, MAX_STRING - 1);
+
+	va_copy(copy, args);
+	res = pack_args(fmt, copy, payload + len, avail - len, err);
+	va_end(copy);
+
+	if (res < 0) {
+		/* a conversion we can't pack, format it here */
+		rec->flags |= RECORD_FLAG_FORMATTED;
+		errno = err;
+		res = vsnprintf((char *) payload + len, avail - len, fmt, args);
+		res = SPA_CLAMP(res, 0, (int) (avail - len) - 1) + 1;
+	}
+	rec->size = sizeof(struct record) + len + res;
+
+	filled = spa_ringbuffer_get_write_index(&r->rb, &index);
+	if (filled < 0 || filled + rec->size > RING_SIZE)
+		goto dropped;
+
+	spa_ringbuffer_write_data(&r->rb, r->data, RING_SIZE,
+				  index & (RING_SIZE - 1), buffer, rec->size);
+	spa_ringbuffer_write_update(&r->rb, index + rec->size);
+	return;
+
+      dropped:
+	__atomic_fetch_add(&impl->dropped, 1, __ATOMIC_RELAXED);
+}
+
+#define FORMAT_VALUE(value)								\
+do {											\
+	if (n_star == 0)								\
+		res = snprintf(text + len, size - len, spec, value);			\
+	else if (n_star == 1)								\
+		res = snprintf(text + len, size - len, spec, star[0], value);		\
+	else										\
+		res = snprintf(text + len, size - len, spec, star[0], star[1], value);	\
+} while (0)
+
+#define FORMAT_ARG(type)								\
+do {											\
+	type _v;									\
+	if (a + sizeof(type) > end)							\
+		goto invalid;								\
+	memcpy(&_v, a, sizeof(type));							\
+	a += sizeof(type);								\
+	FORMAT_VALUE(_v);								\
+} while (0)
+
+/* get the string at \a a and move \a a after it */
+static const char *unpack_string(const uint8_t **a, const uint8_t *end)
+{
+	const char *str = (const char *) *a;
+	size_t len = strnlen(str, end - *a);
+
+	if (len == (size_t) (end - *a))
+		return NULL;
+	*a += len + 1;
+	return str;
+}
+
+/* format the packed arguments in \a a like vsnprintf would */
+static void format_record(const char *fmt, const uint8_t *a, const uint8_t *end,
+			  char *text, size_t size)
+{
+	const char *p = fmt, *s, *str;
+	char spec[MAX_SPEC];
+	size_t len = 0, n_spec;
+	uint32_t i, n_star;
+	enum arg_type type;
+	int star[2], res;
+
+	while (*p && len < size - 1) {
+		if (*p != '%') {
+			text[len++] = *p++;
+			continue;
+		}
+		if ((s = parse_conversion(p + 1, &n_star, &type)) == NULL ||
+		    (size_t) (s - p) >= sizeof(spec))
+			goto invalid;
+
+		n_spec = s - p;
+		memcpy(spec, p, n_spec);
+		spec[n_spec] = '\0';
+		p = s;
+
+		for (i = 0; i < n_star; i++) {
+			if (a + sizeof(int) > end)
+				goto invalid;
+			memcpy(&star[i], a, sizeof(int));
+			a += sizeof(int);
+		}
+
+		res = 0;
+		switch (type) {
+		case ARG_NONE:
+			res = snprintf(text + len, size - len, spec, 0);
+			break;
+		case ARG_INT:
+			FORMAT_ARG(int);
+			break;
+		case ARG_LONG:
+			FORMAT_ARG(long);
+			break;
+		case ARG_LLONG:
+			FORMAT_ARG(long long);
+			break;
+		case ARG_SIZE:
+			FORMAT_ARG(size_t);
+			break;
+		case ARG_INTMAX:
+			FORMAT_ARG(intmax_t);
+			break;
+		case ARG_PTRDIFF:
+			FORMAT_ARG(ptrdiff_t);
+			break;
+		case ARG_PTR:
+			FORMAT_ARG(void *);
+			break;
+		case ARG_DOUBLE:
+			FORMAT_ARG(double);
+			break;
+		case ARG_LDOUBLE:
+			FORMAT_ARG(long double);
+			break;
+		case ARG_ERRNO:
+			/* the string of the errno, format it with %s */
+			spec[n_spec - 1] = 's';
+			/* fall through */
+		case ARG_STRING:
+			if ((str = unpack_string(&a, end)) == NULL)
+				goto invalid;
+			FORMAT_VALUE(str);
+			break;
+		}
+		if (res < 0)
+			goto invalid;
+		len = SPA_MIN(len + res, size - 1);
+	}
+	text[len] = '\0';
+	return;
+
+      invalid:
+	snprintf(text, size, "<invalid record for \"%s\">", fmt);
+}
+
 static void
 impl_log_logv(struct spa_log *log,
 	      enum spa_log_level level,
@@ -74,6 +512,11 @@ impl_log_logv(struct spa_log *log,
 	int size;
 	bool do_trace;
 
+	if (level == SPA_LOG_LEVEL_TRACE && impl->binary) {
+		log_binary(impl, level, file, line, func, fmt, args);
+		return;
+	}
+
 	if ((do_trace = (level == SPA_LOG_LEVEL_TRACE && impl->have_source)))
 		level++;
 
@@ -139,6 +582,113 @@ static void on_trace_event(struct spa_source *source)
         }
 }
 
+static void flush_rings(struct impl *impl)
+{
+	uint8_t buffer[MAX_RECORD];
+	struct record *rec = (struct record *) buffer;
+	const uint8_t *a, *end;
+	const char *file, *func, *fmt;
+	char text[512];
+	uint32_t i, index;
+	uint64_t dropped;
+	int32_t avail;
+
+	for (i = 0; i < MAX_RINGS; i++) {
+		struct log_ring *r = &impl->rings[i];
+
+		while ((avail = spa_ringbuffer_get_read_index(&r->rb, &index)) > 0) {
+			uint32_t offset = index & (RING_SIZE - 1);
+
+			spa_ringbuffer_read_data(&r->rb, r->data, RING_SIZE, offset,
+						 rec, sizeof(struct record));
+			if (rec->size < sizeof(struct record) || rec->size > (uint32_t) avail) {
+				fprintf(stderr, "[E][" NAME "] ring %u corrupted\n", i);
+				spa_ringbuffer_read_update(&r->rb, index + avail);
+				break;
+			}
+			spa_ringbuffer_read_data(&r->rb, r->data, RING_SIZE, offset,
+						 buffer, rec->size);
+			spa_ringbuffer_read_update(&r->rb, index + rec->size);
+
+			a = SPA_MEMBER(rec, sizeof(struct record), const uint8_t);
+			end = SPA_MEMBER(rec, rec->size, const uint8_t);
+			if ((file = unpack_string(&a, end)) == NULL ||
+			    (func = unpack_string(&a, end)) == NULL ||
+			    (fmt = unpack_string(&a, end)) == NULL) {
+				fprintf(stderr, "[E][" NAME "] invalid record in ring %u\n", i);
+				continue;
+			}
+			if (rec->flags & RECORD_FLAG_FORMATTED) {
+				fprintf(stderr, "[*T*][%s:%i %s()] %s\n",
+					file, rec->line, func, fmt);
+				continue;
+			}
+			format_record(fmt, a, end, text, sizeof(text));
+			fprintf(stderr, "[*T*][%s:%i %s()] %s\n",
+				file, rec->line, func, text);
+		}
+	}
+
+	dropped = __atomic_load_n(&impl->dropped, __ATOMIC_RELAXED);
+	if (dropped != impl->dropped_reported) {
+		fprintf(stderr, "[W][" NAME "] %"PRIu64" log records dropped, %"PRIu64" total\n",
+			dropped - impl->dropped_reported, dropped);
+		impl->dropped_reported = dropped;
+	}
+}
+
+static void on_flush(struct spa_source *source)
+{
+	struct impl *impl = source->data;
+	uint64_t expirations;
+
+	if (read(source->fd, &expirations, sizeof(uint64_t)) != sizeof(uint64_t))
+		fprintf(stderr, "failed to read timer fd: %s", strerror(errno));
+
+	flush_rings(impl);
+}
+
+static int init_binary(struct impl *impl, struct spa_loop *loop)
+{
+	struct itimerspec value;
+	uint32_t i;
+	int res;
+
+	impl->rings = calloc(MAX_RINGS, sizeof(struct log_ring));
+	if (impl->rings == NULL)
+		return -errno;
+
+	for (i = 0; i < MAX_RINGS; i++)
+		spa_ringbuffer_init(&impl->rings[i].rb);
+
+	if ((res = pthread_key_create(&impl->ring_key, release_ring)) != 0) {
+		free(impl->rings);
+		return -res;
+	}
+
+	impl->flush.func = on_flush;
+	impl->flush.data = impl;
+	impl->flush.fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	impl->flush.mask = SPA_IO_IN;
+	impl->flush.rmask = 0;
+	if (impl->flush.fd < 0) {
+		res = -errno;
+		pthread_key_delete(impl->ring_key);
+		free(impl->rings);
+		return res;
+	}
+
+	value.it_value.tv_sec = 0;
+	value.it_value.tv_nsec = FLUSH_INTERVAL;
+	value.it_interval = value.it_value;
+	timerfd_settime(impl->flush.fd, 0, &value, NULL);
+
+	spa_loop_add_source(loop, &impl->flush);
+	impl->binary = true;
+
+	return 0;
+}
+
 static const struct spa_log impl_log = {
 	SPA_VERSION_LOG,
 	NULL,
@@ -177,6 +727,14 @@ static int impl_clear(struct spa_handle *handle)
 		close(this->source.fd);
 		this->have_source = false;
 	}
+	if (this->binary) {
+		this->binary = false;
+		spa_loop_remove_source(this->flush.loop, &this->flush);
+		close(this->flush.fd);
+		flush_rings(this);
+		pthread_key_delete(this->ring_key);
+		free(this->rings);
+	}
 	return 0;
 }
 
@@ -190,6 +748,8 @@ impl_init(const struct spa_handle_factory *factory,
 	struct impl *this;
 	uint32_t i;
 	struct spa_loop *loop = NULL;
+	const char *str;
+	int res;
 
 	spa_return_val_if_fail(factory != NULL, -EINVAL);
 	spa_return_val_if_fail(handle != NULL, -EINVAL);
@@ -213,7 +773,16 @@ impl_init(const struct spa_handle_factory *factory,
 	}
 	init_type(&this->type, this->map);
 
-	if (loop) {
+	if (info && (str = spa_dict_lookup(info, "log.binary")) != NULL &&
+	    (strcmp(str, "true") == 0 || atoi(str) == 1)) {
+		if (loop == NULL)
+			spa_log_warn(&this->log, NAME " %p: binary mode needs a main loop", this);
+		else if ((res = init_binary(this, loop)) < 0)
+			spa_log_warn(&this->log, NAME " %p: can't enable binary mode: %s",
+					this, strerror(-res));
+	}
+
+	if (loop && !this->binary) {
 		this->source.func = on_trace_event;
 		this->source.data = this;
 		this->source.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
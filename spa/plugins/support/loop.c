@@ -17,6 +17,7 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <errno.h>
 #include <sys/types.h>
@@ -29,34 +30,119 @@
 #include <sys/signalfd.h>
 #include <pthread.h>
 
+#ifdef HAVE_IO_URING
+#include <poll.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
 #include <spa/support/loop.h>
 #include <spa/support/log.h>
 #include <spa/support/type-map.h>
 #include <spa/support/plugin.h>
 #include <spa/utils/list.h>
-#include <spa/utils/ringbuffer.h>
 
 #define NAME "loop"
 
-#define DATAS_SIZE (4096 * 8)
+#define N_SLOTS		128
+#define MASK_SLOTS	(N_SLOTS - 1)
+#define SLOT_SIZE	256
+
+#define WHEEL_BITS		6
+#define WHEEL_SIZE		(1 << WHEEL_BITS)
+#define WHEEL_MASK		(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS		4
+#define WHEEL_TICK_SHIFT	20	/* a tick is 2^20 nsec, about 1ms */
+
+#define STATS_POOL	256
+#define STATS_HASH	64
+
+#define URING_ENTRIES	256
+#define URING_MAX_CQES	32
 
 /** \cond */
 
+/* completion of a blocking invoke, lives on the stack of the caller */
+struct invoke_sync {
+	bool done;
+	int res;
+};
+
 struct invoke_item {
-	size_t item_size;
 	spa_invoke_func_t func;
 	uint32_t seq;
 	void *data;
 	size_t size;
-	bool block;
 	void *user_data;
-	int res;
+	struct invoke_sync *sync;
+};
+
+/* a slot in the bounded multi-producer queue. The sequence number
+ * tells if the slot is free for the producer at the same position or
+ * filled for the consumer at the same position. */
+struct invoke_slot {
+	uint32_t seq;
+	struct invoke_item item;
+	uint8_t data[SLOT_SIZE - sizeof(struct invoke_item) - sizeof(uint32_t)]
+		SPA_ALIGNED(8);
+} SPA_ALIGNED(64);
+
+/* Timers are kept in a hierarchical timer wheel and share one timerfd.
+ *
+ * Level 0 has a slot for each tick in the current window of WHEEL_SIZE ticks,
+ * level 1 a slot for each window of level 0 etc. A timer is placed in the
+ * lowest level where it is in the same window as the current tick and moves
+ * down a level when its window is reached. The timerfd is armed for the
+ * earliest timer, optionally delayed by the slack so that timers that are
+ * close together expire in one wakeup.
+ *
+ * Timers can be updated from any thread, like a timerfd, so the wheel is
+ * protected with a lock. The lock is not held while the callbacks run. */
+struct wheel {
+	pthread_mutex_t lock;
+	struct spa_source *source;	/* the timerfd */
+	uint64_t now;			/* last processed tick */
+	uint64_t armed;			/* time the timerfd expires or 0 */
+	uint64_t slack;			/* in nsec */
+	uint64_t bitmap[WHEEL_LEVELS];	/* non-empty slots */
+	struct spa_list slots[WHEEL_LEVELS][WHEEL_SIZE];
+};
+
+struct source_stats {
+	struct spa_list link;		/* in a hash bucket or the free list */
+	const struct spa_source *source;
+	const void *func;
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+};
+
+/* dispatch accounting, the entries for the sources are preallocated */
+struct stats {
+	bool enabled;
+	struct spa_loop_stats_info info;
+	struct source_stats *pool;
+	struct spa_list free;
+	struct spa_list hash[STATS_HASH];
+};
+
+/* an item that did not fit in the queue. It is invoked before the slot at
+ * the queue position it was added at so that the order of the items of a
+ * producer is kept. */
+struct overflow_item {
+	struct spa_list link;
+	uint32_t pos;
+	struct invoke_item item;
+	uint8_t data[0] SPA_ALIGNED(8);
 };
 
 struct type {
 	uint32_t loop;
 	uint32_t loop_control;
 	uint32_t loop_utils;
+	uint32_t loop_stats;
 };
 
 static void loop_signal_event(struct spa_source *source);
@@ -66,6 +152,7 @@ static inline void init_type(struct type *type, struct spa_type_map *map)
 	type->loop = spa_type_map_get_id(map, SPA_TYPE__Loop);
 	type->loop_control = spa_type_map_get_id(map, SPA_TYPE__LoopControl);
 	type->loop_utils = spa_type_map_get_id(map, SPA_TYPE__LoopUtils);
+	type->loop_stats = spa_type_map_get_id(map, SPA_TYPE__LoopStats);
 }
 
 struct impl {
@@ -73,6 +160,7 @@ struct impl {
 	struct spa_loop loop;
 	struct spa_loop_control control;
 	struct spa_loop_utils utils;
+	struct spa_loop_stats stats_iface;
 
         struct spa_log *log;
         struct type type;
@@ -85,11 +173,23 @@ struct impl {
 	int epoll_fd;
 	pthread_t thread;
 
+	bool uring;
+#ifdef HAVE_IO_URING
+	struct uring *ring;
+#endif
+
 	struct spa_source *wakeup;
-	int ack_fd;
+	struct wheel wheel;
+	struct stats stats;
 
-	struct spa_ringbuffer buffer;
-	uint8_t buffer_data[DATAS_SIZE];
+	pthread_mutex_t lock;		/* protects the overflow list and completion */
+	pthread_cond_t cond;		/* signaled when a blocking invoke completed */
+	struct spa_list overflow_list;
+	uint32_t n_overflow;
+
+	uint32_t tail;			/* next slot for producers */
+	uint32_t head;			/* next slot for the consumer */
+	struct invoke_slot slots[N_SLOTS];
 };
 
 struct source_impl {
@@ -108,6 +208,15 @@ struct source_impl {
 	} func;
 	int signal_number;
 	bool enabled;
+	uint64_t count;		/* expirations set by the wheel or the counter of an
+				 * event read by the io_uring backend */
+
+	struct spa_list timer_link;
+	bool queued;		/* in a wheel slot or expired list */
+	uint8_t level;
+	uint8_t slot;
+	uint64_t expire;	/* in nsec, 0 when disarmed */
+	uint64_t interval;
 };
 /** \endcond */
 
@@ -143,12 +252,797 @@ static inline enum spa_io spa_epoll_to_io(uint32_t events)
 	return mask;
 }
 
+static void source_io_func(struct spa_source *source);
+static void source_idle_func(struct spa_source *source);
+static void source_event_func(struct spa_source *source);
+static void source_timer_func(struct spa_source *source);
+static void source_signal_func(struct spa_source *source);
+
+static inline uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_TIME(&ts);
+}
+
+static inline bool stats_enabled(struct impl *impl)
+{
+	return __atomic_load_n(&impl->stats.enabled, __ATOMIC_ACQUIRE);
+}
+
+static inline uint32_t stats_bin(uint64_t nsec)
+{
+	uint64_t usec = nsec / 1000;
+	if (usec < 2)
+		return 0;
+	return SPA_MIN(63 - __builtin_clzll(usec), SPA_LOOP_STATS_N_BINS - 1);
+}
+
+static inline uint32_t stats_hash(const struct spa_source *source)
+{
+	return ((uintptr_t) source >> 4) & (STATS_HASH - 1);
+}
+
+/* the callback of the user, not the wrapper of the source */
+static const void *source_callback(const struct spa_source *s)
+{
+	if (s->func == source_io_func ||
+	    s->func == source_idle_func ||
+	    s->func == source_event_func ||
+	    s->func == source_timer_func ||
+	    s->func == source_signal_func) {
+		struct source_impl *impl = SPA_CONTAINER_OF(s, struct source_impl, source);
+		return (const void *) impl->func.io;
+	}
+	return (const void *) s->func;
+}
+
+static struct source_stats *stats_find(struct impl *impl, const struct spa_source *source, bool create)
+{
+	struct stats *st = &impl->stats;
+	struct spa_list *bucket;
+	struct source_stats *ss;
+
+	bucket = &st->hash[stats_hash(source)];
+	spa_list_for_each(ss, bucket, link)
+		if (ss->source == source)
+			return ss;
+
+	/* no allocation here, this can run in a realtime thread */
+	if (!create || spa_list_is_empty(&st->free))
+		return NULL;
+
+	ss = spa_list_first(&st->free, struct source_stats, link);
+	spa_list_remove(&ss->link);
+	ss->source = source;
+	ss->func = source_callback(source);
+	ss->count = ss->total = ss->max = 0;
+	spa_list_append(bucket, &ss->link);
+
+	return ss;
+}
+
+static void stats_remove(struct impl *impl, const struct spa_source *source)
+{
+	struct source_stats *ss;
+
+	if (__atomic_load_n(&impl->stats.pool, __ATOMIC_ACQUIRE) == NULL)
+		return;
+
+	if ((ss = stats_find(impl, source, false)) != NULL) {
+		spa_list_remove(&ss->link);
+		ss->source = NULL;
+		spa_list_append(&impl->stats.free, &ss->link);
+	}
+}
+
+/* dispatch and account, ref is the time of the wakeup or timer expiration */
+static void dispatch_stats(struct impl *impl, struct spa_source *s, uint64_t ref)
+{
+	struct spa_loop_stats_info *info = &impl->stats.info;
+	struct source_stats *ss;
+	uint64_t t0, t1, dt;
+
+	/* the callback can remove and free the source, look up the entry
+	 * first. Removing the source clears the entry. */
+	ss = stats_find(impl, s, true);
+
+	t0 = get_time_ns();
+	s->func(s);
+	t1 = get_time_ns();
+	dt = t1 - t0;
+
+	info->n_dispatches++;
+	info->busy += dt;
+	info->latency[stats_bin(t0 > ref ? t0 - ref : 0)]++;
+	info->dispatch[stats_bin(dt)]++;
+
+	if (ss != NULL && ss->source == s) {
+		ss->count++;
+		ss->total += dt;
+		ss->max = SPA_MAX(ss->max, dt);
+	}
+}
+
+/* the time of the wakeup when the accounting is enabled, 0 otherwise */
+static inline uint64_t stats_wakeup(struct impl *impl)
+{
+	if (SPA_LIKELY(!stats_enabled(impl)))
+		return 0;
+	impl->stats.info.n_iterations++;
+	return get_time_ns();
+}
+
+static inline void dispatch_source(struct impl *impl, struct spa_source *s, uint64_t ref)
+{
+	/* the timers are accounted when the wheel dispatches them */
+	if (SPA_LIKELY(ref == 0) || s == impl->wheel.source)
+		s->func(s);
+	else
+		dispatch_stats(impl, s, ref);
+}
+
+#ifdef HAVE_IO_URING
+/* io_uring backend.
+ *
+ * Event sources are watched with multishot polls that stay armed. When they
+ * complete, the counters of the ready eventfds are read before the dispatch.
+ * A single counter is read directly, the reads of more counters are queued
+ * and submitted with one io_uring_enter call.
+ *
+ * Other fd sources are watched with one-shot polls that are armed again after
+ * the source was dispatched, this keeps the level triggered semantics of the
+ * epoll backend that idle and io sources rely on. Requests, rearms and the wait
+ * timeout are queued in the submission queue and submitted with the
+ * io_uring_enter call that waits for completions. The rearms of the last
+ * dispatch are submitted before iterate returns so that the ring fd becomes
+ * readable for an outer loop that polls it. */
+
+#define URING_TAG_IGNORE	0ULL
+#define URING_TAG_TIMEOUT	1ULL
+#define URING_TAG_READ		1ULL	/* set in the user_data of counter reads */
+
+struct uring_source {
+	struct spa_list link;
+	struct spa_source *source;	/* NULL when removed from the loop */
+	uint32_t pending;		/* requests in flight */
+	bool armed;			/* a poll is queued */
+	bool multishot;			/* the queued poll is multishot */
+	bool rearm;			/* arm again when the cancel completed */
+	bool ready;			/* completed, waiting for dispatch */
+	bool event;			/* an event source, the counter is read */
+	bool queued;			/* the counter needs to be read */
+	bool reading;			/* a read of the counter is in flight */
+	bool again;			/* the poll completed while reading */
+	uint64_t count;			/* the counter of the last read */
+};
+
+struct uring {
+	int fd;
+
+	void *sq_ptr;
+	size_t sq_size;
+	uint32_t *sq_head;
+	uint32_t *sq_tail;
+	uint32_t *sq_mask;
+	uint32_t *sq_array;
+	uint32_t sq_entries;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	uint32_t sq_local;		/* tail of the queued, unsubmitted entries */
+	uint32_t to_submit;
+
+	void *cq_ptr;
+	size_t cq_size;
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct __kernel_timespec ts;
+	bool ext_arg;			/* the timeout can be passed to enter */
+	bool multishot;			/* multishot polls are supported */
+
+	struct spa_list sources;
+	struct spa_list dead;
+};
+
+static inline int uring_setup(uint32_t entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags,
+		void *arg, size_t arg_size)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static inline int uring_register(int fd, uint32_t opcode, void *arg, uint32_t nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static inline uint32_t spa_io_to_poll(enum spa_io mask)
+{
+	uint32_t events = 0;
+
+	if (mask & SPA_IO_IN)
+		events |= POLLIN;
+	if (mask & SPA_IO_OUT)
+		events |= POLLOUT;
+	if (mask & SPA_IO_ERR)
+		events |= POLLERR;
+	if (mask & SPA_IO_HUP)
+		events |= POLLHUP;
+#if __BYTE_ORDER == __BIG_ENDIAN
+	events = (events << 16) | (events >> 16);
+#endif
+	return events;
+}
+
+static inline enum spa_io spa_poll_to_io(uint32_t events)
+{
+	enum spa_io mask = 0;
+
+	if (events & POLLIN)
+		mask |= SPA_IO_IN;
+	if (events & POLLOUT)
+		mask |= SPA_IO_OUT;
+	if (events & POLLHUP)
+		mask |= SPA_IO_HUP;
+	if (events & POLLERR)
+		mask |= SPA_IO_ERR;
+
+	return mask;
+}
+
+static int uring_submit(struct uring *r, uint32_t min_complete, uint32_t flags)
+{
+	int res;
+
+	while (true) {
+		res = uring_enter(r->fd, r->to_submit, min_complete, flags, NULL, 0);
+		if (res >= 0) {
+			r->to_submit -= SPA_MIN((uint32_t)res, r->to_submit);
+			return 0;
+		}
+		if (errno != EINTR || min_complete == 0)
+			return -errno;
+	}
+}
+
+/* submit and wait for a completion until the timeout in r->ts, without a
+ * timeout request. Needs IORING_FEAT_EXT_ARG, since 5.11 */
+static int uring_wait_timeout(struct uring *r)
+{
+	struct io_uring_getevents_arg arg;
+	int res;
+
+	spa_zero(arg);
+	arg.ts = (uint64_t) (uintptr_t) &r->ts;
+
+	while (true) {
+		res = uring_enter(r->fd, r->to_submit, 1,
+				IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+				&arg, sizeof(arg));
+		if (res >= 0) {
+			r->to_submit -= SPA_MIN((uint32_t)res, r->to_submit);
+			return 0;
+		}
+		if (errno == ETIME)
+			return 0;
+		if (errno != EINTR)
+			return -errno;
+	}
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring *r)
+{
+	struct io_uring_sqe *sqe;
+	uint32_t head, idx;
+
+	head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+	if (r->sq_local - head >= r->sq_entries) {
+		/* full, submit what we have and try again */
+		if (uring_submit(r, 0, 0) < 0)
+			return NULL;
+		head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+		if (r->sq_local - head >= r->sq_entries)
+			return NULL;
+	}
+	idx = r->sq_local & *r->sq_mask;
+	sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[idx] = idx;
+	r->sq_local++;
+	r->to_submit++;
+	__atomic_store_n(r->sq_tail, r->sq_local, __ATOMIC_RELEASE);
+
+	return sqe;
+}
+
+static int uring_arm(struct impl *impl, struct uring_source *us)
+{
+	struct uring *r = impl->ring;
+	struct spa_source *s = us->source;
+	struct io_uring_sqe *sqe;
+
+	if (s == NULL || us->armed || s->mask == 0)
+		return 0;
+
+	if ((sqe = uring_get_sqe(r)) == NULL) {
+		spa_log_error(impl->log, NAME " %p: submission queue full", impl);
+		return -EBUSY;
+	}
+	sqe->fd = s->fd;
+	sqe->user_data = (uint64_t) (uintptr_t) us;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->poll32_events = spa_io_to_poll(s->mask);
+	us->multishot = us->event && r->multishot;
+	if (us->multishot)
+		sqe->len = IORING_POLL_ADD_MULTI;
+	us->armed = true;
+	us->pending++;
+
+	return 0;
+}
+
+/* queue a read of the counter of an event source */
+static int uring_read(struct impl *impl, struct uring_source *us)
+{
+	struct io_uring_sqe *sqe;
+
+	if ((sqe = uring_get_sqe(impl->ring)) == NULL)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = us->source->fd;
+	sqe->addr = (uint64_t) (uintptr_t) &us->count;
+	sqe->len = sizeof(uint64_t);
+	sqe->user_data = (uint64_t) (uintptr_t) us | URING_TAG_READ;
+	us->reading = true;
+	us->pending++;
+
+	return 0;
+}
+
+static int uring_cancel(struct impl *impl, struct uring_source *us)
+{
+	struct io_uring_sqe *sqe;
+
+	if ((sqe = uring_get_sqe(impl->ring)) == NULL)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t) (uintptr_t) us;
+	sqe->user_data = URING_TAG_IGNORE;
+
+	return 0;
+}
+
+/* a read of an empty counter waits until the event is signaled */
+static int uring_cancel_read(struct impl *impl, struct uring_source *us)
+{
+	struct io_uring_sqe *sqe;
+
+	if ((sqe = uring_get_sqe(impl->ring)) == NULL)
+		return -EBUSY;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t) (uintptr_t) us | URING_TAG_READ;
+	sqe->user_data = URING_TAG_IGNORE;
+
+	return 0;
+}
+
+static struct uring_source *uring_find(struct impl *impl, struct spa_source *source)
+{
+	struct uring_source *us;
+
+	spa_list_for_each(us, &impl->ring->sources, link)
+		if (us->source == source)
+			return us;
+	return NULL;
+}
+
+static int uring_add_source(struct impl *impl, struct spa_source *source)
+{
+	struct uring_source *us;
+
+	if ((us = calloc(1, sizeof(struct uring_source))) == NULL)
+		return -ENOMEM;
+
+	us->source = source;
+	us->event = source->func == source_event_func;
+	spa_list_append(&impl->ring->sources, &us->link);
+
+	return uring_arm(impl, us);
+}
+
+static int uring_update_source(struct impl *impl, struct spa_source *source)
+{
+	struct uring_source *us;
+
+	if ((us = uring_find(impl, source)) == NULL)
+		return -ENOENT;
+
+	if (us->armed) {
+		/* the mask is changed when the poll completes as cancelled */
+		us->rearm = true;
+		return uring_cancel(impl, us);
+	}
+	if (!us->ready)
+		return uring_arm(impl, us);
+
+	return 0;
+}
+
+static void uring_remove_source(struct impl *impl, struct spa_source *source)
+{
+	struct uring_source *us;
+
+	if ((us = uring_find(impl, source)) == NULL)
+		return;
+
+	us->source = NULL;
+	us->rearm = false;
+	spa_list_remove(&us->link);
+	spa_list_append(&impl->ring->dead, &us->link);
+
+	if (us->armed)
+		uring_cancel(impl, us);
+	if (us->reading)
+		uring_cancel_read(impl, us);
+	/* submit now, the fd is resolved at submit time and the caller
+	 * is free to close and reuse it after this */
+	if (us->armed || us->reading)
+		uring_submit(impl->ring, 0, 0);
+}
+
+static void uring_process_dead(struct impl *impl)
+{
+	struct uring_source *us, *tmp;
+
+	spa_list_for_each_safe(us, tmp, &impl->ring->dead, link) {
+		if (us->pending == 0) {
+			spa_list_remove(&us->link);
+			free(us);
+		}
+	}
+}
+
+static void uring_event_ready(struct uring_source *us, uint64_t count,
+		struct uring_source **ready, uint32_t *n_ready)
+{
+	struct spa_source *s = us->source;
+	struct source_impl *si = SPA_CONTAINER_OF(s, struct source_impl, source);
+
+	if (us->ready) {
+		si->count += count;
+		return;
+	}
+	si->count = count;
+	s->rmask = SPA_IO_IN;
+	us->ready = true;
+	ready[(*n_ready)++] = us;
+}
+
+static void uring_event_queue(struct uring_source *us,
+		struct uring_source **reads, uint32_t *n_reads)
+{
+	if (us->reading) {
+		us->again = true;
+	} else if (!us->queued) {
+		us->queued = true;
+		reads[(*n_reads)++] = us;
+	}
+}
+
+/* handle the completions. The sources that are ready for dispatch are added
+ * to ready, the event sources with a counter to read to reads. */
+static void uring_reap(struct impl *impl, struct uring_source **ready, uint32_t *n_ready,
+		struct uring_source **reads, uint32_t *n_reads)
+{
+	struct uring *r = impl->ring;
+	uint32_t head, tail;
+
+	head = *r->cq_head;
+	tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail && *n_ready + *n_reads < URING_MAX_CQES; head++) {
+		struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+		struct uring_source *us;
+		struct spa_source *s;
+
+		if (cqe->user_data == URING_TAG_IGNORE ||
+		    cqe->user_data == URING_TAG_TIMEOUT)
+			continue;
+
+		if (cqe->user_data & URING_TAG_READ) {
+			us = (struct uring_source *) (uintptr_t) (cqe->user_data & ~URING_TAG_READ);
+			us->reading = false;
+			us->pending--;
+
+			if (us->source == NULL)
+				continue;
+			if (us->again) {
+				us->again = false;
+				uring_event_queue(us, reads, n_reads);
+			}
+			if (cqe->res == sizeof(uint64_t))
+				uring_event_ready(us, us->count, ready, n_ready);
+			continue;
+		}
+
+		us = (struct uring_source *) (uintptr_t) cqe->user_data;
+		if (!(cqe->flags & IORING_CQE_F_MORE)) {
+			us->armed = false;
+			us->pending--;
+		}
+
+		if ((s = us->source) == NULL)
+			continue;
+
+		if (cqe->res < 0) {
+			if (cqe->res == -ECANCELED && us->rearm) {
+				us->rearm = false;
+				uring_arm(impl, us);
+			} else if (cqe->res == -EINVAL && us->multishot) {
+				/* kernels before 5.13 have no multishot polls */
+				r->multishot = false;
+				uring_arm(impl, us);
+			} else if (cqe->res == -EAGAIN || cqe->res == -EINTR) {
+				uring_arm(impl, us);
+			} else if (cqe->res != -ECANCELED) {
+				spa_log_warn(impl->log, NAME " %p: source %p fd %d failed: %s",
+						impl, s, s->fd, strerror(-cqe->res));
+			}
+			continue;
+		}
+		if (us->event) {
+			uring_event_queue(us, reads, n_reads);
+			continue;
+		}
+		s->rmask = spa_poll_to_io(cqe->res);
+		us->ready = true;
+		ready[(*n_ready)++] = us;
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* queue the reads of the counters, they are queued before the polls are armed
+ * again so that the polls see the drained counters */
+static void uring_queue_reads(struct impl *impl, struct uring_source **reads, uint32_t n_reads)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_reads; i++) {
+		reads[i]->queued = false;
+		uring_read(impl, reads[i]);
+	}
+	for (i = 0; i < n_reads; i++)
+		uring_arm(impl, reads[i]);
+}
+
+static int uring_iterate(struct impl *impl, int timeout)
+{
+	struct uring *r = impl->ring;
+	struct spa_loop *loop = &impl->loop;
+	struct uring_source *ready[URING_MAX_CQES], *reads[URING_MAX_CQES];
+	uint32_t head, n_ready = 0, n_reads = 0, i;
+	uint64_t ref;
+	int res = 0;
+
+	if (timeout > 0) {
+		struct io_uring_sqe *sqe;
+
+		r->ts.tv_sec = timeout / 1000;
+		r->ts.tv_nsec = (timeout % 1000) * 1000000LL;
+		/* completes after the timeout or when any other request completed */
+		if (!r->ext_arg && (sqe = uring_get_sqe(r)) != NULL) {
+			sqe->opcode = IORING_OP_TIMEOUT;
+			sqe->fd = -1;
+			sqe->addr = (uint64_t) (uintptr_t) &r->ts;
+			sqe->len = 1;
+			sqe->off = 1;
+			sqe->user_data = URING_TAG_TIMEOUT;
+		}
+	}
+
+	spa_loop_control_hook_before(&impl->hooks_list);
+
+	head = *r->cq_head;
+	if (timeout != 0 && head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+		timeout = 0;
+	if (timeout > 0 && r->ext_arg)
+		res = uring_wait_timeout(r);
+	else if (r->to_submit > 0 || timeout != 0)
+		res = uring_submit(r, timeout == 0 ? 0 : 1,
+				timeout == 0 ? 0 : IORING_ENTER_GETEVENTS);
+
+	spa_loop_control_hook_after(&impl->hooks_list);
+
+	if (SPA_UNLIKELY(res < 0))
+		return -res;
+
+	ref = stats_wakeup(impl);
+
+	/* first we set all the rmasks, then call the callbacks, like the epoll
+	 * backend does */
+	uring_reap(impl, ready, &n_ready, reads, &n_reads);
+
+	if (n_reads == 1) {
+		struct uring_source *us = reads[0];
+		uint64_t count;
+
+		/* cheaper than entering the ring */
+		us->queued = false;
+		if (read(us->source->fd, &count, sizeof(uint64_t)) == sizeof(uint64_t))
+			uring_event_ready(us, count, ready, &n_ready);
+		uring_arm(impl, us);
+	} else if (n_reads > 1) {
+		/* the reads complete when they are submitted */
+		uring_queue_reads(impl, reads, n_reads);
+		n_reads = 0;
+		if (uring_submit(r, 0, 0) == 0)
+			uring_reap(impl, ready, &n_ready, reads, &n_reads);
+		/* submitted before we return */
+		uring_queue_reads(impl, reads, n_reads);
+	}
+
+	for (i = 0; i < n_ready; i++) {
+		struct spa_source *s = ready[i]->source;
+		if (s && s->rmask && s->fd != -1 && s->loop == loop)
+			dispatch_source(impl, s, ref);
+	}
+	for (i = 0; i < n_ready; i++) {
+		ready[i]->ready = false;
+		uring_arm(impl, ready[i]);
+	}
+	uring_process_dead(impl);
+
+	/* submit the rearms now, when the loop is polled through its fd
+	 * there might not be another iterate to do it */
+	if (r->to_submit > 0 && (res = uring_submit(r, 0, 0)) < 0)
+		spa_log_warn(impl->log, NAME " %p: submit failed: %s", impl, strerror(-res));
+
+	return 0;
+}
+
+static void uring_free(struct uring *r)
+{
+	struct uring_source *us;
+
+	if (r->sqes)
+		munmap(r->sqes, r->sqes_size);
+	if (r->cq_ptr)
+		munmap(r->cq_ptr, r->cq_size);
+	if (r->sq_ptr)
+		munmap(r->sq_ptr, r->sq_size);
+	if (r->fd != -1)
+		close(r->fd);
+
+	spa_list_consume(us, &r->sources, link) {
+		spa_list_remove(&us->link);
+		free(us);
+	}
+	spa_list_consume(us, &r->dead, link) {
+		spa_list_remove(&us->link);
+		free(us);
+	}
+	free(r);
+}
+
+static bool uring_probe(struct uring *r)
+{
+	static const uint8_t ops[] = { IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE,
+		IORING_OP_TIMEOUT, IORING_OP_READ, IORING_OP_ASYNC_CANCEL };
+	struct io_uring_probe *probe;
+	uint32_t i;
+	bool res = true;
+
+	probe = calloc(1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+	if (probe == NULL)
+		return false;
+
+	if (uring_register(r->fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+		free(probe);
+		return false;
+	}
+	for (i = 0; i < SPA_N_ELEMENTS(ops); i++) {
+		if (ops[i] > probe->last_op ||
+		    !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+			res = false;
+	}
+	free(probe);
+	return res;
+}
+
+static int uring_new(struct impl *impl)
+{
+	struct io_uring_params p;
+	struct uring *r;
+	int res;
+
+	if ((r = calloc(1, sizeof(struct uring))) == NULL)
+		return -ENOMEM;
+
+	spa_list_init(&r->sources);
+	spa_list_init(&r->dead);
+	r->multishot = true;
+
+	spa_zero(p);
+	if ((r->fd = uring_setup(URING_ENTRIES, &p)) < 0) {
+		res = -errno;
+		goto error;
+	}
+	if (!uring_probe(r)) {
+		res = -ENOTSUP;
+		goto error;
+	}
+
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED) {
+		r->sq_ptr = NULL;
+		res = -errno;
+		goto error;
+	}
+	r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	if (r->cq_ptr == MAP_FAILED) {
+		r->cq_ptr = NULL;
+		res = -errno;
+		goto error;
+	}
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		res = -errno;
+		goto error;
+	}
+
+	r->ext_arg = (p.features & IORING_FEAT_EXT_ARG) != 0;
+
+	r->sq_head = SPA_MEMBER(r->sq_ptr, p.sq_off.head, uint32_t);
+	r->sq_tail = SPA_MEMBER(r->sq_ptr, p.sq_off.tail, uint32_t);
+	r->sq_mask = SPA_MEMBER(r->sq_ptr, p.sq_off.ring_mask, uint32_t);
+	r->sq_array = SPA_MEMBER(r->sq_ptr, p.sq_off.array, uint32_t);
+	r->sq_entries = p.sq_entries;
+	r->sq_local = *r->sq_tail;
+
+	r->cq_head = SPA_MEMBER(r->cq_ptr, p.cq_off.head, uint32_t);
+	r->cq_tail = SPA_MEMBER(r->cq_ptr, p.cq_off.tail, uint32_t);
+	r->cq_mask = SPA_MEMBER(r->cq_ptr, p.cq_off.ring_mask, uint32_t);
+	r->cqes = SPA_MEMBER(r->cq_ptr, p.cq_off.cqes, struct io_uring_cqe);
+
+	impl->ring = r;
+
+	return 0;
+
+      error:
+	uring_free(r);
+	return res;
+}
+#endif
+
 static int loop_add_source(struct spa_loop *loop, struct spa_source *source)
 {
 	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
 
 	source->loop = loop;
 
+#ifdef HAVE_IO_URING
+	if (impl->uring)
+		return source->fd != -1 ? uring_add_source(impl, source) : 0;
+#endif
 	if (source->fd != -1) {
 		struct epoll_event ep;
 
@@ -167,6 +1061,10 @@ static int loop_update_source(struct spa_source *source)
 	struct spa_loop *loop = source->loop;
 	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
 
+#ifdef HAVE_IO_URING
+	if (impl->uring)
+		return source->fd != -1 ? uring_update_source(impl, source) : 0;
+#endif
 	if (source->fd != -1) {
 		struct epoll_event ep;
 
@@ -185,12 +1083,77 @@ static void loop_remove_source(struct spa_source *source)
 	struct spa_loop *loop = source->loop;
 	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
 
+#ifdef HAVE_IO_URING
+	if (impl->uring)
+		uring_remove_source(impl, source);
+	else
+#endif
 	if (source->fd != -1)
 		epoll_ctl(impl->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
 
+	stats_remove(impl, source);
+
 	source->loop = NULL;
 }
 
+static struct invoke_slot *queue_acquire(struct impl *impl, size_t size)
+{
+	struct invoke_slot *slot;
+	uint32_t pos, seq;
+	int32_t diff;
+
+	if (size > sizeof(slot->data))
+		return NULL;
+
+	pos = __atomic_load_n(&impl->tail, __ATOMIC_RELAXED);
+	while (true) {
+		slot = &impl->slots[pos & MASK_SLOTS];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (int32_t) (seq - pos);
+
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&impl->tail, &pos, pos + 1, true,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				return slot;
+		} else if (diff < 0) {
+			/* queue full */
+			return NULL;
+		} else {
+			pos = __atomic_load_n(&impl->tail, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static void queue_release(struct invoke_slot *slot)
+{
+	uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+	/* slot is now filled for the consumer */
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/* add an item that is too large for a slot or that doesn't fit in the full
+ * queue. The queue stays usable for the other items. */
+static int queue_overflow(struct impl *impl, struct invoke_item *item, const void *data)
+{
+	struct overflow_item *o;
+
+	if ((o = malloc(sizeof(struct overflow_item) + item->size)) == NULL)
+		return -errno;
+
+	o->item = *item;
+	o->item.data = o->data;
+	if (item->size > 0)
+		memcpy(o->data, data, item->size);
+
+	pthread_mutex_lock(&impl->lock);
+	o->pos = __atomic_load_n(&impl->tail, __ATOMIC_ACQUIRE);
+	spa_list_append(&impl->overflow_list, &o->link);
+	__atomic_add_fetch(&impl->n_overflow, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&impl->lock);
+
+	return 0;
+}
+
 static int
 loop_invoke(struct spa_loop *loop,
 	    spa_invoke_func_t func,
@@ -202,91 +1165,118 @@ loop_invoke(struct spa_loop *loop,
 {
 	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
 	bool in_thread = pthread_equal(impl->thread, pthread_self());
-	struct invoke_item *item;
+	struct invoke_sync sync = { false, 0 };
+	struct invoke_item item;
+	struct invoke_slot *slot;
 	int res;
 
-	if (in_thread) {
-		res = func(loop, false, seq, data, size, user_data);
-	} else {
-		int32_t filled, avail;
-		uint32_t idx, offset, l0;
+	if (in_thread)
+		return func(loop, false, seq, data, size, user_data);
+
+	item.func = func;
+	item.seq = seq;
+	item.size = size;
+	item.user_data = user_data;
+	item.sync = block ? &sync : NULL;
+
+	if ((slot = queue_acquire(impl, size)) != NULL) {
+		item.data = slot->data;
+		if (size > 0)
+			memcpy(slot->data, data, size);
+		slot->item = item;
+		queue_release(slot);
+	}
+	else if ((res = queue_overflow(impl, &item, data)) < 0)
+		return res;
 
-		filled = spa_ringbuffer_get_write_index(&impl->buffer, &idx);
-		if (filled < 0 || filled > DATAS_SIZE) {
-			spa_log_warn(impl->log, NAME " %p: queue xrun %d", impl, filled);
-			return -EPIPE;
-		}
-		avail = DATAS_SIZE - filled;
-		if (avail < sizeof(struct invoke_item)) {
-			spa_log_warn(impl->log, NAME " %p: queue full %d", impl, avail);
-			return -EPIPE;
-		}
-		offset = idx & (DATAS_SIZE - 1);
-
-		l0 = DATAS_SIZE - offset;
-
-		item = SPA_MEMBER(impl->buffer_data, offset, struct invoke_item);
-		item->func = func;
-		item->seq = seq;
-		item->size = size;
-		item->block = block;
-		item->user_data = user_data;
-
-		if (l0 > sizeof(struct invoke_item) + size) {
-			item->data = SPA_MEMBER(item, sizeof(struct invoke_item), void);
-			item->item_size = sizeof(struct invoke_item) + size;
-			if (l0 < sizeof(struct invoke_item) + item->item_size)
-				item->item_size = l0;
-		} else {
-			item->data = impl->buffer_data;
-			item->item_size = l0 + size;
-		}
-		memcpy(item->data, data, size);
+	spa_loop_utils_signal_event(&impl->utils, impl->wakeup);
 
-		spa_ringbuffer_write_update(&impl->buffer, idx + item->item_size);
+	if (block) {
+		spa_loop_control_hook_before(&impl->hooks_list);
 
-		spa_loop_utils_signal_event(&impl->utils, impl->wakeup);
+		pthread_mutex_lock(&impl->lock);
+		while (!sync.done)
+			pthread_cond_wait(&impl->cond, &impl->lock);
+		pthread_mutex_unlock(&impl->lock);
 
-		if (block) {
-			uint64_t count = 1;
+		spa_loop_control_hook_after(&impl->hooks_list);
 
-			spa_loop_control_hook_before(&impl->hooks_list);
+		res = sync.res;
+	}
+	else {
+		if (seq != SPA_ID_INVALID)
+			res = SPA_RESULT_RETURN_ASYNC(seq);
+		else
+			res = 0;
+	}
+	return res;
+}
 
-			if (read(impl->ack_fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
-				spa_log_warn(impl->log, NAME " %p: failed to read event fd: %s",
-						impl, strerror(errno));
+static void invoke_item(struct impl *impl, struct invoke_item *item)
+{
+	int res;
 
-			spa_loop_control_hook_after(&impl->hooks_list);
+	res = item->func(&impl->loop, true, item->seq, item->data, item->size,
+			 item->user_data);
 
-			res = item->res;
-		}
-		else {
-			if (seq != SPA_ID_INVALID)
-				res = SPA_RESULT_RETURN_ASYNC(seq);
-			else
-				res = 0;
+	if (item->sync) {
+		pthread_mutex_lock(&impl->lock);
+		item->sync->res = res;
+		item->sync->done = true;
+		pthread_cond_broadcast(&impl->cond);
+		pthread_mutex_unlock(&impl->lock);
+	}
+}
+
+/* invoke the overflow items that were added before the slot at pos */
+static void process_overflow(struct impl *impl, uint32_t pos)
+{
+	struct overflow_item *o, *t;
+	struct spa_list list;
+
+	spa_list_init(&list);
+	pthread_mutex_lock(&impl->lock);
+	spa_list_for_each_safe(o, t, &impl->overflow_list, link) {
+		if ((int32_t) (o->pos - pos) <= 0) {
+			spa_list_remove(&o->link);
+			spa_list_append(&list, &o->link);
 		}
 	}
-	return res;
+	pthread_mutex_unlock(&impl->lock);
+
+	spa_list_consume(o, &list, link) {
+		spa_list_remove(&o->link);
+		invoke_item(impl, &o->item);
+		free(o);
+		__atomic_sub_fetch(&impl->n_overflow, 1, __ATOMIC_RELEASE);
+	}
 }
 
 static void wakeup_func(void *data, uint64_t count)
 {
 	struct impl *impl = data;
-	uint32_t index;
-	while (spa_ringbuffer_get_read_index(&impl->buffer, &index) > 0) {
-		struct invoke_item *item =
-		    SPA_MEMBER(impl->buffer_data, index & (DATAS_SIZE - 1), struct invoke_item);
-		item->res = item->func(&impl->loop, true, item->seq, item->data, item->size,
-			   item->user_data);
-		spa_ringbuffer_read_update(&impl->buffer, index + item->item_size);
-
-		if (item->block) {
-			uint64_t count = 1;
-			if (write(impl->ack_fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
-				spa_log_warn(impl->log, NAME " %p: failed to write event fd: %s",
-						impl, strerror(errno));
-		}
+	struct invoke_slot *slot;
+
+	while (true) {
+		uint32_t pos = impl->head;
+		bool filled;
+
+		slot = &impl->slots[pos & MASK_SLOTS];
+		filled = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == pos + 1;
+
+		/* check after the slot, an item that was added to the overflow
+		 * list before the slot was filled is seen now */
+		if (__atomic_load_n(&impl->n_overflow, __ATOMIC_ACQUIRE) > 0)
+			process_overflow(impl, pos);
+
+		if (!filled)
+			break;
+
+		invoke_item(impl, &slot->item);
+
+		impl->head = pos + 1;
+		/* slot is free again for the producer one round later */
+		__atomic_store_n(&slot->seq, pos + N_SLOTS, __ATOMIC_RELEASE);
 	}
 }
 
@@ -294,6 +1284,10 @@ static int loop_get_fd(struct spa_loop_control *ctrl)
 {
 	struct impl *impl = SPA_CONTAINER_OF(ctrl, struct impl, control);
 
+#ifdef HAVE_IO_URING
+	if (impl->uring)
+		return impl->ring->fd;
+#endif
 	return impl->epoll_fd;
 }
 
@@ -334,7 +1328,15 @@ static int loop_iterate(struct spa_loop_control *ctrl, int timeout)
 	struct spa_loop *loop = &impl->loop;
 	struct epoll_event ep[32];
 	int i, nfds, save_errno = 0;
+	uint64_t ref;
 
+#ifdef HAVE_IO_URING
+	if (impl->uring) {
+		int res = uring_iterate(impl, timeout);
+		process_destroy(impl);
+		return res;
+	}
+#endif
 	spa_loop_control_hook_before(&impl->hooks_list);
 
 	if (SPA_UNLIKELY((nfds = epoll_wait(impl->epoll_fd, ep, SPA_N_ELEMENTS(ep), timeout)) < 0))
@@ -345,6 +1347,8 @@ static int loop_iterate(struct spa_loop_control *ctrl, int timeout)
 	if (SPA_UNLIKELY(nfds < 0))
 		return save_errno;
 
+	ref = stats_wakeup(impl);
+
 	/* first we set all the rmasks, then call the callbacks. The reason is that
 	 * some callback might also want to look at other sources it manages and
 	 * can then reset the rmask to suppress the callback */
@@ -355,7 +1359,7 @@ static int loop_iterate(struct spa_loop_control *ctrl, int timeout)
 	for (i = 0; i < nfds; i++) {
 		struct spa_source *s = ep[i].data.ptr;
 		if (s->rmask && s->fd != -1 && s->loop == loop)
-			s->func(s);
+			dispatch_source(impl, s, ref);
 	}
 	process_destroy(impl);
 
@@ -461,7 +1465,10 @@ static void source_event_func(struct spa_source *source)
 	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
 	uint64_t count;
 
-	if (read(source->fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
+	/* the io_uring backend read the counter already */
+	if (impl->impl->uring)
+		count = impl->count;
+	else if (read(source->fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
 		spa_log_warn(impl->impl->log, NAME " %p: failed to read event fd %d: %s",
 				source, source->fd, strerror(errno));
 
@@ -504,16 +1511,207 @@ static void loop_signal_event(struct spa_source *source)
 				source, source->fd, strerror(errno));
 }
 
-static void source_timer_func(struct spa_source *source)
+static inline uint64_t wheel_arm_time(struct wheel *w, uint64_t expire)
 {
-	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
-	uint64_t expirations;
+	if (w->slack == 0)
+		return expire;
+	/* align to the slack so that timers of other loops can be merged as well */
+	return ((expire + w->slack) / w->slack) * w->slack;
+}
 
-	if (read(source->fd, &expirations, sizeof(uint64_t)) != sizeof(uint64_t))
-		spa_log_warn(impl->impl->log, NAME " %p: failed to read timer fd %d: %s",
-				source, source->fd, strerror(errno));
+static void wheel_arm(struct impl *impl, uint64_t time)
+{
+	struct wheel *w = &impl->wheel;
+	struct itimerspec its;
+
+	if (time == w->armed)
+		return;
+
+	spa_zero(its);
+	its.it_value.tv_sec = time / SPA_NSEC_PER_SEC;
+	its.it_value.tv_nsec = time % SPA_NSEC_PER_SEC;
+	if (timerfd_settime(w->source->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		spa_log_warn(impl->log, NAME " %p: failed to arm timer fd: %s",
+				impl, strerror(errno));
+		return;
+	}
+	w->armed = time;
+}
+
+static void wheel_insert(struct impl *impl, struct source_impl *t)
+{
+	struct wheel *w = &impl->wheel;
+	uint64_t tick, val, max;
+	uint32_t l, shift;
+
+	tick = SPA_MAX(t->expire >> WHEEL_TICK_SHIFT, w->now);
+
+	for (l = 0; l < WHEEL_LEVELS - 1; l++) {
+		shift = WHEEL_BITS * (l + 1);
+		if ((tick >> shift) == (w->now >> shift))
+			break;
+	}
+	shift = WHEEL_BITS * l;
+	val = tick >> shift;
+	/* timers beyond the range of the wheel wait in the last slot */
+	max = (w->now >> shift) + WHEEL_MASK;
+	if (val > max)
+		val = max;
+
+	t->level = l;
+	t->slot = val & WHEEL_MASK;
+	t->queued = true;
+	spa_list_append(&w->slots[l][t->slot], &t->timer_link);
+	w->bitmap[l] |= (1ULL << t->slot);
+}
 
-	impl->func.timer(source->data, expirations);
+static void wheel_remove(struct impl *impl, struct source_impl *t)
+{
+	struct wheel *w = &impl->wheel;
+
+	if (!t->queued)
+		return;
+
+	spa_list_remove(&t->timer_link);
+	t->queued = false;
+	if (spa_list_is_empty(&w->slots[t->level][t->slot]))
+		w->bitmap[t->level] &= ~(1ULL << t->slot);
+}
+
+/* the earliest expiration time, 0 when no timers are active */
+static uint64_t wheel_next(struct wheel *w)
+{
+	struct source_impl *t;
+	uint64_t bm, next = 0;
+	uint32_t l, start, slot;
+
+	for (l = 0; l < WHEEL_LEVELS; l++) {
+		if ((bm = w->bitmap[l]) == 0)
+			continue;
+
+		/* first non-empty slot, counting from the current one */
+		start = (w->now >> (WHEEL_BITS * l)) & WHEEL_MASK;
+		if (start > 0)
+			bm = (bm >> start) | (bm << (WHEEL_SIZE - start));
+		slot = (start + __builtin_ctzll(bm)) & WHEEL_MASK;
+
+		spa_list_for_each(t, &w->slots[l][slot], timer_link)
+			if (next == 0 || t->expire < next)
+				next = t->expire;
+		break;
+	}
+	return next;
+}
+
+static void wheel_drain(struct wheel *w, uint32_t level, uint64_t from, uint64_t n,
+		struct spa_list *list)
+{
+	uint64_t i;
+
+	for (i = 0; i < SPA_MIN(n, (uint64_t)WHEEL_SIZE); i++) {
+		uint32_t slot = (from + i) & WHEEL_MASK;
+		struct spa_list *l = &w->slots[level][slot];
+
+		if (spa_list_is_empty(l))
+			continue;
+		spa_list_insert_list(list->prev, l);
+		spa_list_init(l);
+		w->bitmap[level] &= ~(1ULL << slot);
+	}
+}
+
+/* advance the wheel to now and collect the expired timers */
+static void wheel_advance(struct impl *impl, uint64_t now, struct spa_list *expired)
+{
+	struct wheel *w = &impl->wheel;
+	struct spa_list list;
+	struct source_impl *t;
+	uint64_t old = w->now, new = now >> WHEEL_TICK_SHIFT;
+	uint32_t l;
+
+	spa_list_init(&list);
+
+	/* the windows that were entered since the last run move down */
+	for (l = WHEEL_LEVELS - 1; l > 0; l--) {
+		uint64_t from = (old >> (WHEEL_BITS * l)) + 1;
+		uint64_t to = new >> (WHEEL_BITS * l);
+		if (to >= from)
+			wheel_drain(w, l, from, to - from + 1, &list);
+	}
+	/* the last tick is checked again, it can have timers that did not expire */
+	wheel_drain(w, 0, old, new - old + 1, &list);
+
+	w->now = new;
+
+	spa_list_consume(t, &list, timer_link) {
+		spa_list_remove(&t->timer_link);
+		t->queued = false;
+		if (t->expire <= now) {
+			spa_list_append(expired, &t->timer_link);
+			t->queued = true;
+			t->level = 0;
+			t->slot = new & WHEEL_MASK;
+		} else {
+			wheel_insert(impl, t);
+		}
+	}
+}
+
+static void wheel_func(void *data, int fd, enum spa_io mask)
+{
+	struct impl *impl = data;
+	struct wheel *w = &impl->wheel;
+	struct spa_list expired;
+	struct source_impl *t;
+	uint64_t count, now, next, expire;
+	bool stats = stats_enabled(impl);
+
+	pthread_mutex_lock(&w->lock);
+
+	/* the timerfd is one-shot, it is not armed anymore */
+	if (read(fd, &count, sizeof(uint64_t)) != sizeof(uint64_t) && errno != EAGAIN)
+		spa_log_warn(impl->log, NAME " %p: failed to read timer fd %d: %s",
+				impl, fd, strerror(errno));
+	w->armed = 0;
+
+	now = get_time_ns();
+	spa_list_init(&expired);
+	wheel_advance(impl, now, &expired);
+
+	/* the callbacks can update and destroy any timer, also the expired ones */
+	while (!spa_list_is_empty(&expired)) {
+		t = spa_list_first(&expired, struct source_impl, timer_link);
+		spa_list_remove(&t->timer_link);
+		t->queued = false;
+
+		expire = t->expire;
+		t->count = 1;
+		if (t->interval > 0) {
+			t->count += (now - t->expire) / t->interval;
+			t->expire += t->count * t->interval;
+			wheel_insert(impl, t);
+		} else {
+			t->expire = 0;
+		}
+		pthread_mutex_unlock(&w->lock);
+
+		if (SPA_UNLIKELY(stats))
+			dispatch_stats(impl, &t->source, expire);
+		else
+			t->source.func(&t->source);
+
+		pthread_mutex_lock(&w->lock);
+	}
+
+	if ((next = wheel_next(w)) > 0)
+		wheel_arm(impl, wheel_arm_time(w, next));
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void source_timer_func(struct spa_source *source)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+	impl->func.timer(source->data, impl->count);
 }
 
 static struct spa_source *loop_add_timer(struct spa_loop_utils *utils,
@@ -526,17 +1724,16 @@ static struct spa_source *loop_add_timer(struct spa_loop_utils *utils,
 	if (source == NULL)
 		return NULL;
 
+	/* timers don't have an fd, they are dispatched from the wheel */
 	source->source.loop = &impl->loop;
 	source->source.func = source_timer_func;
 	source->source.data = data;
-	source->source.fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	source->source.fd = -1;
 	source->source.mask = SPA_IO_IN;
 	source->impl = impl;
-	source->close = true;
+	source->close = false;
 	source->func.timer = func;
 
-	spa_loop_add_source(&impl->loop, &source->source);
-
 	spa_list_insert(&impl->source_list, &source->link);
 
 	return &source->source;
@@ -546,23 +1743,36 @@ static int
 loop_update_timer(struct spa_source *source,
 		  struct timespec *value, struct timespec *interval, bool absolute)
 {
-	struct itimerspec its;
-	int flags = 0;
+	struct source_impl *t = SPA_CONTAINER_OF(source, struct source_impl, source);
+	struct impl *impl = t->impl;
+	uint64_t expire;
 
-	spa_zero(its);
 	if (value) {
-		its.it_value = *value;
+		expire = SPA_TIMESPEC_TO_TIME(value);
 	} else if (interval) {
-		its.it_value = *interval;
+		expire = SPA_TIMESPEC_TO_TIME(interval);
 		absolute = true;
+	} else {
+		expire = 0;
 	}
-	if (interval)
-		its.it_interval = *interval;
-	if (absolute)
-		flags |= TFD_TIMER_ABSTIME;
+	if (expire > 0 && !absolute)
+		expire += get_time_ns();
+
+	pthread_mutex_lock(&impl->wheel.lock);
+	wheel_remove(impl, t);
+
+	t->expire = expire;
+	t->interval = interval ? SPA_TIMESPEC_TO_TIME(interval) : 0;
 
-	if (timerfd_settime(source->fd, flags, &its, NULL) < 0)
-		return errno;
+	if (expire > 0) {
+		wheel_insert(impl, t);
+
+		/* a later timer is picked up when the wheel runs */
+		expire = wheel_arm_time(&impl->wheel, expire);
+		if (impl->wheel.armed == 0 || expire < impl->wheel.armed)
+			wheel_arm(impl, expire);
+	}
+	pthread_mutex_unlock(&impl->wheel.lock);
 
 	return 0;
 }
@@ -621,7 +1831,14 @@ static void loop_destroy_source(struct spa_source *source)
 
 	spa_list_remove(&impl->link);
 
-	if (source->loop)
+	if (source->func == source_timer_func) {
+		pthread_mutex_lock(&impl->impl->wheel.lock);
+		wheel_remove(impl->impl, impl);
+		pthread_mutex_unlock(&impl->impl->wheel.lock);
+		stats_remove(impl->impl, source);
+		source->loop = NULL;
+	}
+	else if (source->loop)
 		spa_loop_remove_source(source->loop, source);
 
 	if (source->fd != -1 && impl->close) {
@@ -631,6 +1848,83 @@ static void loop_destroy_source(struct spa_source *source)
 	spa_list_insert(&impl->impl->destroy_list, &impl->link);
 }
 
+static int loop_stats_enable(struct spa_loop_stats *stats, bool enable)
+{
+	struct impl *impl = SPA_CONTAINER_OF(stats, struct impl, stats_iface);
+	struct stats *st = &impl->stats;
+	struct source_stats *pool;
+	uint32_t i;
+
+	if (enable && st->pool == NULL) {
+		if ((pool = calloc(STATS_POOL, sizeof(struct source_stats))) == NULL)
+			return -ENOMEM;
+
+		spa_list_init(&st->free);
+		for (i = 0; i < STATS_HASH; i++)
+			spa_list_init(&st->hash[i]);
+		for (i = 0; i < STATS_POOL; i++)
+			spa_list_append(&st->free, &pool[i].link);
+
+		__atomic_store_n(&st->pool, pool, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&st->enabled, enable, __ATOMIC_RELEASE);
+
+	spa_log_debug(impl->log, NAME " %p: stats %s", impl, enable ? "enabled" : "disabled");
+
+	return 0;
+}
+
+static int loop_stats_get_info(struct spa_loop_stats *stats, struct spa_loop_stats_info *info)
+{
+	struct impl *impl = SPA_CONTAINER_OF(stats, struct impl, stats_iface);
+
+	*info = impl->stats.info;
+	return 0;
+}
+
+static int loop_stats_enum_sources(struct spa_loop_stats *stats, uint32_t *index,
+				   struct spa_loop_source_stats *source)
+{
+	struct impl *impl = SPA_CONTAINER_OF(stats, struct impl, stats_iface);
+	struct stats *st = &impl->stats;
+	struct source_stats *ss;
+
+	spa_return_val_if_fail(index != NULL, -EINVAL);
+	spa_return_val_if_fail(source != NULL, -EINVAL);
+
+	if (st->pool == NULL)
+		return 0;
+
+	for (; *index < STATS_POOL; (*index)++) {
+		ss = &st->pool[*index];
+		if (ss->source == NULL)
+			continue;
+
+		source->source = ss->source;
+		source->func = ss->func;
+		source->count = ss->count;
+		source->total = ss->total;
+		source->max = ss->max;
+		(*index)++;
+		return 1;
+	}
+	return 0;
+}
+
+static void loop_stats_reset(struct spa_loop_stats *stats)
+{
+	struct impl *impl = SPA_CONTAINER_OF(stats, struct impl, stats_iface);
+	struct stats *st = &impl->stats;
+	uint32_t i;
+
+	spa_zero(st->info);
+	if (st->pool == NULL)
+		return;
+
+	for (i = 0; i < STATS_POOL; i++)
+		st->pool[i].count = st->pool[i].total = st->pool[i].max = 0;
+}
+
 static const struct spa_loop impl_loop = {
 	SPA_VERSION_LOOP,
 	loop_add_source,
@@ -662,6 +1956,14 @@ static const struct spa_loop_utils impl_loop_utils = {
 	loop_destroy_source,
 };
 
+static const struct spa_loop_stats impl_loop_stats = {
+	SPA_VERSION_LOOP_STATS,
+	loop_stats_enable,
+	loop_stats_get_info,
+	loop_stats_enum_sources,
+	loop_stats_reset,
+};
+
 static int impl_get_interface(struct spa_handle *handle, uint32_t interface_id, void **interface)
 {
 	struct impl *impl;
@@ -677,6 +1979,8 @@ static int impl_get_interface(struct spa_handle *handle, uint32_t interface_id,
 		*interface = &impl->control;
 	else if (interface_id == impl->type.loop_utils)
 		*interface = &impl->utils;
+	else if (interface_id == impl->type.loop_stats)
+		*interface = &impl->stats_iface;
 	else
 		return -ENOENT;
 
@@ -687,6 +1991,7 @@ static int impl_clear(struct spa_handle *handle)
 {
 	struct impl *impl;
 	struct source_impl *source;
+	struct overflow_item *o;
 
 	spa_return_val_if_fail(handle != NULL, -EINVAL);
 
@@ -697,9 +2002,24 @@ static int impl_clear(struct spa_handle *handle)
 
 	process_destroy(impl);
 
-	close(impl->ack_fd);
+#ifdef HAVE_IO_URING
+	if (impl->uring)
+		uring_free(impl->ring);
+	else
+#endif
 	close(impl->epoll_fd);
 
+	pthread_cond_destroy(&impl->cond);
+	pthread_mutex_destroy(&impl->lock);
+	pthread_mutex_destroy(&impl->wheel.lock);
+
+	free(impl->stats.pool);
+
+	spa_list_consume(o, &impl->overflow_list, link) {
+		spa_list_remove(&o->link);
+		free(o);
+	}
+
 	return 0;
 }
 
@@ -711,7 +2031,9 @@ impl_init(const struct spa_handle_factory *factory,
 	  uint32_t n_support)
 {
 	struct impl *impl;
-	uint32_t i;
+	const char *str;
+	uint32_t i, j;
+	int fd, res;
 
 	spa_return_val_if_fail(factory != NULL, -EINVAL);
 	spa_return_val_if_fail(handle != NULL, -EINVAL);
@@ -723,6 +2045,7 @@ impl_init(const struct spa_handle_factory *factory,
 	impl->loop = impl_loop;
 	impl->control = impl_loop_control;
 	impl->utils = impl_loop_utils;
+	impl->stats_iface = impl_loop_stats;
 
 	for (i = 0; i < n_support; i++) {
 		if (strcmp(support[i].type, SPA_TYPE__TypeMap) == 0)
@@ -736,20 +2059,57 @@ impl_init(const struct spa_handle_factory *factory,
 	}
 	init_type(&impl->type, impl->map);
 
-	impl->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
-	if (impl->epoll_fd == -1)
-		return errno;
+	if (info && (str = spa_dict_lookup(info, "loop.backend")) != NULL &&
+	    strcmp(str, "io_uring") == 0) {
+#ifdef HAVE_IO_URING
+		if ((res = uring_new(impl)) < 0)
+			spa_log_warn(impl->log, NAME " %p: can't use io_uring, using epoll: %s",
+					impl, strerror(-res));
+		else
+			impl->uring = true;
+#else
+		spa_log_warn(impl->log, NAME " %p: io_uring not supported, using epoll", impl);
+#endif
+	}
+	if (!impl->uring) {
+		impl->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (impl->epoll_fd == -1)
+			return -errno;
+	}
 
 	spa_list_init(&impl->source_list);
 	spa_list_init(&impl->destroy_list);
 	spa_hook_list_init(&impl->hooks_list);
 
-	spa_ringbuffer_init(&impl->buffer);
+	spa_list_init(&impl->overflow_list);
+	pthread_mutex_init(&impl->lock, NULL);
+	pthread_cond_init(&impl->cond, NULL);
+
+	for (i = 0; i < N_SLOTS; i++)
+		impl->slots[i].seq = i;
+	impl->head = impl->tail = 0;
 
 	impl->wakeup = spa_loop_utils_add_event(&impl->utils, wakeup_func, impl);
-	impl->ack_fd = eventfd(0, EFD_SEMAPHORE | EFD_CLOEXEC);
 
-	spa_log_debug(impl->log, NAME " %p: initialized", impl);
+	for (i = 0; i < WHEEL_LEVELS; i++)
+		for (j = 0; j < WHEEL_SIZE; j++)
+			spa_list_init(&impl->wheel.slots[i][j]);
+	pthread_mutex_init(&impl->wheel.lock, NULL);
+	impl->wheel.now = get_time_ns() >> WHEEL_TICK_SHIFT;
+	if (info && (str = spa_dict_lookup(info, "loop.timer-slack")) != NULL)
+		impl->wheel.slack = strtoull(str, NULL, 10);
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fd == -1) {
+		res = -errno;
+		impl_clear(handle);
+		return res;
+	}
+	impl->wheel.source = spa_loop_utils_add_io(&impl->utils, fd, SPA_IO_IN, true,
+			wheel_func, impl);
+
+	spa_log_debug(impl->log, NAME " %p: initialized with %s", impl,
+			impl->uring ? "io_uring" : "epoll");
 
 	return 0;
 }
@@ -758,6 +2118,7 @@ static const struct spa_interface_info impl_interfaces[] = {
 	{SPA_TYPE__Loop,},
 	{SPA_TYPE__LoopControl,},
 	{SPA_TYPE__LoopUtils,},
+	{SPA_TYPE__LoopStats,},
 };
 
 static int
@@ -26,9 +26,27 @@
 
 #include <spa/support/type-map.h>
 #include <spa/support/plugin.h>
+#include <spa/support/log.h>
+#include <spa/support/loop.h>
+#include <spa/support/dbus.h>
+#include <spa/node/node.h>
+#include <spa/node/io.h>
+#include <spa/node/command.h>
+#include <spa/node/event.h>
+#include <spa/clock/clock.h>
+#include <spa/monitor/monitor.h>
+#include <spa/buffer/buffer.h>
+#include <spa/param/param.h>
+#include <spa/param/format.h>
+#include <spa/param/props.h>
+#include <spa/param/buffers.h>
+#include <spa/param/meta.h>
+#include <spa/param/io.h>
 
 #define NAME "mapper"
 
+#define MIN_BUCKETS	256
+
 struct type {
 	uint32_t type_map;
 };
@@ -38,6 +56,89 @@ static inline void init_type(struct type *type, struct spa_type_map *map)
 	type->type_map = spa_type_map_get_id(map, SPA_TYPE__TypeMap);
 }
 
+/* well-known types, registered first so that they get the same ids in
+ * every map */
+static const char * const static_types[] = {
+	SPA_TYPE__TypeMap,
+	SPA_TYPE__Log,
+	SPA_TYPE__Loop,
+	SPA_TYPE__LoopControl,
+	SPA_TYPE__LoopUtils,
+	SPA_TYPE__LoopStats,
+	SPA_TYPE__DBus,
+	SPA_TYPE__Node,
+	SPA_TYPE__Clock,
+	SPA_TYPE__Monitor,
+	SPA_TYPE__POD,
+	SPA_TYPE_POD__Object,
+	SPA_TYPE_POD__Struct,
+	SPA_TYPE__Param,
+	SPA_TYPE__ParamId,
+	SPA_TYPE_PARAM_ID__List,
+	SPA_TYPE_PARAM_ID__PropInfo,
+	SPA_TYPE_PARAM_ID__Props,
+	SPA_TYPE_PARAM_ID__EnumFormat,
+	SPA_TYPE_PARAM_ID__Format,
+	SPA_TYPE_PARAM_ID__Buffers,
+	SPA_TYPE_PARAM_ID__Meta,
+	SPA_TYPE_PARAM_ID__IO,
+	SPA_TYPE_PARAM__List,
+	SPA_TYPE_PARAM_LIST__id,
+	SPA_TYPE_PARAM__PropInfo,
+	SPA_TYPE_PARAM__Buffers,
+	SPA_TYPE_PARAM_BUFFERS__size,
+	SPA_TYPE_PARAM_BUFFERS__stride,
+	SPA_TYPE_PARAM_BUFFERS__buffers,
+	SPA_TYPE_PARAM_BUFFERS__align,
+	SPA_TYPE_PARAM__Meta,
+	SPA_TYPE_PARAM_META__type,
+	SPA_TYPE_PARAM_META__size,
+	SPA_TYPE_PARAM__IO,
+	SPA_TYPE_PARAM_IO__id,
+	SPA_TYPE_PARAM_IO__size,
+	SPA_TYPE__Format,
+	SPA_TYPE__Props,
+	SPA_TYPE__IO,
+	SPA_TYPE_IO__Buffers,
+	SPA_TYPE_IO__Control,
+	SPA_TYPE_IO__Prop,
+	SPA_TYPE_IO__Ringbuffer,
+	SPA_TYPE__Meta,
+	SPA_TYPE_META__Header,
+	SPA_TYPE_META__VideoCrop,
+	SPA_TYPE_META__Bitmap,
+	SPA_TYPE_META__Cursor,
+	SPA_TYPE__Buffer,
+	SPA_TYPE__Data,
+	SPA_TYPE_DATA__MemPtr,
+	SPA_TYPE_DATA__Fd,
+	SPA_TYPE_DATA_FD__MemFd,
+	SPA_TYPE_DATA_FD__DmaBuf,
+	SPA_TYPE_COMMAND__Node,
+	SPA_TYPE_COMMAND_NODE__Suspend,
+	SPA_TYPE_COMMAND_NODE__Pause,
+	SPA_TYPE_COMMAND_NODE__Start,
+	SPA_TYPE_COMMAND_NODE__Enable,
+	SPA_TYPE_COMMAND_NODE__Disable,
+	SPA_TYPE_COMMAND_NODE__Flush,
+	SPA_TYPE_COMMAND_NODE__Drain,
+	SPA_TYPE_COMMAND_NODE__Marker,
+	SPA_TYPE_COMMAND_NODE__ClockUpdate,
+	SPA_TYPE_EVENT__Node,
+	SPA_TYPE_EVENT_NODE__Error,
+	SPA_TYPE_EVENT_NODE__Buffering,
+	SPA_TYPE_EVENT_NODE__RequestRefresh,
+	SPA_TYPE_EVENT_NODE__RequestClockUpdate,
+	SPA_TYPE__MediaType,
+	SPA_TYPE_MEDIA_TYPE__audio,
+	SPA_TYPE_MEDIA_TYPE__video,
+	SPA_TYPE_MEDIA_TYPE__image,
+	SPA_TYPE_MEDIA_TYPE__binary,
+	SPA_TYPE_MEDIA_TYPE__stream,
+	SPA_TYPE__MediaSubtype,
+	SPA_TYPE_MEDIA_SUBTYPE__raw,
+};
+
 struct array {
 	size_t size;
 	size_t maxsize;
@@ -52,6 +153,10 @@ struct impl {
 
 	struct array types;
 	struct array strings;
+
+	/* open addressing index of id + 1, 0 is an empty bucket */
+	uint32_t *buckets;
+	uint32_t n_buckets;
 };
 
 static inline void * alloc_size(struct array *array, size_t size, size_t extend)
@@ -66,32 +171,87 @@ static inline void * alloc_size(struct array *array, size_t size, size_t extend)
 	return res;
 }
 
+static inline uint32_t hash_type(const char *type, size_t *len)
+{
+	const unsigned char *p;
+	uint32_t hash = 2166136261u;
+
+	for (p = (const unsigned char *) type; *p; p++)
+		hash = (hash ^ *p) * 16777619u;
+	*len = (const char *) p - type;
+	return hash;
+}
+
+static inline const char *get_type(struct impl *impl, uint32_t id)
+{
+	off_t o = ((off_t *)impl->types.data)[id];
+	return SPA_MEMBER(impl->strings.data, o, char);
+}
+
+static void insert_bucket(uint32_t *buckets, uint32_t n_buckets, uint32_t hash, uint32_t id)
+{
+	uint32_t i;
+
+	for (i = hash & (n_buckets - 1); buckets[i] != 0; i = (i + 1) & (n_buckets - 1));
+	buckets[i] = id + 1;
+}
+
+static int rehash(struct impl *impl, uint32_t n_buckets)
+{
+	uint32_t *buckets, i, n_types = impl->types.size / sizeof(off_t);
+	size_t len;
+
+	buckets = calloc(n_buckets, sizeof(uint32_t));
+	if (buckets == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < n_types; i++)
+		insert_bucket(buckets, n_buckets, hash_type(get_type(impl, i), &len), i);
+
+	free(impl->buckets);
+	impl->buckets = buckets;
+	impl->n_buckets = n_buckets;
+
+	return 0;
+}
+
 static uint32_t
 impl_type_map_get_id(struct spa_type_map *map, const char *type)
 {
 	struct impl *impl = SPA_CONTAINER_OF(map, struct impl, map);
-	uint32_t i, len;
+	uint32_t i, id, hash, n_types;
+	size_t len;
 	void *p;
-	off_t o, *off;
+	off_t *off;
 
 	if (type == NULL)
 		return SPA_ID_INVALID;
 
-	for (i = 0; i < impl->types.size / sizeof(off_t); i++) {
-		o = ((off_t *)impl->types.data)[i];
-		if (strcmp(SPA_MEMBER(impl->strings.data, o, char), type) == 0)
-			return i;
+	hash = hash_type(type, &len);
+
+	for (i = hash & (impl->n_buckets - 1); (id = impl->buckets[i]) != 0;
+	     i = (i + 1) & (impl->n_buckets - 1)) {
+		if (strcmp(get_type(impl, id - 1), type) == 0)
+			return id - 1;
+	}
+
+	/* keep the load factor under 1/2 */
+	n_types = impl->types.size / sizeof(off_t);
+	if ((n_types + 1) * 2 > impl->n_buckets) {
+		if (rehash(impl, impl->n_buckets * 2) < 0)
+			return SPA_ID_INVALID;
 	}
-	len = strlen(type);
-	p = alloc_size(&impl->strings, len+1, 1024);
+
+	p = alloc_size(&impl->strings, len + 1, 1024);
 	memcpy(p, type, len + 1);
 
 	off = alloc_size(&impl->types, sizeof(off_t), 128);
 	*off = SPA_PTRDIFF(p, impl->strings.data);
-	i = SPA_PTRDIFF(off, impl->types.data) / sizeof(off_t);
+	id = SPA_PTRDIFF(off, impl->types.data) / sizeof(off_t);
 
-	return i;
+	insert_bucket(impl->buckets, impl->n_buckets, hash, id);
 
+	return id;
 }
 
 static const char *
@@ -99,10 +259,8 @@ impl_type_map_get_type(const struct spa_type_map *map, uint32_t id)
 {
 	struct impl *impl = SPA_CONTAINER_OF(map, struct impl, map);
 
-	if (id < impl->types.size / sizeof(off_t)) {
-		off_t o = ((off_t *)impl->types.data)[id];
-		return SPA_MEMBER(impl->strings.data, o, char);
-	}
+	if (id < impl->types.size / sizeof(off_t))
+		return get_type(impl, id);
 	return NULL;
 }
 
@@ -150,6 +308,7 @@ static int impl_clear(struct spa_handle *handle)
 		free(impl->types.data);
 	if (impl->strings.data)
 		free(impl->strings.data);
+	free(impl->buckets);
 
 	return 0;
 }
@@ -162,6 +321,8 @@ impl_init(const struct spa_handle_factory *factory,
 	  uint32_t n_support)
 {
 	struct impl *impl;
+	uint32_t i;
+	int res;
 
 	spa_return_val_if_fail(factory != NULL, -EINVAL);
 	spa_return_val_if_fail(handle != NULL, -EINVAL);
@@ -173,6 +334,12 @@ impl_init(const struct spa_handle_factory *factory,
 
 	impl->map = impl_type_map;
 
+	if ((res = rehash(impl, MIN_BUCKETS)) < 0)
+		return res;
+
+	for (i = 0; i < SPA_N_ELEMENTS(static_types); i++)
+		spa_type_map_get_id(&impl->map, static_types[i]);
+
 	init_type(&impl->type, &impl->map);
 
 	return 0;
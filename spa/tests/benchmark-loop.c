@@ -0,0 +1,277 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <spa/support/log-impl.h>
+#include <spa/support/loop.h>
+#include <spa/support/type-map-impl.h>
+#include <spa/support/plugin.h>
+
+static SPA_TYPE_MAP_IMPL(default_map, 4096);
+static SPA_LOG_IMPL(default_log);
+
+#define MAX_SOURCES	1024
+
+struct loop {
+	struct spa_handle *handle;
+	struct spa_loop *loop;
+	struct spa_loop_control *control;
+	struct spa_loop_utils *utils;
+};
+
+struct data {
+	struct spa_type_map *map;
+	struct spa_log *log;
+	struct spa_support support[2];
+	uint32_t n_support;
+
+	void *hnd;
+	const struct spa_handle_factory *factory;
+
+	const char *backend;
+	int n_sources;
+	int iterations;
+
+	struct loop loops[2];
+	struct spa_source *events[MAX_SOURCES];
+	struct spa_source *ping;
+	struct spa_source *pong;
+	uint64_t count;
+	bool running;
+};
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * SPA_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int load_factory(struct data *data, const char *lib, const char *name)
+{
+	spa_handle_factory_enum_func_t enum_func;
+	uint32_t i;
+	int res;
+
+	if ((data->hnd = dlopen(lib, RTLD_NOW)) == NULL) {
+		printf("can't load %s: %s\n", lib, dlerror());
+		return -errno;
+	}
+	if ((enum_func = dlsym(data->hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
+		printf("can't find enum function\n");
+		return -errno;
+	}
+	for (i = 0;;) {
+		const struct spa_handle_factory *factory;
+
+		if ((res = enum_func(&factory, &i)) <= 0) {
+			if (res != 0)
+				printf("can't enumerate factories: %s\n", spa_strerror(res));
+			break;
+		}
+		if (strcmp(factory->name, name) == 0) {
+			data->factory = factory;
+			return 0;
+		}
+	}
+	return -ENOENT;
+}
+
+static int make_loop(struct data *data, struct loop *l)
+{
+	struct spa_dict_item items[1];
+	struct spa_dict info = SPA_DICT_INIT(items, 1);
+	int res;
+
+	items[0] = SPA_DICT_ITEM_INIT("loop.backend", data->backend);
+
+	l->handle = calloc(1, data->factory->size);
+	if ((res = spa_handle_factory_init(data->factory, l->handle, &info,
+					   data->support, data->n_support)) < 0) {
+		printf("can't make factory instance: %d\n", res);
+		return res;
+	}
+	if ((res = spa_handle_get_interface(l->handle,
+				spa_type_map_get_id(data->map, SPA_TYPE__Loop),
+				(void **)&l->loop)) < 0)
+		return res;
+	if ((res = spa_handle_get_interface(l->handle,
+				spa_type_map_get_id(data->map, SPA_TYPE__LoopControl),
+				(void **)&l->control)) < 0)
+		return res;
+	if ((res = spa_handle_get_interface(l->handle,
+				spa_type_map_get_id(data->map, SPA_TYPE__LoopUtils),
+				(void **)&l->utils)) < 0)
+		return res;
+
+	spa_loop_control_enter(l->control);
+	return 0;
+}
+
+static void free_loop(struct loop *l)
+{
+	spa_loop_control_leave(l->control);
+	spa_handle_clear(l->handle);
+	free(l->handle);
+}
+
+static void on_event(void *_data, uint64_t count)
+{
+	struct data *data = _data;
+	data->count++;
+}
+
+/* signal all event sources and iterate until all of them are dispatched */
+static void run_events(struct data *data)
+{
+	struct loop *l = &data->loops[0];
+	uint64_t start, elapsed, total;
+	int i, j;
+
+	for (i = 0; i < data->n_sources; i++)
+		data->events[i] = spa_loop_utils_add_event(l->utils, on_event, data);
+
+	data->count = 0;
+	start = get_time();
+	for (i = 0; i < data->iterations; i++) {
+		for (j = 0; j < data->n_sources; j++)
+			spa_loop_utils_signal_event(l->utils, data->events[j]);
+		while (data->count < (uint64_t)(i + 1) * data->n_sources)
+			spa_loop_control_iterate(l->control, -1);
+	}
+	elapsed = get_time() - start;
+	total = (uint64_t)data->iterations * data->n_sources;
+
+	printf("%s events: %d sources, %d rounds: %"PRIu64" ns/round %"PRIu64" ns/event\n",
+			data->backend, data->n_sources, data->iterations,
+			elapsed / data->iterations, elapsed / total);
+
+	for (i = 0; i < data->n_sources; i++)
+		spa_loop_utils_destroy_source(l->utils, data->events[i]);
+}
+
+static void on_ping(void *_data, uint64_t count)
+{
+	struct data *data = _data;
+	spa_loop_utils_signal_event(data->loops[0].utils, data->pong);
+}
+
+static void on_pong(void *_data, uint64_t count)
+{
+	struct data *data = _data;
+	if (++data->count < (uint64_t)data->iterations)
+		spa_loop_utils_signal_event(data->loops[1].utils, data->ping);
+}
+
+static void *ping_thread(void *_data)
+{
+	struct data *data = _data;
+	struct loop *l = &data->loops[1];
+
+	spa_loop_control_enter(l->control);
+	while (data->running)
+		spa_loop_control_iterate(l->control, 10);
+	spa_loop_control_leave(l->control);
+
+	return NULL;
+}
+
+/* bounce an event between two loops in different threads */
+static void run_pingpong(struct data *data)
+{
+	pthread_t thread;
+	uint64_t start, elapsed;
+
+	data->ping = spa_loop_utils_add_event(data->loops[1].utils, on_ping, data);
+	data->pong = spa_loop_utils_add_event(data->loops[0].utils, on_pong, data);
+
+	data->running = true;
+	pthread_create(&thread, NULL, ping_thread, data);
+
+	data->count = 0;
+	start = get_time();
+	spa_loop_utils_signal_event(data->loops[1].utils, data->ping);
+	while (data->count < (uint64_t)data->iterations)
+		spa_loop_control_iterate(data->loops[0].control, -1);
+	elapsed = get_time() - start;
+
+	data->running = false;
+	pthread_join(thread, NULL);
+
+	printf("%s pingpong: %d roundtrips: %"PRIu64" ns/roundtrip\n",
+			data->backend, data->iterations, elapsed / data->iterations);
+
+	spa_loop_utils_destroy_source(data->loops[1].utils, data->ping);
+	spa_loop_utils_destroy_source(data->loops[0].utils, data->pong);
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { NULL };
+	const char *str;
+	int res;
+
+	data.map = &default_map.map;
+	data.log = &default_log.log;
+
+	if ((str = getenv("SPA_DEBUG")))
+		data.log->level = atoi(str);
+
+	data.backend = argc > 1 ? argv[1] : "epoll";
+	data.n_sources = argc > 2 ? atoi(argv[2]) : 64;
+	data.iterations = argc > 3 ? atoi(argv[3]) : 100000;
+	data.n_sources = SPA_CLAMP(data.n_sources, 1, MAX_SOURCES);
+
+	data.support[0].type = SPA_TYPE__TypeMap;
+	data.support[0].data = data.map;
+	data.support[1].type = SPA_TYPE__Log;
+	data.support[1].data = data.log;
+	data.n_support = 2;
+
+	if ((res = load_factory(&data, "build/spa/plugins/support/libspa-support.so", "loop")) < 0) {
+		printf("can't find loop factory: %d\n", res);
+		return -1;
+	}
+	if ((res = make_loop(&data, &data.loops[0])) < 0 ||
+	    (res = make_loop(&data, &data.loops[1])) < 0) {
+		printf("can't make loops: %d\n", res);
+		return -1;
+	}
+	/* the thread of the second loop enters it */
+	spa_loop_control_leave(data.loops[1].control);
+
+	run_events(&data);
+	run_pingpong(&data);
+
+	spa_loop_control_enter(data.loops[1].control);
+	free_loop(&data.loops[1]);
+	free_loop(&data.loops[0]);
+
+	dlclose(data.hnd);
+
+	return 0;
+}
@@ -0,0 +1,142 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <spa/support/type-map-impl.h>
+#include <spa/pod/parser.h>
+#include <spa/pod/builder.h>
+#include <spa/pod/desc.h>
+#include <spa/param/buffers.h>
+
+static SPA_TYPE_MAP_IMPL(default_map, 4096);
+
+struct type {
+	uint32_t object;
+	uint32_t size;
+	uint32_t stride;
+	uint32_t buffers;
+	uint32_t align;
+	uint32_t name;
+};
+
+struct values {
+	int32_t size;
+	int32_t stride;
+	int32_t buffers;
+	int32_t align;
+	const char *name;
+};
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * SPA_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static struct spa_pod *build_format(struct spa_pod_builder *b, struct type *t, struct values *v)
+{
+	return spa_pod_builder_object(b, 0, t->object,
+			":", t->size,    "i", v->size,
+			":", t->stride,  "i", v->stride,
+			":", t->buffers, "i", v->buffers,
+			":", t->align,   "i", v->align,
+			":", t->name,    "s", v->name);
+}
+
+static int parse_format(struct spa_pod *pod, struct type *t, struct values *v)
+{
+	return spa_pod_object_parse(pod,
+			":", t->size,    "i", &v->size,
+			":", t->stride,  "i", &v->stride,
+			":", t->buffers, "i", &v->buffers,
+			":", t->align,   "i", &v->align,
+			":", t->name,    "s", &v->name);
+}
+
+#define REPORT(name,start,n)	\
+	printf("%-14s %8.1f ns/call\n", name, (double)(get_time() - (start)) / (n))
+
+int main(int argc, char *argv[])
+{
+	struct spa_type_map *map = &default_map.map;
+	int i, n = argc > 1 ? atoi(argv[1]) : 1000000;
+	uint8_t buffer[4096];
+	struct spa_pod_builder b;
+	struct spa_pod *pod = NULL;
+	struct values v = { 4096, 16, 8, 16, "benchmark" }, r = { 0, };
+	struct type t;
+	uint64_t start;
+
+	t.object = spa_type_map_get_id(map, SPA_TYPE_PARAM__Buffers);
+	t.size = spa_type_map_get_id(map, SPA_TYPE_PARAM_BUFFERS__size);
+	t.stride = spa_type_map_get_id(map, SPA_TYPE_PARAM_BUFFERS__stride);
+	t.buffers = spa_type_map_get_id(map, SPA_TYPE_PARAM_BUFFERS__buffers);
+	t.align = spa_type_map_get_id(map, SPA_TYPE_PARAM_BUFFERS__align);
+	t.name = spa_type_map_get_id(map, SPA_TYPE_PARAM_BUFFERS_BASE "name");
+
+	/* made once, like a static table */
+	const struct spa_pod_prop_desc desc[] = {
+		SPA_POD_PROP_DESC_INT(t.size, struct values, size, SPA_POD_PROP_DESC_FLAG_REQUIRED),
+		SPA_POD_PROP_DESC_INT(t.stride, struct values, stride, SPA_POD_PROP_DESC_FLAG_REQUIRED),
+		SPA_POD_PROP_DESC_INT(t.buffers, struct values, buffers, SPA_POD_PROP_DESC_FLAG_REQUIRED),
+		SPA_POD_PROP_DESC_INT(t.align, struct values, align, SPA_POD_PROP_DESC_FLAG_REQUIRED),
+		SPA_POD_PROP_DESC_STRING(t.name, struct values, name, SPA_POD_PROP_DESC_FLAG_REQUIRED),
+	};
+
+	start = get_time();
+	for (i = 0; i < n; i++) {
+		spa_pod_builder_init(&b, buffer, sizeof(buffer));
+		pod = build_format(&b, &t, &v);
+	}
+	REPORT("build format", start, n);
+
+	start = get_time();
+	for (i = 0; i < n; i++) {
+		if (parse_format(pod, &t, &r) < 0)
+			return -1;
+	}
+	REPORT("parse format", start, n);
+
+	start = get_time();
+	for (i = 0; i < n; i++) {
+		spa_pod_builder_init(&b, buffer, sizeof(buffer));
+		pod = spa_pod_builder_object_desc(&b, 0, t.object, desc, SPA_N_ELEMENTS(desc), &v);
+	}
+	REPORT("build desc", start, n);
+
+	spa_zero(r);
+	start = get_time();
+	for (i = 0; i < n; i++) {
+		if (spa_pod_object_parse_desc(pod, desc, SPA_N_ELEMENTS(desc), &r) < 0)
+			return -1;
+	}
+	REPORT("parse desc", start, n);
+
+	if (r.size != v.size || r.stride != v.stride || r.buffers != v.buffers ||
+	    r.align != v.align || strcmp(r.name, v.name) != 0) {
+		printf("parsed values differ\n");
+		return -1;
+	}
+	return 0;
+}
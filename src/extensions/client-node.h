@@ -113,6 +113,7 @@ enum pw_client_node_message_type {
 	PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT,		/*< instruct the node to process input */
 	PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT,		/*< instruct the node output is processed */
 	PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER,	/*< reuse a buffer */
+	PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS,	/*< reuse an array of buffers */
 };
 
 struct pw_client_node_message_body {
@@ -135,6 +136,26 @@ struct pw_client_node_message_port_reuse_buffer {
 	struct pw_client_node_message_port_reuse_buffer_body body;
 };
 
+struct pw_client_node_message_port_reuse_buffers_body {
+	struct spa_pod_int type		SPA_ALIGNED(8);	/*< PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS */
+	struct spa_pod_int port_id	SPA_ALIGNED(8);	/*< port id */
+	struct spa_pod_array buffer_ids	SPA_ALIGNED(8);	/*< array of int buffer ids to reuse */
+};
+
+struct pw_client_node_message_port_reuse_buffers {
+	struct spa_pod_struct pod;
+	struct pw_client_node_message_port_reuse_buffers_body body;
+	/* n_buffers uint32_t buffer ids follow */
+};
+
+/** Maximum number of buffer ids in one reuse_buffers message */
+#define PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS_MAX	64
+
+#define PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS_N_IDS(message)				\
+	(((message)->body.buffer_ids.pod.size - sizeof(struct spa_pod_array_body)) / sizeof(uint32_t))
+#define PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS_IDS(message)					\
+	SPA_MEMBER((message), sizeof(struct pw_client_node_message_port_reuse_buffers), uint32_t)
+
 #define PW_CLIENT_NODE_MESSAGE_TYPE(message)	(((struct pw_client_node_message*)(message))->body.type.value)
 
 #define PW_CLIENT_NODE_MESSAGE_INIT(message) (struct pw_client_node_message)			\
@@ -152,6 +173,16 @@ struct pw_client_node_message_port_reuse_buffer {
 		SPA_POD_INT_INIT(port_id),							\
 		SPA_POD_INT_INIT(buffer_id))
 
+#define PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS_INIT(port_id,n_ids)				\
+	PW_CLIENT_NODE_MESSAGE_INIT_FULL(struct pw_client_node_message_port_reuse_buffers,	\
+		sizeof(struct pw_client_node_message_port_reuse_buffers_body) +			\
+			(n_ids) * sizeof(uint32_t),						\
+		PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS,					\
+		SPA_POD_INT_INIT(port_id),							\
+		{ { sizeof(struct spa_pod_array_body) + (n_ids) * sizeof(uint32_t),		\
+		    SPA_POD_TYPE_ARRAY },							\
+		  { { sizeof(uint32_t), SPA_POD_TYPE_INT } } })
+
 /** information about a buffer */
 struct pw_client_node_buffer {
 	uint32_t mem_id;		/**< the memory id for the metadata */
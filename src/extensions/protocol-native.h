@@ -31,7 +31,18 @@ extern "C" {
 #define PW_TYPE_PROTOCOL__Native	PW_TYPE_PROTOCOL_BASE "Native"
 #define PW_TYPE_PROTOCOL_NATIVE_BASE	PW_TYPE_PROTOCOL__Native ":"
 
+/** property with the protocol version of the peer. Clients announce it in
+ * their client properties, the server in the core properties. Newer message
+ * formats and methods are only used when the peer announces them. */
+#define PW_PROTOCOL_NATIVE_PROP_VERSION	"protocol-native.version"
+
+#define PW_PROTOCOL_NATIVE_VERSION_SHARED_TYPES		1	/**< type strings in a shared memfd */
+#define PW_PROTOCOL_NATIVE_VERSION_REGISTRY_FILTER	2	/**< core get_registry_filtered */
+#define PW_PROTOCOL_NATIVE_VERSION			2
+
 struct pw_protocol_native_demarshal {
+	/** demarshal a message, \a data was checked with spa_pod_validate() and
+	 * can be read with the unchecked spa_pod_cursor accessors */
 	int (*func) (void *object, void *data, size_t size);
 
 #define PW_PROTOCOL_NATIVE_REMAP	(1<<0)
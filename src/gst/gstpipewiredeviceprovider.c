@@ -25,6 +25,7 @@
 #endif
 
 #include <string.h>
+#include <stdlib.h>
 
 #include <gst/gst.h>
 
@@ -33,6 +34,8 @@
 #include "gstpipewiresrc.h"
 #include "gstpipewiresink.h"
 
+#include <extensions/protocol-native.h>
+
 GST_DEBUG_CATEGORY_EXTERN (pipewire_debug);
 #define GST_CAT_DEFAULT pipewire_debug
 
@@ -528,6 +531,33 @@ static const struct pw_registry_proxy_events registry_events = {
   .global_remove = registry_event_global_remove,
 };
 
+/* we only look at nodes and their ports */
+static const struct spa_dict_item registry_filter_items[] = {
+  { PW_REGISTRY_FILTER_TYPE, PW_TYPE_INTERFACE__Node "," PW_TYPE_INTERFACE__Port },
+};
+
+static const struct spa_dict registry_filter = {
+  registry_filter_items, SPA_N_ELEMENTS (registry_filter_items)
+};
+
+/* older servers close the connection on the filtered registry method */
+static struct pw_registry_proxy *
+get_registry (struct pw_remote *remote, uint32_t type)
+{
+  struct pw_core_proxy *core_proxy = pw_remote_get_core_proxy (remote);
+  const struct pw_core_info *info = pw_remote_get_core_info (remote);
+  const gchar *value = NULL;
+
+  if (info && info->props)
+    value = spa_dict_lookup (info->props, PW_PROTOCOL_NATIVE_PROP_VERSION);
+
+  if (value && atoi (value) >= PW_PROTOCOL_NATIVE_VERSION_REGISTRY_FILTER)
+    return pw_core_proxy_get_registry_filtered (core_proxy, type,
+        PW_VERSION_REGISTRY, &registry_filter, 0);
+  else
+    return pw_core_proxy_get_registry (core_proxy, type, PW_VERSION_REGISTRY, 0);
+}
+
 static const struct pw_remote_events remote_events = {
   PW_VERSION_REMOTE_EVENTS,
   .state_changed = on_state_changed,
@@ -595,7 +625,7 @@ gst_pipewire_device_provider_probe (GstDeviceProvider * provider)
   self->devices = NULL;
 
   self->core_proxy = pw_remote_get_core_proxy(r);
-  data->registry = pw_core_proxy_get_registry(self->core_proxy, t->registry, PW_VERSION_REGISTRY, 0);
+  data->registry = get_registry (r, t->registry);
   pw_registry_proxy_add_listener(data->registry, &data->registry_listener, &registry_events, data);
   pw_core_proxy_sync(self->core_proxy, ++self->seq);
 
@@ -682,8 +712,7 @@ gst_pipewire_device_provider_start (GstDeviceProvider * provider)
   get_core_info (self->remote, self);
 
   self->core_proxy = pw_remote_get_core_proxy(self->remote);
-  self->registry = pw_core_proxy_get_registry(self->core_proxy, self->type->registry,
-					      PW_VERSION_REGISTRY, 0);
+  self->registry = get_registry (self->remote, self->type->registry);
 
   data->registry = self->registry;
 
@@ -30,10 +30,12 @@
 
 #include <spa/node/node.h>
 #include <spa/pod/filter.h>
+#include <spa/param/audio/format-utils.h>
 
 #include "pipewire/pipewire.h"
 #include "pipewire/interfaces.h"
 #include "pipewire/private.h"
+#include "pipewire/probes.h"
 
 #include "pipewire/core.h"
 #include "modules/spa/spa-node.h"
@@ -47,6 +49,9 @@
 
 #define MAX_BUFFERS      64
 
+#define DEFAULT_QUANTUM  1024	/* frames read from a ring in a cycle when the
+				 * peer doesn't give a size */
+
 #define CHECK_IN_PORT_ID(this,d,p)       ((d) == SPA_DIRECTION_INPUT && (p) < MAX_INPUTS)
 #define CHECK_OUT_PORT_ID(this,d,p)      ((d) == SPA_DIRECTION_OUTPUT && (p) < MAX_OUTPUTS)
 #define CHECK_PORT_ID(this,d,p)          (CHECK_IN_PORT_ID(this,d,p) || CHECK_OUT_PORT_ID(this,d,p))
@@ -92,6 +97,17 @@ struct port {
 
 	uint32_t n_buffers;
 	struct buffer buffers[MAX_BUFFERS];
+
+	struct pw_memblock *ring_mem;
+	struct spa_io_ringbuffer *ring;
+	uint32_t ring_size;		/* size of the ring, never read back from
+					 * the client writable ring header */
+	uint32_t ring_memid;
+	uint32_t ring_index;
+	struct spa_io_control_range *range;	/* size of a cycle, from the peer */
+	uint32_t stride;		/* size of a frame, 0 when unknown */
+	uint8_t silence[4];		/* one sample of silence */
+	uint32_t silence_size;		/* 0 when silence is all zero */
 };
 
 struct node {
@@ -124,10 +140,28 @@ struct node {
 	uint32_t seq;
 };
 
+struct type {
+	struct spa_type_media_type media_type;
+	struct spa_type_media_subtype media_subtype;
+	struct spa_type_format_audio format_audio;
+	struct spa_type_audio_format audio_format;
+};
+
+static inline void init_type(struct type *type, struct spa_type_map *map)
+{
+	spa_type_media_type_map(map, &type->media_type);
+	spa_type_media_subtype_map(map, &type->media_subtype);
+	spa_type_format_audio_map(map, &type->format_audio);
+	spa_type_audio_format_map(map, &type->audio_format);
+}
+
 struct impl {
 	struct pw_client_node this;
 
+	struct type type;
+
 	bool client_reuse;
+	bool client_ring;
 
 	struct pw_core *core;
 	struct pw_type *t;
@@ -212,6 +246,64 @@ static int clear_buffers(struct node *this, struct port *port)
 		m->ref--;
 	}
 	port->n_buffers = 0;
+
+	if (port->ring_mem) {
+		struct mem *m;
+
+		m = pw_array_get_unchecked(&impl->mems, port->ring_memid, struct mem);
+		m->ref--;
+		pw_memblock_free(port->ring_mem);
+		port->ring_mem = NULL;
+		port->ring = NULL;
+		port->ring_size = 0;
+	}
+	return 0;
+}
+
+static int setup_ring(struct node *this, struct port *port,
+		      enum spa_direction direction, uint32_t port_id,
+		      struct spa_buffer **buffers, uint32_t n_buffers)
+{
+	struct impl *impl = this->impl;
+	struct pw_type *t = impl->t;
+	struct pw_memblock *mem;
+	struct mem *m;
+	uint32_t size = 1, total;
+	int res;
+
+	if (n_buffers == 0 || buffers[0]->n_datas == 0)
+		return 0;
+
+	/* make room for all the data of the buffers, rounded up to a power of 2 */
+	total = n_buffers * buffers[0]->datas[0].maxsize;
+	while (size < total)
+		size <<= 1;
+
+	if ((res = pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
+				     PW_MEMBLOCK_FLAG_MAP_READWRITE |
+				     PW_MEMBLOCK_FLAG_SEAL,
+				     sizeof(struct spa_io_ringbuffer) + size,
+				     &mem)) < 0)
+		return res;
+
+	port->ring_mem = mem;
+	port->ring = mem->ptr;
+	port->ring->size = size;
+	port->ring_size = size;
+	port->ring_index = 0;
+	spa_ringbuffer_init(&port->ring->ring);
+
+	m = ensure_mem(impl, mem->fd, t->data.MemFd, mem->flags);
+	port->ring_memid = m->id;
+
+	spa_log_debug(this->log, "node %p: port %d ringbuffer of %u bytes", this, port_id, size);
+
+	pw_client_node_resource_port_set_io(this->resource,
+					    this->seq++,
+					    direction, port_id,
+					    t->io.Ringbuffer,
+					    m->id,
+					    mem->offset, mem->size);
 	return 0;
 }
 
@@ -371,6 +463,89 @@ impl_node_get_port_ids(struct spa_node *node,
 	return 0;
 }
 
+/* the size of a sample and the value of silence of the raw audio formats, the
+ * silence of the unsigned formats is the middle of their range */
+static const struct format_info {
+	size_t id;		/* offset of the id in struct spa_type_audio_format */
+	uint32_t width;
+	uint32_t silence;
+	bool swap;		/* the other endianness */
+} format_info[] = {
+#define FORMAT(id,width,silence,swap) \
+	{ offsetof(struct spa_type_audio_format, id), width, silence, swap }
+	FORMAT(S8, 1, 0, false),
+	FORMAT(U8, 1, 0x80, false),
+	FORMAT(S16, 2, 0, false),
+	FORMAT(U16, 2, 0x8000, false),
+	FORMAT(S24_32, 4, 0, false),
+	FORMAT(U24_32, 4, 0x800000, false),
+	FORMAT(S32, 4, 0, false),
+	FORMAT(U32, 4, 0x80000000, false),
+	FORMAT(S24, 3, 0, false),
+	FORMAT(U24, 3, 0x800000, false),
+	FORMAT(S20, 3, 0, false),
+	FORMAT(U20, 3, 0x80000, false),
+	FORMAT(S18, 3, 0, false),
+	FORMAT(U18, 3, 0x20000, false),
+	FORMAT(F32, 4, 0, false),
+	FORMAT(F64, 8, 0, false),
+	FORMAT(S16_OE, 2, 0, true),
+	FORMAT(U16_OE, 2, 0x8000, true),
+	FORMAT(S24_32_OE, 4, 0, true),
+	FORMAT(U24_32_OE, 4, 0x800000, true),
+	FORMAT(S32_OE, 4, 0, true),
+	FORMAT(U32_OE, 4, 0x80000000, true),
+	FORMAT(S24_OE, 3, 0, true),
+	FORMAT(U24_OE, 3, 0x800000, true),
+	FORMAT(S20_OE, 3, 0, true),
+	FORMAT(U20_OE, 3, 0x80000, true),
+	FORMAT(S18_OE, 3, 0, true),
+	FORMAT(U18_OE, 3, 0x20000, true),
+	FORMAT(F32_OE, 4, 0, true),
+	FORMAT(F64_OE, 8, 0, true),
+#undef FORMAT
+};
+
+/* the ring of a port is read a frame at a time and padded with silence */
+static void port_update_format(struct node *this, struct port *port,
+			       const struct spa_pod *format)
+{
+	struct type *t = &this->impl->type;
+	struct spa_audio_info info = { 0 };
+	const struct format_info *f = NULL;
+	uint32_t i;
+	bool little;
+
+	spa_pod_object_parse(format,
+		"I", &info.media_type,
+		"I", &info.media_subtype);
+
+	if (info.media_type != t->media_type.audio ||
+	    info.media_subtype != t->media_subtype.raw ||
+	    spa_format_audio_raw_parse(format, &info.info.raw, &t->format_audio) < 0)
+		return;
+
+	for (i = 0; i < SPA_N_ELEMENTS(format_info); i++) {
+		if (*SPA_MEMBER(&t->audio_format, format_info[i].id, uint32_t) == info.info.raw.format) {
+			f = &format_info[i];
+			break;
+		}
+	}
+	if (f == NULL)
+		return;
+
+	port->stride = f->width;
+	if (info.info.raw.layout == SPA_AUDIO_LAYOUT_INTERLEAVED)
+		port->stride *= info.info.raw.channels;
+
+	if (f->silence != 0) {
+		little = (__BYTE_ORDER == __LITTLE_ENDIAN) != f->swap;
+		for (i = 0; i < f->width; i++)
+			port->silence[little ? i : f->width - 1 - i] = f->silence >> (8 * i);
+		port->silence_size = f->width;
+	}
+}
+
 static void
 do_update_port(struct node *this,
 	       enum spa_direction direction,
@@ -382,6 +557,7 @@ do_update_port(struct node *this,
 {
 	struct port *port;
 	struct pw_type *t = this->impl->t;
+	struct pw_port *p;
 
 	port = GET_PORT(this, direction, port_id);
 
@@ -389,6 +565,8 @@ do_update_port(struct node *this,
 		int i;
 
 		port->have_format = false;
+		port->stride = 0;
+		port->silence_size = 0;
 
 		spa_log_info(this->log, "node %p: port %u update %d params", this, port_id, n_params);
 		for (i = 0; i < port->n_params; i++)
@@ -399,9 +577,14 @@ do_update_port(struct node *this,
 		for (i = 0; i < port->n_params; i++) {
 			port->params[i] = pw_spa_pod_copy(params[i]);
 
-			if (spa_pod_is_object_id(port->params[i], t->param.idFormat))
+			if (spa_pod_is_object_id(port->params[i], t->param.idFormat)) {
 				port->have_format = true;
+				port_update_format(this, port, port->params[i]);
+			}
 		}
+		if (this->impl->this.node &&
+		    (p = pw_node_find_port(this->impl->this.node, direction, port_id)) != NULL)
+			pw_port_params_changed(p);
 	}
 
 	if (change_mask & PW_CLIENT_NODE_PORT_UPDATE_INFO) {
@@ -457,6 +640,7 @@ static void do_uninit_port(struct node *this, enum spa_direction direction, uint
 		this->n_outputs--;
 	}
 	clear_port(this, port, direction, port_id);
+	port->range = NULL;
 	port->valid = false;
 }
 
@@ -613,6 +797,12 @@ impl_node_port_set_io(struct spa_node *node,
 	if (!CHECK_PORT(this, direction, port_id))
 		return -EINVAL;
 
+	/* the ring is read here, the client doesn't need the range */
+	if (impl->client_ring && id == t->io.ControlRange) {
+		GET_PORT(this, direction, port_id)->range = data;
+		return 0;
+	}
+
 	if (data) {
 		if ((mem = pw_memblock_find(data)) == NULL)
 			return -EINVAL;
@@ -682,6 +872,9 @@ impl_node_port_use_buffers(struct spa_node *node,
 	if (this->resource == NULL)
 		return 0;
 
+	if (impl->client_ring && setup_ring(this, port, direction, port_id, buffers, n_buffers) < 0)
+		return -ENOMEM;
+
 	for (i = 0; i < n_buffers; i++) {
 		struct buffer *b = &port->buffers[i];
 		struct pw_memblock *mem;
@@ -796,7 +989,10 @@ impl_node_port_reuse_buffer(struct spa_node *node, uint32_t port_id, uint32_t bu
 	if (!CHECK_OUT_PORT(this, SPA_DIRECTION_OUTPUT, port_id))
 		return -EINVAL;
 
+#ifndef HAVE_SYS_SDT_H
 	spa_log_trace(this->log, "reuse buffer %d", buffer_id);
+#endif
+	pw_probe(reuse__buffer, this, port_id, buffer_id);
 
 	pw_client_node_transport_add_message(impl->transport, (struct pw_client_node_message *)
 			&PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER_INIT(port_id, buffer_id));
@@ -834,6 +1030,152 @@ impl_node_port_send_command(struct spa_node *node,
 	return 0;
 }
 
+static void ring_write_input(struct node *this, struct port *port, struct spa_io_buffers *io)
+{
+	struct spa_io_ringbuffer *ring = port->ring;
+	struct spa_data *d;
+	uint32_t index, offset, size;
+	int32_t filled;
+
+	if (ring == NULL || io->status != SPA_STATUS_HAVE_BUFFER ||
+	    !CHECK_PORT_BUFFER(this, io->buffer_id, port))
+		return;
+
+	d = &port->buffers[io->buffer_id].outbuf->datas[0];
+	if (d->data == NULL)
+		return;
+
+	offset = SPA_MIN(d->chunk->offset, d->maxsize);
+	size = SPA_MIN(d->chunk->size, d->maxsize - offset);
+
+	filled = spa_ringbuffer_get_write_index(&ring->ring, &index);
+	if (filled < 0 || size > port->ring_size || filled > port->ring_size - size) {
+		spa_log_trace(this->log, "node %p: ringbuffer overrun %d %u", this, filled, size);
+		return;
+	}
+	spa_ringbuffer_write_data(&ring->ring, SPA_IO_RINGBUFFER_DATA(ring), port->ring_size,
+				  index & (port->ring_size - 1),
+				  SPA_MEMBER(d->data, offset, void), size);
+	spa_ringbuffer_write_update(&ring->ring, index + size);
+}
+
+/* the size of one cycle, as asked by the peer or else a default number of frames */
+static uint32_t ring_quantum(struct port *port, uint32_t maxsize)
+{
+	uint32_t size;
+
+	if (port->range && port->range->min_size != 0)
+		size = port->range->min_size;
+	else if (port->stride != 0)
+		size = DEFAULT_QUANTUM * port->stride;
+	else
+		size = maxsize;
+
+	size = SPA_MIN(size, maxsize);
+	if (port->stride != 0 && size >= port->stride)
+		size -= size % port->stride;
+	return size;
+}
+
+static void ring_fill_silence(struct port *port, uint8_t *data, uint32_t offset, uint32_t size)
+{
+	uint32_t i;
+
+	if (port->silence_size == 0) {
+		memset(data + offset, 0, size);
+		return;
+	}
+	/* the buffer starts at a frame, the pattern follows the offset */
+	for (i = offset; i < offset + size; i++)
+		data[i] = port->silence[i % port->silence_size];
+}
+
+static void ring_read_output(struct node *this, struct port *port, struct spa_io_buffers *io)
+{
+	struct spa_io_ringbuffer *ring = port->ring;
+	struct buffer *b;
+	struct spa_data *d;
+	uint32_t index, size, avail;
+	int32_t filled;
+
+	if (io->status == SPA_STATUS_HAVE_BUFFER)
+		return;
+
+	if (ring == NULL || port->n_buffers == 0) {
+		io->status = SPA_STATUS_NEED_BUFFER;
+		return;
+	}
+
+	b = &port->buffers[port->ring_index];
+	d = &b->outbuf->datas[0];
+	if (d->data == NULL) {
+		io->status = SPA_STATUS_NEED_BUFFER;
+		return;
+	}
+
+	/* consume exactly one quantum, pad with silence on underrun */
+	size = ring_quantum(port, d->maxsize);
+	filled = spa_ringbuffer_get_read_index(&ring->ring, &index);
+	avail = SPA_CLAMP(filled, 0, (int32_t) SPA_MIN(size, port->ring_size));
+
+	spa_ringbuffer_read_data(&ring->ring, SPA_IO_RINGBUFFER_DATA(ring), port->ring_size,
+				 index & (port->ring_size - 1), d->data, avail);
+	spa_ringbuffer_read_update(&ring->ring, index + avail);
+
+	if (avail < size) {
+		spa_log_trace(this->log, "node %p: ringbuffer underrun %u < %u", this, avail, size);
+		ring_fill_silence(port, d->data, avail, size - avail);
+	}
+	d->chunk->offset = 0;
+	d->chunk->size = size;
+
+	io->buffer_id = port->ring_index;
+	io->status = SPA_STATUS_HAVE_BUFFER;
+
+	port->ring_index = (port->ring_index + 1) % port->n_buffers;
+}
+
+static int process_input_ring(struct node *this)
+{
+	struct impl *impl = this->impl;
+	struct spa_graph_node *n = &impl->this.node->rt.node;
+	struct spa_graph_port *p, *pp;
+
+	spa_list_for_each(p, &n->ports[SPA_DIRECTION_INPUT], link) {
+		struct spa_io_buffers *io = p->io;
+
+		ring_write_input(this, GET_IN_PORT(this, p->port_id), io);
+
+		if (io->status == SPA_STATUS_HAVE_BUFFER && (pp = p->peer))
+	                spa_node_port_reuse_buffer(pp->node->implementation,
+					pp->port_id, io->buffer_id);
+		io->status = SPA_STATUS_NEED_BUFFER;
+	}
+	/* the data is in the ring, only wake up the client */
+	pw_client_node_transport_add_message(impl->transport,
+		       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT));
+	do_flush(this);
+
+	return SPA_STATUS_NEED_BUFFER;
+}
+
+static int process_output_ring(struct node *this)
+{
+	struct impl *impl = this->impl;
+	struct spa_graph_node *n = &impl->this.node->rt.node;
+	struct spa_graph_port *p;
+
+	spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link)
+		ring_read_output(this, GET_OUT_PORT(this, p->port_id), p->io);
+
+	/* wake up the client so that it can refill the ring */
+	pw_client_node_transport_add_message(impl->transport,
+		       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT));
+	do_flush(this);
+
+	return SPA_STATUS_HAVE_BUFFER;
+}
+
 static int impl_node_process_input(struct spa_node *node)
 {
 	struct node *this = SPA_CONTAINER_OF(node, struct node, node);
@@ -843,6 +1185,9 @@ static int impl_node_process_input(struct spa_node *node)
 	struct spa_graph_port *p, *pp;
 	int res;
 
+	if (impl->client_ring)
+		return process_input_ring(this);
+
 	if (impl->input_ready == 0) {
 		/* the client is not ready to receive our buffers, recycle them */
 		pw_log_trace("node not ready, recycle buffers");
@@ -883,6 +1228,9 @@ static int impl_node_process_output(struct spa_node *node)
 	impl = this->impl;
 	n = &impl->this.node->rt.node;
 
+	if (impl->client_ring)
+		return process_output_ring(this);
+
 	if (impl->out_pending)
 		goto done;
 
@@ -942,6 +1290,35 @@ static int handle_node_message(struct node *this, struct pw_client_node_message
 		}
 		break;
 
+	case PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS:
+		if (impl->client_reuse) {
+			struct pw_client_node_message_port_reuse_buffers *p =
+			    (struct pw_client_node_message_port_reuse_buffers *) message;
+			uint32_t i, n_ids, size = SPA_POD_SIZE(message);
+			uint32_t *ids;
+
+			/* the message comes from the client, make sure the id array
+			 * fits inside it before walking it */
+			if (size < sizeof(struct pw_client_node_message_port_reuse_buffers) ||
+			    p->body.buffer_ids.pod.size < sizeof(struct spa_pod_array_body)) {
+				pw_log_warn("invalid reuse_buffers message of size %u", size);
+				return -EINVAL;
+			}
+			n_ids = PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS_N_IDS(p);
+			if (n_ids > (size - sizeof(struct pw_client_node_message_port_reuse_buffers)) /
+			    sizeof(uint32_t)) {
+				pw_log_warn("invalid reuse_buffers message: %u ids in %u bytes",
+					    n_ids, size);
+				return -EINVAL;
+			}
+			ids = PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS_IDS(p);
+
+			for (i = 0; i < n_ids; i++)
+				this->callbacks->reuse_buffer(this->callbacks_data,
+							     p->body.port_id.value, ids[i]);
+		}
+		break;
+
 	default:
 		pw_log_warn("unhandled message %d", PW_CLIENT_NODE_MESSAGE_TYPE(message));
 		return -ENOTSUP;
@@ -1283,10 +1660,12 @@ struct pw_client_node *pw_client_node_new(struct pw_resource *resource,
 
 	impl->core = core;
 	impl->t = pw_core_get_type(core);
+	init_type(&impl->type, impl->t->map);
 	impl->fds[0] = impl->fds[1] = -1;
 	pw_log_debug("client-node %p: new", impl);
 
-	support = pw_core_get_support(impl->core, &n_support);
+	support = pw_core_get_node_support(impl->core,
+					   properties ? &properties->dict : NULL, &n_support);
 
 	node_init(&impl->node, NULL, support, n_support);
 	impl->node.impl = impl;
@@ -1308,9 +1687,15 @@ struct pw_client_node *pw_client_node_new(struct pw_resource *resource,
 	if (this->node == NULL)
 		goto error_no_node;
 
+	/* the buffers go to the client, they must be shareable */
+	this->node->remote = true;
+
 	str = pw_properties_get(properties, "pipewire.client.reuse");
 	impl->client_reuse = str && pw_properties_parse_bool(str);
 
+	str = pw_properties_get(properties, "pipewire.client.ringbuffer");
+	impl->client_ring = str && pw_properties_parse_bool(str);
+
 	pw_resource_add_listener(this->resource,
 				 &impl->resource_listener,
 				 &resource_events,
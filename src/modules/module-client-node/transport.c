@@ -24,6 +24,7 @@
 #include <spa/utils/ringbuffer.h>
 #include <spa/node/io.h>
 #include <pipewire/log.h>
+#include <pipewire/probes.h>
 #include <extensions/client-node.h>
 
 #include "transport.h"
@@ -130,6 +131,8 @@ static int add_message(struct pw_client_node_transport *trans, struct pw_client_
 				  index & (OUTPUT_BUFFER_SIZE - 1), message, size);
 	spa_ringbuffer_write_update(trans->output_buffer, index + size);
 
+	pw_probe(transport__send, trans, PW_CLIENT_NODE_MESSAGE_TYPE(message), size);
+
 	return 0;
 }
 
@@ -155,6 +158,9 @@ static int next_message(struct pw_client_node_transport *trans, struct pw_client
 
 	*message = impl->current;
 
+	pw_probe(transport__recv, trans, PW_CLIENT_NODE_MESSAGE_TYPE(message),
+		 SPA_POD_SIZE(message));
+
 	return 1;
 }
 
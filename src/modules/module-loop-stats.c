@@ -0,0 +1,381 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <dlfcn.h>
+
+#include "config.h"
+
+#include "pipewire/core.h"
+#include "pipewire/log.h"
+#include "pipewire/module.h"
+#include "pipewire/private.h"
+
+/** \page page_module_loop_stats Loop statistics
+ *
+ * Enables the dispatch accounting of the main and data loops of the core and
+ * publishes the statistics of the last interval in the properties of the
+ * module object. Only the clients that bind the module receive the updates.
+ *
+ * - loop.stats.<loop>: "wakeups dispatches busy-usec"
+ * - loop.stats.<loop>.latency: histogram of the wakeup to dispatch latency,
+ *   a count for each power of 2 microseconds, separated by ','
+ * - loop.stats.<loop>.top: the sources that used the most time, each as
+ *   "name:count:total-usec:max-usec" and separated by ';'
+ *
+ * The interval in seconds is given with the "interval" argument, the
+ * default is 1.
+ */
+
+#define DEFAULT_INTERVAL	1
+#define MAX_TOP			10
+#define MAX_LOOPS		16
+#define MAX_VALUE		1024
+
+struct top_item {
+	const void *func;
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+};
+
+/* the statistics of one interval, copied in the loop */
+struct snapshot {
+	struct spa_loop_stats_info info;
+	struct top_item top[MAX_TOP];
+	uint32_t n_top;
+};
+
+struct loop_data {
+	const char *name;
+	struct pw_loop *loop;
+	bool pending;		/* a collect is queued in the loop */
+	struct snapshot snapshot;	/* written by the loop while pending */
+
+	char key_info[64];
+	char key_latency[64];
+	char key_top[64];
+	char val_info[128];
+	char val_latency[MAX_VALUE];
+	char val_top[MAX_VALUE];
+};
+
+struct impl {
+	struct pw_core *core;
+	struct pw_module *module;
+	struct pw_properties *properties;
+
+	struct spa_hook module_listener;
+
+	struct spa_source *timer;
+	uint32_t interval;
+
+	struct loop_data loops[MAX_LOOPS];
+	uint32_t n_loops;
+	uint32_t n_data_loops;
+
+	uint32_t n_pending;	/* collects that did not reply yet */
+	bool destroyed;		/* free when the last collect replied */
+};
+
+/* sent to the loop and back to the main loop, small enough for a slot of
+ * the invoke queue */
+struct collect {
+	struct impl *impl;
+	uint32_t index;
+};
+
+static void add_top(struct snapshot *sn, const struct spa_loop_source_stats *s)
+{
+	uint32_t i, pos;
+
+	if (s->count == 0)
+		return;
+
+	for (pos = 0; pos < sn->n_top; pos++)
+		if (s->total > sn->top[pos].total)
+			break;
+	if (pos == MAX_TOP)
+		return;
+
+	if (sn->n_top < MAX_TOP)
+		sn->n_top++;
+	for (i = sn->n_top - 1; i > pos; i--)
+		sn->top[i] = sn->top[i - 1];
+
+	sn->top[pos].func = s->func;
+	sn->top[pos].count = s->count;
+	sn->top[pos].total = s->total;
+	sn->top[pos].max = s->max;
+}
+
+static const char *func_name(const void *func, char *name, size_t size)
+{
+	Dl_info di;
+	const char *base;
+
+	if (dladdr(func, &di) == 0) {
+		snprintf(name, size, "%p", func);
+	} else if (di.dli_sname && di.dli_saddr == func) {
+		snprintf(name, size, "%s", di.dli_sname);
+	} else if (di.dli_fname) {
+		base = strrchr(di.dli_fname, '/');
+		snprintf(name, size, "%s+0x%zx", base ? base + 1 : di.dli_fname,
+				(size_t) ((const char *) func - (const char *) di.dli_fbase));
+	} else {
+		snprintf(name, size, "%p", func);
+	}
+	return name;
+}
+
+static void format_loop(struct loop_data *d, const struct snapshot *sn)
+{
+	char name[256];
+	size_t len;
+	uint32_t i;
+
+	snprintf(d->val_info, sizeof(d->val_info), "%"PRIu64" %"PRIu64" %"PRIu64,
+			sn->info.n_iterations, sn->info.n_dispatches, sn->info.busy / 1000);
+
+	for (i = 0, len = 0; i < SPA_LOOP_STATS_N_BINS && len < sizeof(d->val_latency); i++)
+		len += snprintf(d->val_latency + len, sizeof(d->val_latency) - len,
+				"%s%"PRIu64, i ? "," : "", sn->info.latency[i]);
+
+	d->val_top[0] = '\0';
+	for (i = 0, len = 0; i < sn->n_top && len < sizeof(d->val_top); i++)
+		len += snprintf(d->val_top + len, sizeof(d->val_top) - len,
+				"%s%s:%"PRIu64":%"PRIu64":%"PRIu64, i ? ";" : "",
+				func_name(sn->top[i].func, name, sizeof(name)),
+				sn->top[i].count, sn->top[i].total / 1000,
+				sn->top[i].max / 1000);
+}
+
+static void free_impl(struct impl *impl)
+{
+	if (impl->properties)
+		pw_properties_free(impl->properties);
+	free(impl);
+}
+
+/* runs in the main loop */
+static int
+do_reply(struct spa_loop *loop,
+	 bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	const struct collect *c = data;
+	struct impl *impl = c->impl;
+	struct loop_data *d = &impl->loops[c->index];
+	struct spa_dict_item items[3];
+
+	d->pending = false;
+	impl->n_pending--;
+
+	if (impl->destroyed) {
+		if (impl->n_pending == 0)
+			free_impl(impl);
+		return 0;
+	}
+
+	format_loop(d, &d->snapshot);
+
+	items[0] = SPA_DICT_ITEM_INIT(d->key_info, d->val_info);
+	items[1] = SPA_DICT_ITEM_INIT(d->key_latency, d->val_latency);
+	items[2] = SPA_DICT_ITEM_INIT(d->key_top, d->val_top);
+	pw_module_update_properties(impl->module, &SPA_DICT_INIT(items, 3));
+
+	return 0;
+}
+
+/* runs in the thread of the loop, only copies the counters to the snapshot
+ * of the loop, the main loop doesn't use it until the reply */
+static int
+do_collect(struct spa_loop *loop,
+	   bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	const struct collect *c = data;
+	struct impl *impl = c->impl;
+	struct loop_data *d = &impl->loops[c->index];
+	struct snapshot *sn = &d->snapshot;
+	struct spa_loop_source_stats s;
+	uint32_t index = 0;
+
+	pw_loop_stats_get_info(d->loop, &sn->info);
+
+	sn->n_top = 0;
+	while (pw_loop_stats_enum_sources(d->loop, &index, &s) > 0)
+		add_top(sn, &s);
+
+	pw_loop_stats_reset(d->loop);
+
+	pw_loop_invoke(pw_core_get_main_loop(impl->core), do_reply,
+			SPA_ID_INVALID, c, sizeof(*c), false, NULL);
+
+	return 0;
+}
+
+static void add_loop(struct impl *impl, const char *name, struct pw_loop *loop)
+{
+	struct loop_data *d;
+
+	if (impl->n_loops == MAX_LOOPS) {
+		pw_log_warn("module %p: too many loops, no statistics for %s", impl, name);
+		return;
+	}
+	if (loop->stats == NULL) {
+		pw_log_warn("module %p: %s loop has no statistics", impl, name);
+		return;
+	}
+
+	d = &impl->loops[impl->n_loops++];
+	d->name = name;
+	d->loop = loop;
+	snprintf(d->key_info, sizeof(d->key_info), "loop.stats.%s", name);
+	snprintf(d->key_latency, sizeof(d->key_latency), "loop.stats.%s.latency", name);
+	snprintf(d->key_top, sizeof(d->key_top), "loop.stats.%s.top", name);
+
+	pw_loop_stats_reset(loop);
+	pw_loop_stats_enable(loop, true);
+}
+
+/* named data loops are made when a node first uses them and are appended
+ * to the list of the core */
+static void check_data_loops(struct impl *impl)
+{
+	struct pw_data_loop *data_loop;
+	uint32_t i = 0;
+
+	spa_list_for_each(data_loop, &impl->core->data_loop_list, link) {
+		if (i++ < impl->n_data_loops)
+			continue;
+		add_loop(impl, data_loop->name, data_loop->loop);
+		impl->n_data_loops++;
+	}
+}
+
+static void on_timeout(void *data, uint64_t expirations)
+{
+	struct impl *impl = data;
+	struct collect c;
+	uint32_t i;
+
+	check_data_loops(impl);
+
+	for (i = 0; i < impl->n_loops; i++) {
+		struct loop_data *d = &impl->loops[i];
+
+		/* a loop that did not reply to the last collect is not running
+		 * or blocked, don't queue more */
+		if (d->pending) {
+			pw_log_debug("module %p: %s loop did not reply", impl, d->name);
+			continue;
+		}
+		c.impl = impl;
+		c.index = i;
+
+		d->pending = true;
+		impl->n_pending++;
+		if (pw_loop_invoke(d->loop, do_collect, SPA_ID_INVALID,
+				   &c, sizeof(c), false, NULL) < 0) {
+			d->pending = false;
+			impl->n_pending--;
+		}
+	}
+}
+
+static void module_destroy(void *data)
+{
+	struct impl *impl = data;
+	uint32_t i;
+
+	spa_hook_remove(&impl->module_listener);
+
+	for (i = 0; i < impl->n_loops; i++)
+		pw_loop_stats_enable(impl->loops[i].loop, false);
+
+	if (impl->timer)
+		pw_loop_destroy_source(pw_core_get_main_loop(impl->core), impl->timer);
+
+	/* the replies of the pending collects still use impl */
+	if (impl->n_pending > 0) {
+		impl->destroyed = true;
+		return;
+	}
+	free_impl(impl);
+}
+
+static const struct pw_module_events module_events = {
+	PW_VERSION_MODULE_EVENTS,
+	.destroy = module_destroy,
+};
+
+static int module_init(struct pw_module *module, struct pw_properties *properties)
+{
+	struct pw_core *core = pw_module_get_core(module);
+	struct pw_loop *main_loop = pw_core_get_main_loop(core);
+	struct impl *impl;
+	struct timespec value;
+	const char *str;
+
+	impl = calloc(1, sizeof(struct impl));
+	if (impl == NULL)
+		return -ENOMEM;
+
+	pw_log_debug("module %p: new", impl);
+
+	impl->core = core;
+	impl->module = module;
+	impl->properties = properties;
+
+	impl->interval = DEFAULT_INTERVAL;
+	if (properties && (str = pw_properties_get(properties, "interval")) != NULL)
+		impl->interval = SPA_MAX(atoi(str), 1);
+
+	impl->timer = pw_loop_add_timer(main_loop, on_timeout, impl);
+	if (impl->timer == NULL) {
+		if (properties)
+			pw_properties_free(properties);
+		free(impl);
+		return -ENOMEM;
+	}
+
+	add_loop(impl, "main", main_loop);
+	check_data_loops(impl);
+
+	value.tv_sec = impl->interval;
+	value.tv_nsec = 0;
+	pw_loop_update_timer(main_loop, impl->timer, &value, &value, false);
+
+	pw_module_add_listener(module, &impl->module_listener, &module_events, impl);
+
+	return 0;
+}
+
+SPA_EXPORT
+int pipewire__module_init(struct pw_module *module, const char *args)
+{
+	struct pw_properties *props = NULL;
+
+	if (args)
+		props = pw_properties_new_string(args);
+
+	return module_init(module, props);
+}
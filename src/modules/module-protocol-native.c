@@ -17,6 +17,7 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -28,6 +29,7 @@
 #include <sys/file.h>
 
 #include <spa/pod/iter.h>
+#include <spa/pod/validate.h>
 #include <spa/debug/pod.h>
 
 #include "config.h"
@@ -70,6 +72,8 @@ struct protocol_data {
 	struct spa_hook module_listener;
 	struct pw_protocol *protocol;
 	struct pw_properties *properties;
+
+	struct pw_protocol_native_types types;
 };
 
 struct client {
@@ -83,7 +87,10 @@ struct client {
 
         bool disconnecting;
 	bool flush_signaled;
+	bool need_write;
         struct spa_source *flush_event;
+
+	struct pw_protocol_native_types types;
 };
 
 struct server {
@@ -105,35 +112,47 @@ struct client_data {
 	struct spa_source *source;
 	struct pw_protocol_native_connection *connection;
 	bool busy;
+	bool need_write;
+	bool types_fd_sent;
 };
 
-static bool pod_remap_data(uint32_t type, void *body, uint32_t size, struct pw_map *types)
+/* ids below n_identity are the same on both sides and need no lookup */
+static inline bool remap_id(uint32_t *id, struct pw_map *types, uint32_t n_identity)
 {
 	void *t;
 
+	if (*id < n_identity)
+		return true;
+	if ((t = pw_map_lookup(types, *id)) == NULL)
+		return false;
+	*id = PW_MAP_PTR_TO_ID(t);
+	return true;
+}
+
+static bool pod_remap_data(uint32_t type, void *body, uint32_t size,
+			   struct pw_map *types, uint32_t n_identity)
+{
 	switch (type) {
 	case SPA_POD_TYPE_ID:
-		if ((t = pw_map_lookup(types, *(int32_t *) body)) == NULL)
+		if (!remap_id(body, types, n_identity))
 			return false;
-		*(int32_t *) body = PW_MAP_PTR_TO_ID(t);
 		break;
 
 	case SPA_POD_TYPE_PROP:
 	{
 		struct spa_pod_prop_body *b = body;
 
-		if ((t = pw_map_lookup(types, b->key)) == NULL)
+		if (!remap_id(&b->key, types, n_identity))
 			return false;
-		b->key = PW_MAP_PTR_TO_ID(t);
 
 		if (b->value.type == SPA_POD_TYPE_ID) {
 			void *alt;
-			if (!pod_remap_data
-			    (b->value.type, SPA_POD_BODY(&b->value), b->value.size, types))
+			if (!pod_remap_data(b->value.type, SPA_POD_BODY(&b->value),
+					    b->value.size, types, n_identity))
 				return false;
 
 			SPA_POD_PROP_ALTERNATIVE_FOREACH(b, size, alt)
-				if (!pod_remap_data(b->value.type, alt, b->value.size, types))
+				if (!pod_remap_data(b->value.type, alt, b->value.size, types, n_identity))
 					return false;
 		}
 		break;
@@ -143,17 +162,14 @@ static bool pod_remap_data(uint32_t type, void *body, uint32_t size, struct pw_m
 		struct spa_pod_object_body *b = body;
 		struct spa_pod *p;
 
-		if ((t = pw_map_lookup(types, b->id)) != NULL)
-			b->id = PW_MAP_PTR_TO_ID(t);
-		else
+		if (!remap_id(&b->id, types, n_identity))
 			b->id = SPA_ID_INVALID;
 
-		if ((t = pw_map_lookup(types, b->type)) == NULL)
+		if (!remap_id(&b->type, types, n_identity))
 			return false;
-		b->type = PW_MAP_PTR_TO_ID(t);
 
 		SPA_POD_OBJECT_BODY_FOREACH(b, size, p)
-			if (!pod_remap_data(p->type, SPA_POD_BODY(p), p->size, types))
+			if (!pod_remap_data(p->type, SPA_POD_BODY(p), p->size, types, n_identity))
 				return false;
 		break;
 	}
@@ -162,7 +178,7 @@ static bool pod_remap_data(uint32_t type, void *body, uint32_t size, struct pw_m
 		struct spa_pod *b = body, *p;
 
 		SPA_POD_FOREACH(b, size, p)
-			if (!pod_remap_data(p->type, SPA_POD_BODY(p), p->size, types))
+			if (!pod_remap_data(p->type, SPA_POD_BODY(p), p->size, types, n_identity))
 				return false;
 		break;
 	}
@@ -226,8 +242,12 @@ process_messages(struct client_data *data)
 			continue;
 		}
 
+		if (spa_pod_validate(message, size) < 0)
+			goto invalid_message;
+
 		if (demarshal[opcode].flags & PW_PROTOCOL_NATIVE_REMAP)
-			if (!pod_remap_data(SPA_POD_TYPE_STRUCT, message, size, &client->types))
+			if (!pod_remap_data(SPA_POD_TYPE_STRUCT, message, size,
+					    &client->types, client->n_identity))
 				goto invalid_message;
 
 		if (debug_messages) {
@@ -253,20 +273,51 @@ process_messages(struct client_data *data)
 	goto done;
 }
 
+static void client_update_io(struct client_data *c)
+{
+	enum spa_io mask = SPA_IO_ERR | SPA_IO_HUP;
+
+	if (!c->busy)
+		mask |= SPA_IO_IN;
+	if (c->need_write)
+		mask |= SPA_IO_OUT;
+
+	pw_loop_update_io(c->client->core->main_loop, c->source, mask);
+}
+
+/* write the queued messages, when the socket is full we continue when
+ * it becomes writable. On errors the client and \c c are destroyed and
+ * the error is returned. */
+static int client_flush(struct client_data *c)
+{
+	int res;
+	bool need_write;
+
+	res = pw_protocol_native_connection_flush(c->connection);
+	if (res < 0 && res != -EAGAIN) {
+		pw_log_error("protocol-native %p: client %p flush error: %s",
+			     c->client->protocol, c->client, spa_strerror(res));
+		pw_client_destroy(c->client);
+		return res;
+	}
+	need_write = res == -EAGAIN;
+	if (need_write != c->need_write) {
+		c->need_write = need_write;
+		client_update_io(c);
+	}
+	return 0;
+}
+
 static void
 client_busy_changed(void *data, bool busy)
 {
 	struct client_data *c = data;
 	struct pw_client *client = c->client;
-	enum spa_io mask = SPA_IO_ERR | SPA_IO_HUP;
 
 	c->busy = busy;
 
-	if (!busy)
-		mask |= SPA_IO_IN;
-
 	pw_log_debug("protocol-native %p: busy changed %d", client->protocol, busy);
-	pw_loop_update_io(client->core->main_loop, c->source, mask);
+	client_update_io(c);
 
 	if (!busy)
 		process_messages(c);
@@ -285,6 +336,11 @@ connection_data(void *data, int fd, enum spa_io mask)
 		return;
 	}
 
+	if (mask & SPA_IO_OUT) {
+		if (client_flush(this) < 0)
+			return;
+	}
+
 	if (mask & SPA_IO_IN)
 		process_messages(this);
 }
@@ -450,8 +506,7 @@ socket_data(void *data, int fd, enum spa_io mask)
 	}
 	c = client->user_data;
 
-	pw_loop_update_io(client->protocol->core->main_loop,
-			  c->source, SPA_IO_IN | SPA_IO_ERR | SPA_IO_HUP);
+	client_update_io(c);
 }
 
 static bool add_socket(struct pw_protocol *protocol, struct server *s)
@@ -521,6 +576,27 @@ static int impl_steal_fd(struct pw_protocol_client *client)
 	return fd;
 }
 
+static void remote_flush(struct client *impl)
+{
+	struct pw_remote *remote = impl->this.remote;
+	enum spa_io mask = SPA_IO_IN | SPA_IO_HUP | SPA_IO_ERR;
+	bool need_write;
+	int res;
+
+	res = pw_protocol_native_connection_flush(impl->connection);
+	if (res < 0 && res != -EAGAIN) {
+		impl->this.disconnect(&impl->this);
+		return;
+	}
+	need_write = res == -EAGAIN;
+	if (need_write != impl->need_write && impl->source) {
+		impl->need_write = need_write;
+		if (need_write)
+			mask |= SPA_IO_OUT;
+		pw_loop_update_io(remote->core->main_loop, impl->source, mask);
+	}
+}
+
 static void
 on_remote_data(void *data, int fd, enum spa_io mask)
 {
@@ -537,6 +613,12 @@ on_remote_data(void *data, int fd, enum spa_io mask)
 		return;
         }
 
+	if (mask & SPA_IO_OUT) {
+		remote_flush(impl);
+		if (impl->connection == NULL)
+			return;
+	}
+
         if (mask & SPA_IO_IN) {
                 uint8_t opcode;
                 uint32_t id;
@@ -572,8 +654,14 @@ on_remote_data(void *data, int fd, enum spa_io mask)
 				continue;
 			}
 
+			if (spa_pod_validate(message, size) < 0) {
+				pw_log_error("protocol-native %p: invalid message received %u for %u",
+					     this, opcode, id);
+				continue;
+			}
 			if (demarshal[opcode].flags & PW_PROTOCOL_NATIVE_REMAP) {
-				if (!pod_remap_data(SPA_POD_TYPE_STRUCT, message, size, &this->types)) {
+				if (!pod_remap_data(SPA_POD_TYPE_STRUCT, message, size,
+						    &this->types, this->n_identity)) {
                                         pw_log_error
                                             ("protocol-native %p: invalid message received %u for %u", this,
                                              opcode, id);
@@ -599,8 +687,7 @@ static void do_flush_event(void *data, uint64_t count)
         struct client *impl = data;
 	impl->flush_signaled = false;
         if (impl->connection)
-                if (!pw_protocol_native_connection_flush(impl->connection))
-                        impl->this.disconnect(&impl->this);
+		remote_flush(impl);
 }
 
 static void on_need_flush(void *data)
@@ -625,6 +712,7 @@ static int impl_connect_fd(struct pw_protocol_client *client, int fd)
 	struct pw_remote *remote = client->remote;
 
 	impl->disconnecting = false;
+	impl->need_write = false;
 
 	impl->connection = pw_protocol_native_connection_new(remote->core, fd);
 	if (impl->connection == NULL)
@@ -663,6 +751,8 @@ static void impl_disconnect(struct pw_protocol_client *client)
 	if (impl->connection)
                 pw_protocol_native_connection_destroy(impl->connection);
 	impl->connection = NULL;
+
+	pw_protocol_native_types_clear(&impl->types);
 }
 
 static void impl_destroy(struct pw_protocol_client *client)
@@ -698,6 +788,10 @@ impl_new_client(struct pw_protocol *protocol,
 	this->remote = remote;
 
 	impl->properties = properties ? pw_properties_copy(properties) : NULL;
+	impl->types.fd = -1;
+
+	pw_properties_setf(remote->properties, PW_PROTOCOL_NATIVE_PROP_VERSION,
+			   "%d", PW_PROTOCOL_NATIVE_VERSION);
 
 	if (properties)
 		str = pw_properties_get(properties, "remote.intention");
@@ -751,7 +845,7 @@ static void on_before_hook(void *_data)
 
 	spa_list_for_each_safe(client, tmp, &this->client_list, protocol_link) {
 		data = client->user_data;
-		pw_protocol_native_connection_flush(data->connection);
+		client_flush(data);
 	}
 }
 
@@ -886,6 +980,38 @@ const static struct pw_protocol_native_ext protocol_ext_impl = {
 	impl_ext_end_resource,
 };
 
+struct pw_protocol_native_types *pw_protocol_native_get_server_types(struct pw_resource *resource)
+{
+	struct protocol_data *d = pw_protocol_get_user_data(pw_resource_get_protocol(resource));
+	const struct pw_properties *props;
+	const char *str;
+
+	/* older clients only understand the type strings */
+	props = pw_client_get_properties(pw_resource_get_client(resource));
+	if (props == NULL ||
+	    (str = pw_properties_get(props, PW_PROTOCOL_NATIVE_PROP_VERSION)) == NULL ||
+	    atoi(str) < PW_PROTOCOL_NATIVE_VERSION_SHARED_TYPES)
+		return NULL;
+
+	return &d->types;
+}
+
+bool pw_protocol_native_take_types_fd(struct pw_resource *resource)
+{
+	struct client_data *c = pw_client_get_user_data(pw_resource_get_client(resource));
+
+	if (c->types_fd_sent)
+		return false;
+	c->types_fd_sent = true;
+	return true;
+}
+
+struct pw_protocol_native_types *pw_protocol_native_get_client_types(struct pw_proxy *proxy)
+{
+	struct client *impl = SPA_CONTAINER_OF(proxy->remote->conn, struct client, this);
+	return &impl->types;
+}
+
 static void module_destroy(void *data)
 {
 	struct protocol_data *d = data;
@@ -895,6 +1021,8 @@ static void module_destroy(void *data)
 	if (d->properties)
 		pw_properties_free(d->properties);
 
+	pw_protocol_native_types_clear(&d->types);
+
 	pw_protocol_destroy(d->protocol);
 }
 
@@ -930,13 +1058,22 @@ static int module_init(struct pw_module *module, struct pw_properties *propertie
 	d->protocol = this;
 	d->module = module;
 	d->properties = properties;
+	d->types.fd = -1;
 
 	val = getenv("PIPEWIRE_DAEMON");
 	if (val == NULL)
 		val = pw_properties_get(pw_core_get_properties(core), PW_CORE_PROP_DAEMON);
 	if (val && pw_properties_parse_bool(val)) {
+		struct spa_dict_item item;
+		char version[16];
+
 		if (impl_add_server(this, core, properties) == NULL)
 			return -errno;
+
+		/* let the clients know what methods they can use */
+		snprintf(version, sizeof(version), "%d", PW_PROTOCOL_NATIVE_VERSION);
+		item = SPA_DICT_ITEM_INIT(PW_PROTOCOL_NATIVE_PROP_VERSION, version);
+		pw_core_update_properties(core, &SPA_DICT_INIT(&item, 1));
 	}
 
 	pw_module_add_listener(module, &d->module_listener, &module_events, d);
@@ -23,9 +23,11 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/socket.h>
 
 #include <spa/debug/pod.h>
+#include <spa/pod/parser.h>
 
 #include <pipewire/pipewire.h>
 #include <pipewire/private.h>
@@ -35,14 +37,53 @@
 #define MAX_BUFFER_SIZE (1024 * 32)
 #define MAX_FDS 28
 
+/* the output is queued in segments of messages. The fds of a segment are sent
+ * with its first byte, a segment with fds always starts a new sendmsg. The
+ * segment owns a dup of its fds so that the caller can close them before the
+ * segment is sent, they are closed when sent or when the segment is freed.
+ *
+ * The receiver can get the end of the previous segment and the fds of the
+ * next one from the same recvmsg, so a message with fds is followed by a
+ * struct with the index of its first fd in the segment and the number of
+ * fds. The receiver queues the fds and each message takes its own fds from
+ * the queue. Older receivers ignore the struct after the message, messages
+ * without it use the fds of the last recvmsg. */
+#define SEGMENT_SIZE	(1024 * 32)
+#define SEGMENT_FILL	(1024 * 16)
+/* fds a single message can add */
+#define MAX_MESSAGE_FDS	8
+/* received fds that are kept for the next messages */
+#define MAX_QUEUED_FDS	(MAX_FDS * 2)
+#define MAX_IOV		16
+/* a peer that doesn't read is disconnected when this much is queued */
+#define MAX_QUEUED	(16 * 1024 * 1024)
+
 static bool debug_messages = 0;
 
+struct segment {
+	struct spa_list link;
+	uint8_t *data;
+	size_t size;		/**< size of the complete messages */
+	size_t maxsize;
+	size_t offset;		/**< bytes already sent */
+	int fds[MAX_FDS];	/**< owned fds, -1 after they are sent */
+	int src_fds[MAX_FDS];	/**< fds of the callers, to find duplicates */
+	uint32_t n_fds;
+	bool fds_sent;
+};
+
 struct buffer {
 	uint8_t *buffer_data;
 	size_t buffer_size;
 	size_t buffer_maxsize;
-	int fds[MAX_FDS];
+	int fds[MAX_QUEUED_FDS];	/**< received fds that no message took yet */
 	uint32_t n_fds;
+	uint32_t last_fds;		/**< first fd of the last recvmsg in fds */
+	bool counted;			/**< the peer sends the fds of each message */
+
+	int msg_fds[MAX_FDS];		/**< fds of the current message */
+	uint32_t msg_base;		/**< index of msg_fds[0] in its segment */
+	uint32_t msg_n_fds;
 
 	size_t offset;
 	void *data;
@@ -54,7 +95,14 @@ struct buffer {
 struct impl {
 	struct pw_protocol_native_connection this;
 
-	struct buffer in, out;
+	struct buffer in;
+
+	struct spa_list out_queue;	/**< queued segments */
+	struct segment *out_free;	/**< spare segment */
+	struct segment *current;	/**< segment of the message being written */
+	uint32_t msg_fds;		/**< first fd of the message being written */
+	size_t out_queued;
+	int out_error;
 
 	uint32_t dest_id;
 	uint8_t opcode;
@@ -76,11 +124,17 @@ struct impl {
 int pw_protocol_native_connection_get_fd(struct pw_protocol_native_connection *conn, uint32_t index)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	struct buffer *buf = &impl->in;
 
-	if (index >= impl->in.n_fds)
+	if (buf->counted) {
+		if (index < buf->msg_base || index - buf->msg_base >= buf->msg_n_fds)
+			return -1;
+		return buf->msg_fds[index - buf->msg_base];
+	}
+	if (index >= buf->n_fds - buf->last_fds)
 		return -1;
 
-	return impl->in.fds[index];
+	return buf->fds[buf->last_fds + index];
 }
 
 /** Add an fd to a connection
@@ -94,21 +148,31 @@ int pw_protocol_native_connection_get_fd(struct pw_protocol_native_connection *c
 uint32_t pw_protocol_native_connection_add_fd(struct pw_protocol_native_connection *conn, int fd)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	struct segment *seg = impl->current;
 	uint32_t index, i;
 
-	for (i = 0; i < impl->out.n_fds; i++) {
-		if (impl->out.fds[i] == fd)
+	if (seg == NULL)
+		return -1;
+
+	/* the fds of the caller are only known to be alive while this message
+	 * is written, an fd number of an older message can be reused */
+	for (i = impl->msg_fds; i < seg->n_fds; i++) {
+		if (seg->src_fds[i] == fd)
 			return i;
 	}
 
-	index = impl->out.n_fds;
+	index = seg->n_fds;
 	if (index >= MAX_FDS) {
 		pw_log_error("connection %p: too many fds", conn);
 		return -1;
 	}
 
-	impl->out.fds[index] = fd;
-	impl->out.n_fds++;
+	if ((seg->fds[index] = fcntl(fd, F_DUPFD_CLOEXEC, 0)) < 0) {
+		pw_log_error("connection %p: can't dup fd %d: %m", conn, fd);
+		return -1;
+	}
+	seg->src_fds[index] = fd;
+	seg->n_fds++;
 
 	return index;
 }
@@ -136,6 +200,7 @@ static bool refill_buffer(struct pw_protocol_native_connection *conn, struct buf
 	struct msghdr msg = { 0 };
 	struct iovec iov[1];
 	char cmsgbuf[CMSG_SPACE(MAX_FDS * sizeof(int))];
+	uint32_t i, n_fds;
 
 	iov[0].iov_base = buf->buffer_data + buf->buffer_size;
 	iov[0].iov_len = buf->buffer_maxsize - buf->buffer_size;
@@ -159,18 +224,30 @@ static bool refill_buffer(struct pw_protocol_native_connection *conn, struct buf
 
 	buf->buffer_size += len;
 
-	/* handle control messages */
-	buf->n_fds = 0;
+	/* handle control messages, the fds are queued for the messages that
+	 * take them */
 	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
 		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
 			continue;
 
-		buf->n_fds =
-		    (cmsg->cmsg_len - ((char *) CMSG_DATA(cmsg) - (char *) cmsg)) / sizeof(int);
-		memcpy(buf->fds, CMSG_DATA(cmsg), buf->n_fds * sizeof(int));
+		n_fds = (cmsg->cmsg_len - ((char *) CMSG_DATA(cmsg) - (char *) cmsg)) / sizeof(int);
+
+		/* without counts, only the fds of the last recvmsg are used and
+		 * the older ones can be dropped */
+		if (!buf->counted && buf->n_fds + n_fds > MAX_QUEUED_FDS)
+			buf->n_fds = 0;
+		if (buf->n_fds + n_fds > MAX_QUEUED_FDS) {
+			pw_log_error("connection %p: too many fds queued", conn);
+			for (i = 0; i < n_fds; i++)
+				close(((int *) CMSG_DATA(cmsg))[i]);
+			continue;
+		}
+		buf->last_fds = buf->n_fds;
+		memcpy(&buf->fds[buf->n_fds], CMSG_DATA(cmsg), n_fds * sizeof(int));
+		buf->n_fds += n_fds;
 	}
 	pw_log_trace("connection %p: %d read %zd bytes and %d fds", conn, conn->fd, len,
-		     buf->n_fds);
+		     buf->n_fds - buf->last_fds);
 
 	return true;
 
@@ -182,12 +259,106 @@ static bool refill_buffer(struct pw_protocol_native_connection *conn, struct buf
 
 static void clear_buffer(struct buffer *buf)
 {
-	buf->n_fds = 0;
 	buf->offset = 0;
 	buf->size = 0;
 	buf->buffer_size = 0;
 }
 
+/* move the unread data to the start of the buffer */
+static void shift_buffer(struct buffer *buf)
+{
+	if (buf->offset == 0)
+		return;
+	memmove(buf->buffer_data, buf->buffer_data + buf->offset, buf->buffer_size - buf->offset);
+	buf->buffer_size -= buf->offset;
+	buf->offset = 0;
+}
+
+static void close_fds(struct segment *seg)
+{
+	uint32_t i;
+
+	for (i = 0; i < seg->n_fds; i++) {
+		if (seg->fds[i] != -1)
+			close(seg->fds[i]);
+		seg->fds[i] = -1;
+	}
+}
+
+static void free_segment(struct impl *impl, struct segment *seg)
+{
+	spa_list_remove(&seg->link);
+	impl->out_queued -= seg->size;
+	close_fds(seg);
+
+	if (impl->out_free == NULL && seg->maxsize == SEGMENT_SIZE) {
+		seg->size = seg->offset = 0;
+		seg->n_fds = 0;
+		seg->fds_sent = false;
+		impl->out_free = seg;
+	} else {
+		free(seg->data);
+		free(seg);
+	}
+}
+
+static void clear_queue(struct impl *impl)
+{
+	struct segment *seg;
+
+	spa_list_consume(seg, &impl->out_queue, link)
+		free_segment(impl, seg);
+	impl->current = NULL;
+	impl->out_error = 0;
+}
+
+/* get the segment to write the next message in */
+static struct segment *get_segment(struct impl *impl)
+{
+	struct segment *seg = NULL;
+
+	if (!spa_list_is_empty(&impl->out_queue)) {
+		seg = spa_list_last(&impl->out_queue, struct segment, link);
+		if (seg->fds_sent ||
+		    seg->size >= SEGMENT_FILL ||
+		    seg->n_fds > MAX_FDS - MAX_MESSAGE_FDS)
+			seg = NULL;
+	}
+	if (seg == NULL) {
+		if ((seg = impl->out_free) != NULL) {
+			impl->out_free = NULL;
+		} else {
+			if ((seg = calloc(1, sizeof(struct segment))) == NULL)
+				return NULL;
+			if ((seg->data = malloc(SEGMENT_SIZE)) == NULL) {
+				free(seg);
+				return NULL;
+			}
+			seg->maxsize = SEGMENT_SIZE;
+		}
+		spa_list_append(&impl->out_queue, &seg->link);
+	}
+	return seg;
+}
+
+static void *segment_ensure_size(struct pw_protocol_native_connection *conn,
+				 struct segment *seg, size_t size)
+{
+	if (seg->size + size > seg->maxsize) {
+		size_t maxsize = SPA_ROUND_UP_N(seg->size + size, SEGMENT_SIZE);
+		uint8_t *data;
+
+		if ((data = realloc(seg->data, maxsize)) == NULL) {
+			spa_hook_list_call(&conn->listener_list,
+					struct pw_protocol_native_connection_events, error, 0, -ENOMEM);
+			return NULL;
+		}
+		seg->data = data;
+		seg->maxsize = maxsize;
+	}
+	return seg->data + seg->size;
+}
+
 /** Make a new connection object for the given socket
  *
  * \param fd the socket
@@ -213,21 +384,18 @@ struct pw_protocol_native_connection *pw_protocol_native_connection_new(struct p
 	this->fd = fd;
 	spa_hook_list_init(&this->listener_list);
 
-	impl->out.buffer_data = malloc(MAX_BUFFER_SIZE);
-	impl->out.buffer_maxsize = MAX_BUFFER_SIZE;
+	spa_list_init(&impl->out_queue);
 	impl->in.buffer_data = malloc(MAX_BUFFER_SIZE);
 	impl->in.buffer_maxsize = MAX_BUFFER_SIZE;
 	impl->in.update = true;
 	impl->core = core;
 
-	if (impl->out.buffer_data == NULL || impl->in.buffer_data == NULL)
+	if (impl->in.buffer_data == NULL)
 		goto no_mem;
 
 	return this;
 
       no_mem:
-	free(impl->out.buffer_data);
-	free(impl->in.buffer_data);
 	free(impl);
 	return NULL;
 }
@@ -246,11 +414,54 @@ void pw_protocol_native_connection_destroy(struct pw_protocol_native_connection
 
 	spa_hook_list_call(&conn->listener_list, struct pw_protocol_native_connection_events, destroy, 0);
 
-	free(impl->out.buffer_data);
+	clear_queue(impl);
+	if (impl->out_free) {
+		free(impl->out_free->data);
+		free(impl->out_free);
+	}
 	free(impl->in.buffer_data);
 	free(impl);
 }
 
+/* a message with fds is followed by a struct with the index of its first fd
+ * and the number of fds, take them from the queue. Returns the size of the
+ * message without the struct. */
+static uint32_t take_fds(struct pw_protocol_native_connection *conn, struct buffer *buf)
+{
+	struct spa_pod *pod = buf->data;
+	struct spa_pod_parser prs;
+	uint32_t offset;
+	int32_t base, n_fds;
+
+	buf->msg_base = buf->msg_n_fds = 0;
+
+	if (buf->size < sizeof(struct spa_pod) ||
+	    (offset = SPA_ROUND_UP_N(SPA_POD_SIZE(pod), 8)) >= buf->size)
+		return buf->size;
+
+	spa_pod_parser_init(&prs, buf->data, buf->size, offset);
+	if (spa_pod_parser_get(&prs, "[ i", &base, "i", &n_fds, "]", NULL) < 0 ||
+	    base < 0 || n_fds < 0 || n_fds > MAX_FDS) {
+		pw_log_warn("connection %p: invalid fds of message", conn);
+		return buf->size;
+	}
+	buf->counted = true;
+
+	if ((uint32_t) n_fds > buf->n_fds) {
+		pw_log_error("connection %p: missing fds for message", conn);
+		n_fds = buf->n_fds;
+	}
+	memcpy(buf->msg_fds, buf->fds, n_fds * sizeof(int));
+	buf->msg_base = base;
+	buf->msg_n_fds = n_fds;
+
+	buf->n_fds -= n_fds;
+	memmove(buf->fds, &buf->fds[n_fds], buf->n_fds * sizeof(int));
+	buf->last_fds = buf->last_fds > (uint32_t) n_fds ? buf->last_fds - n_fds : 0;
+
+	return offset;
+}
+
 /** Move to the next packet in the connection
  *
  * \param conn the connection
@@ -280,8 +491,9 @@ pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *con
 
 	buf = &impl->in;
 
-	/* move to next packet */
+	/* move to next packet, only once when we need to wait for more data */
 	buf->offset += buf->size;
+	buf->size = 0;
 
       again:
 	if (buf->update) {
@@ -304,6 +516,7 @@ pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *con
 	size -= buf->offset;
 
 	if (size < 8) {
+		shift_buffer(buf);
 		if (connection_ensure_size(conn, buf, 8) == NULL)
 			return false;
 		buf->update = true;
@@ -318,6 +531,7 @@ pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *con
 	len = p[1] & 0xffffff;
 
 	if (len > size) {
+		shift_buffer(buf);
 		if (connection_ensure_size(conn, buf, len) == NULL)
 			return false;
 		buf->update = true;
@@ -328,7 +542,7 @@ pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *con
 	buf->offset += 8;
 
 	*dt = buf->data;
-	*sz = buf->size;
+	*sz = take_fds(conn, buf);
 
 	return true;
 }
@@ -337,9 +551,11 @@ static inline void *begin_write(struct pw_protocol_native_connection *conn, uint
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
 	uint32_t *p;
-	struct buffer *buf = &impl->out;
+
+	if (impl->current == NULL)
+		return NULL;
 	/* 4 for dest_id, 1 for opcode, 3 for size and size for payload */
-	if ((p = connection_ensure_size(conn, buf, 8 + size)) == NULL)
+	if ((p = segment_ensure_size(conn, impl->current, 8 + size)) == NULL)
 		return NULL;
 
 	return p + 2;
@@ -350,7 +566,7 @@ static uint32_t write_pod(struct spa_pod_builder *b, const void *data, uint32_t
 	struct impl *impl = SPA_CONTAINER_OF(b, struct impl, builder);
 	uint32_t ref = b->state.offset;
 
-        if (b->size <= ref) {
+        if (b->size < ref + size) {
                 b->size = SPA_ROUND_UP_N(ref + size, 4096);
                 b->data = begin_write(&impl->this, b->size);
         }
@@ -383,6 +599,8 @@ pw_protocol_native_connection_begin_resource(struct pw_protocol_native_connectio
 
 	impl->dest_id = resource->id;
 	impl->opcode = opcode;
+	impl->current = get_segment(impl);
+	impl->msg_fds = impl->current ? impl->current->n_fds : 0;
 	impl->builder = (struct spa_pod_builder) { NULL, 0, write_pod };
 
 	return &impl->builder;
@@ -412,6 +630,8 @@ pw_protocol_native_connection_begin_proxy(struct pw_protocol_native_connection *
 
 	impl->dest_id = proxy->id;
 	impl->opcode = opcode;
+	impl->current = get_segment(impl);
+	impl->msg_fds = impl->current ? impl->current->n_fds : 0;
 	impl->builder = (struct spa_pod_builder) { NULL, 0, write_pod, };
 
 	return &impl->builder;
@@ -423,15 +643,36 @@ pw_protocol_native_connection_end(struct pw_protocol_native_connection *conn,
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
 	uint32_t *p, size = builder->state.offset;
-	struct buffer *buf = &impl->out;
+	struct segment *seg = impl->current;
 
-	if ((p = connection_ensure_size(conn, buf, 8 + size)) == NULL)
+	if (seg == NULL)
+		return;
+
+	if (seg->n_fds > impl->msg_fds) {
+		/* the fds of the message, see take_fds() */
+		spa_pod_builder_add(builder,
+				"[",
+				"i", impl->msg_fds,
+				"i", seg->n_fds - impl->msg_fds,
+				"]", NULL);
+		size = builder->state.offset;
+	}
+	impl->current = NULL;
+
+	if ((p = segment_ensure_size(conn, seg, 8 + size)) == NULL)
 		return;
 
 	*p++ = impl->dest_id;
 	*p++ = (impl->opcode << 24) | (size & 0xffffff);
 
-	buf->buffer_size += 8 + size;
+	seg->size += 8 + size;
+	impl->out_queued += 8 + size;
+
+	if (impl->out_queued > MAX_QUEUED && impl->out_error == 0) {
+		pw_log_error("connection %p: %zd bytes queued, peer is not reading",
+			     conn, impl->out_queued);
+		impl->out_error = -ENOSPC;
+	}
 
 	if (debug_messages) {
 		printf(">>>>>>>>> out: %d %d %d\n", impl->dest_id, impl->opcode, size);
@@ -444,74 +685,112 @@ pw_protocol_native_connection_end(struct pw_protocol_native_connection *conn,
 /** Flush the connection object
  *
  * \param conn the connection object
- * \return true on success
+ * \return 0 when all messages were written, -EAGAIN when the socket is full
+ *	and the flush should be retried when it becomes writable or a
+ *	negative errno on error
  *
  * Write the queued messages on the connection to the socket
  *
  * \memberof pw_protocol_native_connection
  */
-bool pw_protocol_native_connection_flush(struct pw_protocol_native_connection *conn)
+int pw_protocol_native_connection_flush(struct pw_protocol_native_connection *conn)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
 	ssize_t len;
 	struct msghdr msg = { 0 };
-	struct iovec iov[1];
+	struct iovec iov[MAX_IOV];
 	struct cmsghdr *cmsg;
 	char cmsgbuf[CMSG_SPACE(MAX_FDS * sizeof(int))];
 	int *cm;
-	uint32_t i, fds_len;
-	struct buffer *buf;
-
-	buf = &impl->out;
+	uint32_t i, n_iov, fds_len;
+	struct segment *seg, *first, *t;
+	int res;
 
-	if (buf->buffer_size == 0)
-		return true;
-
-	fds_len = buf->n_fds * sizeof(int);
-
-	iov[0].iov_base = buf->buffer_data;
-	iov[0].iov_len = buf->buffer_size;
-	msg.msg_iov = iov;
-	msg.msg_iovlen = 1;
-
-	if (buf->n_fds > 0) {
-		msg.msg_control = cmsgbuf;
-		msg.msg_controllen = CMSG_SPACE(fds_len);
-		cmsg = CMSG_FIRSTHDR(&msg);
-		cmsg->cmsg_level = SOL_SOCKET;
-		cmsg->cmsg_type = SCM_RIGHTS;
-		cmsg->cmsg_len = CMSG_LEN(fds_len);
-		cm = (int *) CMSG_DATA(cmsg);
-		for (i = 0; i < buf->n_fds; i++)
-			cm[i] = buf->fds[i] > 0 ? buf->fds[i] : -buf->fds[i];
-		msg.msg_controllen = cmsg->cmsg_len;
-	} else {
-		msg.msg_control = NULL;
-		msg.msg_controllen = 0;
-	}
+	if (impl->out_error < 0)
+		return impl->out_error;
 
 	while (true) {
-		len = sendmsg(conn->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
-		if (len < 0) {
-			if (errno == EINTR)
+		/* gather the segments, the fds can only go with the first one */
+		first = NULL;
+		n_iov = 0;
+		spa_list_for_each(seg, &impl->out_queue, link) {
+			if (seg->size == seg->offset)
 				continue;
-			else
+			if (first == NULL)
+				first = seg;
+			else if (n_iov == MAX_IOV || (seg->n_fds > 0 && !seg->fds_sent))
+				break;
+			iov[n_iov].iov_base = seg->data + seg->offset;
+			iov[n_iov].iov_len = seg->size - seg->offset;
+			n_iov++;
+		}
+		if (first == NULL)
+			break;
+
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n_iov;
+
+		if (first->n_fds > 0 && !first->fds_sent) {
+			fds_len = first->n_fds * sizeof(int);
+			msg.msg_control = cmsgbuf;
+			msg.msg_controllen = CMSG_SPACE(fds_len);
+			cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(fds_len);
+			cm = (int *) CMSG_DATA(cmsg);
+			for (i = 0; i < first->n_fds; i++)
+				cm[i] = first->fds[i];
+			msg.msg_controllen = cmsg->cmsg_len;
+		} else {
+			msg.msg_control = NULL;
+			msg.msg_controllen = 0;
+		}
+
+		while (true) {
+			len = sendmsg(conn->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (len < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return -EAGAIN;
 				goto send_error;
+			}
+			break;
 		}
-		break;
-	}
-	pw_log_trace("connection %p: %d written %zd bytes and %u fds", conn, conn->fd, len,
-		     buf->n_fds);
+		pw_log_trace("connection %p: %d written %zd bytes and %u fds", conn, conn->fd, len,
+			     msg.msg_controllen ? first->n_fds : 0);
 
-	buf->buffer_size -= len;
-	buf->n_fds = 0;
+		if (msg.msg_controllen) {
+			/* the peer has its own copy now */
+			first->fds_sent = true;
+			close_fds(first);
+		}
 
-	return true;
+		/* consume what was written, partially written segments
+		 * are resumed in the next round */
+		spa_list_for_each_safe(seg, t, &impl->out_queue, link) {
+			size_t avail = seg->size - seg->offset;
+
+			if ((size_t) len < avail) {
+				seg->offset += len;
+				break;
+			}
+			seg->offset = seg->size;
+			len -= avail;
+
+			if (seg == impl->current)
+				break;
+			free_segment(impl, seg);
+		}
+	}
+	return 0;
 
 	/* ERRORS */
       send_error:
-	pw_log_error("could not sendmsg: %s", strerror(errno));
-	return false;
+	res = -errno;
+	pw_log_error("could not sendmsg: %s", strerror(-res));
+	return res;
 }
 
 /** Clear the connection object
@@ -527,8 +806,10 @@ bool pw_protocol_native_connection_clear(struct pw_protocol_native_connection *c
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
 
-	clear_buffer(&impl->out);
+	clear_queue(impl);
 	clear_buffer(&impl->in);
+	impl->in.n_fds = impl->in.last_fds = 0;
+	impl->in.msg_n_fds = 0;
 	impl->in.update = true;
 
 	return true;
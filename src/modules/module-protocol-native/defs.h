@@ -17,9 +17,31 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include "pipewire/array.h"
+#include "pipewire/mem.h"
+
 int pw_protocol_native_connect_local_socket(struct pw_protocol_client *client,
 					    void (*done_callback) (void *data, int res),
 					    void *data);
 int pw_protocol_native_connect_portal_screencast(struct pw_protocol_client *client,
 					    void (*done_callback) (void *data, int res),
 					    void *data);
+
+/** Type strings shared with the clients in a sealed memfd. The server
+ * appends the strings of new types and only sends the range of new ids
+ * and the offset of the first string. The clients map the memory read-only.
+ * The fd is only sent with the first update to a client and only to clients
+ * that announce at least PW_PROTOCOL_NATIVE_VERSION_SHARED_TYPES, older
+ * clients get the strings. */
+struct pw_protocol_native_types {
+	struct pw_memblock *mem;	/**< the strings, NUL separated */
+	int fd;				/**< read-only fd sent to the clients */
+	uint32_t n_types;		/**< number of types in the table */
+	uint32_t size;			/**< used size of the table */
+	struct pw_array offsets;	/**< offset of the string for each id */
+};
+
+struct pw_protocol_native_types *pw_protocol_native_get_server_types(struct pw_resource *resource);
+bool pw_protocol_native_take_types_fd(struct pw_resource *resource);
+struct pw_protocol_native_types *pw_protocol_native_get_client_types(struct pw_proxy *proxy);
+void pw_protocol_native_types_clear(struct pw_protocol_native_types *types);
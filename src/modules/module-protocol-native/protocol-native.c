@@ -18,9 +18,13 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include "spa/pod/parser.h"
+#include "spa/pod/validate.h"
 
 #include "pipewire/pipewire.h"
 #include "pipewire/protocol.h"
@@ -29,6 +33,101 @@
 #include "extensions/protocol-native.h"
 
 #include "connection.h"
+#include "defs.h"
+
+#ifndef F_GET_SEALS
+#define F_GET_SEALS	(1024 + 10)
+#define F_SEAL_SHRINK	0x0002
+#endif
+
+/* maximum size of the shared type strings, the memfd is sparse */
+#define TYPES_MAX_SIZE	(256 * 1024)
+
+/* a dict item is at least 2 string pods of 16 bytes */
+#define MAX_DICT_ITEMS(size)	((size) / 32)
+
+void pw_protocol_native_types_clear(struct pw_protocol_native_types *types)
+{
+	if (types->mem)
+		pw_memblock_free(types->mem);
+	if (types->fd != -1)
+		close(types->fd);
+	pw_array_clear(&types->offsets);
+	spa_zero(*types);
+	types->fd = -1;
+}
+
+static int types_init(struct pw_protocol_native_types *types)
+{
+	char path[64];
+	int res;
+
+	if ((res = pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
+				     PW_MEMBLOCK_FLAG_MAP_READWRITE |
+				     PW_MEMBLOCK_FLAG_SEAL, TYPES_MAX_SIZE, &types->mem)) < 0)
+		return res;
+
+	/* reopen the memfd read-only, the clients can't map this writable */
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", types->mem->fd);
+	if ((types->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+		res = -errno;
+		pw_log_warn("protocol-native: can't reopen type memfd: %m");
+		pw_protocol_native_types_clear(types);
+		return res;
+	}
+	pw_array_init(&types->offsets, 1024);
+	return 0;
+}
+
+/* append the strings of the core types up to \a n_types */
+static int types_sync(struct pw_protocol_native_types *types, struct spa_type_map *map,
+		      uint32_t n_types)
+{
+	int res;
+
+	if (types->mem == NULL && (res = types_init(types)) < 0)
+		return res;
+
+	while (types->n_types < n_types) {
+		const char *str = spa_type_map_get_type(map, types->n_types);
+		size_t len = strlen(str) + 1;
+		uint32_t *offset;
+
+		if (types->size + len > types->mem->size)
+			return -ENOSPC;
+		if ((offset = pw_array_add(&types->offsets, sizeof(uint32_t))) == NULL)
+			return -ENOMEM;
+
+		memcpy(SPA_MEMBER(types->mem->ptr, types->size, void), str, len);
+		*offset = types->size;
+		types->size += len;
+		types->n_types++;
+	}
+	return 0;
+}
+
+/* map the table of the server, the fd is consumed */
+static int types_import(struct pw_protocol_native_types *types, int fd, uint32_t size)
+{
+	int seals, res;
+
+	if (types->mem != NULL) {
+		close(fd);
+		return types->mem->size == size ? 0 : -EINVAL;
+	}
+
+	/* the server can't shrink the memory under our mapping */
+	if ((seals = fcntl(fd, F_GET_SEALS)) < 0 || (seals & F_SEAL_SHRINK) == 0) {
+		close(fd);
+		return -EINVAL;
+	}
+	if ((res = pw_memblock_import(PW_MEMBLOCK_FLAG_WITH_FD |
+				      PW_MEMBLOCK_FLAG_MAP_READ, fd, 0, size, &types->mem)) < 0) {
+		close(fd);
+		return res;
+	}
+	return 0;
+}
 
 static void core_marshal_hello(void *object)
 {
@@ -112,6 +211,34 @@ static void core_marshal_get_registry(void *object, uint32_t version, uint32_t n
 	pw_protocol_native_end_proxy(proxy, b);
 }
 
+static void
+core_marshal_get_registry_filtered(void *object, uint32_t version,
+				   const struct spa_dict *filter, uint32_t new_id)
+{
+	struct pw_proxy *proxy = object;
+	struct spa_pod_builder *b;
+	uint32_t i, n_items;
+
+	b = pw_protocol_native_begin_proxy(proxy, PW_CORE_PROXY_METHOD_GET_REGISTRY_FILTERED);
+
+	n_items = filter ? filter->n_items : 0;
+
+	spa_pod_builder_add(b,
+			    "[",
+			    "i", version,
+			    "i", new_id,
+			    "i", n_items, NULL);
+
+	for (i = 0; i < n_items; i++) {
+		spa_pod_builder_add(b,
+				    "s", filter->items[i].key,
+				    "s", filter->items[i].value, NULL);
+	}
+	spa_pod_builder_add(b, "]", NULL);
+
+	pw_protocol_native_end_proxy(proxy, b);
+}
+
 static void
 core_marshal_create_object(void *object,
 			   const char *factory_name,
@@ -180,6 +307,21 @@ core_marshal_update_types_client(void *object, uint32_t first_id, const char **t
 	pw_protocol_native_end_proxy(proxy, b);
 }
 
+/* messages are validated before they are demarshalled, the unchecked
+ * cursor can be used for the simple ones */
+static int cursor_get_dict_items(struct spa_pod_cursor *c,
+				 struct spa_dict_item *items, uint32_t n_items)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_items; i++) {
+		if (spa_pod_cursor_get_string(c, &items[i].key) < 0 ||
+		    spa_pod_cursor_get_string(c, &items[i].value) < 0)
+			return -EINVAL;
+	}
+	return 0;
+}
+
 static int core_demarshal_info(void *object, void *data, size_t size)
 {
 	struct pw_proxy *proxy = object;
@@ -202,6 +344,8 @@ static int core_demarshal_info(void *object, void *data, size_t size)
 		return -EINVAL;
 
 	info.props = &props;
+	if (props.n_items > MAX_DICT_ITEMS(size))
+		return -EINVAL;
 	props.items = alloca(props.n_items * sizeof(struct spa_dict_item));
 	for (i = 0; i < props.n_items; i++) {
 		if (spa_pod_parser_get(&prs,
@@ -217,11 +361,11 @@ static int core_demarshal_info(void *object, void *data, size_t size)
 static int core_demarshal_done(void *object, void *data, size_t size)
 {
 	struct pw_proxy *proxy = object;
-	struct spa_pod_parser prs;
-	uint32_t seq;
+	struct spa_pod_cursor c;
+	int32_t seq;
 
-	spa_pod_parser_init(&prs, data, size, 0);
-	if (spa_pod_parser_get(&prs, "[ i", &seq, NULL) < 0)
+	if (spa_pod_cursor_init(&c, data) < 0 ||
+	    spa_pod_cursor_get_int(&c, &seq) < 0)
 		return -EINVAL;
 
 	pw_proxy_notify(proxy, struct pw_core_proxy_events, done, 0, seq);
@@ -249,11 +393,11 @@ static int core_demarshal_error(void *object, void *data, size_t size)
 static int core_demarshal_remove_id(void *object, void *data, size_t size)
 {
 	struct pw_proxy *proxy = object;
-	struct spa_pod_parser prs;
-	uint32_t id;
+	struct spa_pod_cursor c;
+	int32_t id;
 
-	spa_pod_parser_init(&prs, data, size, 0);
-	if (spa_pod_parser_get(&prs, "[ i", &id, NULL) < 0)
+	if (spa_pod_cursor_init(&c, data) < 0 ||
+	    spa_pod_cursor_get_int(&c, &id) < 0)
 		return -EINVAL;
 
 	pw_proxy_notify(proxy, struct pw_core_proxy_events, remove_id, 0, id);
@@ -268,6 +412,8 @@ static int core_demarshal_update_types_client(void *object, void *data, size_t s
 	const char **types;
 	uint32_t i;
 
+	struct spa_pod *pod;
+
 	spa_pod_parser_init(&prs, data, size, 0);
 	if (spa_pod_parser_get(&prs,
 				"["
@@ -276,9 +422,52 @@ static int core_demarshal_update_types_client(void *object, void *data, size_t s
 		return -EINVAL;
 
 	types = alloca(n_types * sizeof(char *));
-	for (i = 0; i < n_types; i++) {
-		if (spa_pod_parser_get(&prs, "s", &types[i], NULL) < 0)
+
+	pod = spa_pod_iter_current(&prs.iter[prs.depth]);
+	if (pod && (SPA_POD_TYPE(pod) == SPA_POD_TYPE_FD || SPA_POD_TYPE(pod) == SPA_POD_TYPE_INT)) {
+		struct pw_protocol_native_types *t = pw_protocol_native_get_client_types(proxy);
+		uint32_t mem_size, offset;
+		const char *str, *end;
+		int fd_idx, fd;
+
+		/* the fd of the table only comes with the first update */
+		if (SPA_POD_TYPE(pod) == SPA_POD_TYPE_FD) {
+			if (spa_pod_parser_get(&prs, "h", &fd_idx, NULL) < 0 ||
+			    (fd = pw_protocol_native_get_proxy_fd(proxy, fd_idx)) < 0)
+				return -EINVAL;
+		} else
+			fd = -1;
+
+		if (spa_pod_parser_get(&prs,
+					"i", &mem_size,
+					"i", &offset, NULL) < 0) {
+			if (fd != -1)
+				close(fd);
+			return -EINVAL;
+		}
+		if (fd != -1) {
+			if (types_import(t, fd, mem_size) < 0)
+				return -EINVAL;
+		} else if (t->mem == NULL || t->mem->size != mem_size)
+			return -EINVAL;
+
+		if (offset >= mem_size)
 			return -EINVAL;
+
+		str = SPA_MEMBER(t->mem->ptr, offset, const char);
+		end = SPA_MEMBER(t->mem->ptr, mem_size, const char);
+		for (i = 0; i < n_types; i++) {
+			const char *next = memchr(str, '\0', end - str);
+			if (next == NULL)
+				return -EINVAL;
+			types[i] = str;
+			str = next + 1;
+		}
+	} else {
+		for (i = 0; i < n_types; i++) {
+			if (spa_pod_parser_get(&prs, "s", &types[i], NULL) < 0)
+				return -EINVAL;
+		}
 	}
 	pw_proxy_notify(proxy, struct pw_core_proxy_events, update_types, 0, first_id, types, n_types);
 	return 0;
@@ -364,6 +553,8 @@ static void
 core_marshal_update_types_server(void *object, uint32_t first_id, const char **types, uint32_t n_types)
 {
 	struct pw_resource *resource = object;
+	struct pw_protocol_native_types *t = pw_protocol_native_get_server_types(resource);
+	struct pw_core *core = pw_client_get_core(pw_resource_get_client(resource));
 	struct spa_pod_builder *b;
 	uint32_t i;
 
@@ -374,8 +565,20 @@ core_marshal_update_types_server(void *object, uint32_t first_id, const char **t
 			    "i", first_id,
 			    "i", n_types, NULL);
 
-	for (i = 0; i < n_types; i++) {
-		spa_pod_builder_add(b, "s", types[i], NULL);
+	if (t != NULL && n_types > 0 &&
+	    types_sync(t, pw_core_get_type(core)->map, first_id + n_types) == 0) {
+		/* the client reads the strings from the shared table, it keeps
+		 * the mapping of the fd we sent with the first update */
+		if (pw_protocol_native_take_types_fd(resource))
+			spa_pod_builder_add(b,
+			    "h", pw_protocol_native_add_resource_fd(resource, t->fd), NULL);
+		spa_pod_builder_add(b,
+			    "i", t->mem->size,
+			    "i", *pw_array_get_unchecked(&t->offsets, first_id, uint32_t), NULL);
+	} else {
+		for (i = 0; i < n_types; i++) {
+			spa_pod_builder_add(b, "s", types[i], NULL);
+		}
 	}
 	spa_pod_builder_add(b, "]", NULL);
 
@@ -393,6 +596,8 @@ static int core_demarshal_client_update(void *object, void *data, size_t size)
 	if (spa_pod_parser_get(&prs, "[ i", &props.n_items, NULL) < 0)
 		return -EINVAL;
 
+	if (props.n_items > MAX_DICT_ITEMS(size))
+		return -EINVAL;
 	props.items = alloca(props.n_items * sizeof(struct spa_dict_item));
 	for (i = 0; i < props.n_items; i++) {
 		if (spa_pod_parser_get(&prs,
@@ -416,6 +621,8 @@ static int core_demarshal_permissions(void *object, void *data, size_t size)
 	if (spa_pod_parser_get(&prs, "[ i", &props.n_items, NULL) < 0)
 		return -EINVAL;
 
+	if (props.n_items > MAX_DICT_ITEMS(size))
+		return -EINVAL;
 	props.items = alloca(props.n_items * sizeof(struct spa_dict_item));
 	for (i = 0; i < props.n_items; i++) {
 		if (spa_pod_parser_get(&prs,
@@ -445,11 +652,11 @@ static int core_demarshal_hello(void *object, void *data, size_t size)
 static int core_demarshal_sync(void *object, void *data, size_t size)
 {
 	struct pw_resource *resource = object;
-	struct spa_pod_parser prs;
-	uint32_t seq;
+	struct spa_pod_cursor c;
+	int32_t seq;
 
-	spa_pod_parser_init(&prs, data, size, 0);
-	if (spa_pod_parser_get(&prs, "[i]", &seq, NULL) < 0)
+	if (spa_pod_cursor_init(&c, data) < 0 ||
+	    spa_pod_cursor_get_int(&c, &seq) < 0)
 		return -EINVAL;
 
 	pw_resource_do(resource, struct pw_core_proxy_methods, sync, 0, seq);
@@ -459,17 +666,45 @@ static int core_demarshal_sync(void *object, void *data, size_t size)
 static int core_demarshal_get_registry(void *object, void *data, size_t size)
 {
 	struct pw_resource *resource = object;
-	struct spa_pod_parser prs;
+	struct spa_pod_cursor c;
 	int32_t version, new_id;
 
-	spa_pod_parser_init(&prs, data, size, 0);
-	if (spa_pod_parser_get(&prs, "[ii]", &version, &new_id, NULL) < 0)
+	if (spa_pod_cursor_init(&c, data) < 0 ||
+	    spa_pod_cursor_get_int(&c, &version) < 0 ||
+	    spa_pod_cursor_get_int(&c, &new_id) < 0)
 		return -EINVAL;
 
 	pw_resource_do(resource, struct pw_core_proxy_methods, get_registry, 0, version, new_id);
 	return 0;
 }
 
+static int core_demarshal_get_registry_filtered(void *object, void *data, size_t size)
+{
+	struct pw_resource *resource = object;
+	struct spa_pod_cursor c;
+	int32_t version, new_id, n_items;
+	struct spa_dict_item *items;
+	struct spa_dict filter;
+
+	if (spa_pod_cursor_init(&c, data) < 0 ||
+	    spa_pod_cursor_get_int(&c, &version) < 0 ||
+	    spa_pod_cursor_get_int(&c, &new_id) < 0 ||
+	    spa_pod_cursor_get_int(&c, &n_items) < 0)
+		return -EINVAL;
+
+	if (n_items < 0 || (size_t) n_items > MAX_DICT_ITEMS(size))
+		return -EINVAL;
+
+	items = alloca(n_items * sizeof(struct spa_dict_item));
+	if (cursor_get_dict_items(&c, items, n_items) < 0)
+		return -EINVAL;
+	filter = SPA_DICT_INIT(items, n_items);
+
+	pw_resource_do(resource, struct pw_core_proxy_methods, get_registry_filtered, 0,
+		       version, &filter, new_id);
+	return 0;
+}
+
 static int core_demarshal_create_object(void *object, void *data, size_t size)
 {
 	struct pw_resource *resource = object;
@@ -487,6 +722,8 @@ static int core_demarshal_create_object(void *object, void *data, size_t size)
 			"i", &props.n_items, NULL) < 0)
 		return -EINVAL;
 
+	if (props.n_items > MAX_DICT_ITEMS(size))
+		return -EINVAL;
 	props.items = alloca(props.n_items * sizeof(struct spa_dict_item));
 	for (i = 0; i < props.n_items; i++) {
 		if (spa_pod_parser_get(&prs, "ss",
@@ -505,11 +742,11 @@ static int core_demarshal_create_object(void *object, void *data, size_t size)
 static int core_demarshal_destroy(void *object, void *data, size_t size)
 {
 	struct pw_resource *resource = object;
-	struct spa_pod_parser prs;
-	uint32_t id;
+	struct spa_pod_cursor c;
+	int32_t id;
 
-	spa_pod_parser_init(&prs, data, size, 0);
-	if (spa_pod_parser_get(&prs, "[i]", &id, NULL) < 0)
+	if (spa_pod_cursor_init(&c, data) < 0 ||
+	    spa_pod_cursor_get_int(&c, &id) < 0)
 		return -EINVAL;
 
 	pw_resource_do(resource, struct pw_core_proxy_methods, destroy, 0, id);
@@ -585,16 +822,15 @@ static void registry_marshal_global_remove(void *object, uint32_t id)
 static int registry_demarshal_bind(void *object, void *data, size_t size)
 {
 	struct pw_resource *resource = object;
-	struct spa_pod_parser prs;
-	uint32_t id, version, type, new_id;
-
-	spa_pod_parser_init(&prs, data, size, 0);
-	if (spa_pod_parser_get(&prs,
-			"["
-			"i", &id,
-			"I", &type,
-			"i", &version,
-			"i", &new_id, NULL) < 0)
+	struct spa_pod_cursor c;
+	int32_t id, version, new_id;
+	uint32_t type;
+
+	if (spa_pod_cursor_init(&c, data) < 0 ||
+	    spa_pod_cursor_get_int(&c, &id) < 0 ||
+	    spa_pod_cursor_get_id(&c, &type) < 0 ||
+	    spa_pod_cursor_get_int(&c, &version) < 0 ||
+	    spa_pod_cursor_get_int(&c, &new_id) < 0)
 		return -EINVAL;
 
 	pw_resource_do(resource, struct pw_registry_proxy_methods, bind, 0, id, type, version, new_id);
@@ -650,6 +886,8 @@ static int module_demarshal_info(void *object, void *data, size_t size)
 		return -EINVAL;
 
 	info.props = &props;
+	if (props.n_items > MAX_DICT_ITEMS(size))
+		return -EINVAL;
 	props.items = alloca(props.n_items * sizeof(struct spa_dict_item));
 	for (i = 0; i < props.n_items; i++) {
 		if (spa_pod_parser_get(&prs, "ss",
@@ -709,6 +947,8 @@ static int factory_demarshal_info(void *object, void *data, size_t size)
 		return -EINVAL;
 
 	info.props = &props;
+	if (props.n_items > MAX_DICT_ITEMS(size))
+		return -EINVAL;
 	props.items = alloca(props.n_items * sizeof(struct spa_dict_item));
 	for (i = 0; i < props.n_items; i++) {
 		if (spa_pod_parser_get(&prs,
@@ -777,6 +1017,8 @@ static int node_demarshal_info(void *object, void *data, size_t size)
 		return -EINVAL;
 
 	info.props = &props;
+	if (props.n_items > MAX_DICT_ITEMS(size))
+		return -EINVAL;
 	props.items = alloca(props.n_items * sizeof(struct spa_dict_item));
 	for (i = 0; i < props.n_items; i++) {
 		if (spa_pod_parser_get(&prs,
@@ -901,6 +1143,8 @@ static int port_demarshal_info(void *object, void *data, size_t size)
 		return -EINVAL;
 
 	info.props = &props;
+	if (props.n_items > MAX_DICT_ITEMS(size))
+		return -EINVAL;
 	props.items = alloca(props.n_items * sizeof(struct spa_dict_item));
 	for (i = 0; i < props.n_items; i++) {
 		if (spa_pod_parser_get(&prs,
@@ -1023,6 +1267,8 @@ static int client_demarshal_info(void *object, void *data, size_t size)
 		return -EINVAL;
 
 	info.props = &props;
+	if (props.n_items > MAX_DICT_ITEMS(size))
+		return -EINVAL;
 	props.items = alloca(props.n_items * sizeof(struct spa_dict_item));
 	for (i = 0; i < props.n_items; i++) {
 		if (spa_pod_parser_get(&prs,
@@ -1087,6 +1333,8 @@ static int link_demarshal_info(void *object, void *data, size_t size)
 		return -EINVAL;
 
 	info.props = &props;
+	if (props.n_items > MAX_DICT_ITEMS(size))
+		return -EINVAL;
 	props.items = alloca(props.n_items * sizeof(struct spa_dict_item));
 	for (i = 0; i < props.n_items; i++) {
 		if (spa_pod_parser_get(&prs,
@@ -1101,28 +1349,28 @@ static int link_demarshal_info(void *object, void *data, size_t size)
 static int registry_demarshal_global(void *object, void *data, size_t size)
 {
 	struct pw_proxy *proxy = object;
-	struct spa_pod_parser prs;
-	uint32_t id, parent_id, permissions, type, version, i;
+	struct spa_pod_cursor c;
+	int32_t id, parent_id, permissions, version, n_items;
+	uint32_t type;
+	struct spa_dict_item *items;
 	struct spa_dict props;
 
-	spa_pod_parser_init(&prs, data, size, 0);
-	if (spa_pod_parser_get(&prs,
-			"["
-			"i", &id,
-			"i", &parent_id,
-			"i", &permissions,
-			"I", &type,
-			"i", &version,
-			"i", &props.n_items, NULL) < 0)
+	if (spa_pod_cursor_init(&c, data) < 0 ||
+	    spa_pod_cursor_get_int(&c, &id) < 0 ||
+	    spa_pod_cursor_get_int(&c, &parent_id) < 0 ||
+	    spa_pod_cursor_get_int(&c, &permissions) < 0 ||
+	    spa_pod_cursor_get_id(&c, &type) < 0 ||
+	    spa_pod_cursor_get_int(&c, &version) < 0 ||
+	    spa_pod_cursor_get_int(&c, &n_items) < 0)
 		return -EINVAL;
 
-	props.items = alloca(props.n_items * sizeof(struct spa_dict_item));
-	for (i = 0; i < props.n_items; i++) {
-		if (spa_pod_parser_get(&prs,
-				       "s", &props.items[i].key,
-				       "s", &props.items[i].value, NULL) < 0)
-			return -EINVAL;
-	}
+	if (n_items < 0 || (size_t) n_items > MAX_DICT_ITEMS(size))
+		return -EINVAL;
+
+	items = alloca(n_items * sizeof(struct spa_dict_item));
+	if (cursor_get_dict_items(&c, items, n_items) < 0)
+		return -EINVAL;
+	props = SPA_DICT_INIT(items, n_items);
 
 	pw_proxy_notify(proxy, struct pw_registry_proxy_events,
 			global, 0, id, parent_id, permissions, type, version,
@@ -1133,11 +1381,11 @@ static int registry_demarshal_global(void *object, void *data, size_t size)
 static int registry_demarshal_global_remove(void *object, void *data, size_t size)
 {
 	struct pw_proxy *proxy = object;
-	struct spa_pod_parser prs;
-	uint32_t id;
+	struct spa_pod_cursor c;
+	int32_t id;
 
-	spa_pod_parser_init(&prs, data, size, 0);
-	if (spa_pod_parser_get(&prs, "[ i", &id, NULL) < 0)
+	if (spa_pod_cursor_init(&c, data) < 0 ||
+	    spa_pod_cursor_get_int(&c, &id) < 0)
 		return -EINVAL;
 
 	pw_proxy_notify(proxy, struct pw_registry_proxy_events, global_remove, 0, id);
@@ -1171,6 +1419,7 @@ static const struct pw_core_proxy_methods pw_protocol_native_core_method_marshal
 	&core_marshal_permissions,
 	&core_marshal_create_object,
 	&core_marshal_destroy,
+	&core_marshal_get_registry_filtered,
 };
 
 static const struct pw_protocol_native_demarshal pw_protocol_native_core_method_demarshal[PW_CORE_PROXY_METHOD_NUM] = {
@@ -1181,7 +1430,8 @@ static const struct pw_protocol_native_demarshal pw_protocol_native_core_method_
 	{ &core_demarshal_client_update, 0, },
 	{ &core_demarshal_permissions, 0, },
 	{ &core_demarshal_create_object, PW_PROTOCOL_NATIVE_REMAP, },
-	{ &core_demarshal_destroy, 0, }
+	{ &core_demarshal_destroy, 0, },
+	{ &core_demarshal_get_registry_filtered, 0, },
 };
 
 static const struct pw_core_proxy_events pw_protocol_native_core_event_marshal = {
@@ -27,6 +27,9 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/eventfd.h>
 
@@ -40,18 +43,62 @@
 #include "pipewire/log.h"
 #include "pipewire/module.h"
 #include "pipewire/utils.h"
+#include "pipewire/private.h"
+
+/** \page page_module_rtkit Realtime scheduling
+ *
+ * Applies the thread policy to the data loops of the core when their thread
+ * starts. The loops that were started before the module was loaded are
+ * updated when the module is loaded. The loop.cpus and loop.rt-priority
+ * properties of a loop are applied by the loop itself, the module only
+ * fills in what the loop could not do.
+ *
+ * - rt.prio: the realtime priority of the data loops, default 20. A loop
+ *   with a loop.rt-priority property uses that instead, 0 leaves the loop
+ *   SCHED_OTHER.
+ * - rt.cpus: the cpus to run the data loops without loop.cpus on, like
+ *   "2,3".
+ * - rt.time.soft, rt.time.hard: the RLIMIT_RTTIME in microseconds, default
+ *   100000 and 200000. When a realtime thread reaches the soft limit all
+ *   data loops are made SCHED_OTHER.
+ * - mlock: lock all memory of the process, default false.
+ *
+ * The threads are made realtime with RealtimeKit. When it is not available,
+ * sched_setscheduler() is used, this needs the privileges to do so.
+ */
+
+#define DEFAULT_RT_PRIO		20
+#define DEFAULT_RT_TIME_SOFT	100000
+#define DEFAULT_RT_TIME_HARD	200000
 
 struct impl {
 	struct pw_core *core;
 	struct pw_type *type;
 	struct pw_properties *properties;
 
-	struct spa_loop *loop;
-	struct spa_source source;
+	int rt_prio;
+	const char *cpus;
+	rlim_t rt_time_soft;
+	rlim_t rt_time_hard;
+
+	struct spa_list loop_list;
+
+	int watchdog_fd;
+	struct spa_source *watchdog;
+	struct impl *watchdog_next;
 
+	struct spa_hook core_listener;
 	struct spa_hook module_listener;
 };
 
+struct loop_data {
+	struct spa_list link;
+	struct impl *impl;
+	struct pw_data_loop *loop;
+	struct spa_hook listener;
+	bool realtime;
+};
+
 /***
   Copyright 2009 Lennart Poettering
   Copyright 2010 David Henningsson <diwic@ubuntu.com>
@@ -384,86 +431,296 @@ int pw_rtkit_make_high_priority(struct pw_rtkit_bus *connection, pid_t thread, i
 	return ret;
 }
 
-static void module_destroy(void *data)
+/* runs in the thread of the loop */
+static void apply_policy(struct loop_data *d)
 {
-	struct impl *impl = data;
+	struct impl *impl = d->impl;
+	struct pw_data_loop *loop = d->loop;
+	struct pw_rtkit_bus *system_bus;
+	struct sched_param sp;
+	const char *str;
+	int res, prio, max;
+
+	/* the loop applied its own loop.cpus */
+	if (pw_properties_get(loop->properties, "loop.cpus") == NULL &&
+	    (str = impl->cpus) != NULL) {
+		cpu_set_t set;
+
+		if (pw_parse_cpus(str, &set) < 0)
+			pw_log_warn("module %p: invalid cpus \"%s\" for loop %s", impl, str, loop->name);
+		else if ((res = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+			pw_log_warn("module %p: can't set affinity of loop %s to %s: %s",
+					impl, loop->name, str, strerror(res));
+	}
 
-	spa_hook_remove(&impl->module_listener);
+	if ((str = pw_properties_get(loop->properties, "loop.rt-priority")) != NULL)
+		prio = atoi(str);
+	else
+		prio = impl->rt_prio;
+	if (prio <= 0)
+		return;
 
-	if (impl->properties)
-		pw_properties_free(impl->properties);
+	/* the loop could make itself realtime with loop.rt-priority */
+	if ((sched_getscheduler(0) & ~SCHED_RESET_ON_FORK) == SCHED_FIFO) {
+		pw_log_debug("module %p: loop %s is already realtime", impl, loop->name);
+		d->realtime = true;
+		return;
+	}
 
-	free(impl);
+	if ((system_bus = pw_rtkit_bus_get_system()) != NULL) {
+		if ((max = pw_rtkit_get_max_realtime_priority(system_bus)) > 0 && prio > max) {
+			pw_log_debug("module %p: clamping priority of loop %s to %d for rtkit",
+					impl, loop->name, max);
+			prio = max;
+		}
+		res = pw_rtkit_make_realtime(system_bus, 0, prio);
+		pw_rtkit_bus_free(system_bus);
+
+		if (res >= 0) {
+			pw_log_info("module %p: loop %s made realtime with priority %d",
+					impl, loop->name, prio);
+			d->realtime = true;
+			return;
+		}
+		pw_log_debug("module %p: rtkit can't make loop %s realtime: %s",
+				impl, loop->name, strerror(-res));
+	}
+
+	/* without rtkit we need the privileges to do it ourselves */
+	spa_zero(sp);
+	sp.sched_priority = prio;
+	if (sched_setscheduler(0, SCHED_FIFO | SCHED_RESET_ON_FORK, &sp) < 0) {
+		pw_log_warn("module %p: can't make loop %s realtime: %s",
+				impl, loop->name, strerror(errno));
+		return;
+	}
+	pw_log_info("module %p: loop %s is SCHED_FIFO with priority %d", impl, loop->name, prio);
+	d->realtime = true;
 }
 
-static const struct pw_module_events module_events = {
-	PW_VERSION_MODULE_EVENTS,
-	.destroy = module_destroy,
+static void loop_started(void *data)
+{
+	apply_policy(data);
+}
+
+static void remove_loop(struct loop_data *d)
+{
+	spa_hook_remove(&d->listener);
+	spa_list_remove(&d->link);
+	free(d);
+}
+
+static void loop_destroy(void *data)
+{
+	remove_loop(data);
+}
+
+static const struct pw_data_loop_events data_loop_events = {
+	PW_VERSION_DATA_LOOP_EVENTS,
+	.destroy = loop_destroy,
+	.started = loop_started,
+};
+
+static int
+do_apply(struct spa_loop *loop,
+	 bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	apply_policy(user_data);
+	return 0;
+}
+
+static void add_loop(struct impl *impl, struct pw_data_loop *loop)
+{
+	struct loop_data *d;
+
+	if ((d = calloc(1, sizeof(struct loop_data))) == NULL)
+		return;
+
+	d->impl = impl;
+	d->loop = loop;
+	spa_list_append(&impl->loop_list, &d->link);
+	pw_data_loop_add_listener(loop, &d->listener, &data_loop_events, d);
+
+	/* the loops made before the module was loaded are already running */
+	if (loop->running)
+		pw_loop_invoke(loop->loop, do_apply, SPA_ID_INVALID, NULL, 0, true, d);
+}
+
+static void core_data_loop_added(void *data, struct pw_data_loop *loop)
+{
+	add_loop(data, loop);
+}
+
+static const struct pw_core_events core_events = {
+	PW_VERSION_CORE_EVENTS,
+	.data_loop_added = core_data_loop_added,
 };
 
-static void idle_func(struct spa_source *source)
+/* the SIGXCPU handler is for the whole process, it wakes up the watchdog of
+ * every instance and then calls the handler that was installed before the
+ * first instance. The list is changed with watchdog_lock held, an instance
+ * is only freed when no handler runs anymore. */
+static pthread_mutex_t watchdog_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct impl *watchdog_list;
+static int watchdog_active;
+static struct sigaction watchdog_old_action;
+
+static void sigxcpu_handler(int sig, siginfo_t *info, void *context)
 {
-	struct impl *impl = source->data;
+	struct impl *impl;
+	uint64_t count = 1;
+
+	/* only async-signal-safe calls, the main loops do the rest */
+	__atomic_add_fetch(&watchdog_active, 1, __ATOMIC_SEQ_CST);
+	for (impl = __atomic_load_n(&watchdog_list, __ATOMIC_SEQ_CST); impl;
+	     impl = __atomic_load_n(&impl->watchdog_next, __ATOMIC_SEQ_CST)) {
+		if (write(impl->watchdog_fd, &count, sizeof(uint64_t)) < 0)
+			continue;
+	}
+	__atomic_sub_fetch(&watchdog_active, 1, __ATOMIC_SEQ_CST);
+
+	if (watchdog_old_action.sa_flags & SA_SIGINFO) {
+		if (watchdog_old_action.sa_sigaction)
+			watchdog_old_action.sa_sigaction(sig, info, context);
+	}
+	else if (watchdog_old_action.sa_handler != SIG_DFL &&
+		 watchdog_old_action.sa_handler != SIG_IGN)
+		watchdog_old_action.sa_handler(sig);
+}
+
+/* the soft RLIMIT_RTTIME was reached, a realtime thread did not block for
+ * too long. Make the data loops SCHED_OTHER before the hard limit kills us. */
+static void on_watchdog(void *data, int fd, enum spa_io mask)
+{
+	struct impl *impl = data;
+	struct loop_data *d;
 	struct sched_param sp;
-	struct pw_rtkit_bus *system_bus;
-	struct rlimit rl;
-	int r, rtprio;
-	long long rttime;
 	uint64_t count;
+	int res;
 
-	read(impl->source.fd, &count, sizeof(uint64_t));
+	if (read(fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
+		return;
 
-	rtprio = 20;
-	rttime = 20000;
+	pw_log_error("module %p: realtime limit exceeded, data loops are made SCHED_OTHER", impl);
 
 	spa_zero(sp);
-	sp.sched_priority = rtprio;
+	spa_list_for_each(d, &impl->loop_list, link) {
+		if (!d->realtime || !d->loop->running)
+			continue;
+		if ((res = pthread_setschedparam(d->loop->thread, SCHED_OTHER, &sp)) != 0)
+			pw_log_warn("module %p: can't make loop %s SCHED_OTHER: %s",
+					impl, d->loop->name, strerror(res));
+		else
+			d->realtime = false;
+	}
+}
 
-	if (pthread_setschedparam(pthread_self(), SCHED_OTHER | SCHED_RESET_ON_FORK, &sp) == 0) {
-		pw_log_debug("SCHED_OTHER|SCHED_RESET_ON_FORK worked.");
-		return;
+static void set_rttime(struct impl *impl)
+{
+	struct pw_rtkit_bus *system_bus;
+	struct rlimit rl;
+	long long max;
+
+	if ((system_bus = pw_rtkit_bus_get_system()) != NULL) {
+		/* rtkit only accepts processes with a limit below its maximum */
+		max = pw_rtkit_get_rttime_usec_max(system_bus);
+		if (max > 0 && (long long) impl->rt_time_hard > max) {
+			pw_log_debug("module %p: clamping rlimit-rttime to %lld for rtkit", impl, max);
+			impl->rt_time_hard = max;
+		}
+		pw_rtkit_bus_free(system_bus);
 	}
+	impl->rt_time_soft = SPA_MIN(impl->rt_time_soft, impl->rt_time_hard);
 
-	system_bus = pw_rtkit_bus_get_system();
-	if (system_bus == NULL)
-		return;
+	rl.rlim_cur = impl->rt_time_soft;
+	rl.rlim_max = impl->rt_time_hard;
+	if (setrlimit(RLIMIT_RTTIME, &rl) < 0)
+		pw_log_warn("module %p: setrlimit() failed: %s", impl, strerror(errno));
+}
 
-	rl.rlim_cur = rl.rlim_max = rttime;
-	if ((r = setrlimit(RLIMIT_RTTIME, &rl)) < 0)
-		pw_log_debug("setrlimit() failed: %s", strerror(errno));
+static int start_watchdog(struct impl *impl)
+{
+	struct sigaction sa;
 
-	if (rttime >= 0) {
-		r = getrlimit(RLIMIT_RTTIME, &rl);
-		if (r >= 0 && (long long) rl.rlim_max > rttime) {
-			pw_log_debug("Clamping rlimit-rttime to %lld for RealtimeKit", rttime);
-			rl.rlim_cur = rl.rlim_max = rttime;
+	if ((impl->watchdog_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+		return -errno;
 
-			if ((r = setrlimit(RLIMIT_RTTIME, &rl)) < 0)
-				pw_log_debug("setrlimit() failed: %s", strerror(errno));
-		}
+	impl->watchdog = pw_loop_add_io(pw_core_get_main_loop(impl->core), impl->watchdog_fd,
+					SPA_IO_IN, true, on_watchdog, impl);
+	if (impl->watchdog == NULL) {
+		close(impl->watchdog_fd);
+		return -ENOMEM;
 	}
 
-	if ((r = pw_rtkit_make_realtime(system_bus, 0, rtprio)) < 0) {
-		pw_log_debug("could not make thread realtime: %s", strerror(r));
-	} else {
-		pw_log_debug("thread made realtime");
+	pthread_mutex_lock(&watchdog_lock);
+	if (watchdog_list == NULL) {
+		spa_zero(sa);
+		sa.sa_sigaction = sigxcpu_handler;
+		sa.sa_flags = SA_SIGINFO | SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGXCPU, &sa, &watchdog_old_action);
 	}
-	pw_rtkit_bus_free(system_bus);
+	impl->watchdog_next = watchdog_list;
+	__atomic_store_n(&watchdog_list, impl, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&watchdog_lock);
+
+	return 0;
 }
 
+static void stop_watchdog(struct impl *impl)
+{
+	struct impl **p;
+
+	pthread_mutex_lock(&watchdog_lock);
+	for (p = &watchdog_list; *p; p = &(*p)->watchdog_next) {
+		if (*p == impl) {
+			__atomic_store_n(p, impl->watchdog_next, __ATOMIC_SEQ_CST);
+			break;
+		}
+	}
+	if (watchdog_list == NULL)
+		sigaction(SIGXCPU, &watchdog_old_action, NULL);
+	pthread_mutex_unlock(&watchdog_lock);
+
+	/* a handler could still be writing to our fd */
+	while (__atomic_load_n(&watchdog_active, __ATOMIC_SEQ_CST) > 0)
+		sched_yield();
+
+	pw_loop_destroy_source(pw_core_get_main_loop(impl->core), impl->watchdog);
+}
+
+static void module_destroy(void *data)
+{
+	struct impl *impl = data;
+	struct loop_data *d;
+
+	spa_hook_remove(&impl->module_listener);
+	spa_hook_remove(&impl->core_listener);
+
+	spa_list_consume(d, &impl->loop_list, link)
+		remove_loop(d);
+
+	if (impl->watchdog)
+		stop_watchdog(impl);
+
+	if (impl->properties)
+		pw_properties_free(impl->properties);
+
+	free(impl);
+}
+
+static const struct pw_module_events module_events = {
+	PW_VERSION_MODULE_EVENTS,
+	.destroy = module_destroy,
+};
+
 static int module_init(struct pw_module *module, struct pw_properties *properties)
 {
 	struct pw_core *core = pw_module_get_core(module);
+	struct pw_data_loop *loop;
 	struct impl *impl;
-	struct spa_loop *loop;
-	const struct spa_support *support;
-	uint32_t n_support;
-
-	support = pw_core_get_support(core, &n_support);
-
-	loop = spa_support_find(support, n_support, SPA_TYPE_LOOP__DataLoop);
-        if (loop == NULL)
-                return -ENOTSUP;
+	const char *str;
+	int res;
 
 	impl = calloc(1, sizeof(struct impl));
 	if (impl == NULL)
@@ -474,14 +731,36 @@ static int module_init(struct pw_module *module, struct pw_properties *propertie
 	impl->core = core;
 	impl->type = pw_core_get_type(core);
 	impl->properties = properties;
-	impl->loop = loop;
+	spa_list_init(&impl->loop_list);
+
+	impl->rt_prio = DEFAULT_RT_PRIO;
+	impl->rt_time_soft = DEFAULT_RT_TIME_SOFT;
+	impl->rt_time_hard = DEFAULT_RT_TIME_HARD;
+
+	if (properties) {
+		if ((str = pw_properties_get(properties, "rt.prio")) != NULL)
+			impl->rt_prio = atoi(str);
+		if ((str = pw_properties_get(properties, "rt.time.soft")) != NULL)
+			impl->rt_time_soft = atoll(str);
+		if ((str = pw_properties_get(properties, "rt.time.hard")) != NULL)
+			impl->rt_time_hard = atoll(str);
+		impl->cpus = pw_properties_get(properties, "rt.cpus");
+
+		if ((str = pw_properties_get(properties, "mlock")) != NULL &&
+		    pw_properties_parse_bool(str) &&
+		    mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+			pw_log_warn("module %p: can't lock memory: %s", impl, strerror(errno));
+	}
+
+	set_rttime(impl);
+
+	if ((res = start_watchdog(impl)) < 0)
+		pw_log_warn("module %p: can't start watchdog: %s", impl, strerror(-res));
 
-	impl->source.loop = loop;
-	impl->source.func = idle_func;
-	impl->source.data = impl;
-	impl->source.fd = eventfd(1, EFD_CLOEXEC | EFD_NONBLOCK);
-	impl->source.mask = SPA_IO_IN;
-	spa_loop_add_source(impl->loop, &impl->source);
+	pw_core_add_listener(core, &impl->core_listener, &core_events, impl);
+
+	spa_list_for_each(loop, &core->data_loop_list, link)
+		add_loop(impl, loop);
 
 	pw_module_add_listener(module, &impl->module_listener, &module_events, impl);
 
@@ -491,5 +770,10 @@ static int module_init(struct pw_module *module, struct pw_properties *propertie
 SPA_EXPORT
 int pipewire__module_init(struct pw_module *module, const char *args)
 {
-	return module_init(module, NULL);
+	struct pw_properties *props = NULL;
+
+	if (args)
+		props = pw_properties_new_string(args);
+
+	return module_init(module, props);
 }
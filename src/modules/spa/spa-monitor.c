@@ -51,6 +51,7 @@ struct impl {
 	struct pw_core *core;
 	struct pw_type *t;
 	struct pw_global *parent;
+	struct pw_properties *properties;	/**< extra properties for the nodes */
 
 	void *hnd;
 
@@ -85,7 +86,10 @@ static void add_item(struct pw_spa_monitor *this, struct spa_pod *item)
 
 	pw_log_debug("monitor %p: add: \"%s\" (%s)", this, name, id);
 
-	props = pw_properties_new(NULL, NULL);
+	if (impl->properties)
+		props = pw_properties_copy(impl->properties);
+	else
+		props = pw_properties_new(NULL, NULL);
 
 	if (info) {
 		struct spa_pod_parser prs;
@@ -101,7 +105,7 @@ static void add_item(struct pw_spa_monitor *this, struct spa_pod *item)
 		}
 	}
 
-	support = pw_core_get_support(impl->core, &n_support);
+	support = pw_core_get_node_support(impl->core, &props->dict, &n_support);
 
 	handle = calloc(1, factory->size);
 	if ((res = spa_handle_factory_init(factory,
@@ -256,6 +260,7 @@ struct pw_spa_monitor *pw_spa_monitor_load(struct pw_core *core,
 					   const char *lib,
 					   const char *factory_name,
 					   const char *system_name,
+					   struct pw_properties *properties,
 					   size_t user_data_size)
 {
 	struct impl *impl;
@@ -308,6 +313,7 @@ struct pw_spa_monitor *pw_spa_monitor_load(struct pw_core *core,
 	impl->core = core;
 	impl->t = t;
 	impl->parent = parent;
+	impl->properties = properties;
 	impl->hnd = hnd;
 
 	this = &impl->this;
@@ -350,6 +356,8 @@ struct pw_spa_monitor *pw_spa_monitor_load(struct pw_core *core,
 	dlclose(hnd);
       open_failed:
 	free(filename);
+	if (properties)
+		pw_properties_free(properties);
 	return NULL;
 
 }
@@ -370,6 +378,9 @@ void pw_spa_monitor_destroy(struct pw_spa_monitor *monitor)
 	free(monitor->factory_name);
 	free(monitor->system_name);
 
+	if (impl->properties)
+		pw_properties_free(impl->properties);
+
 	dlclose(impl->hnd);
 	free(impl);
 }
@@ -278,7 +278,8 @@ struct pw_node *pw_spa_node_load(struct pw_core *core,
 			break;
 	}
 
-	support = pw_core_get_support(core, &n_support);
+	support = pw_core_get_node_support(core, properties ? &properties->dict : NULL,
+					   &n_support);
 
 	handle = calloc(1, factory->size);
 	if ((res = spa_handle_factory_init(factory,
@@ -32,33 +32,78 @@ struct permission {
 	uint32_t permissions;
 };
 
+/* permissions of the globals registered before \a serial and after the
+ * serial of the previous range */
+struct permission_range {
+	uint64_t serial;
+	uint32_t permissions;
+};
+
 /** \cond */
 struct impl {
 	struct pw_client this;
 	uint32_t permissions_default;
 	struct spa_hook core_listener;
-	struct pw_array permissions;
+	struct pw_array permissions;	/**< specific permissions, sorted on id */
+	struct pw_array existing;	/**< ranges set with permissions.existing,
+					  *  sorted on serial */
 };
 
 struct resource_data {
 	struct spa_hook resource_listener;
 };
 
+/** the index of the permission for \a id or where it should be inserted */
+static uint32_t find_index(struct impl *impl, uint32_t id)
+{
+	struct permission *p = impl->permissions.data;
+	uint32_t lo = 0, hi = pw_array_get_len(&impl->permissions, struct permission);
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (p[mid].id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
 /** find a specific permission for a global or NULL when there is none */
 static struct permission *
 find_permission(struct pw_client *client, struct pw_global *global)
 {
 	struct impl *impl = SPA_CONTAINER_OF(client, struct impl, this);
 	struct permission *p;
+	uint32_t idx;
 
-	if (!pw_array_check_index(&impl->permissions, global->id, struct permission))
+	idx = find_index(impl, global->id);
+	if (!pw_array_check_index(&impl->permissions, idx, struct permission))
 		return NULL;
 
-	p = pw_array_get_unchecked(&impl->permissions, global->id, struct permission);
-	if (p->permissions == -1)
-		return NULL;
-	else
-		return p;
+	p = pw_array_get_unchecked(&impl->permissions, idx, struct permission);
+	return p->id == global->id ? p : NULL;
+}
+
+/* the permissions of a global without specific permissions */
+static uint32_t
+range_permission(const struct permission_range *r, uint32_t n_ranges,
+		 uint32_t permissions_default, struct pw_global *global)
+{
+	uint32_t i;
+
+	for (i = 0; i < n_ranges; i++) {
+		if (global->serial < r[i].serial)
+			return r[i].permissions;
+	}
+	return permissions_default;
+}
+
+static uint32_t default_permission(struct impl *impl, struct pw_global *global)
+{
+	return range_permission(impl->existing.data,
+				pw_array_get_len(&impl->existing, struct permission_range),
+				impl->permissions_default, global);
 }
 
 /** \endcond */
@@ -70,9 +115,12 @@ client_permission_func(struct pw_global *global,
 	struct impl *impl = data;
 	struct permission *p;
 
+	if (impl->permissions.size == 0)
+		return default_permission(impl, global);
+
 	p = find_permission(client, global);
 	if (p == NULL)
-		return impl->permissions_default;
+		return default_permission(impl, global);
 	else
 		return p->permissions;
 }
@@ -127,11 +175,15 @@ core_global_removed(void *data, struct pw_global *global)
 	struct impl *impl = data;
 	struct pw_client *client = &impl->this;
 	struct permission *p;
+	size_t offset;
 
 	p = find_permission(client, global);
 	pw_log_debug("client %p: global %d removed, %p", client, global->id, p);
-	if (p != NULL)
-		p->permissions = -1;
+	if (p != NULL) {
+		offset = SPA_PTRDIFF(p, impl->permissions.data) + sizeof(struct permission);
+		memmove(p, p + 1, impl->permissions.size - offset);
+		impl->permissions.size -= sizeof(struct permission);
+	}
 }
 
 static const struct pw_core_events core_events = {
@@ -139,6 +191,17 @@ static const struct pw_core_events core_events = {
 	.global_removed = core_global_removed,
 };
 
+static void emit_info(struct pw_info_pending *pending, uint64_t change_mask)
+{
+	struct pw_client *client = SPA_CONTAINER_OF(pending, struct pw_client, info_pending);
+	struct pw_resource *resource;
+
+	client->info.change_mask = change_mask;
+	spa_list_for_each(resource, &client->resource_list, link)
+		pw_client_resource_info(resource, &client->info);
+	client->info.change_mask = 0;
+}
+
 /** Make a new client object
  *
  * \param core a \ref pw_core object to register the client with
@@ -170,7 +233,8 @@ struct pw_client *pw_client_new(struct pw_core *core,
 	if (properties == NULL)
 		return NULL;
 
-	pw_array_init(&impl->permissions, 1024);
+	pw_array_init(&impl->permissions, 16 * sizeof(struct permission));
+	pw_array_init(&impl->existing, 4 * sizeof(struct permission_range));
 
 	this->properties = properties;
 	this->permission_func = client_permission_func;
@@ -182,6 +246,7 @@ struct pw_client *pw_client_new(struct pw_core *core,
 
 	spa_list_init(&this->resource_list);
 	spa_hook_list_init(&this->listener_list);
+	pw_info_pending_init(&this->info_pending, emit_info);
 
 	pw_map_init(&this->objects, 0, 32);
 	pw_map_init(&this->types, 0, 32);
@@ -296,6 +361,8 @@ void pw_client_destroy(struct pw_client *client)
 	pw_log_debug("client %p: destroy", client);
 	pw_client_events_destroy(client);
 
+	pw_info_pending_cancel(&client->info_pending);
+
 	spa_hook_remove(&impl->core_listener);
 
 	if (client->registered)
@@ -317,6 +384,7 @@ void pw_client_destroy(struct pw_client *client)
 	pw_map_clear(&client->objects);
 	pw_map_clear(&client->types);
 	pw_array_clear(&impl->permissions);
+	pw_array_clear(&impl->existing);
 
 	pw_properties_free(client->properties);
 
@@ -352,7 +420,6 @@ const struct pw_client_info *pw_client_get_info(struct pw_client *client)
 SPA_EXPORT
 int pw_client_update_properties(struct pw_client *client, const struct spa_dict *dict)
 {
-	struct pw_resource *resource;
 	uint32_t i, changed = 0;
 
 	for (i = 0; i < dict->n_items; i++) {
@@ -377,9 +444,7 @@ int pw_client_update_properties(struct pw_client *client, const struct spa_dict
 	client->info.props = &client->properties->dict;
 	pw_client_events_info_changed(client, &client->info);
 
-	spa_list_for_each(resource, &client->resource_list, link)
-		pw_client_resource_info(resource, &client->info);
-
+	pw_core_queue_info(client->core, &client->info_pending, client->info.change_mask);
 	client->info.change_mask = 0;
 
 	return changed;
@@ -388,38 +453,34 @@ int pw_client_update_properties(struct pw_client *client, const struct spa_dict
 struct permissions_update {
 	struct pw_client *client;
 	uint32_t permissions;
-	bool only_new;
+	uint64_t serial;			/**< globals before this serial are updated */
+	const struct permission_range *old;	/**< the ranges before the update */
+	uint32_t n_old;
 };
 
-static int do_permissions(void *data, struct pw_global *global)
+/* apply specific permissions to one global */
+static int update_permission(struct pw_client *client, struct pw_global *global, uint32_t mask)
 {
-	struct permissions_update *update = data;
-	struct pw_client *client = update->client;
 	struct impl *impl = SPA_CONTAINER_OF(client, struct impl, this);
 	struct permission *p;
-	size_t len, i;
-	uint32_t old;
+	uint32_t idx, len, old;
 
+	idx = find_index(impl, global->id);
 	len = pw_array_get_len(&impl->permissions, struct permission);
-	if (len <= global->id) {
-		size_t diff = global->id - len + 1;
 
-		p = pw_array_add(&impl->permissions, diff * sizeof(struct permission));
-		if (p == NULL)
+	if (idx == len ||
+	    (p = pw_array_get_unchecked(&impl->permissions, idx, struct permission))->id != global->id) {
+		if (pw_array_add(&impl->permissions, sizeof(struct permission)) == NULL)
 			return -ENOMEM;
 
-		for (i = 0; i < diff; i++)
-			p[i].permissions = -1;
+		p = pw_array_get_unchecked(&impl->permissions, idx, struct permission);
+		memmove(p + 1, p, (len - idx) * sizeof(struct permission));
+		p->id = global->id;
+		p->permissions = default_permission(impl, global);
 	}
 
-	p = pw_array_get_unchecked(&impl->permissions, global->id, struct permission);
-	if (p->permissions == -1)
-		old = p->permissions = impl->permissions_default;
-	else if (update->only_new)
-		return 0;
-
 	old = p->permissions;
-	p->permissions &= update->permissions;
+	p->permissions &= mask;
 	pw_log_debug("client %p: change global %d permissions %08x -> %08x",
 			client, global->id, old, p->permissions);
 
@@ -428,6 +489,71 @@ static int do_permissions(void *data, struct pw_global *global)
 	return 0;
 }
 
+/* emit the change of a global that doesn't have specific permissions */
+static int emit_existing(void *data, struct pw_global *global)
+{
+	struct permissions_update *update = data;
+	struct pw_client *client = update->client;
+	struct impl *impl = SPA_CONTAINER_OF(client, struct impl, this);
+	uint32_t old, new;
+
+	if (global->serial >= update->serial ||
+	    find_permission(client, global) != NULL)
+		return 0;
+
+	old = range_permission(update->old, update->n_old, impl->permissions_default, global);
+	new = default_permission(impl, global);
+
+	pw_log_debug("client %p: change global %d permissions %08x -> %08x",
+			client, global->id, old, new);
+	pw_global_events_permissions_changed(global, client, old, new);
+	return 0;
+}
+
+/* mask the permissions of all globals without specific permissions. The
+ * globals are not stored, the permissions are kept for the range of global
+ * serials that existed at each update so that this only allocates a range
+ * per update. The events are emitted after the update so that the handlers
+ * can look at the permissions */
+static int update_existing(struct pw_client *client, uint32_t mask)
+{
+	struct impl *impl = SPA_CONTAINER_OF(client, struct impl, this);
+	struct permissions_update update = { client, mask, client->core->global_serial, };
+	struct permission_range *r, *old;
+	uint32_t i, j, n_ranges;
+
+	n_ranges = pw_array_get_len(&impl->existing, struct permission_range);
+	old = alloca((n_ranges + 1) * sizeof(struct permission_range));
+	if (n_ranges > 0)
+		memcpy(old, impl->existing.data, n_ranges * sizeof(struct permission_range));
+	update.old = old;
+	update.n_old = n_ranges;
+
+	/* the globals after the last range had the default permissions */
+	if (n_ranges == 0 ||
+	    pw_array_get_unchecked(&impl->existing, n_ranges - 1,
+				   struct permission_range)->serial < update.serial) {
+		if ((r = pw_array_add(&impl->existing, sizeof(struct permission_range))) == NULL)
+			return -ENOMEM;
+		r->serial = update.serial;
+		r->permissions = impl->permissions_default;
+		n_ranges++;
+	}
+
+	/* mask all ranges and merge the ones that became equal */
+	r = impl->existing.data;
+	for (i = 0, j = 0; i < n_ranges; i++) {
+		r[i].permissions &= mask;
+		if (j > 0 && r[j - 1].permissions == r[i].permissions)
+			r[j - 1].serial = r[i].serial;
+		else
+			r[j++] = r[i];
+	}
+	impl->existing.size = j * sizeof(struct permission_range);
+
+	return pw_core_for_each_global(client->core, emit_existing, &update);
+}
+
 static uint32_t parse_mask(const char *str)
 {
 	uint32_t mask = 0;
@@ -455,7 +581,6 @@ int pw_client_update_permissions(struct pw_client *client, const struct spa_dict
 	int i;
 	const char *str;
 	size_t len;
-	struct permissions_update update = { client, 0 };
 	uint32_t permissions_existing, permissions_default;
 
 	permissions_default = impl->permissions_default;
@@ -488,9 +613,7 @@ int pw_client_update_permissions(struct pw_client *client, const struct spa_dict
 			/* apply the specific updates in order. This is ok for now, we could add
 			 * a field to the permission struct later to accumulate the changes
 			 * and apply them out of this loop */
-			update.permissions = parse_mask(str + len);
-			update.only_new = false;
-			do_permissions(&update, global);
+			update_permission(client, global, parse_mask(str + len));
 		}
 		else if (strcmp(dict->items[i].key, PW_CORE_PROXY_PERMISSIONS_EXISTING) == 0) {
 			permissions_existing = parse_mask(str);
@@ -500,11 +623,8 @@ int pw_client_update_permissions(struct pw_client *client, const struct spa_dict
 	}
 	/* apply default and existing permissions after specific ones to make the
 	 * permission update look like an atomic unordered set of changes. */
-	if (permissions_existing != -1) {
-		update.permissions = permissions_existing;
-		update.only_new = true;
-		pw_core_for_each_global(client->core, do_permissions, &update);
-	}
+	if (permissions_existing != -1)
+		update_existing(client, permissions_existing);
 	impl->permissions_default = permissions_default;
 
 	return 0;
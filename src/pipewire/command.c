@@ -33,6 +33,7 @@
 
 static struct pw_command *parse_command_help(const char *line, char **err);
 static struct pw_command *parse_command_module_load(const char *line, char **err);
+static struct pw_command *parse_command_set_prop(const char *line, char **err);
 
 struct impl {
 	struct pw_command this;
@@ -49,6 +50,7 @@ struct command_parse {
 static const struct command_parse parsers[] = {
 	{"help", "Show this help", parse_command_help},
 	{"load-module", "Load a module", parse_command_module_load},
+	{"set-prop", "Set a core property", parse_command_set_prop},
 	{NULL, NULL, NULL }
 };
 
@@ -127,6 +129,43 @@ static struct pw_command *parse_command_module_load(const char *line, char **err
 	return NULL;
 }
 
+static int
+execute_command_set_prop(struct pw_command *command, struct pw_core *core, char **err)
+{
+	struct spa_dict_item item;
+
+	item = SPA_DICT_ITEM_INIT(command->args[1], command->args[2]);
+	return pw_core_update_properties(core, &SPA_DICT_INIT(&item, 1));
+}
+
+static struct pw_command *parse_command_set_prop(const char *line, char **err)
+{
+	struct impl *impl;
+	struct pw_command *this;
+
+	impl = calloc(1, sizeof(struct impl));
+	if (impl == NULL)
+		goto no_mem;
+
+	this = &impl->this;
+	this->func = execute_command_set_prop;
+	this->args = pw_split_strv(line, whitespace, 3, &this->n_args);
+
+	if (this->n_args < 3)
+		goto no_value;
+
+	return this;
+
+      no_value:
+	asprintf(err, "%s requires a key and a value", this->args[0]);
+	pw_free_strv(this->args);
+	free(impl);
+	return NULL;
+      no_mem:
+	asprintf(err, "no memory");
+	return NULL;
+}
+
 /** Free command
  *
  * \param command a command to free
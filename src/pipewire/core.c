@@ -33,15 +33,43 @@
 #include <pipewire/core.h>
 #include <pipewire/data-loop.h>
 
-#undef spa_debug
-#define spa_debug pw_log_trace
-#include <spa/graph/graph-scheduler6.h>
+#define MAX_FORMAT_CACHE	64
+#define MAX_FILTER_TYPES	16
 
 /** \cond */
 struct resource_data {
 	struct spa_hook resource_listener;
 };
 
+struct registry_data {
+	struct spa_hook resource_listener;
+	struct pw_properties *filter;	/**< properties to match or NULL */
+	char *type_names;		/**< copy of the type names, NUL separated */
+	uint32_t n_types;		/**< types to match, 0 for all types */
+	const char *types[MAX_FILTER_TYPES];
+};
+
+/* a format negotiated between two ports with the given EnumFormat hashes */
+/* the params that identify the result of a negotiation and their hash */
+struct format_key {
+	uint64_t hash;
+	size_t size;
+	size_t alloc;
+	uint8_t *data;
+};
+
+struct format_entry {
+	struct spa_list link;
+	uint64_t output;
+	uint64_t input;
+	uint64_t filter;
+	size_t output_size;
+	size_t input_size;
+	size_t filter_size;
+	uint8_t *keys;		/* the output, input and filter keys */
+	struct spa_pod *format;
+};
+
 /** \endcond */
 
 static void registry_bind(void *object, uint32_t id,
@@ -94,7 +122,13 @@ static const struct pw_registry_proxy_methods registry_methods = {
 static void destroy_registry_resource(void *object)
 {
 	struct pw_resource *resource = object;
+	struct registry_data *data = pw_resource_get_user_data(resource);
+
 	spa_list_remove(&resource->link);
+
+	if (data->filter)
+		pw_properties_free(data->filter);
+	free(data->type_names);
 }
 
 static const struct pw_resource_events resource_events = {
@@ -144,17 +178,84 @@ static void core_sync(void *object, uint32_t seq)
 	struct pw_resource *resource = object;
 
 	pw_log_debug("core %p: sync %d from resource %p", resource->core, seq, resource);
+	/* info queued before the sync must arrive before the done */
+	pw_core_flush_info(resource->core);
 	pw_core_resource_done(resource, seq);
 }
 
-static void core_get_registry(void *object, uint32_t version, uint32_t new_id)
+bool pw_core_registry_match(struct pw_resource *resource, struct pw_global *global)
+{
+	struct registry_data *data = pw_resource_get_user_data(resource);
+	const struct spa_dict_item *item;
+	const char *str;
+	uint32_t i;
+
+	if (data->n_types > 0) {
+		str = spa_type_map_get_type(global->core->type.map, global->type);
+		if (str == NULL)
+			return false;
+		for (i = 0; i < data->n_types; i++)
+			if (strcmp(data->types[i], str) == 0)
+				break;
+		if (i == data->n_types)
+			return false;
+	}
+	if (data->filter == NULL)
+		return true;
+
+	spa_dict_for_each(item, &data->filter->dict) {
+		if (global->properties == NULL ||
+		    (str = pw_properties_get(global->properties, item->key)) == NULL)
+			return false;
+		if (strcmp(item->value, "*") != 0 && strcmp(item->value, str) != 0)
+			return false;
+	}
+	return true;
+}
+
+static int parse_filter(struct registry_data *data, const struct spa_dict *filter)
+{
+	const char *str, *state = NULL, *t;
+	char *name;
+	size_t len;
+
+	if (filter == NULL || filter->n_items == 0)
+		return 0;
+
+	if ((data->filter = pw_properties_new_dict(filter)) == NULL)
+		return -ENOMEM;
+
+	/* the names are compared with the type of the globals, the client can't
+	 * add new types to the type map with a filter */
+	if ((str = pw_properties_get(data->filter, PW_REGISTRY_FILTER_TYPE)) != NULL) {
+		if ((data->type_names = strdup(str)) == NULL)
+			return -ENOMEM;
+		while ((t = pw_split_walk(str, ",", &len, &state)) != NULL) {
+			if (data->n_types == MAX_FILTER_TYPES)
+				return -EINVAL;
+			name = data->type_names + (t - str);
+			name[len] = '\0';
+			data->types[data->n_types++] = name;
+		}
+		pw_properties_set(data->filter, PW_REGISTRY_FILTER_TYPE, NULL);
+	}
+	if (data->filter->dict.n_items == 0) {
+		pw_properties_free(data->filter);
+		data->filter = NULL;
+	}
+	return 0;
+}
+
+static void core_get_registry_filtered(void *object, uint32_t version,
+				       const struct spa_dict *filter, uint32_t new_id)
 {
 	struct pw_resource *resource = object;
 	struct pw_client *client = resource->client;
 	struct pw_core *this = resource->core;
 	struct pw_global *global;
 	struct pw_resource *registry_resource;
-	struct resource_data *data;
+	struct registry_data *data;
+	int res;
 
 	registry_resource = pw_resource_new(client,
 					    new_id,
@@ -177,9 +278,13 @@ static void core_get_registry(void *object, uint32_t version, uint32_t new_id)
 
 	spa_list_append(&this->registry_resource_list, &registry_resource->link);
 
+	if ((res = parse_filter(data, filter)) < 0)
+		goto invalid_filter;
+
 	spa_list_for_each(global, &this->global_list, link) {
 		uint32_t permissions = pw_global_get_permissions(global, client);
-		if (PW_PERM_IS_R(permissions)) {
+		if (PW_PERM_IS_R(permissions) &&
+		    pw_core_registry_match(registry_resource, global)) {
 			pw_registry_resource_global(registry_resource,
 						    global->id,
 						    global->parent->id,
@@ -197,6 +302,18 @@ static void core_get_registry(void *object, uint32_t version, uint32_t new_id)
 	pw_log_error("can't create registry resource");
 	pw_core_resource_error(client->core_resource,
 			       resource->id, -ENOMEM, "no memory");
+	return;
+
+      invalid_filter:
+	pw_log_error("invalid registry filter");
+	pw_core_resource_error(client->core_resource,
+			       resource->id, res, "invalid registry filter");
+	pw_resource_destroy(registry_resource);
+}
+
+static void core_get_registry(void *object, uint32_t version, uint32_t new_id)
+{
+	core_get_registry_filtered(object, version, NULL, new_id);
 }
 
 static void
@@ -285,10 +402,15 @@ static void core_update_types(void *object, uint32_t first_id, const char **type
 	struct pw_client *client = resource->client;
 	int i;
 
+	if (first_id < client->n_identity)
+		client->n_identity = first_id;
+
 	for (i = 0; i < n_types; i++, first_id++) {
 		uint32_t this_id = spa_type_map_get_id(this->type.map, types[i]);
 		if (!pw_map_insert_at(&client->types, first_id, PW_MAP_ID_TO_PTR(this_id)))
 			pw_log_error("can't add type %d->%d for client", first_id, this_id);
+		else if (this_id == first_id && first_id == client->n_identity)
+			client->n_identity++;
 	}
 }
 
@@ -302,6 +424,7 @@ static const struct pw_core_proxy_methods core_methods = {
 	.permissions = core_permissions,
 	.create_object = core_create_object,
 	.destroy = core_destroy,
+	.get_registry_filtered = core_get_registry_filtered,
 };
 
 static void core_unbind_func(void *data)
@@ -365,6 +488,29 @@ static const struct pw_global_events global_events = {
 	.bind = global_bind,
 };
 
+/* dispatched like the other sources, with the thread loop lock held */
+static void do_flush_event(void *data, uint64_t count)
+{
+	struct pw_core *core = data;
+	core->flush_signaled = false;
+	pw_link_process_batch(core);
+	pw_core_flush_info(core);
+}
+
+static void init_loop_support(struct pw_core *core, struct pw_data_loop *loop)
+{
+	uint32_t i;
+
+	for (i = 0; i < core->n_support; i++) {
+		if (strcmp(core->support[i].type, SPA_TYPE_LOOP__DataLoop) == 0)
+			loop->support[i] = SPA_SUPPORT_INIT(SPA_TYPE_LOOP__DataLoop,
+							    loop->loop->loop);
+		else
+			loop->support[i] = core->support[i];
+	}
+	loop->n_support = core->n_support;
+}
+
 /** Create a new core object
  *
  * \param main_loop the main loop to use
@@ -377,7 +523,7 @@ SPA_EXPORT
 struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *properties)
 {
 	struct pw_core *this;
-	const char *name;
+	const char *name, *str;
 
 	this = calloc(1, sizeof(struct pw_core));
 	if (this == NULL)
@@ -395,18 +541,36 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 	this->data_loop_impl = pw_data_loop_new(properties);
 	if (this->data_loop_impl == NULL)
 		goto no_data_loop;
+	spa_list_init(&this->data_loop_list);
+	spa_list_append(&this->data_loop_list, &this->data_loop_impl->link);
 
 	this->data_loop = pw_data_loop_get_loop(this->data_loop_impl);
 	this->main_loop = main_loop;
 
+	this->flush_event = pw_loop_add_event(main_loop, do_flush_event, this);
+	if (this->flush_event == NULL)
+		goto no_mem;
+
 	pw_type_init(&this->type);
 	pw_map_init(&this->globals, 128, 32);
 
-	spa_graph_init(&this->rt.graph);
-	spa_graph_set_callbacks(&this->rt.graph, &spa_graph_impl_default, NULL);
-
 	this->dbus_iface = pw_get_spa_dbus(this->main_loop);
 
+	if ((str = pw_properties_get(properties, "log.binary")) == NULL)
+		str = getenv("PIPEWIRE_LOG_BINARY");
+	if (str && pw_properties_parse_bool(str)) {
+		struct spa_dict_item items[1];
+
+		/* trace messages from the data loops are recorded without
+		 * formatting and printed from the main loop */
+		items[0] = SPA_DICT_ITEM_INIT("log.binary", "true");
+		this->log_iface = pw_get_spa_log(this->main_loop, &SPA_DICT_INIT(items, 1));
+		if (this->log_iface) {
+			this->old_log = pw_log_get();
+			pw_log_set(this->log_iface);
+		}
+	}
+
 	this->support[0] = SPA_SUPPORT_INIT(SPA_TYPE__TypeMap, this->type.map);
 	this->support[1] = SPA_SUPPORT_INIT(SPA_TYPE_LOOP__DataLoop, this->data_loop->loop);
 	this->support[2] = SPA_SUPPORT_INIT(SPA_TYPE_LOOP__MainLoop, this->main_loop->loop);
@@ -417,6 +581,8 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 
 	pw_log_debug("%p", this->support[5].data);
 
+	init_loop_support(this, this->data_loop_impl);
+
 	pw_data_loop_start(this->data_loop_impl);
 
 	spa_list_init(&this->protocol_list);
@@ -427,10 +593,15 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 	spa_list_init(&this->module_list);
 	spa_list_init(&this->client_list);
 	spa_list_init(&this->node_list);
+	spa_list_init(&this->port_node_list[0]);
+	spa_list_init(&this->port_node_list[1]);
 	spa_list_init(&this->factory_list);
 	spa_list_init(&this->link_list);
 	spa_list_init(&this->control_list[0]);
 	spa_list_init(&this->control_list[1]);
+	spa_list_init(&this->format_cache);
+	spa_list_init(&this->link_batch);
+	spa_list_init(&this->info_queue);
 	spa_hook_list_init(&this->listener_list);
 
 	if ((name = pw_properties_get(properties, PW_CORE_PROP_NAME)) == NULL) {
@@ -490,10 +661,13 @@ void pw_core_destroy(struct pw_core *core)
 	struct pw_remote *remote;
 	struct pw_resource *resource;
 	struct pw_node *node;
+	struct pw_data_loop *data_loop;
+	struct format_entry *entry;
 
 	pw_log_debug("core %p: destroy", core);
 	pw_core_events_destroy(core);
 
+	pw_loop_destroy_source(core->main_loop, core->flush_event);
 	spa_hook_remove(&core->global_listener);
 
 	spa_list_consume(remote, &core->remote_list, link)
@@ -515,13 +689,26 @@ void pw_core_destroy(struct pw_core *core)
 		pw_global_destroy(global);
 	pw_map_clear(&core->globals);
 
+	spa_list_consume(entry, &core->format_cache, link) {
+		spa_list_remove(&entry->link);
+		free(entry);
+	}
+
 	pw_log_debug("core %p: free", core);
 	pw_core_events_free(core);
 
-	pw_data_loop_destroy(core->data_loop_impl);
+	spa_list_consume(data_loop, &core->data_loop_list, link) {
+		spa_list_remove(&data_loop->link);
+		pw_data_loop_destroy(data_loop);
+	}
 
 	pw_release_spa_dbus(core->dbus_iface);
 
+	if (core->log_iface) {
+		pw_log_set(core->old_log);
+		pw_release_spa_log(core->log_iface);
+	}
+
 	pw_properties_free(core->properties);
 
 	free(core);
@@ -561,6 +748,86 @@ const struct spa_support *pw_core_get_support(struct pw_core *core, uint32_t *n_
 	return core->support;
 }
 
+/* a named loop is configured with data-loop.<name>.<key> properties on the
+ * core, they are passed to the loop as loop.<key> */
+static struct pw_properties *data_loop_properties(struct pw_core *core, const char *name)
+{
+	struct pw_properties *props = NULL;
+	const char *key;
+	void *state = NULL;
+	size_t len = strlen(name);
+	char loop_key[256];
+
+	while ((key = pw_properties_iterate(core->properties, &state))) {
+		if (strncmp(key, "data-loop.", 10) != 0 ||
+		    strncmp(key + 10, name, len) != 0 || key[10 + len] != '.')
+			continue;
+
+		if (props == NULL &&
+		    (props = pw_properties_new("loop.name", name, NULL)) == NULL)
+			return NULL;
+
+		snprintf(loop_key, sizeof(loop_key), "loop.%s", key + 11 + len);
+		pw_properties_set(props, loop_key, pw_properties_get(core->properties, key));
+	}
+	return props;
+}
+
+SPA_EXPORT
+struct pw_data_loop *pw_core_get_data_loop(struct pw_core *core, const char *name)
+{
+	struct pw_data_loop *loop;
+	struct pw_properties *props;
+
+	if (name == NULL)
+		return core->data_loop_impl;
+
+	spa_list_for_each(loop, &core->data_loop_list, link) {
+		if (strcmp(loop->name, name) == 0)
+			return loop;
+	}
+
+	/* only loops from the configuration are made so that clients can't
+	 * start threads */
+	if ((props = data_loop_properties(core, name)) == NULL) {
+		pw_log_warn("core %p: data loop \"%s\" is not configured", core, name);
+		return core->data_loop_impl;
+	}
+
+	loop = pw_data_loop_new(props);
+	pw_properties_free(props);
+	if (loop == NULL)
+		return core->data_loop_impl;
+
+	init_loop_support(core, loop);
+
+	spa_list_append(&core->data_loop_list, &loop->link);
+	pw_core_events_data_loop_added(core, loop);
+
+	if (pw_data_loop_start(loop) < 0) {
+		spa_list_remove(&loop->link);
+		pw_data_loop_destroy(loop);
+		return core->data_loop_impl;
+	}
+
+	pw_log_info("core %p: new data loop %p \"%s\"", core, loop, name);
+
+	return loop;
+}
+
+SPA_EXPORT
+const struct spa_support *pw_core_get_node_support(struct pw_core *core,
+						    const struct spa_dict *props,
+						    uint32_t *n_support)
+{
+	struct pw_data_loop *loop;
+
+	loop = pw_core_get_data_loop(core, props ? spa_dict_lookup(props, PW_NODE_PROP_DATA_LOOP) : NULL);
+
+	*n_support = loop->n_support;
+	return loop->support;
+}
+
 SPA_EXPORT
 struct pw_loop *pw_core_get_main_loop(struct pw_core *core)
 {
@@ -643,6 +910,44 @@ struct pw_global *pw_core_find_global(struct pw_core *core, uint32_t id)
 	return global;
 }
 
+/* the checks on a node that don't need its ports */
+static bool node_can_link(struct pw_core *core, struct pw_node *n,
+			  struct pw_port *other_port, enum pw_direction direction)
+{
+	if (n->global == NULL || other_port->node == n || !n->enabled)
+		return false;
+
+	if (core->current_client &&
+	    !PW_PERM_IS_R(pw_global_get_permissions(n->global, core->current_client)))
+		return false;
+
+	return pw_node_has_free_port(n, direction);
+}
+
+/* the media type of the first EnumFormat param of the port, 0 when unknown */
+static uint32_t port_media_type(struct pw_core *core, struct pw_port *port)
+{
+	uint8_t buffer[4096];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+	struct spa_pod *param;
+	uint32_t index = 0, media_type;
+
+	if (port->media_type != 0)
+		return port->media_type;
+
+	if (spa_node_port_enum_params(port->node->node,
+				      port->spa_direction, port->port_id,
+				      core->type.param.idEnumFormat, &index,
+				      NULL, &param, &b) <= 0)
+		return 0;
+
+	if (spa_pod_object_parse(param, "I", &media_type) < 0)
+		return 0;
+
+	port->media_type = media_type;
+	return media_type;
+}
+
 /** Find a port to link with
  *
  * \param core a core
@@ -665,77 +970,296 @@ struct pw_port *pw_core_find_port(struct pw_core *core,
 				  char **error)
 {
 	struct pw_port *best = NULL;
-	bool have_id;
+	enum pw_direction direction = pw_direction_reverse(other_port->direction);
 	struct pw_node *n;
+	uint32_t other_type;
 
-	have_id = id != SPA_ID_INVALID;
+	pw_log_debug("id \"%u\", %d", id, id != SPA_ID_INVALID);
 
-	pw_log_debug("id \"%u\", %d", id, have_id);
+	if (id != SPA_ID_INVALID) {
+		struct pw_global *global = pw_map_lookup(&core->globals, id);
 
-	spa_list_for_each(n, &core->node_list, link) {
-		if (n->global == NULL)
-			continue;
+		if (global == NULL || global->type != core->type.node)
+			goto done;
 
-		if (other_port->node == n)
-			continue;
+		n = global->object;
+		if (!node_can_link(core, n, other_port, direction))
+			goto done;
 
-		if (core->current_client &&
-		    !PW_PERM_IS_R(pw_global_get_permissions(n->global, core->current_client)))
-			continue;
+		pw_log_debug("id \"%u\" matches node %p", id, n);
+		best = pw_node_get_free_port(n, direction);
+		goto done;
+	}
+
+	other_type = port_media_type(core, other_port);
 
-		if (!n->enabled)
+	spa_list_for_each(n, &core->port_node_list[direction], port_link[direction]) {
+		struct pw_port *p, *pin, *pout;
+		uint8_t buf[4096];
+		struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buf, sizeof(buf));
+		struct spa_pod *dummy;
+		uint32_t type;
+
+		if (!node_can_link(core, n, other_port, direction))
 			continue;
 
 		pw_log_debug("node id \"%d\"", n->global->id);
 
-		if (have_id) {
-			if (n->global->id == id) {
-				pw_log_debug("id \"%u\" matches node %p", id, n);
+		p = pw_node_get_free_port(n, direction);
+		if (p == NULL)
+			continue;
 
-				best =
-				    pw_node_get_free_port(n, pw_direction_reverse(other_port->direction));
-				if (best)
-					break;
-			}
+		/* the media types must match before trying the full negotiation */
+		type = port_media_type(core, p);
+		if (other_type != 0 && type != 0 && type != other_type)
+			continue;
+
+		if (p->direction == PW_DIRECTION_OUTPUT) {
+			pin = other_port;
+			pout = p;
 		} else {
-			struct pw_port *p, *pin, *pout;
-			uint8_t buf[4096];
-			struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buf, sizeof(buf));
-			struct spa_pod *dummy;
-
-			p = pw_node_get_free_port(n, pw_direction_reverse(other_port->direction));
-			if (p == NULL)
-				continue;
-
-			if (p->direction == PW_DIRECTION_OUTPUT) {
-				pin = other_port;
-				pout = p;
-			} else {
-				pin = p;
-				pout = other_port;
-			}
+			pin = p;
+			pout = other_port;
+		}
 
-			if (pw_core_find_format(core,
-						pout,
-						pin,
-						props,
-						n_format_filters,
-						format_filters,
-						&dummy,
-						&b,
-						error) < 0) {
-				free(*error);
-				continue;
-			}
-			best = p;
+		if (pw_core_find_format(core,
+					pout,
+					pin,
+					props,
+					n_format_filters,
+					format_filters,
+					&dummy,
+					&b,
+					error) < 0) {
+			free(*error);
+			continue;
 		}
+		best = p;
 	}
+      done:
 	if (best == NULL) {
 		asprintf(error, "No matching Node found");
 	}
 	return best;
 }
 
+#define FORMAT_KEY_INIT	(struct format_key) { 0xcbf29ce484222325ULL, 0, 0, NULL }
+
+static int format_key_add(struct format_key *key, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	size_t i;
+
+	if (key->size + size > key->alloc) {
+		size_t alloc = SPA_MAX(key->alloc * 2, key->size + size);
+		uint8_t *d;
+
+		if ((d = realloc(key->data, alloc)) == NULL)
+			return -errno;
+		key->data = d;
+		key->alloc = alloc;
+	}
+	memcpy(key->data + key->size, data, size);
+	key->size += size;
+
+	for (i = 0; i < size; i++) {
+		key->hash ^= p[i];
+		key->hash *= 0x100000001b3ULL;
+	}
+	return 0;
+}
+
+/* the factory of the node and the EnumFormat params of the port identify
+ * the result of the negotiation without trusting the node to report all of
+ * its param changes */
+static int port_format_key(struct pw_core *core, struct pw_port *port, struct format_key *key)
+{
+	struct pw_node *node = port->node;
+	struct spa_pod_builder b = { 0 };
+	uint8_t buffer[4096];
+	struct spa_pod *param;
+	uint32_t index = 0;
+	const char *str;
+	int res;
+
+	if (node->properties &&
+	    (str = pw_properties_get(node->properties, "factory.name")) != NULL &&
+	    (res = format_key_add(key, str, strlen(str) + 1)) < 0)
+		return res;
+
+	while (true) {
+		spa_pod_builder_init(&b, buffer, sizeof(buffer));
+		if ((res = spa_node_port_enum_params(node->node,
+						     port->spa_direction, port->port_id,
+						     core->type.param.idEnumFormat, &index,
+						     NULL, &param, &b)) <= 0)
+			break;
+		if ((res = format_key_add(key, param, SPA_POD_SIZE(param))) < 0)
+			return res;
+	}
+	if (res < 0 || index == 0)
+		return res < 0 ? res : -ENOENT;
+
+	/* 0 means unknown */
+	if (key->hash == 0)
+		key->hash = 1;
+	port->format_hash = key->hash;
+	return 0;
+}
+
+static int filter_key(uint32_t n_format_filters, struct spa_pod **format_filters,
+		      struct format_key *key)
+{
+	uint32_t i;
+	int res;
+
+	for (i = 0; i < n_format_filters; i++)
+		if ((res = format_key_add(key, format_filters[i],
+					  SPA_POD_SIZE(format_filters[i]))) < 0)
+			return res;
+	return 0;
+}
+
+/* the hashes only find the candidates, the keys must be the same */
+static struct format_entry *
+find_format(struct pw_core *core, const struct format_key *output,
+	    const struct format_key *input, const struct format_key *filter)
+{
+	struct format_entry *entry;
+	const uint8_t *keys;
+
+	spa_list_for_each(entry, &core->format_cache, link) {
+		if (entry->output != output->hash || entry->input != input->hash ||
+		    entry->filter != filter->hash ||
+		    entry->output_size != output->size || entry->input_size != input->size ||
+		    entry->filter_size != filter->size)
+			continue;
+
+		keys = entry->keys;
+		if (memcmp(keys, output->data, output->size) != 0 ||
+		    memcmp(keys + output->size, input->data, input->size) != 0 ||
+		    (filter->size > 0 &&
+		     memcmp(keys + output->size + input->size, filter->data, filter->size) != 0))
+			continue;
+
+		/* move to the front, the tail is evicted first */
+		spa_list_remove(&entry->link);
+		spa_list_prepend(&core->format_cache, &entry->link);
+		return entry;
+	}
+	return NULL;
+}
+
+static void add_format(struct pw_core *core, const struct format_key *output,
+		       const struct format_key *input, const struct format_key *filter,
+		       const struct spa_pod *format)
+{
+	struct format_entry *entry;
+	size_t size = SPA_POD_SIZE(format);
+	uint8_t *keys;
+
+	if (core->n_format_cache >= MAX_FORMAT_CACHE) {
+		entry = spa_list_last(&core->format_cache, struct format_entry, link);
+		spa_list_remove(&entry->link);
+		free(entry);
+		core->n_format_cache--;
+	}
+
+	if ((entry = malloc(sizeof(struct format_entry) + size +
+			    output->size + input->size + filter->size)) == NULL)
+		return;
+
+	entry->output = output->hash;
+	entry->input = input->hash;
+	entry->filter = filter->hash;
+	entry->output_size = output->size;
+	entry->input_size = input->size;
+	entry->filter_size = filter->size;
+	entry->format = SPA_MEMBER(entry, sizeof(struct format_entry), struct spa_pod);
+	memcpy(entry->format, format, size);
+
+	entry->keys = keys = SPA_MEMBER(entry->format, size, uint8_t);
+	memcpy(keys, output->data, output->size);
+	memcpy(keys + output->size, input->data, input->size);
+	if (filter->size > 0)
+		memcpy(keys + output->size + input->size, filter->data, filter->size);
+
+	spa_list_prepend(&core->format_cache, &entry->link);
+	core->n_format_cache++;
+}
+
+/** Queue an info event
+ *
+ * When the info of the object is already queued, the change_mask is merged
+ * and only one event with the latest values is sent from the next main loop
+ * iteration. The emit function of \a pending is called with the merged
+ * change_mask.
+ */
+void pw_core_queue_info(struct pw_core *core, struct pw_info_pending *pending, uint64_t change_mask)
+{
+	if (change_mask == 0)
+		return;
+
+	if (pending->change_mask == 0) {
+		spa_list_append(&core->info_queue, &pending->link);
+		pw_core_schedule_flush(core);
+	} else
+		core->info_elided++;
+
+	pending->change_mask |= change_mask;
+}
+
+void pw_core_flush_info(struct pw_core *core)
+{
+	struct pw_info_pending *pending;
+	uint64_t change_mask;
+
+	spa_list_consume(pending, &core->info_queue, link) {
+		spa_list_remove(&pending->link);
+		change_mask = pending->change_mask;
+		pending->change_mask = 0;
+		pending->emit(pending, change_mask);
+	}
+	pw_log_trace("core %p: %"PRIu64" info events merged", core, core->info_elided);
+}
+
+/** Flush the batched links and the queued info from the next iteration
+ * of the main loop */
+void pw_core_schedule_flush(struct pw_core *core)
+{
+	if (!core->flush_signaled) {
+		core->flush_signaled = true;
+		pw_loop_signal_event(core->main_loop, core->flush_event);
+	}
+}
+
+/** Get the number of info events that were merged into an already queued
+ * event since the core was created
+ *
+ * \memberof pw_core
+ */
+SPA_EXPORT
+uint64_t pw_core_get_info_elided(struct pw_core *core)
+{
+	return core->info_elided;
+}
+
+void pw_core_invalidate_formats(struct pw_core *core, uint64_t hash)
+{
+	struct format_entry *entry, *t;
+
+	if (hash == 0)
+		return;
+
+	spa_list_for_each_safe(entry, t, &core->format_cache, link) {
+		if (entry->output != hash && entry->input != hash)
+			continue;
+		spa_list_remove(&entry->link);
+		free(entry);
+		core->n_format_cache--;
+	}
+}
+
 /** Find a common format between two ports
  *
  * \param core a core object
@@ -769,6 +1293,7 @@ int pw_core_find_format(struct pw_core *core,
 	struct spa_pod_builder fb = { 0 };
 	uint8_t fbuf[4096];
 	struct spa_pod *filter;
+	struct format_key okey = FORMAT_KEY_INIT, ikey = FORMAT_KEY_INIT, fkey = FORMAT_KEY_INIT;
 
 	out_state = output->state;
 	in_state = input->state;
@@ -822,6 +1347,22 @@ int pw_core_find_format(struct pw_core *core,
 			goto error;
 		}
 	} else if (in_state == PW_PORT_STATE_CONFIGURE && out_state == PW_PORT_STATE_CONFIGURE) {
+		struct format_entry *entry;
+		bool cache;
+
+		cache = port_format_key(core, output, &okey) == 0 &&
+			port_format_key(core, input, &ikey) == 0 &&
+			filter_key(n_format_filters, format_filters, &fkey) == 0;
+
+		if (cache && (entry = find_format(core, &okey, &ikey, &fkey)) != NULL) {
+			uint32_t ref = spa_pod_builder_raw_padded(builder, entry->format,
+								  SPA_POD_SIZE(entry->format));
+			if ((*format = spa_pod_builder_deref(builder, ref)) != NULL) {
+				pw_log_debug("core %p: cached format %p", core, entry);
+				res = 1;
+				goto done;
+			}
+		}
 	      again:
 		/* both ports need a format */
 		pw_log_debug("core %p: do enum input %d", core, iidx);
@@ -856,16 +1397,23 @@ int pw_core_find_format(struct pw_core *core,
 		pw_log_debug("Got filtered:");
 		if (pw_log_level_enabled(SPA_LOG_LEVEL_DEBUG))
 			spa_debug_format(2, core->type.map, *format);
+
+		if (cache)
+			add_format(core, &okey, &ikey, &fkey, *format);
 	} else {
 		res = -EBADF;
 		asprintf(error, "error node state");
 		goto error;
 	}
-	return res;
+	goto done;
 
       error:
 	if (res == 0)
 		res = -EBADF;
+      done:
+	free(okey.data);
+	free(ikey.data);
+	free(fkey.data);
 	return res;
 }
 
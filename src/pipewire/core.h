@@ -45,6 +45,7 @@ struct pw_core;
 #include <pipewire/factory.h>
 #include <pipewire/port.h>
 #include <pipewire/properties.h>
+#include <pipewire/data-loop.h>
 
 /** \page page_core_api Core API
  *
@@ -85,7 +86,7 @@ struct pw_core;
 
 /** core events emited by the core object added with \ref pw_core_add_listener */
 struct pw_core_events {
-#define PW_VERSION_CORE_EVENTS	0
+#define PW_VERSION_CORE_EVENTS	1
 	uint32_t version;
 
 	/** The core is being destroyed */
@@ -98,6 +99,9 @@ struct pw_core_events {
 	void (*global_added) (void *data, struct pw_global *global);
 	/** a global object was removed */
 	void (*global_removed) (void *data, struct pw_global *global);
+	/** a data loop was added, emitted before its thread is started.
+	 * \since version 1 */
+	void (*data_loop_added) (void *data, struct pw_data_loop *loop);
 };
 
 /** The user name that started the core */
@@ -141,9 +145,18 @@ int pw_core_update_properties(struct pw_core *core, const struct spa_dict *dict)
 /** Get the core support objects */
 const struct spa_support *pw_core_get_support(struct pw_core *core, uint32_t *n_support);
 
+/** Get the support objects for a node with \a props, the data loop is the
+ * one selected with the node.data-loop property */
+const struct spa_support *pw_core_get_node_support(struct pw_core *core,
+						    const struct spa_dict *props,
+						    uint32_t *n_support);
+
 /** get the core main loop */
 struct pw_loop *pw_core_get_main_loop(struct pw_core *core);
 
+/** Get the total number of info events that were merged into a queued one */
+uint64_t pw_core_get_info_elided(struct pw_core *core);
+
 /** Iterate the globals of the core. The callback should return
  * 0 to fetch the next item, any other value stops the iteration and returns
  * the value. When all callbacks return 0, this function returns 0 when all
@@ -18,19 +18,60 @@
  */
 
 #include <pthread.h>
+#include <sched.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/resource.h>
 
 #include "pipewire/log.h"
 #include "pipewire/data-loop.h"
 #include "pipewire/private.h"
+#include "pipewire/probes.h"
+
+#undef spa_debug
+#define spa_debug pw_log_trace
+#define spa_graph_probe pw_probe
+#include <spa/graph/graph-scheduler6.h>
+
+/* runs in the thread of the loop */
+static void apply_thread_settings(struct pw_data_loop *this)
+{
+	const char *str;
+	int err;
+
+	if ((str = pw_properties_get(this->properties, "loop.cpus")) != NULL) {
+		cpu_set_t set;
+
+		if (pw_parse_cpus(str, &set) < 0)
+			pw_log_warn("data-loop %p: invalid loop.cpus \"%s\"", this, str);
+		else if ((err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+			pw_log_warn("data-loop %p: can't set affinity to %s: %s",
+					this, str, strerror(err));
+		else
+			pw_log_debug("data-loop %p: affinity %s", this, str);
+	}
+	if ((str = pw_properties_get(this->properties, "loop.rt-priority")) != NULL) {
+		struct sched_param sp;
+
+		spa_zero(sp);
+		sp.sched_priority = atoi(str);
+		if (sp.sched_priority > 0 &&
+		    (err = pthread_setschedparam(pthread_self(),
+						 SCHED_FIFO | SCHED_RESET_ON_FORK, &sp)) != 0)
+			pw_log_warn("data-loop %p: can't set priority %d: %s",
+					this, sp.sched_priority, strerror(err));
+	}
+}
 
 static void *do_loop(void *user_data)
 {
 	struct pw_data_loop *this = user_data;
 	int res;
 
-	pw_log_debug("data-loop %p: enter thread", this);
+	pw_log_debug("data-loop %p: enter thread \"%s\"", this, this->name);
+	apply_thread_settings(this);
+	pw_data_loop_events_started(this);
 	pw_loop_enter(this->loop);
 
 	while (this->running) {
@@ -51,7 +92,43 @@ static void do_stop(void *data, uint64_t count)
 	this->running = false;
 }
 
+static int
+do_wakeup(struct spa_loop *loop,
+	  bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct spa_graph_port *port = ((struct spa_graph_port **) data)[0];
+
+	/* pairs with the release in spa_graph_impl_schedule_peer() */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (!spa_graph_port_is_disabled(port))
+		spa_graph_impl_process_peer(port);
+	return 0;
+}
+
+/* called from the thread of the graph of the peer of port. The port is passed
+ * through the lock-free invoke queue and its node is processed in this loop,
+ * the buffer itself is exchanged in the io area of the link. The port stays
+ * valid until the link drained the queue, see pw_link_destroy(). */
+static int graph_wakeup(void *data, struct spa_graph_port *port)
+{
+	struct pw_data_loop *this = data;
+
+	return pw_loop_invoke(this->loop, do_wakeup, SPA_ID_INVALID,
+			      &port, sizeof(struct spa_graph_port *), false, this);
+}
+
+static const struct spa_graph_callbacks graph_callbacks = {
+	SPA_VERSION_GRAPH_CALLBACKS,
+	.need_input = spa_graph_impl_need_input,
+	.have_output = spa_graph_impl_have_output,
+	.wakeup = graph_wakeup,
+};
+
 /** Create a new \ref pw_data_loop.
+ * \param properties properties for the loop, the name of the loop is
+ *	taken from loop.name, loop.cpus can contain a list of cpus to run on
+ *	and loop.rt-priority the realtime priority of the thread. Listeners
+ *	of the started event can change the thread further.
  * \return a newly allocated data loop
  *
  * \memberof pw_data_loop
@@ -67,6 +144,18 @@ struct pw_data_loop *pw_data_loop_new(struct pw_properties *properties)
 
 	pw_log_debug("data-loop %p: new", this);
 
+	if (properties)
+		this->properties = pw_properties_copy(properties);
+	else
+		this->properties = pw_properties_new(NULL, NULL);
+	if (this->properties == NULL)
+		goto no_properties;
+
+	if ((this->name = pw_properties_get(this->properties, "loop.name")) == NULL) {
+		pw_properties_set(this->properties, "loop.name", "data");
+		this->name = pw_properties_get(this->properties, "loop.name");
+	}
+
 	this->loop = pw_loop_new(properties);
 	if (this->loop == NULL)
 		goto no_loop;
@@ -75,9 +164,14 @@ struct pw_data_loop *pw_data_loop_new(struct pw_properties *properties)
 
 	this->event = pw_loop_add_event(this->loop, do_stop, this);
 
+	spa_graph_init(&this->rt.graph);
+	spa_graph_set_callbacks(&this->rt.graph, &graph_callbacks, this);
+
 	return this;
 
       no_loop:
+	pw_properties_free(this->properties);
+      no_properties:
 	free(this);
 	return NULL;
 }
@@ -97,6 +191,7 @@ void pw_data_loop_destroy(struct pw_data_loop *loop)
 
 	pw_loop_destroy_source(loop->loop, loop->event);
 	pw_loop_destroy(loop->loop);
+	pw_properties_free(loop->properties);
 	free(loop);
 }
 
@@ -38,13 +38,16 @@ struct pw_data_loop;
 
 /** Loop events, use \ref pw_data_loop_add_listener to add a listener */
 struct pw_data_loop_events {
-#define PW_VERSION_DATA_LOOP_EVENTS		0
+#define PW_VERSION_DATA_LOOP_EVENTS		1
 	uint32_t version;
 	/** The loop is destroyed */
 	void (*destroy) (void *data);
+	/** The thread of the loop started, emitted from the new thread before
+	 * the loop is iterated. \since version 1 */
+	void (*started) (void *data);
 };
 
-/** Make a new loop */
+/** Make a new loop, \a properties are copied */
 struct pw_data_loop *
 pw_data_loop_new(struct pw_properties *properties);
 
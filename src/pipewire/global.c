@@ -122,6 +122,7 @@ pw_global_register(struct pw_global *global,
 	global->parent = parent;
 
 	global->id = pw_map_insert_new(&core->globals, global);
+	global->serial = core->global_serial++;
 
 	spa_list_append(&core->global_list, &global->link);
 
@@ -131,7 +132,7 @@ pw_global_register(struct pw_global *global,
 	spa_list_for_each(registry, &core->registry_resource_list, link) {
 		uint32_t permissions = pw_global_get_permissions(global, registry->client);
 		pw_log_debug("registry %p: global %d %08x", registry, global->id, permissions);
-		if (PW_PERM_IS_R(permissions))
+		if (PW_PERM_IS_R(permissions) && pw_core_registry_match(registry, global))
 			pw_registry_resource_global(registry,
 						    global->id,
 						    global->parent->id,
@@ -256,7 +257,7 @@ void pw_global_destroy(struct pw_global *global)
 		spa_list_for_each(registry, &core->registry_resource_list, link) {
 			uint32_t permissions = pw_global_get_permissions(global, registry->client);
 			pw_log_debug("registry %p: global %d %08x", registry, global->id, permissions);
-			if (PW_PERM_IS_R(permissions))
+			if (PW_PERM_IS_R(permissions) && pw_core_registry_match(registry, global))
 				pw_registry_resource_global_remove(registry, global->id);
 		}
 
@@ -76,7 +76,8 @@ struct pw_link_proxy;
 #define PW_CORE_PROXY_METHOD_PERMISSIONS	5
 #define PW_CORE_PROXY_METHOD_CREATE_OBJECT	6
 #define PW_CORE_PROXY_METHOD_DESTROY		7
-#define PW_CORE_PROXY_METHOD_NUM		8
+#define PW_CORE_PROXY_METHOD_GET_REGISTRY_FILTERED	8
+#define PW_CORE_PROXY_METHOD_NUM		9
 
 /**
  * Key to update default permissions of globals without specific
@@ -196,6 +197,18 @@ struct pw_core_proxy_methods {
 	 * \param id the object id to destroy
 	 */
 	void (*destroy) (void *object, uint32_t id);
+	/**
+	 * Get a registry object that only announces the matching globals
+	 *
+	 * Like get_registry but the global and global_remove events are only
+	 * emitted for the globals that match \a filter. See
+	 * \ref PW_REGISTRY_FILTER_TYPE for the keys of the filter.
+	 * \param version the registry version
+	 * \param filter the filter
+	 * \param new_id the client proxy id
+	 */
+	void (*get_registry_filtered) (void *object, uint32_t version,
+				       const struct spa_dict *filter, uint32_t new_id);
 };
 
 static inline void
@@ -224,6 +237,16 @@ pw_core_proxy_get_registry(struct pw_core_proxy *core, uint32_t type, uint32_t v
 	return (struct pw_registry_proxy *) p;
 }
 
+static inline struct pw_registry_proxy *
+pw_core_proxy_get_registry_filtered(struct pw_core_proxy *core, uint32_t type, uint32_t version,
+				    const struct spa_dict *filter, size_t user_data_size)
+{
+	struct pw_proxy *p = pw_proxy_new((struct pw_proxy*)core, type, user_data_size);
+	pw_proxy_do((struct pw_proxy*)core, struct pw_core_proxy_methods, get_registry_filtered,
+		    version, filter, pw_proxy_get_id(p));
+	return (struct pw_registry_proxy *) p;
+}
+
 static inline void
 pw_core_proxy_client_update(struct pw_core_proxy *core, const struct spa_dict *props)
 {
@@ -342,6 +365,18 @@ pw_core_proxy_add_listener(struct pw_core_proxy *core,
 
 #define PW_VERSION_REGISTRY			0
 
+/** \page page_registry_filter Registry filter
+ *
+ * The filter of pw_core_proxy_get_registry_filtered() is evaluated by the
+ * server. A global matches when:
+ *
+ * - its type is one of the types in \ref PW_REGISTRY_FILTER_TYPE, when given
+ * - for all other keys, the global has a property with that key and the same
+ *   value. The value "*" matches any value.
+ */
+/** comma separated list of type names, like PW_TYPE_INTERFACE__Node */
+#define PW_REGISTRY_FILTER_TYPE		"registry.filter.type"
+
 /** \page page_registry Registry
  *
  * \section page_registry_overview Overview
@@ -22,6 +22,7 @@
 #include <stdio.h>
 
 #include <spa/pod/parser.h>
+#include <spa/pod/desc.h>
 #include <spa/pod/compare.h>
 #include <spa/param/param.h>
 
@@ -39,10 +40,20 @@
 #define MAX_BUFFERS     16
 
 /** \cond */
+/** values of the Buffers param */
+struct buffers_param {
+	uint32_t minsize;
+	uint32_t stride;
+	uint32_t buffers;
+};
+
 struct impl {
 	struct pw_link this;
 
 	bool active;
+	bool batched;
+
+	struct spa_list batch_link;	/**< link in core link_batch */
 
 	struct pw_work_queue *work;
 
@@ -116,13 +127,23 @@ static void complete_streaming(void *obj, void *data, int res, uint32_t id)
 	}
 }
 
+static void emit_info(struct pw_info_pending *pending, uint64_t change_mask)
+{
+	struct pw_link *this = SPA_CONTAINER_OF(pending, struct pw_link, info_pending);
+	struct pw_resource *resource;
+
+	this->info.change_mask = change_mask;
+	spa_list_for_each(resource, &this->resource_list, link)
+		pw_link_resource_info(resource, &this->info);
+	this->info.change_mask = 0;
+}
+
 static int do_negotiate(struct pw_link *this, uint32_t in_state, uint32_t out_state)
 {
 	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
 	int res = -EIO, res2;
 	struct spa_pod *format = NULL, *current;
 	char *error = NULL;
-	struct pw_resource *resource;
 	bool changed = true;
 	struct pw_port *input, *output;
 	uint8_t buffer[4096];
@@ -225,9 +246,7 @@ static int do_negotiate(struct pw_link *this, uint32_t in_state, uint32_t out_st
 
 		pw_link_events_info_changed(this, &this->info);
 
-		spa_list_for_each(resource, &this->resource_list, link)
-			pw_link_resource_info(resource, &this->info);
-
+		pw_core_queue_info(this->core, &this->info_pending, this->info.change_mask);
 		this->info.change_mask = 0;
 	}
 
@@ -332,6 +351,12 @@ static int alloc_buffers(struct pw_link *this,
 	struct spa_meta *metas;
 	struct pw_memblock *m;
 	struct pw_type *t = &this->core->type;
+	const struct spa_pod_prop_desc meta_desc[] = {
+		SPA_POD_PROP_DESC_ID(t->param_meta.type, struct spa_meta, type,
+				     SPA_POD_PROP_DESC_FLAG_REQUIRED),
+		SPA_POD_PROP_DESC_INT(t->param_meta.size, struct spa_meta, size,
+				      SPA_POD_PROP_DESC_FLAG_REQUIRED),
+	};
 
 	n_metas = data_size = meta_size = 0;
 
@@ -342,17 +367,13 @@ static int alloc_buffers(struct pw_link *this,
 	/* collect metadata */
 	for (i = 0; i < n_params; i++) {
 		if (spa_pod_is_object_type (params[i], t->param_meta.Meta)) {
-			uint32_t type, size;
-
-			if (spa_pod_object_parse(params[i],
-				":", t->param_meta.type, "I", &type,
-				":", t->param_meta.size, "i", &size, NULL) < 0)
+			if (spa_pod_object_parse_desc(params[i], meta_desc,
+					SPA_N_ELEMENTS(meta_desc), &metas[n_metas]) < 0)
 				continue;
 
-			pw_log_debug("link %p: enable meta %d %d", this, type, size);
+			pw_log_debug("link %p: enable meta %d %d", this,
+					metas[n_metas].type, metas[n_metas].size);
 
-			metas[n_metas].type = type;
-			metas[n_metas].size = size;
 			meta_size += metas[n_metas].size;
 			n_metas++;
 			skel_size += sizeof(struct spa_meta);
@@ -428,6 +449,7 @@ static int alloc_buffers(struct pw_link *this,
 	allocation->mem = m;
 	allocation->n_buffers = n_buffers;
 	allocation->buffers = buffers;
+	allocation->local = false;
 
 	return 0;
 }
@@ -491,6 +513,7 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 	struct pw_port *input, *output;
 	struct pw_type *t = &this->core->type;
 	struct allocation allocation;
+	bool remote;
 
 	if (in_state != PW_PORT_STATE_READY && out_state != PW_PORT_STATE_READY)
 		return 0;
@@ -516,6 +539,16 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 	in_flags = iinfo->flags;
 	out_flags = oinfo->flags;
 
+	/* buffers that are only valid in this process can't be given to
+	 * a node in another process */
+	remote = output->node->remote || input->node->remote;
+	if (remote) {
+		if (out_flags & SPA_PORT_INFO_FLAG_LOCAL_BUFFERS)
+			out_flags &= ~SPA_PORT_INFO_FLAG_CAN_ALLOC_BUFFERS;
+		if (in_flags & SPA_PORT_INFO_FLAG_LOCAL_BUFFERS)
+			in_flags &= ~SPA_PORT_INFO_FLAG_CAN_ALLOC_BUFFERS;
+	}
+
 	if (out_flags & SPA_PORT_INFO_FLAG_LIVE) {
 		pw_log_debug("setting link as live");
 		output->node->live = true;
@@ -559,6 +592,13 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 		spa_debug_port_info(2, oinfo);
 		spa_debug_port_info(2, iinfo);
 	}
+	/* the buffers are in use by other links, keep them */
+	if (remote && (output->allocation.local || input->allocation.local)) {
+		asprintf(&error, "local buffers can't be used by a remote node");
+		pw_link_update_state(this, PW_LINK_STATE_ERROR, error);
+		return -ENOTSUP;
+	}
+
 	if (output->allocation.n_buffers) {
 		out_flags = 0;
 		in_flags = SPA_PORT_INFO_FLAG_CAN_USE_BUFFERS;
@@ -602,21 +642,24 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 		minsize = stride = 0;
 		param = find_param(params, n_params, t->param_buffers.Buffers);
 		if (param) {
-			uint32_t qmax_buffers = max_buffers,
-			    qminsize = minsize, qstride = stride;
-
-			spa_pod_object_parse(param,
-				":", t->param_buffers.size, "i", &qminsize,
-				":", t->param_buffers.stride, "i", &qstride,
-				":", t->param_buffers.buffers, "i", &qmax_buffers, NULL);
+			struct buffers_param q = { minsize, stride, max_buffers };
+			const struct spa_pod_prop_desc desc[] = {
+				SPA_POD_PROP_DESC_INT(t->param_buffers.size,
+						      struct buffers_param, minsize, 0),
+				SPA_POD_PROP_DESC_INT(t->param_buffers.stride,
+						      struct buffers_param, stride, 0),
+				SPA_POD_PROP_DESC_INT(t->param_buffers.buffers,
+						      struct buffers_param, buffers, 0),
+			};
+
+			spa_pod_object_parse_desc(param, desc, SPA_N_ELEMENTS(desc), &q);
 
 			max_buffers =
-			    qmax_buffers == 0 ? max_buffers : SPA_MIN(qmax_buffers,
-							      max_buffers);
-			minsize = SPA_MAX(minsize, qminsize);
-			stride = SPA_MAX(stride, qstride);
+			    q.buffers == 0 ? max_buffers : SPA_MIN(q.buffers, max_buffers);
+			minsize = SPA_MAX(minsize, q.minsize);
+			stride = SPA_MAX(stride, q.stride);
 
-			pw_log_debug("%d %d %d -> %zd %zd %d", qminsize, qstride, qmax_buffers,
+			pw_log_debug("%d %d %d -> %zd %zd %d", q.minsize, q.stride, q.buffers,
 				     minsize, stride, max_buffers);
 		} else {
 			pw_log_warn("no buffers param");
@@ -657,6 +700,7 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 			if (SPA_RESULT_IS_ASYNC(res))
 				pw_work_queue_add(impl->work, output->node, res, complete_paused, output);
 
+			allocation.local = SPA_FLAG_CHECK(oinfo->flags, SPA_PORT_INFO_FLAG_LOCAL_BUFFERS);
 			move_allocation(&allocation, &output->allocation);
 
 			pw_log_debug("link %p: allocated %d buffers %p from output port", this,
@@ -672,6 +716,7 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 			if (SPA_RESULT_IS_ASYNC(res))
 				pw_work_queue_add(impl->work, input->node, res, complete_paused, input);
 
+			allocation.local = SPA_FLAG_CHECK(iinfo->flags, SPA_PORT_INFO_FLAG_LOCAL_BUFFERS);
 			pw_log_debug("link %p: allocated %d buffers %p from input port", this,
 				     allocation.n_buffers, allocation.buffers);
 		}
@@ -717,16 +762,44 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 	return res;
 }
 
+/* the ports of the link are in the graphs of the data loops of both nodes,
+ * each port is only changed by the loop of its graph. The other loop reads
+ * the flags of its peer so they are changed atomically. */
 static int
-do_activate_link(struct spa_loop *loop,
-		 bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+set_port_disabled(struct spa_graph_port *port, bool disabled)
 {
-        struct pw_link *this = user_data;
-	SPA_FLAG_UNSET(this->rt.out_port.flags, SPA_GRAPH_PORT_FLAG_DISABLED);
-	SPA_FLAG_UNSET(this->rt.in_port.flags, SPA_GRAPH_PORT_FLAG_DISABLED);
+	if (disabled)
+		__atomic_or_fetch(&port->flags, SPA_GRAPH_PORT_FLAG_DISABLED, __ATOMIC_RELAXED);
+	else
+		__atomic_and_fetch(&port->flags, ~SPA_GRAPH_PORT_FLAG_DISABLED, __ATOMIC_RELAXED);
 	return 0;
 }
 
+static int
+do_activate_output(struct spa_loop *loop,
+		   bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+        struct pw_link *this = user_data;
+	return set_port_disabled(&this->rt.out_port, false);
+}
+
+static int
+do_activate_input(struct spa_loop *loop,
+		  bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+        struct pw_link *this = user_data;
+	return set_port_disabled(&this->rt.in_port, false);
+}
+
+static void invoke_link(struct pw_link *this, spa_invoke_func_t out_func,
+			spa_invoke_func_t in_func, bool block)
+{
+	pw_loop_invoke(this->output->node->data_loop, out_func,
+		       SPA_ID_INVALID, NULL, 0, block, this);
+	pw_loop_invoke(this->input->node->data_loop, in_func,
+		       SPA_ID_INVALID, NULL, 0, block, this);
+}
+
 static int do_start(struct pw_link *this, uint32_t in_state, uint32_t out_state)
 {
 	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
@@ -742,8 +815,7 @@ static int do_start(struct pw_link *this, uint32_t in_state, uint32_t out_state)
 	input = this->input;
 	output = this->output;
 
-	pw_loop_invoke(output->node->data_loop,
-		       do_activate_link, SPA_ID_INVALID, NULL, 0, false, this);
+	invoke_link(this, do_activate_output, do_activate_input, false);
 
 	if (in_state == PW_PORT_STATE_PAUSED) {
 		if  ((res = pw_node_set_state(input->node, PW_NODE_STATE_RUNNING)) < 0) {
@@ -774,10 +846,10 @@ static int do_start(struct pw_link *this, uint32_t in_state, uint32_t out_state)
 	return res;
 }
 
-static int check_states(struct pw_link *this, void *user_data, int res)
+/* get the states of the ports, returns < 0 on error and 0 when the link
+ * has no ports anymore */
+static int get_port_states(struct pw_link *this, uint32_t *in_state, uint32_t *out_state)
 {
-	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
-	int in_state, out_state;
 	struct pw_port *input, *output;
 
 	if (this->state == PW_LINK_STATE_ERROR)
@@ -793,15 +865,25 @@ static int check_states(struct pw_link *this, void *user_data, int res)
 	    output->node->info.state == PW_NODE_STATE_ERROR)
 		return -EIO;
 
-	in_state = input->state;
-	out_state = output->state;
+	*in_state = input->state;
+	*out_state = output->state;
 
-	pw_log_debug("link %p: input state %d, output state %d", this, in_state, out_state);
+	pw_log_debug("link %p: input state %d, output state %d", this, *in_state, *out_state);
 
-	if (in_state == PW_PORT_STATE_ERROR || out_state == PW_PORT_STATE_ERROR) {
+	if (*in_state == PW_PORT_STATE_ERROR || *out_state == PW_PORT_STATE_ERROR) {
 		pw_link_update_state(this, PW_LINK_STATE_ERROR, NULL);
 		return -EIO;
 	}
+	return 1;
+}
+
+static int check_states(struct pw_link *this, void *user_data, int res)
+{
+	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
+	uint32_t in_state, out_state;
+
+	if ((res = get_port_states(this, &in_state, &out_state)) <= 0)
+		return res;
 
 	if (in_state == PW_PORT_STATE_STREAMING && out_state == PW_PORT_STATE_STREAMING) {
 		pw_link_update_state(this, PW_LINK_STATE_RUNNING, NULL);
@@ -828,6 +910,49 @@ static int check_states(struct pw_link *this, void *user_data, int res)
 	return res;
 }
 
+static void batch_step(struct pw_core *core,
+		       int (*step) (struct pw_link *this, uint32_t in_state, uint32_t out_state))
+{
+	struct impl *impl, *t;
+	uint32_t in_state, out_state;
+
+	spa_list_for_each_safe(impl, t, &core->link_batch, batch_link) {
+		if (get_port_states(&impl->this, &in_state, &out_state) <= 0)
+			continue;
+		step(&impl->this, in_state, out_state);
+	}
+}
+
+/** Activate the links that were queued since the last call
+ *
+ * Each step is done for all the links before going to the next one. All
+ * formats are set before buffers are allocated, the links on the same output
+ * port then share the allocation of the first link, and the nodes are
+ * started once for all their links. Asynchronous results are handled by the
+ * work queue of each link, they are waited for in parallel.
+ */
+void pw_link_process_batch(struct pw_core *core)
+{
+	struct impl *impl;
+
+	if (spa_list_is_empty(&core->link_batch))
+		return;
+
+	pw_log_debug("core %p: process link batch", core);
+
+	batch_step(core, do_negotiate);
+	batch_step(core, do_allocation);
+	batch_step(core, do_start);
+
+	spa_list_consume(impl, &core->link_batch, batch_link) {
+		spa_list_remove(&impl->batch_link);
+		impl->batched = false;
+		/* finish the link, this waits for the async results */
+		pw_work_queue_add(impl->work,
+				  &impl->this, -EBUSY, (pw_work_func_t) check_states, &impl->this);
+	}
+}
+
 static void
 input_node_async_complete(void *data, uint32_t seq, int res)
 {
@@ -947,20 +1072,36 @@ int pw_link_activate(struct pw_link *this)
 	this->output->node->n_used_output_links++;
 	this->input->node->n_used_input_links++;
 
-	pw_work_queue_add(impl->work,
-			  this, -EBUSY, (pw_work_func_t) check_states, this);
+	/* activated together with the other links in the next main loop iteration */
+	spa_list_append(&this->core->link_batch, &impl->batch_link);
+	impl->batched = true;
+	pw_core_schedule_flush(this->core);
 
 	return 0;
 }
 
 static int
-do_deactivate_link(struct spa_loop *loop,
-		   bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+do_deactivate_output(struct spa_loop *loop,
+		     bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+        struct pw_link *this = user_data;
+	pw_log_trace("link %p: disable %p", this, &this->rt.out_port);
+	return set_port_disabled(&this->rt.out_port, true);
+}
+
+static int
+do_deactivate_input(struct spa_loop *loop,
+		    bool async, uint32_t seq, const void *data, size_t size, void *user_data)
 {
         struct pw_link *this = user_data;
-	pw_log_trace("link %p: disable %p and %p", this, &this->rt.out_port, &this->rt.in_port);
-	SPA_FLAG_SET(this->rt.out_port.flags, SPA_GRAPH_PORT_FLAG_DISABLED);
-	SPA_FLAG_SET(this->rt.in_port.flags, SPA_GRAPH_PORT_FLAG_DISABLED);
+	pw_log_trace("link %p: disable %p", this, &this->rt.in_port);
+	return set_port_disabled(&this->rt.in_port, true);
+}
+
+static int
+do_flush(struct spa_loop *loop,
+	 bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
 	return 0;
 }
 
@@ -974,8 +1115,12 @@ int pw_link_deactivate(struct pw_link *this)
 
 	impl->active = false;
 	pw_log_debug("link %p: deactivate", this);
-	pw_loop_invoke(this->output->node->data_loop,
-		       do_deactivate_link, SPA_ID_INVALID, NULL, 0, true, this);
+
+	if (impl->batched) {
+		spa_list_remove(&impl->batch_link);
+		impl->batched = false;
+	}
+	invoke_link(this, do_deactivate_output, do_deactivate_input, true);
 
 	input_node = this->input->node;
 	output_node = this->output->node;
@@ -1181,6 +1326,7 @@ struct pw_link *pw_link_new(struct pw_core *core,
 	}
 	spa_list_init(&this->resource_list);
 	spa_hook_list_init(&this->listener_list);
+	pw_info_pending_init(&this->info_pending, emit_info);
 
 	impl->format_filter = format_filter;
 
@@ -1332,10 +1478,13 @@ void pw_link_destroy(struct pw_link *link)
 {
 	struct impl *impl = SPA_CONTAINER_OF(link, struct impl, this);
 	struct pw_resource *resource;
+	struct pw_loop *input_loop;
 
 	pw_log_debug("link %p: destroy", impl);
 	pw_link_events_destroy(link);
 
+	pw_info_pending_cancel(&link->info_pending);
+
 	pw_link_deactivate(link);
 
 	if (link->registered)
@@ -1344,10 +1493,17 @@ void pw_link_destroy(struct pw_link *link)
 	if (link->output->node->clock == link->input->node->clock)
 		link->input->node->clock = NULL;
 
+	input_loop = link->input->node->data_loop;
+
 	input_remove(link, link->input);
 
 	output_remove(link, link->output);
 
+	/* the loop of the output could queue a wakeup of the input port until
+	 * the output port was removed, wait until it is processed. Wakeups of
+	 * the output port were processed before the output port was removed. */
+	pw_loop_invoke(input_loop, do_flush, SPA_ID_INVALID, NULL, 0, true, link);
+
 	spa_list_consume(resource, &link->resource_list, link)
 		pw_resource_destroy(resource);
 
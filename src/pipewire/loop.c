@@ -18,6 +18,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <spa/support/loop.h>
 #include <spa/support/type-map.h>
@@ -38,6 +39,12 @@ struct impl {
 /** \endcond */
 
 /** Create a new loop
+ * \param properties extra properties for the loop, can be NULL. The
+ *	"loop.backend" property selects the backend to use, "epoll" (the
+ *	default) or "io_uring". The PIPEWIRE_LOOP_BACKEND environment
+ *	variable is used when the property is not set. "loop.timer-slack"
+ *	is the time in nanoseconds that timers are allowed to expire late
+ *	so that they can be handled in one wakeup, it defaults to 0.
  * \returns a newly allocated loop
  * \memberof pw_loop
  */
@@ -52,6 +59,9 @@ struct pw_loop *pw_loop_new(struct pw_properties *properties)
 	void *iface;
 	const struct spa_support *support;
 	uint32_t n_support;
+	struct spa_dict_item items[2];
+	struct spa_dict info = SPA_DICT_INIT(items, 0);
+	const char *str = NULL;
 
 	support = pw_get_support(&n_support);
 	if (support == NULL)
@@ -71,11 +81,20 @@ struct pw_loop *pw_loop_new(struct pw_properties *properties)
 
 	impl->handle = SPA_MEMBER(impl, sizeof(struct impl), struct spa_handle);
 
+	if (properties)
+		str = pw_properties_get(properties, "loop.backend");
+	if (str == NULL)
+		str = getenv("PIPEWIRE_LOOP_BACKEND");
+	if (str)
+		items[info.n_items++] = SPA_DICT_ITEM_INIT("loop.backend", str);
+	if (properties && (str = pw_properties_get(properties, "loop.timer-slack")))
+		items[info.n_items++] = SPA_DICT_ITEM_INIT("loop.timer-slack", str);
+
 	this = &impl->this;
 
 	if ((res = spa_handle_factory_init(factory,
 					   impl->handle,
-					   NULL,
+					   &info,
 					   support,
 					   n_support)) < 0) {
 		fprintf(stderr, "can't make factory instance: %d\n", res);
@@ -106,6 +125,12 @@ struct pw_loop *pw_loop_new(struct pw_properties *properties)
         }
 	this->utils = iface;
 
+	/* optional */
+	if (spa_handle_get_interface(impl->handle,
+				     spa_type_map_get_id(map, SPA_TYPE__LoopStats),
+				     &iface) >= 0)
+		this->stats = iface;
+
 	return this;
 
       failed:
@@ -38,6 +38,7 @@ struct pw_loop {
 	struct spa_loop *loop;			/**< wrapped loop */
 	struct spa_loop_control *control;	/**< loop control */
 	struct spa_loop_utils *utils;		/**< loop utils */
+	struct spa_loop_stats *stats;		/**< loop statistics, can be NULL */
 };
 
 struct pw_loop *
@@ -68,6 +69,11 @@ pw_loop_destroy(struct pw_loop *loop);
 #define pw_loop_add_signal(l,...)	spa_loop_utils_add_signal((l)->utils,__VA_ARGS__)
 #define pw_loop_destroy_source(l,...)	spa_loop_utils_destroy_source((l)->utils,__VA_ARGS__)
 
+#define pw_loop_stats_enable(l,...)		spa_loop_stats_enable((l)->stats,__VA_ARGS__)
+#define pw_loop_stats_get_info(l,...)		spa_loop_stats_get_info((l)->stats,__VA_ARGS__)
+#define pw_loop_stats_enum_sources(l,...)	spa_loop_stats_enum_sources((l)->stats,__VA_ARGS__)
+#define pw_loop_stats_reset(l)			spa_loop_stats_reset((l)->stats)
+
 #ifdef __cplusplus
 }
 #endif
@@ -305,6 +305,8 @@ void pw_module_destroy(struct pw_module *module)
 	free((char *) module->info.name);
 	free((char *) module->info.filename);
 	free((char *) module->info.args);
+	if (module->properties)
+		pw_properties_free(module->properties);
 
 	dlclose(impl->hnd);
 	free(impl);
@@ -330,6 +332,35 @@ pw_module_get_info(struct pw_module *module)
 	return &module->info;
 }
 
+SPA_EXPORT
+int pw_module_update_properties(struct pw_module *module, const struct spa_dict *dict)
+{
+	struct pw_resource *resource;
+	uint32_t i, changed = 0;
+
+	if (module->properties == NULL &&
+	    (module->properties = pw_properties_new(NULL, NULL)) == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < dict->n_items; i++)
+		changed += pw_properties_set(module->properties, dict->items[i].key, dict->items[i].value);
+
+	pw_log_debug("module %p: updated %d properties", module, changed);
+
+	if (!changed)
+		return 0;
+
+	module->info.change_mask = PW_MODULE_CHANGE_MASK_PROPS;
+	module->info.props = &module->properties->dict;
+
+	spa_list_for_each(resource, &module->resource_list, link)
+		pw_module_resource_info(resource, &module->info);
+
+	module->info.change_mask = 0;
+
+	return changed;
+}
+
 SPA_EXPORT
 void pw_module_add_listener(struct pw_module *module,
 			    struct spa_hook *listener,
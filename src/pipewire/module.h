@@ -82,6 +82,10 @@ struct pw_global * pw_module_get_global(struct pw_module *module);
 /** Get the module info */
 const struct pw_module_info *pw_module_get_info(struct pw_module *module);
 
+/** Update the properties of the module info, the clients that bound
+ * the module are notified of the change */
+int pw_module_update_properties(struct pw_module *module, const struct spa_dict *dict);
+
 /** Add an event listener to a module */
 void pw_module_add_listener(struct pw_module *module,
 			    struct spa_hook *listener,
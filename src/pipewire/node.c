@@ -28,6 +28,7 @@
 #include "pipewire/pipewire.h"
 #include "pipewire/interfaces.h"
 #include "pipewire/private.h"
+#include "pipewire/probes.h"
 
 #include "pipewire/node.h"
 #include "pipewire/data-loop.h"
@@ -107,6 +108,52 @@ static int suspend_node(struct pw_node *this)
 	return res;
 }
 
+#define MAX_CLOCK_HOPS	64
+
+static int64_t get_latency(const struct pw_properties *properties, const char *key)
+{
+	const char *str;
+
+	if (properties == NULL || (str = pw_properties_get(properties, key)) == NULL)
+		return 0;
+	return SPA_MAX(strtoll(str, NULL, 10), 0);
+}
+
+/* the latency in nsec between the node and the node that provides its clock,
+ * the sum of the "port.latency" and "link.latency" properties of the ports
+ * and links on the way. The clock is given to the input nodes of a link so
+ * the path goes up the input links. */
+static int64_t clock_path_latency(struct pw_node *this)
+{
+	struct pw_node *node = this;
+	struct pw_port *port;
+	struct pw_link *found, *l;
+	int64_t latency = 0;
+	uint32_t hops;
+
+	for (hops = 0; hops < MAX_CLOCK_HOPS; hops++) {
+		found = NULL;
+		spa_list_for_each(port, &node->input_ports, link) {
+			spa_list_for_each(l, &port->links, input_link) {
+				if (l->output->node->clock == this->clock) {
+					found = l;
+					break;
+				}
+			}
+			if (found)
+				break;
+		}
+		if (found == NULL)
+			break;
+
+		latency += get_latency(found->input->properties, "port.latency");
+		latency += get_latency(found->properties, "link.latency");
+		latency += get_latency(found->output->properties, "port.latency");
+		node = found->output->node;
+	}
+	return latency;
+}
+
 static void send_clock_update(struct pw_node *this)
 {
 	int res;
@@ -131,6 +178,7 @@ static void send_clock_update(struct pw_node *this)
 					 &cu.body.rate.value,
 					 &cu.body.ticks.value,
 					 &cu.body.monotonic_time.value);
+		cu.body.latency.value += clock_path_latency(this);
 	}
 	res = spa_node_send_command(this->node, (struct spa_command *) &cu);
 	if (res < 0)
@@ -188,6 +236,30 @@ static void update_port_map(struct pw_node *node, enum pw_direction direction,
 	}
 }
 
+/* keep the node in the core lists of nodes that can have ports in a
+ * direction, pw_core_find_port() only looks at those */
+static void update_port_index(struct pw_node *node)
+{
+	uint32_t max_ports[2];
+	int i;
+
+	max_ports[PW_DIRECTION_INPUT] = node->info.max_input_ports;
+	max_ports[PW_DIRECTION_OUTPUT] = node->info.max_output_ports;
+
+	for (i = 0; i < 2; i++) {
+		bool index = node->registered && max_ports[i] > 0;
+
+		if (index == node->port_indexed[i])
+			continue;
+
+		if (index)
+			spa_list_append(&node->core->port_node_list[i], &node->port_link[i]);
+		else
+			spa_list_remove(&node->port_link[i]);
+		node->port_indexed[i] = index;
+	}
+}
+
 int pw_node_update_ports(struct pw_node *node)
 {
 	uint32_t *input_port_ids, *output_port_ids;
@@ -228,6 +300,8 @@ int pw_node_update_ports(struct pw_node *node)
 	update_port_map(node, PW_DIRECTION_INPUT, &node->input_port_map, input_port_ids, n_input_ports);
 	update_port_map(node, PW_DIRECTION_OUTPUT, &node->output_port_map, output_port_ids, n_output_ports);
 
+	update_port_index(node);
+
 	return 0;
 }
 
@@ -357,6 +431,7 @@ int pw_node_register(struct pw_node *this,
 
 	spa_list_append(&core->node_list, &this->link);
 	this->registered = true;
+	update_port_index(this);
 
 	this->global = pw_global_new(core,
 				     core->type.node, PW_VERSION_NODE,
@@ -395,6 +470,17 @@ static void check_properties(struct pw_node *node)
 		impl->pause_on_idle = true;
 }
 
+static void emit_info(struct pw_info_pending *pending, uint64_t change_mask)
+{
+	struct pw_node *node = SPA_CONTAINER_OF(pending, struct pw_node, info_pending);
+	struct pw_resource *resource;
+
+	node->info.change_mask = change_mask;
+	spa_list_for_each(resource, &node->resource_list, link)
+		pw_node_resource_info(resource, &node->info);
+	node->info.change_mask = 0;
+}
+
 SPA_EXPORT
 struct pw_node *pw_node_new(struct pw_core *core,
 			    const char *name,
@@ -403,6 +489,7 @@ struct pw_node *pw_node_new(struct pw_core *core,
 {
 	struct impl *impl;
 	struct pw_node *this;
+	struct pw_data_loop *data_loop;
 
 	impl = calloc(1, sizeof(struct impl) + user_data_size);
 	if (impl == NULL)
@@ -428,13 +515,17 @@ struct pw_node *pw_node_new(struct pw_core *core,
 	impl->work = pw_work_queue_new(this->core->main_loop);
 	this->info.name = strdup(name);
 
-	this->data_loop = core->data_loop;
+	/* the node is scheduled in the graph of its data loop, links to nodes
+	 * in other loops hand over the buffers between the loops */
+	data_loop = pw_core_get_data_loop(core, pw_properties_get(properties, PW_NODE_PROP_DATA_LOOP));
+	this->data_loop = data_loop->loop;
 
-	this->rt.graph = &core->rt.graph;
+	this->rt.graph = &data_loop->rt.graph;
 
 	spa_list_init(&this->resource_list);
 
 	spa_hook_list_init(&this->listener_list);
+	pw_info_pending_init(&this->info_pending, emit_info);
 
 	this->info.state = PW_NODE_STATE_CREATING;
 	this->info.props = &this->properties->dict;
@@ -486,7 +577,6 @@ const struct pw_properties *pw_node_get_properties(struct pw_node *node)
 SPA_EXPORT
 int pw_node_update_properties(struct pw_node *node, const struct spa_dict *dict)
 {
-	struct pw_resource *resource;
 	uint32_t i, changed = 0;
 
 	for (i = 0; i < dict->n_items; i++)
@@ -503,9 +593,7 @@ int pw_node_update_properties(struct pw_node *node, const struct spa_dict *dict)
 	node->info.change_mask |= PW_NODE_CHANGE_MASK_PROPS;
 	pw_node_events_info_changed(node, &node->info);
 
-	spa_list_for_each(resource, &node->resource_list, link)
-		pw_node_resource_info(resource, &node->info);
-
+	pw_core_queue_info(node->core, &node->info_pending, node->info.change_mask);
 	node->info.change_mask = 0;
 
 	return changed;
@@ -535,17 +623,25 @@ static void node_event(void *data, struct spa_event *event)
 static void node_need_input(void *data)
 {
 	struct pw_node *node = data;
+#ifndef HAVE_SYS_SDT_H
 	pw_log_trace("node %p: need input", node);
+#endif
+	pw_probe(cycle__start, node, SPA_DIRECTION_INPUT);
 	pw_node_events_need_input(node);
 	spa_graph_need_input(node->rt.graph, &node->rt.node);
+	pw_probe(cycle__end, node, SPA_DIRECTION_INPUT);
 }
 
 static void node_have_output(void *data)
 {
 	struct pw_node *node = data;
+#ifndef HAVE_SYS_SDT_H
 	pw_log_trace("node %p: have output", node);
+#endif
+	pw_probe(cycle__start, node, SPA_DIRECTION_OUTPUT);
 	spa_graph_have_output(node->rt.graph, &node->rt.node);
 	pw_node_events_have_output(node);
+	pw_probe(cycle__end, node, SPA_DIRECTION_OUTPUT);
 }
 
 static void node_reuse_buffer(void *data, uint32_t port_id, uint32_t buffer_id)
@@ -557,6 +653,7 @@ static void node_reuse_buffer(void *data, uint32_t port_id, uint32_t buffer_id)
 		if (p->port_id != port_id)
 			continue;
 
+		pw_probe(reuse__buffer, node, port_id, buffer_id);
 		if ((pp = p->peer) != NULL)
 			spa_node_port_reuse_buffer(pp->node->implementation, pp->port_id, buffer_id);
 		break;
@@ -632,9 +729,13 @@ void pw_node_destroy(struct pw_node *node)
 	pw_log_debug("node %p: destroy", impl);
 	pw_node_events_destroy(node);
 
+	pw_info_pending_cancel(&node->info_pending);
+
 	if (node->registered) {
 		pw_loop_invoke(node->data_loop, do_node_remove, 1, NULL, 0, true, node);
 		spa_list_remove(&node->link);
+		node->registered = false;
+		update_port_index(node);
 	}
 
 	pw_log_debug("node %p: unlink ports", node);
@@ -747,6 +848,35 @@ uint32_t pw_node_get_free_port_id(struct pw_node *node, enum pw_direction direct
 		return pw_map_insert_new(&node->output_port_map, NULL);
 }
 
+/** Check if pw_node_get_free_port() can return a port without creating
+ * or linking anything */
+bool pw_node_has_free_port(struct pw_node *node, enum pw_direction direction)
+{
+	uint32_t n_ports, max_ports;
+	struct spa_list *ports;
+	struct pw_port *p;
+
+	if (direction == PW_DIRECTION_INPUT) {
+		max_ports = node->info.max_input_ports;
+		n_ports = node->info.n_input_ports;
+		ports = &node->input_ports;
+	} else {
+		max_ports = node->info.max_output_ports;
+		n_ports = node->info.n_output_ports;
+		ports = &node->output_ports;
+	}
+
+	if (n_ports < max_ports)
+		return true;
+
+	spa_list_for_each(p, ports, link) {
+		if (spa_list_is_empty(&p->links) ||
+		    direction == PW_DIRECTION_OUTPUT || p->mix != NULL)
+			return true;
+	}
+	return false;
+}
+
 /**
  * pw_node_get_free_port:
  * \param node a \ref pw_node
@@ -932,7 +1062,6 @@ void pw_node_update_state(struct pw_node *node, enum pw_node_state state, char *
 
 	old = node->info.state;
 	if (old != state) {
-		struct pw_resource *resource;
 
 		pw_log_debug("node %p: update state from %s -> %s", node,
 			     pw_node_state_as_string(old), pw_node_state_as_string(state));
@@ -952,9 +1081,7 @@ void pw_node_update_state(struct pw_node *node, enum pw_node_state state, char *
 		node->info.change_mask |= PW_NODE_CHANGE_MASK_STATE;
 		pw_node_events_info_changed(node, &node->info);
 
-		spa_list_for_each(resource, &node->resource_list, link)
-			pw_node_resource_info(resource, &node->info);
-
+		pw_core_queue_info(node->core, &node->info_pending, node->info.change_mask);
 		node->info.change_mask = 0;
 	}
 }
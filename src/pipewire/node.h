@@ -104,6 +104,9 @@ struct pw_node_events {
 #define PW_NODE_PROP_AUTOCONNECT	"pipewire.autoconnect"
 /** Try to connect the node to this node id */
 #define PW_NODE_PROP_TARGET_NODE	"pipewire.target.node"
+/** Run the node in the data loop with this name, the loop is configured
+ * with data-loop.<name>.cpus and data-loop.<name>.rt-priority core properties */
+#define PW_NODE_PROP_DATA_LOOP		"node.data-loop"
 
 /** Create a new node \memberof pw_node */
 struct pw_node *
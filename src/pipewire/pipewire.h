@@ -94,6 +94,11 @@ extern "C" {
  * - &lt;category&gt;:  Specifies a string category to enable. Many categories
  *		  can be separated by commas. Current categories are:
  *   + `connection`: to log connection messages
+ *
+ * When the 'PIPEWIRE_LOG_BINARY' environment variable or the "log.binary"
+ * core property is true, the trace messages of the realtime threads are
+ * recorded without formatting and printed later from the main loop of the
+ * core. Records are dropped when the main loop can't keep up.
  */
 
 /** \class pw_pipewire
@@ -136,6 +141,9 @@ pw_get_support_interface(const char *type);
 void *pw_get_spa_dbus(struct pw_loop *loop);
 int pw_release_spa_dbus(void *dbus);
 
+void *pw_get_spa_log(struct pw_loop *loop, const struct spa_dict *props);
+int pw_release_spa_log(void *log);
+
 const struct spa_handle_factory *
 pw_get_support_factory(const char *factory_name);
 
@@ -25,6 +25,7 @@
 
 #include "pipewire/pipewire.h"
 #include "pipewire/private.h"
+#include "pipewire/probes.h"
 #include "pipewire/port.h"
 
 /** \cond */
@@ -87,7 +88,10 @@ static int schedule_tee_reuse_buffer(struct spa_node *data, uint32_t port_id, ui
 	struct spa_graph_port *p = &this->rt.mix_port, *pp;
 
 	if ((pp = p->peer) != NULL) {
+#ifndef HAVE_SYS_SDT_H
 		pw_log_trace("node %p: tee reuse buffer %d %d", node, port_id, buffer_id);
+#endif
+		pw_probe(reuse__buffer, node, port_id, buffer_id);
 		spa_node_port_reuse_buffer(pp->node->implementation, port_id, buffer_id);
 	}
 	return 0;
@@ -145,7 +149,10 @@ static int schedule_mix_reuse_buffer(struct spa_node *data, uint32_t port_id, ui
 
 	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
 		if ((pp = p->peer) != NULL) {
+#ifndef HAVE_SYS_SDT_H
 			pw_log_trace("mix %p: reuse buffer %d %d", node, port_id, buffer_id);
+#endif
+			pw_probe(reuse__buffer, node, port_id, buffer_id);
 			spa_node_port_reuse_buffer(pp->node->implementation, port_id, buffer_id);
 		}
 	}
@@ -160,6 +167,17 @@ static const struct spa_node schedule_mix_node = {
 	.port_reuse_buffer = schedule_mix_reuse_buffer,
 };
 
+static void emit_info(struct pw_info_pending *pending, uint64_t change_mask)
+{
+	struct pw_port *port = SPA_CONTAINER_OF(pending, struct pw_port, info_pending);
+	struct pw_resource *resource;
+
+	port->info.change_mask = change_mask;
+	spa_list_for_each(resource, &port->resource_list, link)
+		pw_port_resource_info(resource, &port->info);
+	port->info.change_mask = 0;
+}
+
 struct pw_port *pw_port_new(enum pw_direction direction,
 			    uint32_t port_id,
 			    struct pw_properties *properties,
@@ -200,6 +218,7 @@ struct pw_port *pw_port_new(enum pw_direction direction,
 	spa_list_init(&this->resource_list);
 
 	spa_hook_list_init(&this->listener_list);
+	pw_info_pending_init(&this->info_pending, emit_info);
 
 	spa_graph_port_init(&this->rt.port,
 			    this->spa_direction,
@@ -251,7 +270,6 @@ const struct pw_properties *pw_port_get_properties(struct pw_port *port)
 SPA_EXPORT
 int pw_port_update_properties(struct pw_port *port, const struct spa_dict *dict)
 {
-	struct pw_resource *resource;
 	uint32_t i, changed = 0;
 
 	for (i = 0; i < dict->n_items; i++)
@@ -266,8 +284,10 @@ int pw_port_update_properties(struct pw_port *port, const struct spa_dict *dict)
 	port->info.change_mask |= PW_PORT_CHANGE_MASK_PROPS;
 	pw_port_events_info_changed(port, &port->info);
 
-	spa_list_for_each(resource, &port->resource_list, link)
-		pw_port_resource_info(resource, &port->info);
+	if (port->node)
+		pw_core_queue_info(port->node->core, &port->info_pending, port->info.change_mask);
+	else
+		emit_info(&port->info_pending, port->info.change_mask);
 
 	port->info.change_mask = 0;
 
@@ -553,6 +573,8 @@ void pw_port_destroy(struct pw_port *port)
 
 	pw_port_events_destroy(port);
 
+	pw_info_pending_cancel(&port->info_pending);
+
 	if (node)
 		pw_port_remove(port);
 
@@ -590,6 +612,17 @@ do_port_command(struct spa_loop *loop,
 	return spa_node_port_send_command(node->node, port->spa_direction, port->port_id, data);
 }
 
+void pw_port_params_changed(struct pw_port *port)
+{
+	if (port->node == NULL)
+		return;
+
+	pw_log_debug("port %p: params changed", port);
+	pw_core_invalidate_formats(port->node->core, port->format_hash);
+	port->format_hash = 0;
+	port->media_type = 0;
+}
+
 int pw_port_send_command(struct pw_port *port, bool block, const struct spa_command *command)
 {
 	return pw_loop_invoke(port->node->data_loop, do_port_command, 0,
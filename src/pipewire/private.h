@@ -26,6 +26,7 @@ extern "C" {
 
 #include <sys/socket.h>
 #include <sys/types.h> /* for pthread_t */
+#include <sched.h> /* for cpu_set_t */
 
 
 #include "pipewire/mem.h"
@@ -51,6 +52,30 @@ struct pw_command {
         int n_args;
 };
 
+/** An info event of an object that is waiting to be sent to the resources.
+ * Changes are merged until the main loop is about to flush the connections. */
+struct pw_info_pending {
+	struct spa_list link;		/**< link in core info_queue */
+	uint64_t change_mask;		/**< merged changes, 0 when not queued */
+	void (*emit) (struct pw_info_pending *pending, uint64_t change_mask);
+};
+
+static inline void pw_info_pending_init(struct pw_info_pending *pending,
+		void (*emit) (struct pw_info_pending *pending, uint64_t change_mask))
+{
+	pending->change_mask = 0;
+	pending->emit = emit;
+}
+
+/** Drop a queued info event, used when the object is destroyed */
+static inline void pw_info_pending_cancel(struct pw_info_pending *pending)
+{
+	if (pending->change_mask != 0) {
+		spa_list_remove(&pending->link);
+		pending->change_mask = 0;
+	}
+}
+
 #define pw_protocol_events_destroy(p) spa_hook_list_call(&p->listener_list, struct pw_protocol_events, destroy, 0)
 
 struct pw_protocol {
@@ -97,6 +122,7 @@ struct pw_client {
 	void *permission_data;			/**< data passed to permission function */
 
 	struct pw_properties *properties;	/**< Client properties */
+	struct pw_info_pending info_pending;	/**< info to send to the resources */
 
 	struct pw_client_info info;	/**< client info */
 
@@ -105,6 +131,8 @@ struct pw_client {
 	struct pw_map objects;		/**< list of resource objects */
 	uint32_t n_types;		/**< number of client types */
 	struct pw_map types;		/**< map of client types */
+	uint32_t n_identity;		/**< number of leading client types with
+					  *  the same id in the core */
 
 	struct spa_list resource_list;	/**< The list of resources of this client */
 
@@ -134,6 +162,7 @@ struct pw_global {
 
 	struct spa_list link;		/**< link in core list of globals */
 	uint32_t id;			/**< server id of the object */
+	uint64_t serial;		/**< increasing registration number, ids are reused */
 	struct pw_global *parent;	/**< parent global */
 
 	struct pw_properties *properties;	/**< properties of the global */
@@ -152,6 +181,7 @@ struct pw_global {
 #define pw_core_events_info_changed(c,i)	pw_core_events_emit(c, info_changed, 0, i)
 #define pw_core_events_global_added(c,g)	pw_core_events_emit(c, global_added, 0, g)
 #define pw_core_events_global_removed(c,g)	pw_core_events_emit(c, global_removed, 0, g)
+#define pw_core_events_data_loop_added(c,l)	pw_core_events_emit(c, data_loop_added, 1, l)
 
 struct pw_core {
 	struct pw_global *global;	/**< the global of the core */
@@ -173,6 +203,8 @@ struct pw_core {
 	struct spa_list global_list;		/**< list of globals */
 	struct spa_list client_list;		/**< list of clients */
 	struct spa_list node_list;		/**< list of nodes */
+	struct spa_list port_node_list[2];	/**< registered nodes that can have input
+						  *  or output ports */
 	struct spa_list factory_list;		/**< list of factories */
 	struct spa_list link_list;		/**< list of links */
 	struct spa_list control_list[2];	/**< list of controls, indexed by direction */
@@ -182,8 +214,11 @@ struct pw_core {
 	struct pw_loop *main_loop;	/**< main loop for control */
 	struct pw_loop *data_loop;	/**< data loop for data passing */
         struct pw_data_loop *data_loop_impl;
+	struct spa_list data_loop_list;	/**< list of named data loops */
 
 	void *dbus_iface;
+	void *log_iface;		/**< logger with binary trace records */
+	struct spa_log *old_log;	/**< global log before log_iface */
 
 	struct spa_support support[16];	/**< support for spa plugins */
 	uint32_t n_support;		/**< number of support items */
@@ -192,23 +227,42 @@ struct pw_core {
 
 	long sc_pagesize;
 
-	struct {
-		struct spa_graph graph;
-	} rt;
+	struct spa_list link_batch;		/**< links waiting to be activated */
+
+	struct spa_list info_queue;		/**< pending info events */
+	uint64_t info_elided;			/**< total info events merged into a pending one */
+	uint64_t global_serial;			/**< serial of the next registered global */
+	struct spa_source *flush_event;		/**< flushes the batched links and info */
+	bool flush_signaled;
+
+	struct spa_list format_cache;		/**< recently negotiated formats */
+	uint32_t n_format_cache;		/**< number of cached formats */
 };
 
 #define pw_data_loop_events_emit(o,m,v,...) spa_hook_list_call(&o->listener_list, struct pw_data_loop_events, m, v, ##__VA_ARGS__)
 #define pw_data_loop_events_destroy(o) pw_data_loop_events_emit(o, destroy, 0)
+#define pw_data_loop_events_started(o) pw_data_loop_events_emit(o, started, 1)
 
 struct pw_data_loop {
         struct pw_loop *loop;
+	struct spa_list link;		/**< link in core data_loop_list */
+
+	struct pw_properties *properties;
+	const char *name;		/**< loop.name property */
 
 	struct spa_hook_list listener_list;
 
         struct spa_source *event;
 
+	struct spa_support support[16];	/**< support for the plugins in this loop */
+	uint32_t n_support;
+
         bool running;
         pthread_t thread;
+
+	struct {
+		struct spa_graph graph;	/**< the nodes scheduled in this loop */
+	} rt;
 };
 
 #define pw_main_loop_events_emit(o,m,v,...) spa_hook_list_call(&o->listener_list, struct pw_main_loop_events, m, v, ##__VA_ARGS__)
@@ -227,6 +281,7 @@ struct allocation {
 	struct pw_memblock *mem;	/**< allocated buffer memory */
 	struct spa_buffer **buffers;	/**< port buffers */
 	uint32_t n_buffers;		/**< number of port buffers */
+	bool local;			/**< buffers can only be used in this process */
 };
 
 static inline void move_allocation(struct allocation *alloc, struct allocation *dest)
@@ -244,6 +299,7 @@ static inline void free_allocation(struct allocation *alloc)
 	alloc->mem = NULL;
 	alloc->buffers = NULL;
 	alloc->n_buffers = 0;
+	alloc->local = false;
 }
 
 #define pw_link_events_emit(o,m,v,...) spa_hook_list_call(&o->listener_list, struct pw_link_events, m, v, ##__VA_ARGS__)
@@ -261,6 +317,7 @@ struct pw_link {
 	bool registered;
 
         struct pw_link_info info;		/**< introspectable link info */
+	struct pw_info_pending info_pending;	/**< info to send to the resources */
 	struct pw_properties *properties;	/**< extra link properties */
 
 	enum pw_link_state state;	/**< link state */
@@ -295,6 +352,7 @@ struct pw_module {
 	struct spa_hook global_listener;
 
 	struct pw_module_info info;     /**< introspectable module info */
+	struct pw_properties *properties; /**< properties of the module info */
 
 	struct spa_list resource_list;	/**< list of resources for this module */
 
@@ -333,10 +391,15 @@ struct pw_node {
 	struct pw_properties *properties;	/**< properties of the node */
 
 	struct pw_node_info info;		/**< introspectable node info */
+	struct pw_info_pending info_pending;	/**< info to send to the resources */
+
+	struct spa_list port_link[2];		/**< link in core port_node_list */
+	bool port_indexed[2];			/**< if port_link is in the core list */
 
 	bool enabled;			/**< if the node is enabled */
 	bool active;			/**< if the node is active */
 	bool live;			/**< if the node is live */
+	bool remote;			/**< if the node is implemented in another process */
 	struct spa_clock *clock;	/**< handle to SPA clock if any */
 	struct spa_node *node;		/**< SPA node implementation */
 
@@ -389,6 +452,7 @@ struct pw_port {
 
 	struct pw_properties *properties;	/**< properties of the port */
 	struct pw_port_info info;
+	struct pw_info_pending info_pending;	/**< info to send to the resources */
 
 	struct spa_list resource_list;	/**< list of resources for this port */
 
@@ -396,6 +460,9 @@ struct pw_port {
 
 	struct spa_io_buffers io;	/**< io area of the port */
 
+	uint64_t format_hash;		/**< hash of the EnumFormat params, 0 when unknown */
+	uint32_t media_type;		/**< media type of the first EnumFormat, 0 when unknown */
+
 	bool allocated;			/**< if buffers are allocated */
 	struct allocation allocation;
 
@@ -482,6 +549,8 @@ struct pw_remote {
 
 	uint32_t n_types;			/**< number of client types */
 	struct pw_map types;			/**< client types */
+	uint32_t n_identity;			/**< number of leading server types with
+						  *  the same id in the client */
 
 	struct spa_list proxy_list;		/**< list of \ref pw_proxy objects */
 	struct spa_list stream_list;		/**< list of \ref pw_stream objects */
@@ -588,6 +657,23 @@ int pw_core_find_format(struct pw_core *core,
 			struct spa_pod_builder *builder,
 			char **error);
 
+/** Queue an info event with \a change_mask for the resources of an object */
+void pw_core_queue_info(struct pw_core *core, struct pw_info_pending *pending, uint64_t change_mask);
+
+/** Send all pending info events */
+void pw_core_flush_info(struct pw_core *core);
+void pw_core_schedule_flush(struct pw_core *core);
+
+/** Get the data loop with \a name or the default data loop when \a name is
+ * NULL or not configured. A named loop is created when it is first used. */
+struct pw_data_loop *pw_core_get_data_loop(struct pw_core *core, const char *name);
+
+/** Check if \a global passes the filter of the registry \a resource */
+bool pw_core_registry_match(struct pw_resource *resource, struct pw_global *global);
+
+/** Drop the cached formats that were negotiated with the given EnumFormat hash */
+void pw_core_invalidate_formats(struct pw_core *core, uint64_t hash);
+
 /** Find a ports compatible with \a other_port and the format filters */
 struct pw_port *
 pw_core_find_port(struct pw_core *core,
@@ -656,6 +742,10 @@ int pw_port_alloc_buffers(struct pw_port *port,
 			  struct spa_pod **params, uint32_t n_params,
 			  struct spa_buffer **buffers, uint32_t *n_buffers);
 
+/** Signal that the params of a port changed \memberof pw_port
+ * Formats negotiated with the old EnumFormat params are no longer used */
+void pw_port_params_changed(struct pw_port *port);
+
 /** Send a command to a port */
 int pw_port_send_command(struct pw_port *port, bool block, const struct spa_command *command);
 
@@ -667,11 +757,17 @@ void pw_node_update_state(struct pw_node *node, enum pw_node_state state, char *
 
 int pw_node_update_ports(struct pw_node *node);
 
+bool pw_node_has_free_port(struct pw_node *node, enum pw_direction direction);
+
 /** Activate a link \memberof pw_link
   * Starts the negotiation of formats and buffers on \a link and then
   * starts data streaming */
 int pw_link_activate(struct pw_link *link);
 
+/** Activate the links that were activated since the last call, this is
+  * done by the core before the main loop goes to sleep */
+void pw_link_process_batch(struct pw_core *core);
+
 /** Deactivate a link \memberof pw_link */
 int pw_link_deactivate(struct pw_link *link);
 
@@ -683,6 +779,9 @@ pw_control_new(struct pw_core *core,
 
 void pw_control_destroy(struct pw_control *control);
 
+/** Parse a list of cpus like "0,2-3" into \a set \memberof pw_utils */
+int pw_parse_cpus(const char *str, cpu_set_t *set);
+
 /** \endcond */
 
 #ifdef __cplusplus
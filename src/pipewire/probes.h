@@ -0,0 +1,62 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __PIPEWIRE_PROBES_H__
+#define __PIPEWIRE_PROBES_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "config.h"
+
+/** \page page_probes Static probes
+ *
+ * The scheduling paths have static probes in the "pipewire" provider.
+ * A probe is a single nop instruction until a tracer such as bpftrace or
+ * systemtap attaches to it. The arguments are always evaluated so that
+ * the tracer can find them, only pass values that are already at hand.
+ * The probes are only compiled in when sys/sdt.h is available, the trace
+ * messages next to them are only compiled in when it is not so that the
+ * scheduling paths don't pay for both.
+ *
+ * - cycle__start(node, direction), cycle__end(node, direction): a node
+ *   starts and ends a cycle, the direction is SPA_DIRECTION_INPUT when the
+ *   node needs input and SPA_DIRECTION_OUTPUT when it has output.
+ * - process__input__start(node), process__input__end(node, status)
+ * - process__output__start(node), process__output__end(node, status)
+ * - reuse__buffer(node, port_id, buffer_id)
+ * - transport__send(trans, type, size), transport__recv(trans, type, size):
+ *   a message is added to or taken from the client-node transport.
+ *
+ * Example scripts for bpftrace are in src/tools/bpftrace.
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define pw_probe(name,...)	STAP_PROBEV(pipewire, name, __VA_ARGS__)
+#else
+#define pw_probe(name,...)	do { } while (0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PIPEWIRE_PROBES_H__ */
@@ -18,48 +18,317 @@
  */
 
 #include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include "pipewire/pipewire.h"
 #include "pipewire/properties.h"
 
 /** \cond */
+
+/* build a hash index when there are more items */
+#define INDEX_MIN	8
+
+/* an interned key, shared between all properties */
+struct key {
+	int ref;
+	uint32_t hash;
+	struct key *next;
+	char str[];
+};
+
+#define KEY(s)		(SPA_CONTAINER_OF(s, struct key, str))
+
+static struct {
+	pthread_mutex_t lock;
+	struct key **buckets;
+	uint32_t n_buckets;
+	uint32_t n_keys;
+} keys = { PTHREAD_MUTEX_INITIALIZER, };
+
+/* the items, shared between copies until one of them is changed */
+struct storage {
+	int ref;
+	struct pw_array items;
+	uint32_t *index;	/**< item index + 1 or 0 for an empty bucket */
+	uint32_t n_index;	/**< 0 when the items are not indexed */
+};
+
 struct properties {
 	struct pw_properties this;
 
-	struct pw_array items;
+	struct storage *storage;
 };
 /** \endcond */
 
-static int add_func(struct pw_properties *this, char *key, char *value)
+static inline uint32_t hash_str(const char *str)
+{
+	const unsigned char *p;
+	uint32_t hash = 2166136261u;
+
+	for (p = (const unsigned char *) str; *p; p++)
+		hash = (hash ^ *p) * 16777619u;
+	return hash;
+}
+
+static void keys_rehash(uint32_t n_buckets)
+{
+	struct key **buckets, *k, *next;
+	uint32_t i;
+
+	if ((buckets = calloc(n_buckets, sizeof(struct key *))) == NULL)
+		return;
+
+	for (i = 0; i < keys.n_buckets; i++) {
+		for (k = keys.buckets[i]; k; k = next) {
+			next = k->next;
+			k->next = buckets[k->hash & (n_buckets - 1)];
+			buckets[k->hash & (n_buckets - 1)] = k;
+		}
+	}
+	free(keys.buckets);
+	keys.buckets = buckets;
+	keys.n_buckets = n_buckets;
+}
+
+static const char *key_intern(const char *str)
+{
+	uint32_t hash = hash_str(str);
+	struct key *k = NULL;
+	size_t len;
+
+	pthread_mutex_lock(&keys.lock);
+	if (keys.n_keys >= keys.n_buckets)
+		keys_rehash(keys.n_buckets ? keys.n_buckets * 2 : 256);
+	if (keys.n_buckets == 0)
+		goto done;
+
+	for (k = keys.buckets[hash & (keys.n_buckets - 1)]; k; k = k->next) {
+		if (k->hash == hash && strcmp(k->str, str) == 0) {
+			k->ref++;
+			goto done;
+		}
+	}
+	len = strlen(str);
+	if ((k = malloc(sizeof(struct key) + len + 1)) == NULL)
+		goto done;
+
+	k->ref = 1;
+	k->hash = hash;
+	memcpy(k->str, str, len + 1);
+	k->next = keys.buckets[hash & (keys.n_buckets - 1)];
+	keys.buckets[hash & (keys.n_buckets - 1)] = k;
+	keys.n_keys++;
+      done:
+	pthread_mutex_unlock(&keys.lock);
+	return k ? k->str : NULL;
+}
+
+static const char *key_ref(const char *str)
+{
+	pthread_mutex_lock(&keys.lock);
+	KEY(str)->ref++;
+	pthread_mutex_unlock(&keys.lock);
+	return str;
+}
+
+static void key_unref(const char *str)
+{
+	struct key *k = KEY(str), **l;
+
+	pthread_mutex_lock(&keys.lock);
+	if (--k->ref == 0) {
+		for (l = &keys.buckets[k->hash & (keys.n_buckets - 1)]; *l; l = &(*l)->next) {
+			if (*l == k) {
+				*l = k->next;
+				break;
+			}
+		}
+		keys.n_keys--;
+		free(k);
+	}
+	pthread_mutex_unlock(&keys.lock);
+}
+
+static inline uint32_t n_items(struct storage *s)
+{
+	return pw_array_get_len(&s->items, struct spa_dict_item);
+}
+
+static inline struct spa_dict_item *get_item(struct storage *s, uint32_t index)
+{
+	return pw_array_get_unchecked(&s->items, index, struct spa_dict_item);
+}
+
+static void index_insert(struct storage *s, uint32_t hash, uint32_t index)
+{
+	uint32_t i, mask = s->n_index - 1;
+
+	for (i = hash & mask; s->index[i] != 0; i = (i + 1) & mask);
+	s->index[i] = index + 1;
+}
+
+static void index_rebuild(struct storage *s)
+{
+	uint32_t i, n = n_items(s), size;
+
+	if (n <= INDEX_MIN) {
+		free(s->index);
+		s->index = NULL;
+		s->n_index = 0;
+		return;
+	}
+	/* keep the load factor under 1/2 */
+	for (size = 32; size < n * 2; size <<= 1);
+
+	if (size != s->n_index) {
+		uint32_t *index = realloc(s->index, size * sizeof(uint32_t));
+		if (index == NULL) {
+			/* fall back to a linear search */
+			free(s->index);
+			s->index = NULL;
+			s->n_index = 0;
+			return;
+		}
+		s->index = index;
+		s->n_index = size;
+	}
+	memset(s->index, 0, size * sizeof(uint32_t));
+	for (i = 0; i < n; i++)
+		index_insert(s, KEY(get_item(s, i)->key)->hash, i);
+}
+
+static struct storage *storage_new(int prealloc)
+{
+	struct storage *s;
+
+	if ((s = calloc(1, sizeof(struct storage))) == NULL)
+		return NULL;
+
+	s->ref = 1;
+	pw_array_init(&s->items, prealloc);
+	return s;
+}
+
+static void clear_item(struct spa_dict_item *item)
+{
+	key_unref(item->key);
+	free((char *) item->value);
+}
+
+static void storage_unref(struct storage *s)
 {
 	struct spa_dict_item *item;
+
+	if (__atomic_sub_fetch(&s->ref, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+
+	pw_array_for_each(item, &s->items)
+		clear_item(item);
+
+	pw_array_clear(&s->items);
+	free(s->index);
+	free(s);
+}
+
+static inline void update_dict(struct properties *impl)
+{
+	impl->this.dict.items = impl->storage->items.data;
+	impl->this.dict.n_items = n_items(impl->storage);
+}
+
+/* make sure the storage is not shared before changing it */
+static int make_writable(struct properties *impl)
+{
+	struct storage *s = impl->storage, *copy;
+	struct spa_dict_item *item, *ci;
+
+	if (__atomic_load_n(&s->ref, __ATOMIC_ACQUIRE) == 1)
+		return 0;
+
+	if ((copy = storage_new(SPA_MAX(n_items(s), 16u))) == NULL)
+		return -ENOMEM;
+
+	pw_array_for_each(item, &s->items) {
+		if ((ci = pw_array_add(&copy->items, sizeof(struct spa_dict_item))) == NULL)
+			goto no_mem;
+		ci->key = key_ref(item->key);
+		if ((ci->value = strdup(item->value)) == NULL) {
+			key_unref(ci->key);
+			copy->items.size -= sizeof(struct spa_dict_item);
+			goto no_mem;
+		}
+	}
+	index_rebuild(copy);
+
+	impl->storage = copy;
+	storage_unref(s);
+	update_dict(impl);
+	return 0;
+
+      no_mem:
+	storage_unref(copy);
+	return -ENOMEM;
+}
+
+static int add_func(struct pw_properties *this, const char *key, char *value)
+{
 	struct properties *impl = SPA_CONTAINER_OF(this, struct properties, this);
+	struct storage *s = impl->storage;
+	struct spa_dict_item *item;
+	uint32_t n;
 
-	item = pw_array_add(&impl->items, sizeof(struct spa_dict_item));
+	if (value == NULL)
+		return -ENOMEM;
+
+	if ((key = key_intern(key)) == NULL)
+		goto no_mem;
+
+	if ((item = pw_array_add(&s->items, sizeof(struct spa_dict_item))) == NULL) {
+		key_unref(key);
+		goto no_mem;
+	}
 	item->key = key;
 	item->value = value;
 
-	this->dict.items = impl->items.data;
-	this->dict.n_items = pw_array_get_len(&impl->items, struct spa_dict_item);
+	n = n_items(s);
+	if (s->n_index == 0 ? n > INDEX_MIN : n * 2 > s->n_index)
+		index_rebuild(s);
+	else if (s->n_index)
+		index_insert(s, KEY(key)->hash, n - 1);
+
+	update_dict(impl);
 	return 0;
-}
 
-static void clear_item(struct spa_dict_item *item)
-{
-	free((char *) item->key);
-	free((char *) item->value);
+      no_mem:
+	free(value);
+	return -ENOMEM;
 }
 
 static int find_index(const struct pw_properties *this, const char *key)
 {
 	struct properties *impl = SPA_CONTAINER_OF(this, struct properties, this);
-	int i, len = pw_array_get_len(&impl->items, struct spa_dict_item);
+	struct storage *s = impl->storage;
+	struct spa_dict_item *item;
+	uint32_t i, idx, hash, mask;
 
-	for (i = 0; i < len; i++) {
-		struct spa_dict_item *item =
-		    pw_array_get_unchecked(&impl->items, i, struct spa_dict_item);
-		if (strcmp(item->key, key) == 0)
-			return i;
+	if (s->n_index == 0) {
+		uint32_t len = n_items(s);
+
+		for (i = 0; i < len; i++) {
+			item = get_item(s, i);
+			if (item->key == key || strcmp(item->key, key) == 0)
+				return i;
+		}
+		return -1;
+	}
+
+	hash = hash_str(key);
+	mask = s->n_index - 1;
+	for (i = hash & mask; (idx = s->index[i]) != 0; i = (i + 1) & mask) {
+		item = get_item(s, idx - 1);
+		if (KEY(item->key)->hash == hash && strcmp(item->key, key) == 0)
+			return idx - 1;
 	}
 	return -1;
 }
@@ -72,7 +341,11 @@ static struct properties *properties_new(int prealloc)
 	if (impl == NULL)
 		return NULL;
 
-	pw_array_init(&impl->items, prealloc);
+	if ((impl->storage = storage_new(prealloc)) == NULL) {
+		free(impl);
+		return NULL;
+	}
+	update_dict(impl);
 
 	return impl;
 }
@@ -100,7 +373,7 @@ struct pw_properties *pw_properties_new(const char *key, ...)
 	while (key != NULL) {
 		value = va_arg(varargs, char *);
 		if (value)
-			add_func(&impl->this, strdup(key), strdup(value));
+			add_func(&impl->this, key, strdup(value));
 		key = va_arg(varargs, char *);
 	}
 	va_end(varargs);
@@ -127,7 +400,7 @@ struct pw_properties *pw_properties_new_dict(const struct spa_dict *dict)
 
 	for (i = 0; i < dict->n_items; i++) {
 		if (dict->items[i].key != NULL && dict->items[i].value != NULL)
-			add_func(&impl->this, strdup(dict->items[i].key),
+			add_func(&impl->this, dict->items[i].key,
 				 strdup(dict->items[i].value));
 	}
 
@@ -167,6 +440,7 @@ pw_properties_new_string(const char *str)
 			*eq = '\0';
 			add_func(&impl->this, val, strdup(eq+1));
 		}
+		free(val);
 		s = pw_split_walk(str, " \t\n\r", &len, &state);
 	}
 	return &impl->this;
@@ -177,23 +451,26 @@ pw_properties_new_string(const char *str)
  * \param properties properties to copy
  * \return a new properties object
  *
+ * The copy shares the items with \a properties until one of them is
+ * changed.
+ *
  * \memberof pw_properties
  */
 SPA_EXPORT
 struct pw_properties *pw_properties_copy(const struct pw_properties *properties)
 {
 	struct properties *impl = SPA_CONTAINER_OF(properties, struct properties, this);
-	struct pw_properties *copy;
-	struct spa_dict_item *item;
+	struct properties *copy;
 
-	copy = pw_properties_new(NULL, NULL);
+	copy = calloc(1, sizeof(struct properties));
 	if (copy == NULL)
 		return NULL;
 
-	pw_array_for_each(item, &impl->items)
-		add_func(copy, strdup(item->key), strdup(item->value));
+	__atomic_add_fetch(&impl->storage->ref, 1, __ATOMIC_RELAXED);
+	copy->storage = impl->storage;
+	update_dict(copy);
 
-	return copy;
+	return &copy->this;
 }
 
 /** Merge properties into one
@@ -245,12 +522,8 @@ SPA_EXPORT
 void pw_properties_free(struct pw_properties *properties)
 {
 	struct properties *impl = SPA_CONTAINER_OF(properties, struct properties, this);
-	struct spa_dict_item *item;
 
-	pw_array_for_each(item, &impl->items)
-		clear_item(item);
-
-	pw_array_clear(&impl->items);
+	storage_unref(impl->storage);
 	free(impl);
 }
 
@@ -258,33 +531,42 @@ static int do_replace(struct pw_properties *properties, const char *key, char *v
 {
 	struct properties *impl = SPA_CONTAINER_OF(properties, struct properties, this);
 	int index = find_index(properties, key);
+	struct spa_dict_item *item;
+
+	if (index == -1 && value == NULL)
+		return 0;
+
+	if (index != -1 && value &&
+	    strcmp(get_item(impl->storage, index)->value, value) == 0) {
+		if (!copy)
+			free(value);
+		return 0;
+	}
+
+	if (make_writable(impl) < 0) {
+		if (!copy)
+			free(value);
+		return -ENOMEM;
+	}
 
 	if (index == -1) {
-		if (value == NULL)
-			return 0;
-		add_func(properties, strdup(key), copy ? strdup(value) : value);
-	} else {
-		struct spa_dict_item *item =
-		    pw_array_get_unchecked(&impl->items, index, struct spa_dict_item);
+		add_func(properties, key, copy ? strdup(value) : value);
+		return 1;
+	}
 
-		if (value && strcmp(item->value, value) == 0) {
-			if (!copy)
-				free(value);
-			return 0;
-		}
+	item = get_item(impl->storage, index);
+	if (value == NULL) {
+		struct storage *s = impl->storage;
+		struct spa_dict_item *other = get_item(s, n_items(s) - 1);
 
-		if (value == NULL) {
-			struct spa_dict_item *other = pw_array_get_unchecked(&impl->items,
-						     pw_array_get_len(&impl->items, struct spa_dict_item) - 1,
-						     struct spa_dict_item);
-			clear_item(item);
-			item->key = other->key;
-			item->value = other->value;
-			impl->items.size -= sizeof(struct spa_dict_item);
-		} else {
-			free((char *) item->value);
-			item->value = copy ? strdup(value) : value;
-		}
+		clear_item(item);
+		*item = *other;
+		s->items.size -= sizeof(struct spa_dict_item);
+		index_rebuild(s);
+		update_dict(impl);
+	} else {
+		free((char *) item->value);
+		item->value = copy ? strdup(value) : value;
 	}
 	return 1;
 }
@@ -366,7 +648,7 @@ const char *pw_properties_get(const struct pw_properties *properties, const char
 	if (index == -1)
 		return NULL;
 
-	return pw_array_get_unchecked(&impl->items, index, struct spa_dict_item)->value;
+	return get_item(impl->storage, index)->value;
 }
 
 /** Iterate property values
@@ -393,10 +675,10 @@ const char *pw_properties_iterate(const struct pw_properties *properties, void *
 	else
 		index = SPA_PTR_TO_INT(*state);
 
-	if (!pw_array_check_index(&impl->items, index, struct spa_dict_item))
+	if (!pw_array_check_index(&impl->storage->items, index, struct spa_dict_item))
 		 return NULL;
 
 	*state = SPA_INT_TO_PTR(index + 1);
 
-	return pw_array_get_unchecked(&impl->items, index, struct spa_dict_item)->key;
+	return get_item(impl->storage, index)->key;
 }
@@ -195,10 +195,15 @@ core_event_update_types(void *data, uint32_t first_id, const char **types, uint3
 	struct pw_remote *this = data;
 	int i;
 
+	if (first_id < this->n_identity)
+		this->n_identity = first_id;
+
 	for (i = 0; i < n_types; i++, first_id++) {
 		uint32_t this_id = spa_type_map_get_id(this->core->type.map, types[i]);
 		if (!pw_map_insert_at(&this->types, first_id, PW_MAP_ID_TO_PTR(this_id)))
 			pw_log_error("can't add type for client");
+		else if (this_id == first_id && first_id == this->n_identity)
+			this->n_identity++;
 	}
 }
 
@@ -467,6 +472,7 @@ int pw_remote_disconnect(struct pw_remote *remote)
 	pw_map_clear(&remote->objects);
 	pw_map_clear(&remote->types);
 	remote->n_types = 0;
+	remote->n_identity = 0;
 
 	if (remote->info) {
 		pw_core_info_free(remote->info);
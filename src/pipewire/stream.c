@@ -25,9 +25,11 @@
 #include <time.h>
 
 #include "spa/utils/ringbuffer.h"
+#include "spa/utils/dll.h"
 
 #include "pipewire/pipewire.h"
 #include "pipewire/private.h"
+#include "pipewire/probes.h"
 #include "pipewire/interfaces.h"
 #include "pipewire/array.h"
 #include "pipewire/stream.h"
@@ -36,12 +38,12 @@
 
 /** \cond */
 
-#define MAX_BUFFERS	64
-#define MASK_BUFFERS	(MAX_BUFFERS-1)
 #define MIN_QUEUED	1
 
 #define MAX_PORTS	1
 
+#define CLOCK_UPDATE_INTERVAL	(100 * SPA_NSEC_PER_MSEC)
+
 struct mem {
 	uint32_t id;
 	int fd;
@@ -64,7 +66,8 @@ struct buffer {
 };
 
 struct queue {
-	uint32_t ids[MAX_BUFFERS];
+	uint32_t *ids;
+	uint32_t mask;
 	struct spa_ringbuffer ring;
 	uint64_t incount;
 	uint64_t outcount;
@@ -105,16 +108,19 @@ struct stream {
 	struct pw_array mem_ids;
 
 	struct spa_io_buffers *io;
+	struct spa_io_ringbuffer *ring;
 
 	bool client_reuse;
 	struct queue dequeue;
 	struct queue queue;
 	bool in_process;
 
-	struct buffer buffers[MAX_BUFFERS];
+	struct buffer *buffers;
+	uint32_t max_buffers;
 	int n_buffers;
 
 	struct pw_time last_time;
+	struct spa_dll dll;
 };
 /** \endcond */
 
@@ -258,6 +264,53 @@ static void clear_buffers(struct pw_stream *stream)
 
 }
 
+static int init_queue(struct queue *queue, uint32_t n_buffers)
+{
+	uint32_t size = 1;
+	uint32_t *ids;
+
+	/* the ringbuffer index is masked, keep the size a power of 2 */
+	while (size < n_buffers)
+		size <<= 1;
+
+	if (queue->ids == NULL || size > queue->mask + 1) {
+		if ((ids = realloc(queue->ids, size * sizeof(uint32_t))) == NULL)
+			return -ENOMEM;
+		queue->ids = ids;
+		queue->mask = size - 1;
+	}
+	spa_ringbuffer_init(&queue->ring);
+	return 0;
+}
+
+static void free_queue(struct queue *queue)
+{
+	free(queue->ids);
+	queue->ids = NULL;
+	queue->mask = 0;
+}
+
+static int ensure_buffers(struct stream *impl, uint32_t n_buffers)
+{
+	struct buffer *buffers;
+	int res;
+
+	if (n_buffers > impl->max_buffers) {
+		buffers = realloc(impl->buffers, n_buffers * sizeof(struct buffer));
+		if (buffers == NULL)
+			return -ENOMEM;
+		memset(&buffers[impl->max_buffers], 0,
+		       (n_buffers - impl->max_buffers) * sizeof(struct buffer));
+		impl->buffers = buffers;
+		impl->max_buffers = n_buffers;
+	}
+	if ((res = init_queue(&impl->dequeue, n_buffers)) < 0 ||
+	    (res = init_queue(&impl->queue, n_buffers)) < 0)
+		return res;
+
+	return 0;
+}
+
 static inline int push_queue(struct stream *stream, struct queue *queue, struct buffer *buffer)
 {
 	uint32_t index;
@@ -270,7 +323,7 @@ static inline int push_queue(struct stream *stream, struct queue *queue, struct
 	queue->incount += buffer->buffer.size;
 
 	filled = spa_ringbuffer_get_write_index(&queue->ring, &index);
-	queue->ids[index & MASK_BUFFERS] = buffer->id;
+	queue->ids[index & queue->mask] = buffer->id;
 	spa_ringbuffer_write_update(&queue->ring, index + 1);
 
 	pw_log_trace("stream %p: queued buffer %d %d", stream, buffer->id, filled);
@@ -287,7 +340,7 @@ static inline struct buffer *pop_queue(struct stream *stream, struct queue *queu
 	if ((avail = spa_ringbuffer_get_read_index(&queue->ring, &index)) < MIN_QUEUED)
 		return NULL;
 
-	id = queue->ids[index & MASK_BUFFERS];
+	id = queue->ids[index & queue->mask];
 	spa_ringbuffer_read_update(&queue->ring, index + 1);
 
 	buffer = &stream->buffers[id];
@@ -400,6 +453,8 @@ struct pw_stream *pw_stream_new(struct pw_remote *remote,
 	impl->type_client_node = spa_type_map_get_id(remote->core->type.map, PW_TYPE_INTERFACE__ClientNode);
 	impl->rtwritefd = -1;
 
+	spa_dll_init(&impl->dll, SPA_DLL_BW_MIN, (double) CLOCK_UPDATE_INTERVAL / SPA_NSEC_PER_SEC);
+
 	str = pw_properties_get(props, "pipewire.client.reuse");
 	impl->client_reuse = str && pw_properties_parse_bool(str);
 
@@ -412,13 +467,20 @@ struct pw_stream *pw_stream_new(struct pw_remote *remote,
 
 	impl->pending_seq = SPA_ID_INVALID;
 
-	spa_ringbuffer_init(&impl->queue.ring);
-	spa_ringbuffer_init(&impl->dequeue.ring);
+	if (init_queue(&impl->queue, 1) < 0 ||
+	    init_queue(&impl->dequeue, 1) < 0)
+		goto no_mem_queue;
 
 	spa_list_append(&remote->stream_list, &this->link);
 
 	return this;
 
+      no_mem_queue:
+	free_queue(&impl->queue);
+	free_queue(&impl->dequeue);
+	pw_array_clear(&impl->mem_ids);
+	free(this->name);
+	pw_properties_free(props);
       no_mem:
 	free(impl);
 	return NULL;
@@ -547,6 +609,10 @@ void pw_stream_destroy(struct pw_stream *stream)
 
 	pw_array_clear(&impl->mem_ids);
 
+	free_queue(&impl->queue);
+	free_queue(&impl->dequeue);
+	free(impl->buffers);
+
 	free(stream->error);
 	free(stream->name);
 
@@ -633,6 +699,30 @@ static inline void send_reuse_buffer(struct pw_stream *stream, uint32_t id)
 	write(impl->rtwritefd, &cmd, 8);
 }
 
+static inline void send_reuse_buffers(struct pw_stream *stream, uint32_t *ids, uint32_t n_ids)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct pw_client_node_message_port_reuse_buffers *msg;
+	uint64_t cmd = 1;
+	uint32_t n;
+
+	msg = alloca(sizeof(*msg) + PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS_MAX * sizeof(uint32_t));
+
+	while (n_ids > 0) {
+		n = SPA_MIN(n_ids, PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS_MAX);
+
+		pw_log_trace("send %u", n);
+		*msg = PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS_INIT(impl->port_id, n);
+		memcpy(PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFERS_IDS(msg), ids, n * sizeof(uint32_t));
+		pw_client_node_transport_add_message(impl->trans, (struct pw_client_node_message*) msg);
+
+		ids += n;
+		n_ids -= n;
+	}
+	/* one wakeup for all messages */
+	write(impl->rtwritefd, &cmd, 8);
+}
+
 static void add_async_complete(struct pw_stream *stream, uint32_t seq, int res)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
@@ -682,7 +772,10 @@ static inline void reuse_buffer(struct pw_stream *stream, uint32_t id)
 
 	if ((b = get_buffer(stream, id)) &&
 	    !SPA_FLAG_CHECK(b->flags, BUFFER_FLAG_QUEUED)) {
+#ifndef HAVE_SYS_SDT_H
 		pw_log_trace("stream %p: reuse buffer %u", stream, id);
+#endif
+		pw_probe(reuse__buffer, stream, impl->port_id, id);
 		push_queue(impl, &impl->dequeue, b);
 	}
 }
@@ -692,6 +785,8 @@ static int process_input(struct pw_stream *stream)
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	int i;
 
+	pw_probe(process__input__start, stream);
+
 	for (i = 0; i < impl->trans->area->n_input_ports; i++) {
 		struct spa_io_buffers *input = &impl->trans->inputs[i];
 		struct buffer *b;
@@ -721,6 +816,7 @@ static int process_input(struct pw_stream *stream)
 
 		pw_log_trace("stream %p: reuse %d", stream, input->buffer_id);
 	}
+	pw_probe(process__input__end, stream, SPA_STATUS_NEED_BUFFER);
 	return SPA_STATUS_NEED_BUFFER;
 }
 
@@ -729,6 +825,8 @@ static int process_output(struct pw_stream *stream)
 	int i, res = 0;
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 
+	pw_probe(process__output__start, stream);
+
 	for (i = 0; i < impl->trans->area->n_output_ports; i++) {
 		struct spa_io_buffers *io = &impl->trans->outputs[i];
 		struct buffer *b;
@@ -763,6 +861,7 @@ static int process_output(struct pw_stream *stream)
 		}
 		res = io->status;
 	}
+	pw_probe(process__output__end, stream, res);
 	return res;
 }
 
@@ -775,12 +874,16 @@ static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_nod
 
 	switch (PW_CLIENT_NODE_MESSAGE_TYPE(message)) {
 	case PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT:
-		if (process_input(stream) == SPA_STATUS_NEED_BUFFER)
+		if (SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_RINGBUFFER))
+			call_process(impl);
+		else if (process_input(stream) == SPA_STATUS_NEED_BUFFER)
 			send_need_input(stream);
 		break;
 
 	case PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT:
-		if (process_output(stream) == SPA_STATUS_HAVE_BUFFER)
+		if (SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_RINGBUFFER))
+			call_process(impl);
+		else if (process_output(stream) == SPA_STATUS_HAVE_BUFFER)
 			send_have_output(stream);
 		break;
 
@@ -843,8 +946,8 @@ static void handle_socket(struct pw_stream *stream, int rtreadfd, int rtwritefd)
 					       true, on_rtsocket_condition, stream);
 
 	impl->timeout_source = pw_loop_add_timer(stream->remote->core->main_loop, on_timeout, stream);
-	interval.tv_sec = 0;
-	interval.tv_nsec = 100000000;
+	interval.tv_sec = CLOCK_UPDATE_INTERVAL / SPA_NSEC_PER_SEC;
+	interval.tv_nsec = CLOCK_UPDATE_INTERVAL % SPA_NSEC_PER_SEC;
 	pw_loop_update_timer(stream->remote->core->main_loop, impl->timeout_source, NULL, &interval, false);
 
 	return;
@@ -862,6 +965,38 @@ static void client_node_event(void *data, const struct spa_event *event)
 	pw_log_warn("unhandled node event %d", SPA_EVENT_TYPE(event));
 }
 
+static void update_clock(struct stream *impl, const struct spa_command_node_clock_update *cu)
+{
+	struct pw_time *t = &impl->last_time;
+	int64_t now = cu->body.monotonic_time.value;
+	int64_t ticks = cu->body.ticks.value;
+	int32_t rate = cu->body.rate.value;
+
+	if (now == 0 || rate <= 0) {
+		/* not a live clock, nothing to track */
+		impl->dll.valid = false;
+	}
+	else if (!impl->dll.valid || rate != t->rate.denom || (uint64_t) ticks < t->ticks) {
+		spa_dll_reset(&impl->dll, now, ticks, (double) rate / SPA_NSEC_PER_SEC);
+	}
+	else {
+		spa_dll_update(&impl->dll, now, ticks);
+	}
+
+	t->now = now;
+	t->ticks = ticks;
+	t->rate.num = 1;
+	t->rate.denom = rate;
+	if (rate > 0 && cu->body.latency.value > 0)
+		t->delay = cu->body.latency.value * rate / SPA_NSEC_PER_SEC;
+	else
+		t->delay = 0;
+	t->rate_diff = 1.0;
+
+	pw_log_debug("clock update %"PRIu64" %d %"PRId64" delay %"PRIu64, t->ticks,
+			t->rate.denom, t->now, t->delay);
+}
+
 static void client_node_command(void *data, uint32_t seq, const struct spa_command *command)
 {
 	struct stream *impl = data;
@@ -892,9 +1027,12 @@ static void client_node_command(void *data, uint32_t seq, const struct spa_comma
 					  SPA_IO_IN | SPA_IO_ERR | SPA_IO_HUP);
 
 			if (impl->direction == SPA_DIRECTION_INPUT) {
-				for (i = 0; i < impl->trans->area->max_input_ports; i++)
-					impl->trans->inputs[i].status = SPA_STATUS_NEED_BUFFER;
-				send_need_input(stream);
+				/* in ringbuffer mode the server fills the ring by itself */
+				if (!SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_RINGBUFFER)) {
+					for (i = 0; i < impl->trans->area->max_input_ports; i++)
+						impl->trans->inputs[i].status = SPA_STATUS_NEED_BUFFER;
+					send_need_input(stream);
+				}
 			}
 			else {
 				call_process(impl);
@@ -910,13 +1048,7 @@ static void client_node_command(void *data, uint32_t seq, const struct spa_comma
 					   PW_STREAM_PROP_LATENCY_MIN, "%" PRId64,
 					   cu->body.latency.value);
 		}
-		impl->last_time.now = cu->body.monotonic_time.value;
-		impl->last_time.ticks = cu->body.ticks.value;
-		impl->last_time.rate.num = 1;
-		impl->last_time.rate.denom = cu->body.rate.value;
-		impl->last_time.delay = 0;
-		pw_log_debug("clock update %ld %d %ld", impl->last_time.ticks,
-				impl->last_time.rate.denom, impl->last_time.now);
+		update_clock(impl, cu);
 	} else {
 		pw_log_warn("unhandled node command %d", SPA_COMMAND_TYPE(command));
 		add_async_complete(stream, seq, -ENOTSUP);
@@ -1022,6 +1154,12 @@ client_node_port_use_buffers(void *data,
 	/* clear previous buffers */
 	clear_buffers(stream);
 
+	if (ensure_buffers(impl, n_buffers) < 0) {
+		pw_log_error("stream %p: can't allocate %u buffers", stream, n_buffers);
+		add_async_complete(stream, seq, -ENOMEM);
+		return;
+	}
+
 	for (i = 0; i < n_buffers; i++) {
 		off_t offset;
 
@@ -1200,6 +1338,11 @@ static void client_node_port_set_io(void *data,
 		impl->io = ptr;
 		pw_log_debug("stream %p: set io id %u %p", stream, id, ptr);
 	}
+	else if (id == t->io.Ringbuffer) {
+		impl->ring = ptr;
+		pw_log_debug("stream %p: set ringbuffer %p size %u", stream, ptr,
+				ptr ? impl->ring->size : 0);
+	}
 
 	res = 0;
 
@@ -1234,6 +1377,7 @@ static void on_node_proxy_destroy(void *data)
 	set_init_params(this, 0, NULL);
 	set_params(this, 0, NULL);
 
+	impl->ring = NULL;
 	clear_buffers(this);
 	clear_mems(this);
 
@@ -1278,6 +1422,8 @@ pw_stream_connect(struct pw_stream *stream,
 		pw_properties_set(stream->properties, PW_NODE_PROP_TARGET_NODE, port_path);
 	if (flags & PW_STREAM_FLAG_AUTOCONNECT)
 		pw_properties_set(stream->properties, PW_NODE_PROP_AUTOCONNECT, "1");
+	if (flags & PW_STREAM_FLAG_RINGBUFFER)
+		pw_properties_set(stream->properties, "pipewire.client.ringbuffer", "1");
 
 	impl->node_proxy = pw_core_proxy_create_object(stream->remote->core_proxy,
 			       "client-node",
@@ -1366,26 +1512,64 @@ static inline int64_t get_queue_size(struct queue *queue)
 	return (int64_t)(queue->incount - queue->outcount);
 }
 
-SPA_EXPORT
-int pw_stream_get_time(struct pw_stream *stream, struct pw_time *time)
+static void get_time(struct stream *impl, struct pw_time *time)
 {
-	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
-
-	if (impl->last_time.rate.denom == 0)
-		return -EAGAIN;
+	struct pw_stream *stream = &impl->this;
 
 	*time = impl->last_time;
-	if (impl->direction == SPA_DIRECTION_INPUT)
+
+	if (impl->dll.valid) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		time->now = SPA_TIMESPEC_TO_TIME(&ts);
+		time->ticks = spa_dll_get_pos(&impl->dll, time->now);
+		time->rate_diff = impl->dll.rate * SPA_NSEC_PER_SEC / time->rate.denom;
+	}
+
+	if (impl->ring) {
+		uint32_t index;
+		int32_t filled;
+
+		if (impl->direction == SPA_DIRECTION_INPUT)
+			filled = spa_ringbuffer_get_read_index(&impl->ring->ring, &index);
+		else
+			filled = spa_ringbuffer_get_write_index(&impl->ring->ring, &index);
+		time->queued = SPA_MAX(filled, 0);
+	}
+	else if (impl->direction == SPA_DIRECTION_INPUT)
 		time->queued = get_queue_size(&impl->dequeue);
 	else
 		time->queued = get_queue_size(&impl->queue);
 
-	pw_log_trace("stream %p: %ld %d/%d %ld", stream,
-			time->ticks, time->rate.num, time->rate.denom, time->queued);
+	pw_log_trace("stream %p: %"PRIu64" %d/%d %"PRIu64" %"PRIu64" %f", stream,
+			time->ticks, time->rate.num, time->rate.denom, time->delay,
+			time->queued, time->rate_diff);
+}
+
+SPA_EXPORT
+int pw_stream_get_time_n(struct pw_stream *stream, struct pw_time *time, size_t size)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct pw_time t;
+
+	if (impl->last_time.rate.denom == 0)
+		return -EAGAIN;
+
+	get_time(impl, &t);
+	memcpy(time, &t, SPA_MIN(size, sizeof(struct pw_time)));
 
 	return 0;
 }
 
+SPA_EXPORT
+int pw_stream_get_time(struct pw_stream *stream, struct pw_time *time)
+{
+	/* callers built against an older header have a pw_time that ends
+	 * with the queued field */
+	return pw_stream_get_time_n(stream, time, offsetof(struct pw_time, rate_diff));
+}
+
 SPA_EXPORT
 int pw_stream_set_control(struct pw_stream *stream, const char *name, float value)
 {
@@ -1401,42 +1585,141 @@ int pw_stream_get_control(struct pw_stream *stream, const char *name, float *val
 SPA_EXPORT
 struct pw_buffer *pw_stream_dequeue_buffer(struct pw_stream *stream)
 {
-	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
-	struct buffer *b;
+	struct pw_buffer *buffer;
 
-	if ((b = pop_queue(impl, &impl->dequeue)) == NULL) {
-		pw_log_trace("stream %p: no more buffers", stream);
+	if (pw_stream_dequeue_buffers(stream, &buffer, 1) < 1)
 		return NULL;
-	}
-	pw_log_trace("stream %p: dequeue buffer %d", stream, b->id);
 
-	return &b->buffer;
+	return buffer;
 }
 
 SPA_EXPORT
-int pw_stream_queue_buffer(struct pw_stream *stream, struct pw_buffer *buffer)
+int pw_stream_dequeue_buffers(struct pw_stream *stream, struct pw_buffer **buffers,
+			      uint32_t n_buffers)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	struct buffer *b;
+	uint32_t i;
+
+	for (i = 0; i < n_buffers; i++) {
+		if ((b = pop_queue(impl, &impl->dequeue)) == NULL) {
+			pw_log_trace("stream %p: no more buffers", stream);
+			break;
+		}
+		pw_log_trace("stream %p: dequeue buffer %d", stream, b->id);
+		buffers[i] = &b->buffer;
+	}
+	return i;
+}
+
+SPA_EXPORT
+int pw_stream_queue_buffer(struct pw_stream *stream, struct pw_buffer *buffer)
+{
 	int res;
 
-	if ((b = get_buffer(stream, buffer->buffer->id)) == NULL)
-		return -EINVAL;
+	if ((res = pw_stream_queue_buffers(stream, &buffer, 1, NULL)) < 0)
+		return res;
 
-	pw_log_trace("stream %p: queue buffer %d", stream, b->id);
-	if ((res = push_queue(impl, &impl->queue, b)) < 0)
+	return 0;
+}
+
+SPA_EXPORT
+int pw_stream_queue_buffers(struct pw_stream *stream, struct pw_buffer **buffers,
+			    uint32_t n_buffers, uint32_t *n_queued)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct buffer *b;
+	uint32_t i, n_ids = 0, *ids;
+	int res = 0, filled = -1;
+
+	for (i = 0; i < n_buffers; i++) {
+		if ((b = get_buffer(stream, buffers[i]->buffer->id)) == NULL) {
+			res = -EINVAL;
+			break;
+		}
+		pw_log_trace("stream %p: queue buffer %d", stream, b->id);
+		if ((res = push_queue(impl, &impl->queue, b)) < 0)
+			break;
+		if (filled == -1)
+			filled = res;
+		res = 0;
+	}
+	if (n_queued)
+		*n_queued = i;
+	if (i == 0)
 		return res;
 
 	if (impl->direction == SPA_DIRECTION_OUTPUT) {
-		if (res == 0 &&
+		if (filled == 0 &&
 		    SPA_FLAG_CHECK(impl->flags, PW_STREAM_FLAG_DRIVER) &&
 		    process_output(stream) == SPA_STATUS_HAVE_BUFFER)
 			send_have_output(stream);
 	}
-	else {
-		if (impl->client_reuse)
-			if ((b = pop_queue(impl, &impl->queue)))
-				send_reuse_buffer(stream, b->id);
+	else if (impl->client_reuse) {
+		ids = alloca(i * sizeof(uint32_t));
+		while (n_ids < i && (b = pop_queue(impl, &impl->queue)))
+			ids[n_ids++] = b->id;
+
+		if (n_ids == 1)
+			send_reuse_buffer(stream, ids[0]);
+		else if (n_ids > 1)
+			send_reuse_buffers(stream, ids, n_ids);
 	}
-	return 0;
+	return res < 0 ? res : (int) i;
+}
+
+SPA_EXPORT
+int pw_stream_write(struct pw_stream *stream, const void *data, uint32_t size)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct spa_io_ringbuffer *ring = impl->ring;
+	uint32_t index;
+	int32_t filled;
+
+	if (impl->direction != SPA_DIRECTION_OUTPUT)
+		return -EINVAL;
+	if (ring == NULL)
+		return -EIO;
+
+	filled = spa_ringbuffer_get_write_index(&ring->ring, &index);
+	if (filled < 0 || filled > ring->size) {
+		pw_log_warn("stream %p: ringbuffer overrun %d", stream, filled);
+		filled = 0;
+	}
+	size = SPA_MIN(size, ring->size - filled);
+
+	spa_ringbuffer_write_data(&ring->ring, SPA_IO_RINGBUFFER_DATA(ring), ring->size,
+				  index & (ring->size - 1), data, size);
+	spa_ringbuffer_write_update(&ring->ring, index + size);
+
+	pw_log_trace("stream %p: write %u %d", stream, size, filled);
+
+	return size;
+}
+
+SPA_EXPORT
+int pw_stream_read(struct pw_stream *stream, void *data, uint32_t size)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct spa_io_ringbuffer *ring = impl->ring;
+	uint32_t index;
+	int32_t avail;
+
+	if (impl->direction != SPA_DIRECTION_INPUT)
+		return -EINVAL;
+	if (ring == NULL)
+		return -EIO;
+
+	avail = spa_ringbuffer_get_read_index(&ring->ring, &index);
+	if (avail <= 0)
+		return 0;
+	size = SPA_MIN(size, (uint32_t) avail);
+
+	spa_ringbuffer_read_data(&ring->ring, SPA_IO_RINGBUFFER_DATA(ring), ring->size,
+				 index & (ring->size - 1), data, size);
+	spa_ringbuffer_read_update(&ring->ring, index + size);
+
+	pw_log_trace("stream %p: read %u %d", stream, size, avail);
+
+	return size;
 }
@@ -122,6 +122,9 @@ extern "C" {
  * When the buffer is no longer in use, call \ref pw_stream_queue_buffer()
  * to let PipeWire reuse the buffer.
  *
+ * \ref pw_stream_dequeue_buffers() and \ref pw_stream_queue_buffers() can
+ * be used to handle multiple buffers with one call.
+ *
  * \subsection ssec_produce Produce data
  *
  * \ref pw_stream_dequeue_buffer() gives an empty buffer that can be filled.
@@ -131,6 +134,15 @@ extern "C" {
  * The process event is emited when PipeWire has emptied a buffer that
  * can now be refilled.
  *
+ * \subsection ssec_ringbuffer Ringbuffer mode
+ *
+ * Streams connected with \ref PW_STREAM_FLAG_RINGBUFFER don't exchange
+ * buffers with the server. Instead, data is written with
+ * \ref pw_stream_write() or read with \ref pw_stream_read() in any amount
+ * and at any time. The server consumes or produces one quantum per cycle
+ * directly from a ringbuffer that is shared with the stream. The process
+ * event is emited after each cycle.
+ *
  * \section sec_stream_disconnect Disconnect
  *
  * Use \ref pw_stream_disconnect() to disconnect a stream after use.
@@ -215,6 +227,9 @@ enum pw_stream_flags {
 	PW_STREAM_FLAG_NO_CONVERT	= (1 << 5),	/**< don't convert format */
 	PW_STREAM_FLAG_EXCLUSIVE	= (1 << 6),	/**< require exclusive access to the
 							  *  device */
+	PW_STREAM_FLAG_RINGBUFFER	= (1 << 7),	/**< exchange data through a shared
+							  *  ringbuffer with pw_stream_write()
+							  *  and pw_stream_read() */
 };
 
 /** Create a new unconneced \ref pw_stream \memberof pw_stream
@@ -313,20 +328,40 @@ int pw_stream_set_active(struct pw_stream *stream, bool active);
 /** A time structure \memberof pw_stream */
 struct pw_time {
 	int64_t now;			/**< the monotonic time */
-	struct spa_fraction rate;	/**< the rate of \a ticks */
+	struct spa_fraction rate;	/**< the nominal rate of \a ticks */
 	uint64_t ticks;			/**< the ticks at \a now. This is the current time that
 					     the remote end is reading/writing. */
 	uint64_t delay;			/**< delay to device, add to ticks for INPUT streams and
 					     subtract from ticks for OUTPUT streams to get the
-					     time of the device. */
+					     time of the device. This includes the
+					     "port.latency" and "link.latency" in nsec of the
+					     ports and links between the stream and the
+					     device. */
 	uint64_t queued;		/**< data queued in the stream, this is the sum
 					     of the size fields in the pw_buffer that are
 					     currently queued */
+	/* fields below are only filled by pw_stream_get_time_n() */
+	double rate_diff;		/**< the measured rate of \a ticks relative to
+					     the nominal \a rate */
 };
 
-/** Query the time on the stream \memberof pw_stream */
+/** Query the time on the stream \memberof pw_stream
+ *
+ * For live streams, the clock updates of the server are smoothed with
+ * a delay-locked loop and \a ticks is interpolated to the current
+ * monotonic time.
+ *
+ * Only the fields up to \a queued are filled, use
+ * \ref pw_stream_get_time_n() to get the other fields. */
 int pw_stream_get_time(struct pw_stream *stream, struct pw_time *time);
 
+/** Query the time on the stream \memberof pw_stream
+ *
+ * Like \ref pw_stream_get_time() but fills at most \a size bytes of
+ * \a time. Pass sizeof(struct pw_time) as \a size. \a rate_diff
+ * contains the measured drift of the server clock. */
+int pw_stream_get_time_n(struct pw_stream *stream, struct pw_time *time, size_t size);
+
 /** Get a buffer that can be filled for playback streams or consumed
  * for capture streams.  */
 struct pw_buffer *pw_stream_dequeue_buffer(struct pw_stream *stream);
@@ -334,6 +369,44 @@ struct pw_buffer *pw_stream_dequeue_buffer(struct pw_stream *stream);
 /** Submit a buffer for playback or recycle a buffer for capture. */
 int pw_stream_queue_buffer(struct pw_stream *stream, struct pw_buffer *buffer);
 
+/** Get at most \a n_buffers buffers from the stream. \memberof pw_stream
+ * \return the number of buffers placed in \a buffers */
+int pw_stream_dequeue_buffers(struct pw_stream *stream,	/**< a \ref pw_stream */
+			      struct pw_buffer **buffers,	/**< array to hold the buffers */
+			      uint32_t n_buffers		/**< size of \a buffers */);
+
+/** Submit or recycle \a n_buffers buffers at once. \memberof pw_stream
+ *
+ * This is the same as calling \ref pw_stream_queue_buffer() for each
+ * buffer but the server is woken up only once for the complete batch.
+ *
+ * Buffers are queued in order. When queueing a buffer fails, the
+ * remaining buffers are not queued and the error of the failing buffer
+ * is returned. The buffers before it are queued and their number is
+ * placed in \a n_queued.
+ *
+ * \return the number of buffers queued or < 0 on error */
+int pw_stream_queue_buffers(struct pw_stream *stream,		/**< a \ref pw_stream */
+			    struct pw_buffer **buffers,		/**< buffers to queue */
+			    uint32_t n_buffers,			/**< number of buffers */
+			    uint32_t *n_queued			/**< number of queued buffers,
+								  *  can be NULL */);
+
+
+/** Write \a size bytes to the ringbuffer of a \ref PW_STREAM_FLAG_RINGBUFFER
+ * output stream. \memberof pw_stream
+ *
+ * The server consumes one quantum from the ringbuffer in each cycle.
+ *
+ * \return the number of bytes written, which can be less than \a size
+ * when the ringbuffer is full, or < 0 on error. */
+int pw_stream_write(struct pw_stream *stream, const void *data, uint32_t size);
+
+/** Read at most \a size bytes from the ringbuffer of a
+ * \ref PW_STREAM_FLAG_RINGBUFFER input stream. \memberof pw_stream
+ *
+ * \return the number of bytes read or < 0 on error. */
+int pw_stream_read(struct pw_stream *stream, void *data, uint32_t size);
 
 #ifdef __cplusplus
 }
@@ -18,10 +18,13 @@
  */
 
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
 
 #include <pipewire/array.h>
 #include <pipewire/log.h>
 #include <pipewire/utils.h>
+#include <pipewire/private.h>
 
 /** Split a string based on delimiters
  * \param str a string to split
@@ -133,3 +136,39 @@ char *pw_strip(char *str, const char *whitespace)
 
 	return str;
 }
+
+/** Parse a list of cpus
+ * \param str a list of cpus and ranges of cpus like "0,2-3"
+ * \param[out] set the cpus of the list, cpus above CPU_SETSIZE are ignored
+ * \return 0 on success or -EINVAL when \a str is not a valid list
+ *
+ * \memberof pw_utils
+ */
+SPA_EXPORT
+int pw_parse_cpus(const char *str, cpu_set_t *set)
+{
+	char *end;
+	long first, last;
+
+	CPU_ZERO(set);
+	while (*str) {
+		first = last = strtol(str, &end, 10);
+		if (end == str || first < 0)
+			return -EINVAL;
+		if (*end == '-') {
+			str = end + 1;
+			last = strtol(str, &end, 10);
+			if (end == str || last < first)
+				return -EINVAL;
+		}
+		for (; first <= last && first < CPU_SETSIZE; first++)
+			CPU_SET(first, set);
+
+		str = end;
+		if (*str == ',')
+			str++;
+		else if (*str != '\0')
+			return -EINVAL;
+	}
+	return 0;
+}
@@ -24,7 +24,15 @@
 #include "pipewire/log.h"
 #include "pipewire/work-queue.h"
 
+#define INITIAL_BUCKETS	16
+
 /** \cond */
+enum item_state {
+	ITEM_WAIT_ASYNC,	/**< waiting for pw_work_queue_complete() */
+	ITEM_WAIT_SYNC,		/**< waiting until it is the first item */
+	ITEM_READY,		/**< in the ready_list */
+};
+
 struct work_item {
 	uint32_t id;
 	void *obj;
@@ -32,7 +40,10 @@ struct work_item {
 	int res;
 	pw_work_func_t func;
 	void *data;
-	struct spa_list link;
+	enum item_state state;
+	struct spa_list link;		/**< link in work_list or free_list */
+	struct spa_list id_link;	/**< link in the id hash */
+	struct spa_list seq_link;	/**< link in the seq hash or the ready_list */
 };
 
 struct pw_work_queue {
@@ -41,41 +52,129 @@ struct pw_work_queue {
 	struct spa_source *wakeup;
 	uint32_t counter;
 
-	struct spa_list work_list;
+	struct spa_list work_list;	/**< all items, in the order they were added */
+	struct spa_list ready_list;	/**< items that can be processed */
 	struct spa_list free_list;
 	int n_queued;
+
+	struct spa_list *id_hash;	/**< items by id */
+	struct spa_list *seq_hash;	/**< async items by obj and seq */
+	uint32_t n_buckets;		/**< power of 2 */
 };
 /** \endcond */
 
+static inline uint32_t id_bucket(struct pw_work_queue *this, uint32_t id)
+{
+	return id & (this->n_buckets - 1);
+}
+
+static inline uint32_t seq_bucket(struct pw_work_queue *this, void *obj, uint32_t seq)
+{
+	uint32_t h = (uint32_t) ((uintptr_t) obj >> 4) ^ (seq * 0x9e3779b1u);
+	return (h ^ (h >> 16)) & (this->n_buckets - 1);
+}
+
+static struct spa_list *alloc_buckets(uint32_t n_buckets)
+{
+	struct spa_list *buckets;
+	uint32_t i;
+
+	if ((buckets = malloc(n_buckets * sizeof(struct spa_list))) == NULL)
+		return NULL;
+	for (i = 0; i < n_buckets; i++)
+		spa_list_init(&buckets[i]);
+	return buckets;
+}
+
+/* double the hash tables when they get too full, on failure the old
+ * tables are kept, they are only slower */
+static void check_buckets(struct pw_work_queue *this)
+{
+	struct spa_list *id_hash, *seq_hash;
+	struct work_item *item;
+
+	if ((uint32_t) this->n_queued <= this->n_buckets * 2)
+		return;
+
+	id_hash = alloc_buckets(this->n_buckets * 2);
+	seq_hash = alloc_buckets(this->n_buckets * 2);
+	if (id_hash == NULL || seq_hash == NULL) {
+		free(id_hash);
+		free(seq_hash);
+		return;
+	}
+	free(this->id_hash);
+	free(this->seq_hash);
+	this->id_hash = id_hash;
+	this->seq_hash = seq_hash;
+	this->n_buckets *= 2;
+
+	spa_list_for_each(item, &this->work_list, link) {
+		spa_list_append(&this->id_hash[id_bucket(this, item->id)], &item->id_link);
+		if (item->state == ITEM_WAIT_ASYNC)
+			spa_list_append(&this->seq_hash[seq_bucket(this, item->obj, item->seq)],
+					&item->seq_link);
+	}
+}
+
+static void make_ready(struct pw_work_queue *this, struct work_item *item)
+{
+	if (item->state == ITEM_READY)
+		return;
+	if (item->state == ITEM_WAIT_ASYNC)
+		spa_list_remove(&item->seq_link);
+
+	item->state = ITEM_READY;
+	spa_list_append(&this->ready_list, &item->seq_link);
+}
+
+/* a sync item can run when all items before it are done */
+static void check_head(struct pw_work_queue *this)
+{
+	struct work_item *head;
+
+	if (spa_list_is_empty(&this->work_list))
+		return;
+
+	head = spa_list_first(&this->work_list, struct work_item, link);
+	if (head->state == ITEM_WAIT_SYNC) {
+		pw_log_debug("work-queue %p: sync item %p is head", this, head->obj);
+		make_ready(this, head);
+	}
+}
+
 static void process_work_queue(void *data, uint64_t count)
 {
 	struct pw_work_queue *this = data;
-	struct work_item *item, *tmp;
+	struct work_item *item, *last;
+	bool done;
 
-	spa_list_for_each_safe(item, tmp, &this->work_list, link) {
-		if (item->seq != SPA_ID_INVALID) {
-			pw_log_debug("work-queue %p: %d waiting for item %p %d", this,
-				     this->n_queued, item->obj, item->seq);
-			continue;
-		}
+	if (spa_list_is_empty(&this->ready_list))
+		return;
 
-		if (item->res == -EBUSY &&
-		    item != spa_list_first(&this->work_list, struct work_item, link)) {
-			pw_log_debug("work-queue %p: %d sync item %p not head", this,
-				     this->n_queued, item->obj);
-			continue;
-		}
+	/* items that get ready while processing are done in the next wakeup */
+	last = spa_list_last(&this->ready_list, struct work_item, seq_link);
+	do {
+		item = spa_list_first(&this->ready_list, struct work_item, seq_link);
+		done = item == last;
 
 		spa_list_remove(&item->link);
+		spa_list_remove(&item->id_link);
+		spa_list_remove(&item->seq_link);
 		this->n_queued--;
 
+		check_head(this);
+
 		if (item->func) {
 			pw_log_debug("work-queue %p: %d process work item %p %d %d", this,
 				     this->n_queued, item->obj, item->seq, item->res);
 			item->func(item->obj, item->data, item->res, item->id);
 		}
 		spa_list_append(&this->free_list, &item->link);
-	}
+	} while (!done);
+
+	if (!spa_list_is_empty(&this->ready_list))
+		pw_loop_signal_event(this->loop, this->wakeup);
 }
 
 /** Create a new \ref pw_work_queue
@@ -90,16 +189,32 @@ struct pw_work_queue *pw_work_queue_new(struct pw_loop *loop)
 	struct pw_work_queue *this;
 
 	this = calloc(1, sizeof(struct pw_work_queue));
+	if (this == NULL)
+		return NULL;
+
 	pw_log_debug("work-queue %p: new", this);
 
 	this->loop = loop;
 
+	this->n_buckets = INITIAL_BUCKETS;
+	this->id_hash = alloc_buckets(this->n_buckets);
+	this->seq_hash = alloc_buckets(this->n_buckets);
+	if (this->id_hash == NULL || this->seq_hash == NULL)
+		goto no_mem;
+
 	this->wakeup = pw_loop_add_event(this->loop, process_work_queue, this);
 
 	spa_list_init(&this->work_list);
+	spa_list_init(&this->ready_list);
 	spa_list_init(&this->free_list);
 
 	return this;
+
+      no_mem:
+	free(this->id_hash);
+	free(this->seq_hash);
+	free(this);
+	return NULL;
 }
 
 /** Destroy a work queue
@@ -123,6 +238,8 @@ void pw_work_queue_destroy(struct pw_work_queue *queue)
 	spa_list_for_each_safe(item, tmp, &queue->free_list, link)
 		free(item);
 
+	free(queue->id_hash);
+	free(queue->seq_hash);
 	free(queue);
 }
 
@@ -154,24 +271,33 @@ pw_work_queue_add(struct pw_work_queue *queue, void *obj, int res, pw_work_func_
 	item->obj = obj;
 	item->func = func;
 	item->data = data;
+	item->res = res;
+
+	spa_list_append(&queue->work_list, &item->link);
+	spa_list_append(&queue->id_hash[id_bucket(queue, item->id)], &item->id_link);
+	queue->n_queued++;
 
 	if (SPA_RESULT_IS_ASYNC(res)) {
 		item->seq = SPA_RESULT_ASYNC_SEQ(res);
-		item->res = res;
+		item->state = ITEM_WAIT_ASYNC;
+		spa_list_append(&queue->seq_hash[seq_bucket(queue, obj, item->seq)],
+				&item->seq_link);
 		pw_log_debug("work-queue %p: defer async %d for object %p", queue, item->seq, obj);
 	} else if (res == -EBUSY) {
 		pw_log_debug("work-queue %p: wait sync object %p", queue, obj);
 		item->seq = SPA_ID_INVALID;
-		item->res = res;
-		have_work = true;
+		item->state = ITEM_WAIT_SYNC;
+		check_head(queue);
+		have_work = item->state == ITEM_READY;
 	} else {
 		item->seq = SPA_ID_INVALID;
-		item->res = res;
+		item->state = ITEM_READY;
+		spa_list_append(&queue->ready_list, &item->seq_link);
 		have_work = true;
 		pw_log_debug("work-queue %p: defer object %p", queue, obj);
 	}
-	spa_list_append(&queue->work_list, &item->link);
-	queue->n_queued++;
+
+	check_buckets(queue);
 
 	if (have_work)
 		pw_loop_signal_event(queue->loop, queue->wakeup);
@@ -179,6 +305,15 @@ pw_work_queue_add(struct pw_work_queue *queue, void *obj, int res, pw_work_func_
 	return item->id;
 }
 
+static void cancel_item(struct pw_work_queue *queue, struct work_item *item)
+{
+	pw_log_debug("work-queue %p: cancel defer %d for object %p", queue,
+		     item->seq, item->obj);
+	item->seq = SPA_ID_INVALID;
+	item->func = NULL;
+	make_ready(queue, item);
+}
+
 /** Cancel a work item
  * \param queue the work queue
  * \param obj the owner object
@@ -191,13 +326,19 @@ int pw_work_queue_cancel(struct pw_work_queue *queue, void *obj, uint32_t id)
 	bool have_work = false;
 	struct work_item *item;
 
-	spa_list_for_each(item, &queue->work_list, link) {
-		if ((id == SPA_ID_INVALID || item->id == id) && (obj == NULL || item->obj == obj)) {
-			pw_log_debug("work-queue %p: cancel defer %d for object %p", queue,
-				     item->seq, item->obj);
-			item->seq = SPA_ID_INVALID;
-			item->func = NULL;
-			have_work = true;
+	if (id != SPA_ID_INVALID) {
+		spa_list_for_each(item, &queue->id_hash[id_bucket(queue, id)], id_link) {
+			if (item->id == id && (obj == NULL || item->obj == obj)) {
+				cancel_item(queue, item);
+				have_work = true;
+			}
+		}
+	} else {
+		spa_list_for_each(item, &queue->work_list, link) {
+			if (obj == NULL || item->obj == obj) {
+				cancel_item(queue, item);
+				have_work = true;
+			}
 		}
 	}
 	if (!have_work) {
@@ -219,15 +360,16 @@ int pw_work_queue_cancel(struct pw_work_queue *queue, void *obj, uint32_t id)
  */
 int pw_work_queue_complete(struct pw_work_queue *queue, void *obj, uint32_t seq, int res)
 {
-	struct work_item *item;
+	struct work_item *item, *tmp;
 	bool have_work = false;
 
-	spa_list_for_each(item, &queue->work_list, link) {
+	spa_list_for_each_safe(item, tmp, &queue->seq_hash[seq_bucket(queue, obj, seq)], seq_link) {
 		if (item->obj == obj && item->seq == seq) {
 			pw_log_debug("work-queue %p: found defered %d for object %p", queue, seq,
 				     obj);
 			item->seq = SPA_ID_INVALID;
 			item->res = res;
+			make_ready(queue, item);
 			have_work = true;
 		}
 	}
@@ -0,0 +1,196 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/work-queue.h>
+
+#define N_OBJECTS	64
+#define N_ITEMS		10000
+#define CANCEL_EVERY	97
+
+struct data;
+
+struct item {
+	struct data *data;
+	uint32_t id;
+	uint32_t seq;
+	int res;
+	bool cancelled;
+	int called;
+};
+
+struct data {
+	struct pw_loop *loop;
+	struct pw_work_queue *queue;
+
+	int objects[N_OBJECTS];
+	struct item items[N_ITEMS];
+	uint32_t order[N_ITEMS];
+
+	uint32_t n_expected;
+	uint32_t n_done;
+	bool sync_done;
+	int errors;
+};
+
+static uint64_t get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * SPA_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void on_item(void *obj, void *user_data, int res, uint32_t id)
+{
+	struct item *item = user_data;
+	struct data *data = item->data;
+
+	if (obj != &data->objects[item->seq % N_OBJECTS]) {
+		printf("item %u: wrong object\n", item->seq);
+		data->errors++;
+	}
+	if (item->called++ > 0) {
+		printf("item %u called twice\n", item->seq);
+		data->errors++;
+	}
+	if (item->cancelled) {
+		printf("cancelled item %u called\n", item->seq);
+		data->errors++;
+	}
+	if (res != item->res || id != item->id) {
+		printf("item %u: wrong result %d != %d or id %u != %u\n",
+				item->seq, res, item->res, id, item->id);
+		data->errors++;
+	}
+	data->n_done++;
+}
+
+static void on_sync(void *obj, void *user_data, int res, uint32_t id)
+{
+	struct data *data = user_data;
+
+	/* a sync item runs after all the items that were added before it */
+	if (data->n_done != data->n_expected) {
+		printf("sync item ran after %u of %u items\n", data->n_done, data->n_expected);
+		data->errors++;
+	}
+	data->sync_done = true;
+}
+
+int main(int argc, char *argv[])
+{
+	struct data *data;
+	uint64_t start, t_add, t_complete, t_run;
+	uint32_t i, j, tmp;
+	int res;
+
+	pw_init(&argc, &argv);
+
+	data = calloc(1, sizeof(struct data));
+	data->loop = pw_loop_new(NULL);
+	data->queue = pw_work_queue_new(data->loop);
+
+	pw_loop_enter(data->loop);
+
+	/* the items are spread over the objects and completed through the
+	 * obj/seq pair */
+	start = get_time();
+	for (i = 0; i < N_ITEMS; i++) {
+		struct item *item = &data->items[i];
+
+		item->data = data;
+		item->seq = i;
+		item->id = pw_work_queue_add(data->queue, &data->objects[i % N_OBJECTS],
+					     SPA_RESULT_RETURN_ASYNC(i), on_item, item);
+		data->order[i] = i;
+	}
+	pw_work_queue_add(data->queue, data, -EBUSY, on_sync, data);
+	t_add = get_time() - start;
+
+	for (i = 0; i < N_ITEMS; i += CANCEL_EVERY) {
+		data->items[i].cancelled = true;
+		if ((res = pw_work_queue_cancel(data->queue, &data->objects[i % N_OBJECTS],
+						 data->items[i].id)) < 0) {
+			printf("can't cancel item %u: %d\n", i, res);
+			data->errors++;
+		}
+	}
+	data->n_expected = N_ITEMS - (N_ITEMS + CANCEL_EVERY - 1) / CANCEL_EVERY;
+
+	srand(0);
+	for (i = N_ITEMS - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		tmp = data->order[i];
+		data->order[i] = data->order[j];
+		data->order[j] = tmp;
+	}
+
+	start = get_time();
+	for (i = 0; i < N_ITEMS; i++) {
+		struct item *item = &data->items[data->order[i]];
+
+		if (item->cancelled)
+			continue;
+		/* the result is given to the callback */
+		item->res = -(int) item->seq;
+		if ((res = pw_work_queue_complete(data->queue, &data->objects[item->seq % N_OBJECTS],
+						  item->seq, item->res)) < 0) {
+			printf("can't complete item %u: %d\n", item->seq, res);
+			data->errors++;
+		}
+	}
+	t_complete = get_time() - start;
+
+	start = get_time();
+	while (!data->sync_done)
+		pw_loop_iterate(data->loop, -1);
+	t_run = get_time() - start;
+
+	if (data->n_done != data->n_expected) {
+		printf("%u of %u items done\n", data->n_done, data->n_expected);
+		data->errors++;
+	}
+	if (pw_work_queue_complete(data->queue, &data->objects[1], 1, 0) != -EINVAL) {
+		printf("completed item that was done\n");
+		data->errors++;
+	}
+
+	printf("%d items: add %"PRIu64" ns/item, complete %"PRIu64" ns/item, "
+			"dispatch %"PRIu64" ns/item\n", N_ITEMS,
+			t_add / N_ITEMS, t_complete / data->n_expected, t_run / N_ITEMS);
+
+	pw_loop_leave(data->loop);
+
+	pw_work_queue_destroy(data->queue);
+	pw_loop_destroy(data->loop);
+
+	res = data->errors;
+	free(data);
+
+	if (res) {
+		printf("%d errors\n", res);
+		return -1;
+	}
+	return 0;
+}
@@ -18,6 +18,8 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 
 #include <spa/debug/pod.h>
@@ -45,6 +47,8 @@ struct data {
 
 	uint32_t seq;
 	struct spa_list pending_list;
+
+	bool top;
 };
 
 struct proxy_data {
@@ -137,10 +141,72 @@ static void print_properties(const struct spa_dict *props, char mark)
 
 #define MARK_CHANGE(f) ((print_mark && ((info)->change_mask & (1 << (f)))) ? '*' : ' ')
 
+static void print_top_loop(const struct spa_dict *props, const char *name)
+{
+	const char *str;
+	char key[64], *top, *item, *state;
+	uint64_t wakeups = 0, dispatches = 0, busy = 0;
+
+	snprintf(key, sizeof(key), "loop.stats.%s", name);
+	if ((str = spa_dict_lookup(props, key)) == NULL)
+		return;
+	sscanf(str, "%"SCNu64" %"SCNu64" %"SCNu64, &wakeups, &dispatches, &busy);
+
+	printf("%s loop: %"PRIu64" wakeups, %"PRIu64" dispatches, %"PRIu64" usec busy\n",
+			name, wakeups, dispatches, busy);
+
+	snprintf(key, sizeof(key), "loop.stats.%s.latency", name);
+	if ((str = spa_dict_lookup(props, key)) != NULL)
+		printf("  latency (2^n usec): %s\n", str);
+
+	printf("  %10s %12s %10s  %s\n", "COUNT", "TOTAL(us)", "MAX(us)", "SOURCE");
+
+	snprintf(key, sizeof(key), "loop.stats.%s.top", name);
+	if ((str = spa_dict_lookup(props, key)) == NULL || (top = strdup(str)) == NULL)
+		return;
+
+	for (item = strtok_r(top, ";", &state); item; item = strtok_r(NULL, ";", &state)) {
+		char *count, *total, *max;
+
+		if ((count = strchr(item, ':')) == NULL ||
+		    (total = strchr(count + 1, ':')) == NULL ||
+		    (max = strchr(total + 1, ':')) == NULL)
+			continue;
+		*count++ = *total++ = *max++ = '\0';
+		printf("  %10s %12s %10s  %s\n", count, total, max, item);
+	}
+	free(top);
+}
+
+static void print_top(const struct spa_dict *props)
+{
+	uint32_t i;
+
+	if (props == NULL)
+		return;
+
+	/* clear the screen */
+	printf("\033[H\033[2J");
+	for (i = 0; i < props->n_items; i++) {
+		const char *key = props->items[i].key;
+
+		/* one loop.stats.<loop> key for each loop */
+		if (strncmp(key, "loop.stats.", 11) != 0 || strchr(key + 11, '.') != NULL)
+			continue;
+		print_top_loop(props, key + 11);
+		printf("\n");
+	}
+	fflush(stdout);
+}
+
 static void on_info_changed(void *data, const struct pw_core_info *info)
 {
+	struct data *d = data;
 	bool print_all = true, print_mark = false;
 
+	if (d->top)
+		return;
+
 	printf("\ttype: %s\n", PW_TYPE_INTERFACE__Core);
 	if (print_all) {
 		printf("%c\tuser-name: \"%s\"\n", MARK_CHANGE(0), info->user_name);
@@ -157,6 +223,12 @@ static void module_event_info(void *object, struct pw_module_info *info)
         struct proxy_data *data = object;
 	bool print_all, print_mark;
 
+	if (data->data->top) {
+		info = data->info = pw_module_info_update(data->info, info);
+		print_top(info->props);
+		return;
+	}
+
 	print_all = true;
         if (data->info == NULL) {
 		printf("added:\n");
@@ -479,6 +551,15 @@ static void registry_event_global(void *data, uint32_t id, uint32_t parent_id,
 	struct proxy_data *pd;
 	pw_destroy_t destroy;
 	print_func_t print_func = NULL;
+	const char *str;
+
+	/* only the module with the loop statistics is shown with --top */
+	if (d->top) {
+		if (type != t->module || props == NULL ||
+		    (str = spa_dict_lookup(props, PW_MODULE_PROP_NAME)) == NULL ||
+		    strstr(str, "module-loop-stats") == NULL)
+			return;
+	}
 
 	if (type == t->node) {
 		events = &node_events;
@@ -553,6 +634,11 @@ static void registry_event_global(void *data, uint32_t id, uint32_t parent_id,
 
 static void registry_event_global_remove(void *object, uint32_t id)
 {
+	struct data *d = object;
+
+	if (d->top)
+		return;
+
 	printf("removed:\n");
 	printf("\tid: %u\n", id);
 }
@@ -576,7 +662,8 @@ static void on_state_changed(void *_data, enum pw_remote_state old,
 		break;
 
 	case PW_REMOTE_STATE_CONNECTED:
-		printf("remote state: \"%s\"\n", pw_remote_state_as_string(state));
+		if (!data->top)
+			printf("remote state: \"%s\"\n", pw_remote_state_as_string(state));
 
 		data->core_proxy = pw_remote_get_core_proxy(data->remote);
 		data->registry_proxy = pw_core_proxy_get_registry(data->core_proxy,
@@ -588,7 +675,8 @@ static void on_state_changed(void *_data, enum pw_remote_state old,
 		break;
 
 	default:
-		printf("remote state: \"%s\"\n", pw_remote_state_as_string(state));
+		if (!data->top)
+			printf("remote state: \"%s\"\n", pw_remote_state_as_string(state));
 		break;
 	}
 }
@@ -626,6 +714,12 @@ int main(int argc, char *argv[])
 	if (data.core == NULL)
 		return -1;
 
+	/* --top shows the loop statistics of module-loop-stats */
+	if (argc > 1 && strcmp(argv[1], "--top") == 0) {
+		data.top = true;
+		argc--;
+		argv++;
+	}
 	if (argc > 1)
 		props = pw_properties_new(PW_REMOTE_PROP_REMOTE_NAME, argv[1], NULL);
 